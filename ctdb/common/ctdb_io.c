@@ -37,6 +37,7 @@
 
 #include "common/logging.h"
 #include "common/common.h"
+#include "common/io_thread.h"
 
 /* structures for packet queueing - see common/ctdb_io.c */
 struct ctdb_buffer {
@@ -68,12 +69,17 @@ struct ctdb_queue {
 	bool *destroyed;
 	const char *name;
 	uint32_t buffer_size;
+	struct io_thread_pool *io_pool;
+	struct io_thread_conn *io_conn;
 };
 
 
 
 int ctdb_queue_length(struct ctdb_queue *queue)
 {
+	if (queue->io_conn != NULL) {
+		return io_thread_conn_queue_length(queue->io_conn);
+	}
 	return queue->out_queue_length;
 }
 
@@ -318,6 +324,22 @@ int ctdb_queue_send(struct ctdb_queue *queue, uint8_t *data, uint32_t length)
 	}
 
 	full_length = length2;
+
+	if (queue->io_conn != NULL) {
+		int ret;
+
+		ret = io_thread_conn_write(queue->io_conn, data, length2);
+		if (ret == EPIPE) {
+			/* the dead connection is reported by the I/O thread */
+			return 0;
+		}
+		if (ret != 0) {
+			DEBUG(DEBUG_ERR, ("Failed to queue packet on %s\n",
+					  queue->name));
+			return -1;
+		}
+		return 0;
+	}
 	
 	/* if the queue is empty then try an immediate write, avoiding
 	   queue overhead. This relies on non-blocking sockets */
@@ -386,6 +408,60 @@ int ctdb_queue_send(struct ctdb_queue *queue, uint8_t *data, uint32_t length)
 }
 
 
+/*
+  called with packets read by an I/O thread
+*/
+static void queue_io_thread_read(uint8_t *data, size_t length,
+				 void *private_data)
+{
+	struct ctdb_queue *queue = talloc_get_type(private_data,
+						   struct ctdb_queue);
+
+	if (data == NULL) {
+		TALLOC_FREE(queue->io_conn);
+		queue->fd = -1;
+		queue->callback(NULL, 0, queue->private_data);
+		return;
+	}
+
+	/* the packet has to outlive the connection */
+	talloc_steal(queue, data);
+
+	/* It is the responsibility of the callback to free 'data' */
+	queue->callback(data, length, queue->private_data);
+}
+
+/*
+  hand the fd over to an I/O thread, the thread owns it from now on
+ */
+static int queue_io_thread_setup(struct ctdb_queue *queue, int fd)
+{
+	struct ctdb_queue_pkt *pkt;
+	int ret;
+
+	ret = io_thread_conn_setup(queue, queue->io_pool, fd,
+				   queue->buffer_size, queue_io_thread_read,
+				   queue, &queue->io_conn);
+	if (ret != 0) {
+		DEBUG(DEBUG_ERR, ("Failed to set up I/O thread for %s\n",
+				  queue->name));
+		return -1;
+	}
+
+	/* packets queued while there was no fd */
+	while ((pkt = queue->out_queue) != NULL) {
+		if (pkt->length == pkt->full_length) {
+			io_thread_conn_write(queue->io_conn, pkt->data,
+					     pkt->length);
+		}
+		DLIST_REMOVE(queue->out_queue, pkt);
+		queue->out_queue_length--;
+		talloc_free(pkt);
+	}
+
+	return 0;
+}
+
 /*
   setup the fd used by the queue
  */
@@ -394,6 +470,15 @@ int ctdb_queue_set_fd(struct ctdb_queue *queue, int fd)
 	queue->fd = fd;
 	talloc_free(queue->fde);
 	queue->fde = NULL;
+	TALLOC_FREE(queue->io_conn);
+
+	if (fd != -1 && queue->io_pool != NULL &&
+	    io_thread_pool_size(queue->io_pool) > 0) {
+		if (queue_io_thread_setup(queue, fd) == 0) {
+			return 0;
+		}
+		/* fall back to doing the I/O in the main loop */
+	}
 
 	if (fd != -1) {
 		queue->fde = tevent_add_fd(queue->ctdb->ev, queue, fd,
@@ -412,6 +497,37 @@ int ctdb_queue_set_fd(struct ctdb_queue *queue, int fd)
 	return 0;
 }
 
+/*
+  do the socket I/O of the queue in the threads of pool, if it has any
+ */
+int ctdb_queue_set_io_pool(struct ctdb_queue *queue,
+			   struct io_thread_pool *pool)
+{
+	queue->io_pool = pool;
+
+	if (queue->fde == NULL || pool == NULL ||
+	    io_thread_pool_size(pool) == 0) {
+		return 0;
+	}
+
+	/* only switch over between packets, else wait for the next fd */
+	if (queue->buffer.length > 0 ||
+	    (queue->out_queue != NULL &&
+	     queue->out_queue->length != queue->out_queue->full_length)) {
+		return 0;
+	}
+
+	/* the fd is passed on, not closed */
+	tevent_fd_set_close_fn(queue->fde, NULL);
+	TALLOC_FREE(queue->fde);
+
+	if (queue_io_thread_setup(queue, queue->fd) != 0) {
+		return ctdb_queue_set_fd(queue, queue->fd);
+	}
+
+	return 0;
+}
+
 /* If someone sets up this pointer, they want to know if the queue is freed */
 static int queue_destructor(struct ctdb_queue *queue)
 {
@@ -449,13 +565,6 @@ struct ctdb_queue *ctdb_queue_setup(struct ctdb_context *ctdb,
 	queue->alignment = alignment;
 	queue->private_data = private_data;
 	queue->callback = callback;
-	if (fd != -1) {
-		if (ctdb_queue_set_fd(queue, fd) != 0) {
-			talloc_free(queue);
-			return NULL;
-		}
-	}
-	talloc_set_destructor(queue, queue_destructor);
 
 	queue->buffer_size = ctdb->tunable.queue_buffer_size;
 	/* In client code, ctdb->tunable is not initialized.
@@ -465,5 +574,13 @@ struct ctdb_queue *ctdb_queue_setup(struct ctdb_context *ctdb,
 		queue->buffer_size = 1024;
 	}
 
+	if (fd != -1) {
+		if (ctdb_queue_set_fd(queue, fd) != 0) {
+			talloc_free(queue);
+			return NULL;
+		}
+	}
+	talloc_set_destructor(queue, queue_destructor);
+
 	return queue;
 }
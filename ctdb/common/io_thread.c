@@ -0,0 +1,1203 @@
+/*
+   Packet I/O on sockets in helper threads
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/network.h"
+#include "system/select.h"
+#include "system/time.h"
+
+#include <talloc.h>
+#include <tevent.h>
+
+#include "lib/util/dlinklist.h"
+#include "lib/util/sys_rw.h"
+#include "lib/util/blocking.h"
+
+#include "common/io_thread.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+#include <signal.h>
+
+/*
+ * Memory shared between the main thread and the helper threads is
+ * allocated with malloc, talloc is not thread-safe.
+ *
+ * struct io_thread_shared is the part of a connection both sides see.
+ * Fields marked (locked) are protected by the mutex of the thread
+ * serving the connection, fields marked (thread) are only used by that
+ * thread, the rest is constant.
+ *
+ * References to struct io_thread_shared are held by the main thread
+ * connection until it is freed, by the serving thread until it has
+ * processed the detach request, and by the ready list.
+ */
+
+struct io_thread_pkt {
+	struct io_thread_pkt *next;
+	size_t length;
+	size_t offset;
+	uint8_t buf[];
+};
+
+struct io_thread_shared {
+	int fd;
+	size_t read_size;
+
+	/* (locked) */
+	unsigned int refcount;
+	struct io_thread_conn *conn;
+	struct io_thread_shared *work_next;
+	struct io_thread_shared *ready_next;
+	bool on_work, on_ready;
+	bool detached, failed;
+	struct io_thread_pkt *tx_head, *tx_tail;
+	struct io_thread_pkt *rx_head, *rx_tail;
+	unsigned int tx_count;
+
+	/* (thread) */
+	struct io_thread_shared *prev, *next;
+	struct io_thread_shared *todo_next;
+	struct io_thread_pkt *out_head, *out_tail;
+	uint8_t *in_buf;
+	size_t in_length, in_size;
+	bool registered, closing, dead;
+};
+
+struct io_thread {
+	struct io_thread_pool *pool;
+	pthread_t id;
+	pthread_mutex_t mutex;
+	int wake_fd[2];
+
+	/* (locked) */
+	bool stop;
+	bool work_kicked, ready_kicked;
+	struct io_thread_shared *work_head, *work_tail;
+	struct io_thread_shared *ready_head, *ready_tail;
+	struct io_thread_stats stats;
+	uint64_t busy_us;
+
+	/* (thread) */
+	struct io_thread_shared *conns;
+	struct pollfd *pfd;
+	struct io_thread_shared **pfd_conn;
+	size_t pfd_size;
+
+	/* main thread only */
+	unsigned int num_conns;
+};
+
+struct io_thread_pool {
+	struct io_thread_pool *prev, *next;
+	struct tevent_context *ev;
+	struct tevent_fd *fde;
+	int ready_fd[2];
+	struct io_thread *threads[IO_THREAD_MAX];
+	unsigned int num_threads;
+	unsigned int size;
+	struct io_thread_conn *conns;
+	bool forked;
+};
+
+struct io_thread_conn {
+	struct io_thread_conn *prev, *next;
+	struct io_thread_pool *pool;
+	struct io_thread *thread;
+	struct io_thread_shared *shared;
+	struct tevent_immediate *im;
+	io_thread_read_fn read_fn;
+	void *private_data;
+	bool eof_reported;
+};
+
+/*
+ * Only the main thread creates and frees pools, the list is used to
+ * disable the pools in a child process after fork()
+ */
+static struct io_thread_pool *io_thread_pools;
+static pthread_once_t io_thread_atfork_once = PTHREAD_ONCE_INIT;
+
+static void io_thread_pkt_list_free(struct io_thread_pkt *pkt)
+{
+	while (pkt != NULL) {
+		struct io_thread_pkt *next = pkt->next;
+
+		free(pkt);
+		pkt = next;
+	}
+}
+
+static void io_thread_shared_free(struct io_thread_shared *s)
+{
+	io_thread_pkt_list_free(s->tx_head);
+	io_thread_pkt_list_free(s->rx_head);
+	io_thread_pkt_list_free(s->out_head);
+	free(s->in_buf);
+	free(s);
+}
+
+static void io_thread_kick(int fd)
+{
+	uint8_t c = 0;
+
+	/* A full pipe is as good as a successful write */
+	sys_write_v(fd, &c, 1);
+}
+
+static void io_thread_drain(int fd)
+{
+	uint8_t buf[64];
+	ssize_t n;
+
+	do {
+		n = read(fd, buf, sizeof(buf));
+	} while (n == sizeof(buf) || (n == -1 && errno == EINTR));
+}
+
+static uint64_t io_thread_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Helper thread
+ */
+
+/* Called with the mutex held */
+static bool io_thread_ready_add(struct io_thread *t,
+				struct io_thread_shared *s)
+{
+	if (s->on_ready) {
+		return false;
+	}
+
+	s->on_ready = true;
+	s->refcount += 1;
+	s->ready_next = NULL;
+	if (t->ready_tail == NULL) {
+		t->ready_head = s;
+	} else {
+		t->ready_tail->ready_next = s;
+	}
+	t->ready_tail = s;
+
+	if (t->ready_kicked) {
+		return false;
+	}
+	t->ready_kicked = true;
+	return true;
+}
+
+static void io_thread_report(struct io_thread *t, struct io_thread_shared *s,
+			     struct io_thread_pkt *head,
+			     struct io_thread_pkt *tail, uint32_t count,
+			     bool failed)
+{
+	bool kick;
+
+	pthread_mutex_lock(&t->mutex);
+	if (head != NULL) {
+		if (s->rx_tail == NULL) {
+			s->rx_head = head;
+		} else {
+			s->rx_tail->next = head;
+		}
+		s->rx_tail = tail;
+		t->stats.packets_recv += count;
+	}
+	if (failed) {
+		s->failed = true;
+		s->tx_count = 0;
+	}
+	kick = io_thread_ready_add(t, s);
+	pthread_mutex_unlock(&t->mutex);
+
+	if (kick) {
+		io_thread_kick(t->pool->ready_fd[1]);
+	}
+}
+
+static void io_thread_fail(struct io_thread *t, struct io_thread_shared *s)
+{
+	s->dead = true;
+	io_thread_pkt_list_free(s->out_head);
+	s->out_head = s->out_tail = NULL;
+	io_thread_report(t, s, NULL, NULL, 0, true);
+}
+
+static void io_thread_read(struct io_thread *t, struct io_thread_shared *s)
+{
+	struct io_thread_pkt *head = NULL, *tail = NULL;
+	uint32_t count = 0;
+	size_t offset = 0;
+	ssize_t n;
+
+	if (s->in_buf == NULL) {
+		s->in_buf = malloc(s->read_size);
+		if (s->in_buf == NULL) {
+			goto fail;
+		}
+		s->in_size = s->read_size;
+	}
+
+	n = read(s->fd, s->in_buf + s->in_length, s->in_size - s->in_length);
+	if (n == -1 &&
+	    (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	if (n <= 0) {
+		goto fail;
+	}
+	s->in_length += n;
+
+	while (s->in_length - offset >= sizeof(uint32_t)) {
+		struct io_thread_pkt *pkt;
+		uint32_t pkt_size;
+
+		memcpy(&pkt_size, s->in_buf + offset, sizeof(pkt_size));
+		if (pkt_size < sizeof(pkt_size)) {
+			goto fail;
+		}
+		if (s->in_length - offset < pkt_size) {
+			if (pkt_size > s->in_size) {
+				uint8_t *buf;
+
+				/* Move the partial packet to a larger buffer */
+				buf = malloc(pkt_size);
+				if (buf == NULL) {
+					goto fail;
+				}
+				memcpy(buf, s->in_buf + offset,
+				       s->in_length - offset);
+				free(s->in_buf);
+				s->in_buf = buf;
+				s->in_size = pkt_size;
+				s->in_length -= offset;
+				offset = 0;
+			}
+			break;
+		}
+
+		pkt = malloc(offsetof(struct io_thread_pkt, buf) + pkt_size);
+		if (pkt == NULL) {
+			goto fail;
+		}
+		pkt->next = NULL;
+		pkt->length = pkt_size;
+		pkt->offset = 0;
+		memcpy(pkt->buf, s->in_buf + offset, pkt_size);
+		offset += pkt_size;
+
+		if (tail == NULL) {
+			head = pkt;
+		} else {
+			tail->next = pkt;
+		}
+		tail = pkt;
+		count += 1;
+	}
+
+	if (offset > 0) {
+		if (s->in_length > offset) {
+			memmove(s->in_buf, s->in_buf + offset,
+				s->in_length - offset);
+		}
+		s->in_length -= offset;
+	}
+	if (s->in_length == 0 && s->in_size > s->read_size) {
+		free(s->in_buf);
+		s->in_buf = NULL;
+		s->in_size = 0;
+	}
+
+	if (head != NULL) {
+		io_thread_report(t, s, head, tail, count, false);
+	}
+	return;
+
+fail:
+	/* Pass up what has been read before the failure */
+	if (head != NULL) {
+		io_thread_report(t, s, head, tail, count, false);
+	}
+	io_thread_fail(t, s);
+}
+
+static void io_thread_write(struct io_thread *t, struct io_thread_shared *s)
+{
+	uint32_t count = 0;
+
+	while (s->out_head != NULL) {
+		struct io_thread_pkt *pkt = s->out_head;
+		ssize_t n;
+
+		n = write(s->fd, pkt->buf + pkt->offset,
+			  pkt->length - pkt->offset);
+		if (n == -1 &&
+		    (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			break;
+		}
+		if (n <= 0) {
+			io_thread_fail(t, s);
+			return;
+		}
+
+		pkt->offset += n;
+		if (pkt->offset < pkt->length) {
+			break;
+		}
+
+		s->out_head = pkt->next;
+		if (s->out_head == NULL) {
+			s->out_tail = NULL;
+		}
+		free(pkt);
+		count += 1;
+	}
+
+	if (count > 0) {
+		pthread_mutex_lock(&t->mutex);
+		s->tx_count -= MIN(count, s->tx_count);
+		t->stats.packets_sent += count;
+		pthread_mutex_unlock(&t->mutex);
+	}
+}
+
+static void io_thread_work(struct io_thread *t)
+{
+	struct io_thread_shared *work, *s, *next;
+
+	/*
+	 * Once on_work is cleared the main thread can queue s again, so
+	 * take everything needed from the work list while it is locked
+	 */
+	pthread_mutex_lock(&t->mutex);
+	work = t->work_head;
+	t->work_head = t->work_tail = NULL;
+	t->work_kicked = false;
+
+	for (s = work; s != NULL; s = s->todo_next) {
+		s->todo_next = s->work_next;
+		s->on_work = false;
+		s->closing = s->detached;
+		if (s->tx_head != NULL) {
+			if (s->out_tail == NULL) {
+				s->out_head = s->tx_head;
+			} else {
+				s->out_tail->next = s->tx_head;
+			}
+			s->out_tail = s->tx_tail;
+			s->tx_head = s->tx_tail = NULL;
+		}
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	for (s = work; s != NULL; s = next) {
+		bool last;
+
+		next = s->todo_next;
+
+		if (!s->registered) {
+			s->registered = true;
+			DLIST_ADD(t->conns, s);
+		}
+
+		if (s->dead) {
+			io_thread_pkt_list_free(s->out_head);
+			s->out_head = s->out_tail = NULL;
+		}
+
+		if (!s->closing) {
+			continue;
+		}
+
+		DLIST_REMOVE(t->conns, s);
+		close(s->fd);
+
+		pthread_mutex_lock(&t->mutex);
+		s->refcount -= 1;
+		last = (s->refcount == 0);
+		pthread_mutex_unlock(&t->mutex);
+
+		if (last) {
+			io_thread_shared_free(s);
+		}
+	}
+}
+
+/*
+ * If the arrays cannot grow, only wait for the main thread and try
+ * again on the next wakeup
+ */
+static nfds_t io_thread_pfd_setup(struct io_thread *t)
+{
+	struct io_thread_shared *s;
+	nfds_t n = 1;
+
+	t->pfd[0] = (struct pollfd) {
+		.fd = t->wake_fd[0], .events = POLLIN,
+	};
+	t->pfd_conn[0] = NULL;
+
+	for (s = t->conns; s != NULL; s = s->next) {
+		n += 1;
+	}
+
+	if (n > t->pfd_size) {
+		struct pollfd *pfd;
+		struct io_thread_shared **pfd_conn;
+
+		pfd = realloc(t->pfd, n * sizeof(struct pollfd));
+		if (pfd == NULL) {
+			return 1;
+		}
+		t->pfd = pfd;
+		pfd_conn = realloc(t->pfd_conn,
+				   n * sizeof(struct io_thread_shared *));
+		if (pfd_conn == NULL) {
+			return 1;
+		}
+		t->pfd_conn = pfd_conn;
+		t->pfd_size = n;
+	}
+
+	n = 1;
+	for (s = t->conns; s != NULL; s = s->next) {
+		short events = 0;
+
+		if (!s->dead) {
+			events = POLLIN;
+			if (s->out_head != NULL) {
+				events |= POLLOUT;
+			}
+		}
+		t->pfd[n] = (struct pollfd) {
+			/* poll() ignores negative fds */
+			.fd = (events != 0 ? s->fd : -1), .events = events,
+		};
+		t->pfd_conn[n] = s;
+		n += 1;
+	}
+
+	return n;
+}
+
+static void *io_thread_main(void *private_data)
+{
+	struct io_thread *t = private_data;
+	struct io_thread_shared *s;
+
+	while (true) {
+		nfds_t i, num_pfd;
+		uint64_t start;
+		bool stop;
+		int ret;
+
+		num_pfd = io_thread_pfd_setup(t);
+
+		ret = poll(t->pfd, num_pfd, -1);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		start = io_thread_now_us();
+
+		/*
+		 * Connections are only freed in io_thread_work(), so do the
+		 * I/O before that
+		 */
+		for (i=1; i<num_pfd; i++) {
+			short revents = t->pfd[i].revents;
+
+			s = t->pfd_conn[i];
+			if (revents == 0 || s->dead) {
+				continue;
+			}
+			if (revents & POLLOUT) {
+				io_thread_write(t, s);
+			}
+			if (s->dead) {
+				continue;
+			}
+			if (revents & (POLLIN|POLLHUP|POLLERR|POLLNVAL)) {
+				io_thread_read(t, s);
+			}
+		}
+
+		if (t->pfd[0].revents != 0) {
+			io_thread_drain(t->wake_fd[0]);
+			io_thread_work(t);
+		}
+
+		pthread_mutex_lock(&t->mutex);
+		t->stats.wakeups += 1;
+		t->busy_us += io_thread_now_us() - start;
+		stop = t->stop;
+		pthread_mutex_unlock(&t->mutex);
+
+		if (stop) {
+			break;
+		}
+	}
+
+	/* Detach requests queued before the stop */
+	io_thread_work(t);
+
+	return NULL;
+}
+
+static int io_thread_start(struct io_thread_pool *pool)
+{
+	struct io_thread *t;
+	sigset_t mask, old_mask;
+	int ret;
+
+	t = calloc(1, sizeof(struct io_thread));
+	if (t == NULL) {
+		return ENOMEM;
+	}
+	t->pool = pool;
+
+	t->pfd = malloc(sizeof(struct pollfd));
+	t->pfd_conn = malloc(sizeof(struct io_thread_shared *));
+	if (t->pfd == NULL || t->pfd_conn == NULL) {
+		free(t->pfd);
+		free(t->pfd_conn);
+		free(t);
+		return ENOMEM;
+	}
+	t->pfd_size = 1;
+
+	ret = pipe(t->wake_fd);
+	if (ret != 0) {
+		ret = errno;
+		free(t->pfd);
+		free(t->pfd_conn);
+		free(t);
+		return ret;
+	}
+	set_blocking(t->wake_fd[0], false);
+	set_blocking(t->wake_fd[1], false);
+	set_close_on_exec(t->wake_fd[0]);
+	set_close_on_exec(t->wake_fd[1]);
+
+	ret = pthread_mutex_init(&t->mutex, NULL);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	/* Signals are handled by the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+	ret = pthread_create(&t->id, NULL, io_thread_main, t);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (ret != 0) {
+		pthread_mutex_destroy(&t->mutex);
+		goto fail;
+	}
+
+	pool->threads[pool->num_threads] = t;
+	pool->num_threads += 1;
+	return 0;
+
+fail:
+	close(t->wake_fd[0]);
+	close(t->wake_fd[1]);
+	free(t->pfd);
+	free(t->pfd_conn);
+	free(t);
+	return ret;
+}
+
+static void io_thread_stop(struct io_thread *t)
+{
+	pthread_mutex_lock(&t->mutex);
+	t->stop = true;
+	pthread_mutex_unlock(&t->mutex);
+
+	io_thread_kick(t->wake_fd[1]);
+	pthread_join(t->id, NULL);
+
+	close(t->wake_fd[0]);
+	close(t->wake_fd[1]);
+	pthread_mutex_destroy(&t->mutex);
+	free(t->pfd);
+	free(t->pfd_conn);
+}
+
+/*
+ * Main thread
+ */
+
+/* Called with the mutex held */
+static bool io_thread_work_add(struct io_thread *t,
+			       struct io_thread_shared *s)
+{
+	if (s->on_work) {
+		return false;
+	}
+
+	s->on_work = true;
+	s->work_next = NULL;
+	if (t->work_tail == NULL) {
+		t->work_head = s;
+	} else {
+		t->work_tail->work_next = s;
+	}
+	t->work_tail = s;
+
+	if (t->work_kicked) {
+		return false;
+	}
+	t->work_kicked = true;
+	return true;
+}
+
+static void io_thread_conn_process(struct tevent_context *ev,
+				   struct tevent_immediate *im,
+				   void *private_data)
+{
+	struct io_thread_conn *conn = talloc_get_type_abort(
+		private_data, struct io_thread_conn);
+	struct io_thread *t = conn->thread;
+	struct io_thread_shared *s = conn->shared;
+	struct io_thread_pkt *pkt;
+	bool more, failed;
+	uint8_t *buf;
+	size_t buflen;
+
+	if (s == NULL || conn->eof_reported) {
+		return;
+	}
+
+	pthread_mutex_lock(&t->mutex);
+	pkt = s->rx_head;
+	if (pkt != NULL) {
+		s->rx_head = pkt->next;
+		if (s->rx_head == NULL) {
+			s->rx_tail = NULL;
+		}
+	}
+	more = (s->rx_head != NULL);
+	failed = s->failed;
+	pthread_mutex_unlock(&t->mutex);
+
+	if (pkt == NULL) {
+		if (failed) {
+			conn->eof_reported = true;
+			conn->read_fn(NULL, 0, conn->private_data);
+		}
+		return;
+	}
+
+	/*
+	 * One packet at a time, like ctdb_queue, the callback can free
+	 * the connection
+	 */
+	if (more || failed) {
+		tevent_schedule_immediate(conn->im, conn->pool->ev,
+					  io_thread_conn_process, conn);
+	}
+
+	buflen = pkt->length;
+	buf = talloc_size(conn, buflen);
+	if (buf == NULL) {
+		free(pkt);
+		conn->eof_reported = true;
+		conn->read_fn(NULL, 0, conn->private_data);
+		return;
+	}
+	memcpy(buf, pkt->buf, buflen);
+	free(pkt);
+
+	conn->read_fn(buf, buflen, conn->private_data);
+}
+
+static void io_thread_pool_ready(struct tevent_context *ev,
+				 struct tevent_fd *fde, uint16_t flags,
+				 void *private_data)
+{
+	struct io_thread_pool *pool = talloc_get_type_abort(
+		private_data, struct io_thread_pool);
+	unsigned int i;
+
+	io_thread_drain(pool->ready_fd[0]);
+
+	for (i=0; i<pool->num_threads; i++) {
+		struct io_thread *t = pool->threads[i];
+		struct io_thread_shared *s, *next;
+
+		pthread_mutex_lock(&t->mutex);
+		s = t->ready_head;
+		t->ready_head = t->ready_tail = NULL;
+		t->ready_kicked = false;
+		pthread_mutex_unlock(&t->mutex);
+
+		for (; s != NULL; s = next) {
+			struct io_thread_conn *conn;
+			bool last;
+
+			pthread_mutex_lock(&t->mutex);
+			next = s->ready_next;
+			s->on_ready = false;
+			conn = s->conn;
+			s->refcount -= 1;
+			last = (s->refcount == 0);
+			pthread_mutex_unlock(&t->mutex);
+
+			if (last) {
+				io_thread_shared_free(s);
+				continue;
+			}
+			if (conn != NULL) {
+				tevent_schedule_immediate(
+					conn->im, pool->ev,
+					io_thread_conn_process, conn);
+			}
+		}
+	}
+}
+
+static void io_thread_atfork_child(void)
+{
+	struct io_thread_pool *pool;
+
+	/*
+	 * Only the forking thread exists in the child.  The threads and
+	 * their locks are gone, so disable the pools and close the
+	 * sockets they own.
+	 */
+	for (pool = io_thread_pools; pool != NULL; pool = pool->next) {
+		struct io_thread_conn *conn;
+		unsigned int i;
+
+		pool->forked = true;
+		pool->size = 0;
+		TALLOC_FREE(pool->fde);
+
+		for (i=0; i<pool->num_threads; i++) {
+			close(pool->threads[i]->wake_fd[0]);
+			close(pool->threads[i]->wake_fd[1]);
+		}
+
+		for (conn = pool->conns; conn != NULL; conn = conn->next) {
+			if (conn->shared != NULL) {
+				close(conn->shared->fd);
+				conn->shared = NULL;
+			}
+		}
+	}
+}
+
+static void io_thread_atfork_init(void)
+{
+	pthread_atfork(NULL, NULL, io_thread_atfork_child);
+}
+
+static int io_thread_pool_destructor(struct io_thread_pool *pool)
+{
+	struct io_thread_conn *conn;
+	unsigned int i;
+
+	DLIST_REMOVE(io_thread_pools, pool);
+
+	if (pool->forked) {
+		/* The threads are gone, leave their memory alone */
+		while ((conn = pool->conns) != NULL) {
+			DLIST_REMOVE(pool->conns, conn);
+			conn->pool = NULL;
+		}
+		return 0;
+	}
+
+	for (i=0; i<pool->num_threads; i++) {
+		io_thread_stop(pool->threads[i]);
+	}
+
+	/* Only references from the ready lists and the connections remain */
+	for (i=0; i<pool->num_threads; i++) {
+		struct io_thread_shared *s, *next;
+
+		for (s = pool->threads[i]->ready_head; s != NULL; s = next) {
+			next = s->ready_next;
+			s->refcount -= 1;
+			if (s->refcount == 0) {
+				io_thread_shared_free(s);
+			}
+		}
+	}
+
+	while ((conn = pool->conns) != NULL) {
+		DLIST_REMOVE(pool->conns, conn);
+		if (conn->shared != NULL) {
+			close(conn->shared->fd);
+			io_thread_shared_free(conn->shared);
+			conn->shared = NULL;
+		}
+		conn->pool = NULL;
+	}
+
+	for (i=0; i<pool->num_threads; i++) {
+		free(pool->threads[i]);
+	}
+
+	TALLOC_FREE(pool->fde);
+	return 0;
+}
+
+int io_thread_pool_init(TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+			struct io_thread_pool **result)
+{
+	struct io_thread_pool *pool;
+	int ret;
+
+	ret = pthread_once(&io_thread_atfork_once, io_thread_atfork_init);
+	if (ret != 0) {
+		return ret;
+	}
+
+	pool = talloc_zero(mem_ctx, struct io_thread_pool);
+	if (pool == NULL) {
+		return ENOMEM;
+	}
+	pool->ev = ev;
+
+	ret = pipe(pool->ready_fd);
+	if (ret != 0) {
+		ret = errno;
+		talloc_free(pool);
+		return ret;
+	}
+	set_blocking(pool->ready_fd[0], false);
+	set_blocking(pool->ready_fd[1], false);
+	set_close_on_exec(pool->ready_fd[0]);
+	set_close_on_exec(pool->ready_fd[1]);
+
+	pool->fde = tevent_add_fd(ev, pool, pool->ready_fd[0], TEVENT_FD_READ,
+				  io_thread_pool_ready, pool);
+	if (pool->fde == NULL) {
+		close(pool->ready_fd[0]);
+		close(pool->ready_fd[1]);
+		talloc_free(pool);
+		return ENOMEM;
+	}
+	tevent_fd_set_auto_close(pool->fde);
+
+	/* The write end goes with the read end */
+	talloc_set_destructor(pool, io_thread_pool_destructor);
+	DLIST_ADD(io_thread_pools, pool);
+
+	*result = pool;
+	return 0;
+}
+
+int io_thread_pool_set_size(struct io_thread_pool *pool,
+			    unsigned int num_threads)
+{
+	if (pool->forked) {
+		return 0;
+	}
+
+	if (num_threads > IO_THREAD_MAX) {
+		num_threads = IO_THREAD_MAX;
+	}
+
+	while (pool->num_threads < num_threads) {
+		int ret;
+
+		ret = io_thread_start(pool);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	pool->size = num_threads;
+	return 0;
+}
+
+unsigned int io_thread_pool_size(struct io_thread_pool *pool)
+{
+	return pool->size;
+}
+
+unsigned int io_thread_pool_num_threads(struct io_thread_pool *pool)
+{
+	if (pool->forked) {
+		return 0;
+	}
+	return pool->num_threads;
+}
+
+int io_thread_pool_stats(struct io_thread_pool *pool, unsigned int idx,
+			 bool reset, struct io_thread_stats *stats)
+{
+	struct io_thread *t;
+
+	if (pool->forked || idx >= pool->num_threads) {
+		return EINVAL;
+	}
+	t = pool->threads[idx];
+
+	pthread_mutex_lock(&t->mutex);
+	*stats = t->stats;
+	stats->busy_ms = t->busy_us / 1000;
+	if (reset) {
+		t->stats = (struct io_thread_stats) { 0 };
+		t->busy_us = 0;
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	stats->num_conns = t->num_conns;
+	return 0;
+}
+
+static int io_thread_conn_destructor(struct io_thread_conn *conn)
+{
+	struct io_thread_pool *pool = conn->pool;
+	struct io_thread *t = conn->thread;
+	struct io_thread_shared *s = conn->shared;
+	bool kick;
+
+	if (pool == NULL) {
+		return 0;
+	}
+	DLIST_REMOVE(pool->conns, conn);
+
+	if (s == NULL) {
+		return 0;
+	}
+	conn->shared = NULL;
+	t->num_conns -= 1;
+
+	/* The thread closes the socket and drops the last reference */
+	pthread_mutex_lock(&t->mutex);
+	s->conn = NULL;
+	s->detached = true;
+	s->refcount -= 1;
+	kick = io_thread_work_add(t, s);
+	pthread_mutex_unlock(&t->mutex);
+
+	if (kick) {
+		io_thread_kick(t->wake_fd[1]);
+	}
+	return 0;
+}
+
+int io_thread_conn_setup(TALLOC_CTX *mem_ctx, struct io_thread_pool *pool,
+			 int fd, size_t read_size,
+			 io_thread_read_fn read_fn, void *private_data,
+			 struct io_thread_conn **result)
+{
+	struct io_thread_conn *conn;
+	struct io_thread_shared *s;
+	struct io_thread *t;
+	unsigned int i;
+	bool kick;
+
+	if (pool->size == 0 || fd < 0) {
+		return EINVAL;
+	}
+
+	conn = talloc_zero(mem_ctx, struct io_thread_conn);
+	if (conn == NULL) {
+		return ENOMEM;
+	}
+
+	conn->im = tevent_create_immediate(conn);
+	if (conn->im == NULL) {
+		talloc_free(conn);
+		return ENOMEM;
+	}
+
+	s = calloc(1, sizeof(struct io_thread_shared));
+	if (s == NULL) {
+		talloc_free(conn);
+		return ENOMEM;
+	}
+	s->fd = fd;
+	s->read_size = MAX(read_size, sizeof(uint32_t));
+	s->conn = conn;
+	/* One for the connection, one for the thread */
+	s->refcount = 2;
+
+	t = pool->threads[0];
+	for (i=1; i<pool->size; i++) {
+		if (pool->threads[i]->num_conns < t->num_conns) {
+			t = pool->threads[i];
+		}
+	}
+
+	conn->pool = pool;
+	conn->thread = t;
+	conn->shared = s;
+	conn->read_fn = read_fn;
+	conn->private_data = private_data;
+
+	t->num_conns += 1;
+	DLIST_ADD(pool->conns, conn);
+	talloc_set_destructor(conn, io_thread_conn_destructor);
+
+	pthread_mutex_lock(&t->mutex);
+	kick = io_thread_work_add(t, s);
+	pthread_mutex_unlock(&t->mutex);
+
+	if (kick) {
+		io_thread_kick(t->wake_fd[1]);
+	}
+
+	*result = conn;
+	return 0;
+}
+
+int io_thread_conn_write(struct io_thread_conn *conn,
+			 uint8_t *buf, size_t buflen)
+{
+	struct io_thread *t = conn->thread;
+	struct io_thread_shared *s = conn->shared;
+	struct io_thread_pkt *pkt;
+	bool kick;
+
+	if (s == NULL) {
+		return EPIPE;
+	}
+
+	pkt = malloc(offsetof(struct io_thread_pkt, buf) + buflen);
+	if (pkt == NULL) {
+		return ENOMEM;
+	}
+	pkt->next = NULL;
+	pkt->length = buflen;
+	pkt->offset = 0;
+	memcpy(pkt->buf, buf, buflen);
+
+	pthread_mutex_lock(&t->mutex);
+	if (s->failed) {
+		pthread_mutex_unlock(&t->mutex);
+		free(pkt);
+		return EPIPE;
+	}
+	if (s->tx_tail == NULL) {
+		s->tx_head = pkt;
+	} else {
+		s->tx_tail->next = pkt;
+	}
+	s->tx_tail = pkt;
+	s->tx_count += 1;
+	kick = io_thread_work_add(t, s);
+	pthread_mutex_unlock(&t->mutex);
+
+	if (kick) {
+		io_thread_kick(t->wake_fd[1]);
+	}
+	return 0;
+}
+
+unsigned int io_thread_conn_queue_length(struct io_thread_conn *conn)
+{
+	struct io_thread *t = conn->thread;
+	struct io_thread_shared *s = conn->shared;
+	unsigned int count;
+
+	if (s == NULL) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&t->mutex);
+	count = s->tx_count;
+	pthread_mutex_unlock(&t->mutex);
+
+	return count;
+}
+
+#else /* HAVE_PTHREAD */
+
+struct io_thread_pool {
+	struct tevent_context *ev;
+};
+
+struct io_thread_conn {
+	int fd;
+};
+
+int io_thread_pool_init(TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+			struct io_thread_pool **result)
+{
+	struct io_thread_pool *pool;
+
+	pool = talloc_zero(mem_ctx, struct io_thread_pool);
+	if (pool == NULL) {
+		return ENOMEM;
+	}
+	pool->ev = ev;
+
+	*result = pool;
+	return 0;
+}
+
+int io_thread_pool_set_size(struct io_thread_pool *pool,
+			    unsigned int num_threads)
+{
+	return (num_threads == 0 ? 0 : ENOSYS);
+}
+
+unsigned int io_thread_pool_size(struct io_thread_pool *pool)
+{
+	return 0;
+}
+
+unsigned int io_thread_pool_num_threads(struct io_thread_pool *pool)
+{
+	return 0;
+}
+
+int io_thread_pool_stats(struct io_thread_pool *pool, unsigned int idx,
+			 bool reset, struct io_thread_stats *stats)
+{
+	return EINVAL;
+}
+
+int io_thread_conn_setup(TALLOC_CTX *mem_ctx, struct io_thread_pool *pool,
+			 int fd, size_t read_size,
+			 io_thread_read_fn read_fn, void *private_data,
+			 struct io_thread_conn **result)
+{
+	return ENOSYS;
+}
+
+int io_thread_conn_write(struct io_thread_conn *conn,
+			 uint8_t *buf, size_t buflen)
+{
+	return ENOSYS;
+}
+
+unsigned int io_thread_conn_queue_length(struct io_thread_conn *conn)
+{
+	return 0;
+}
+
+#endif /* HAVE_PTHREAD */
@@ -0,0 +1,190 @@
+/*
+   Packet I/O on sockets in helper threads
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CTDB_IO_THREAD_H__
+#define __CTDB_IO_THREAD_H__
+
+#include <talloc.h>
+#include <tevent.h>
+
+/**
+ * @file io_thread.h
+ *
+ * @brief Move socket reads and writes off the main event loop
+ *
+ * A pool of threads does the read(2) and write(2) calls and the packet
+ * framing for a set of connections.  Every connection is served by
+ * exactly one thread, so packets on a connection stay in order.
+ *
+ * Packets start with a 32-bit length that includes the length field
+ * itself, like all CTDB packets.
+ *
+ * Everything else, in particular all packet processing, stays in the
+ * thread running the tevent context the pool was created with.  The
+ * helper threads do not use talloc or tevent, they only see malloc'ed
+ * copies of the packets.
+ *
+ * Without pthread support the pool always has zero threads.
+ */
+
+/**
+ * @brief Maximum number of threads in a pool
+ */
+#define IO_THREAD_MAX	8
+
+/**
+ * @brief Abstract structure representing a pool of I/O threads
+ */
+struct io_thread_pool;
+
+/**
+ * @brief Abstract structure representing a connection served by a pool
+ */
+struct io_thread_conn;
+
+/**
+ * @brief The callback function for incoming packets
+ *
+ * This is called in the main thread for every complete packet read from
+ * the connection.  The callback owns buf, it is a talloc child of the
+ * connection.
+ *
+ * On EOF or error it is called once with buf=NULL and buflen=0, after
+ * all packets read before have been passed up.  Nothing is read or
+ * written on the connection afterwards.
+ *
+ * The callback may free the connection.
+ */
+typedef void (*io_thread_read_fn)(uint8_t *buf, size_t buflen,
+				  void *private_data);
+
+/**
+ * @brief Load counters of a thread
+ *
+ * All counters apart from num_conns count since the last call to
+ * io_thread_pool_stats() with reset=true.
+ */
+struct io_thread_stats {
+	uint32_t num_conns;
+	uint32_t packets_recv;
+	uint32_t packets_sent;
+	uint32_t wakeups;
+	uint32_t busy_ms;
+};
+
+/**
+ * @brief Create a pool of I/O threads
+ *
+ * The pool starts without threads, see io_thread_pool_set_size().
+ *
+ * @param[in] mem_ctx Talloc memory context
+ * @param[in] ev Tevent context of the main thread
+ * @param[out] result The new pool
+ * @return 0 on success, errno on failure
+ */
+int io_thread_pool_init(TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+			struct io_thread_pool **result);
+
+/**
+ * @brief Set the number of threads new connections are spread over
+ *
+ * Threads are started on demand, up to IO_THREAD_MAX.  Reducing the
+ * number does not stop any thread, the existing connections stay with
+ * their thread.  Only new connections use the first num_threads threads.
+ *
+ * @param[in] pool The pool
+ * @param[in] num_threads Number of threads to use, 0 disables the pool
+ * @return 0 on success, errno on failure
+ */
+int io_thread_pool_set_size(struct io_thread_pool *pool,
+			    unsigned int num_threads);
+
+/**
+ * @brief Number of threads new connections are spread over
+ *
+ * This is 0 in a child process forked from the process owning the pool.
+ *
+ * @param[in] pool The pool
+ * @return Number of threads in use
+ */
+unsigned int io_thread_pool_size(struct io_thread_pool *pool);
+
+/**
+ * @brief Number of threads that have been started
+ *
+ * @param[in] pool The pool
+ * @return Number of threads, the index bound for io_thread_pool_stats()
+ */
+unsigned int io_thread_pool_num_threads(struct io_thread_pool *pool);
+
+/**
+ * @brief Get the load counters of a thread
+ *
+ * @param[in] pool The pool
+ * @param[in] idx Thread index, less than io_thread_pool_num_threads()
+ * @param[in] reset Whether to start counting from 0 again
+ * @param[out] stats The counters
+ * @return 0 on success, errno on failure
+ */
+int io_thread_pool_stats(struct io_thread_pool *pool, unsigned int idx,
+			 bool reset, struct io_thread_stats *stats);
+
+/**
+ * @brief Hand a socket over to the pool
+ *
+ * The connection is assigned to the thread with the fewest connections.
+ * The pool owns fd from now on, it is closed when the connection is
+ * freed.  fd must be non-blocking.
+ *
+ * @param[in] mem_ctx Talloc memory context
+ * @param[in] pool The pool, it must have at least one thread in use
+ * @param[in] fd The socket
+ * @param[in] read_size Number of bytes to read at a time
+ * @param[in] read_fn Callback for incoming packets
+ * @param[in] private_data Private data for the callback
+ * @param[out] result The new connection
+ * @return 0 on success, errno on failure
+ */
+int io_thread_conn_setup(TALLOC_CTX *mem_ctx, struct io_thread_pool *pool,
+			 int fd, size_t read_size,
+			 io_thread_read_fn read_fn, void *private_data,
+			 struct io_thread_conn **result);
+
+/**
+ * @brief Queue a packet for sending
+ *
+ * The data is copied, the caller keeps buf.
+ *
+ * @param[in] conn The connection
+ * @param[in] buf The packet
+ * @param[in] buflen Length of the packet
+ * @return 0 on success, errno on failure
+ */
+int io_thread_conn_write(struct io_thread_conn *conn,
+			 uint8_t *buf, size_t buflen);
+
+/**
+ * @brief Number of packets queued and not yet completely written
+ *
+ * @param[in] conn The connection
+ * @return Number of packets
+ */
+unsigned int io_thread_conn_queue_length(struct io_thread_conn *conn);
+
+#endif /* __CTDB_IO_THREAD_H__ */
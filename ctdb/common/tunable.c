@@ -157,6 +157,18 @@ static struct {
 		offsetof(struct ctdb_tunable_list, ip_alloc_algorithm) },
 	{ "AllowMixedVersions", 0, false,
 		offsetof(struct ctdb_tunable_list, allow_mixed_versions) },
+	{ "IOThreads", 0, false,
+		offsetof(struct ctdb_tunable_list, io_threads) },
+	{ "MigrationHoldTime", 0, false,
+		offsetof(struct ctdb_tunable_list, migration_hold_time) },
+	{ "MigrationHoldThreshold", 10, false,
+		offsetof(struct ctdb_tunable_list, migration_hold_threshold) },
+	{ "ClientRingSize", 0, false,
+		offsetof(struct ctdb_tunable_list, client_ring_size) },
+	{ "RecoveryMemoryLimit", 1024, false,
+		offsetof(struct ctdb_tunable_list, recovery_memory_limit) },
+	{ "VacuumChainsPerRun", 0, false,
+		offsetof(struct ctdb_tunable_list, vacuum_chains_per_run) },
 	{ NULL, 0, true, }
 };
 
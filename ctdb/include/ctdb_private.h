@@ -65,6 +65,7 @@ struct ctdb_client {
 	uint32_t db_id;
 	uint32_t num_persistent_updates;
 	struct ctdb_client_notify_list *notify;
+	struct daemon_client_ring *ring;
 };
 
 /*
@@ -290,6 +291,7 @@ struct ctdb_context {
 	struct ctdb_db_context *db_list;
 	struct srvid_context *srv;
 	struct srvid_context *tunnels;
+	struct io_thread_pool *io_pool; /* threads doing client and node I/O */
 	struct ctdb_daemon_data daemon;
 	struct ctdb_statistics statistics;
 	struct ctdb_statistics statistics_current;
@@ -371,6 +373,7 @@ struct ctdb_db_context {
 	*/
 	struct trbt_tree *deferred_fetch;
 	struct trbt_tree *defer_dmaster;
+	struct trbt_tree *migration_holds;
 
 	struct ctdb_db_statistics_old statistics;
 
@@ -556,8 +559,13 @@ int daemon_deregister_message_handler(struct ctdb_context *ctdb,
 void daemon_tunnel_handler(uint64_t tunnel_id, TDB_DATA data,
 			   void *private_data);
 
+int32_t ctdb_control_client_ring(struct ctdb_context *ctdb,
+				 uint32_t client_id, TDB_DATA *outdata);
+
 int ctdb_start_daemon(struct ctdb_context *ctdb, bool do_fork);
 
+struct io_thread_pool *ctdb_io_thread_pool(struct ctdb_context *ctdb);
+
 struct ctdb_req_header *_ctdb_transport_allocate(struct ctdb_context *ctdb,
 						 TALLOC_CTX *mem_ctx,
 						 enum ctdb_operation operation,
@@ -873,6 +881,8 @@ int32_t ctdb_control_get_server_id_list(struct ctdb_context *ctdb,
 
 int ctdb_statistics_init(struct ctdb_context *ctdb);
 
+void ctdb_statistics_update_io_threads(struct ctdb_context *ctdb);
+
 int32_t ctdb_control_get_stat_history(struct ctdb_context *ctdb,
 				      struct ctdb_req_control_old *c,
 				      TDB_DATA *outdata);
@@ -1004,6 +1014,8 @@ void ctdb_local_remove_from_delete_queue(struct ctdb_db_context *ctdb_db,
 					 const struct ctdb_ltdb_header *hdr,
 					 const TDB_DATA key);
 
+uint32_t ctdb_vacuum_delete_queue_len(struct ctdb_db_context *ctdb_db);
+
 /* from eventscript.c */
 
 int ctdb_start_eventd(struct ctdb_context *ctdb);
@@ -142,6 +142,45 @@ struct ctdb_req_tunnel_old {
 	uint8_t data[1];
 };
 
+/*
+   Shared memory ring from ctdbd to a local client, see
+   CTDB_CONTROL_CLIENT_RING.
+
+   ctdbd appends at head, the client consumes from tail.  Both count
+   bytes and wrap around at 2^32, size is a power of 2.  Each record
+   in data[] is aligned to CTDB_DS_ALIGNMENT and starts with a 32 bit
+   length: CTDB_CLIENT_RING_WRAP means the rest of data[] is unused,
+   CTDB_CLIENT_RING_SOCKET means the next packet has been sent on the
+   socket instead.  Anything else is a complete packet.
+
+   The client can write all of it: ctdbd keeps its own copy of size
+   and head, writes them only for the client to read, and checks the
+   tail it reads back.
+
+   reader_sleeping is set by the client before it waits on the socket,
+   ctdbd then sends a CTDB_SRVID_CLIENT_RING message there.
+   writer_waiting is set by ctdbd when the ring is full, the client
+   sends a CTDB_SRVID_CLIENT_RING message once it has made space.
+*/
+#define CTDB_CLIENT_RING_MAGIC	0x43524e47
+#define CTDB_CLIENT_RING_WRAP	0
+#define CTDB_CLIENT_RING_SOCKET	0xffffffff
+
+#define CTDB_CLIENT_RING_ALIGN(len) \
+	(((len) + (CTDB_DS_ALIGNMENT-1)) & ~(CTDB_DS_ALIGNMENT-1))
+
+struct ctdb_client_ring {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t head;
+	uint32_t reader_sleeping;
+	uint8_t pad1[48];
+	uint32_t tail;
+	uint32_t writer_waiting;
+	uint8_t pad2[56];
+	uint8_t data[1];
+};
+
 /*
    Structure used for a nodemap. 
    The nodemap is the structure containing a list of all nodes
@@ -190,10 +229,20 @@ struct ctdb_db_statistics_old {
 	} locks;
 	struct {
 		struct ctdb_latency_counter latency;
+		uint32_t num_queued;
+		uint32_t num_deleted;
+		uint32_t queue_len;
+		uint32_t pass_time;
 	} vacuum;
 	uint32_t db_ro_delegations;
 	uint32_t db_ro_revokes;
 	uint32_t hop_count_bucket[MAX_COUNT_BUCKETS];
+	struct {
+		uint32_t num_total;
+		uint32_t num_hot;
+		uint32_t num_held;
+		uint32_t num_batched;
+	} migrations;
 	uint32_t num_hot_keys;
 	struct {
 		uint32_t count;
@@ -179,6 +179,9 @@ struct ctdb_call {
 /* SRVID to inform recovery daemon to disable the public ip checks */
 #define CTDB_SRVID_DISABLE_IP_CHECK  0xFC00000000000000LL
 
+/* SRVID for the doorbell and flow control of a client ring */
+#define CTDB_SRVID_CLIENT_RING  0xFC01000000000000LL
+
 /* A range of ports reserved for registering a PID (top 8 bits)
  * All ports matching the 8 top bits are reserved for exclusive use by
  * registering a SRVID that matches the process-id of the requesting process
@@ -373,9 +376,11 @@ enum ctdb_controls {CTDB_CONTROL_PROCESS_EXISTS          = 0,
 		    CTDB_CONTROL_CHECK_PID_SRVID         = 151,
 		    CTDB_CONTROL_TUNNEL_REGISTER         = 152,
 		    CTDB_CONTROL_TUNNEL_DEREGISTER       = 153,
+		    CTDB_CONTROL_CLIENT_RING             = 154,
 };
 
 #define MAX_COUNT_BUCKETS 16
+#define MAX_IO_THREADS 8
 #define MAX_HOT_KEYS      10
 
 struct ctdb_latency_counter {
@@ -444,6 +449,14 @@ struct ctdb_statistics {
 	struct timeval statistics_current_time;
 	uint32_t total_ro_delegations;
 	uint32_t total_ro_revokes;
+	uint32_t num_io_threads;
+	struct {
+		uint32_t num_conns;
+		uint32_t packets_recv;
+		uint32_t packets_sent;
+		uint32_t wakeups;
+		uint32_t busy_ms;
+	} io_threads[MAX_IO_THREADS];
 };
 
 #define INVALID_GENERATION 1
@@ -656,6 +669,12 @@ struct ctdb_tunable_list {
 	uint32_t queue_buffer_size;
 	uint32_t ip_alloc_algorithm;
 	uint32_t allow_mixed_versions;
+	uint32_t io_threads;
+	uint32_t migration_hold_time;
+	uint32_t migration_hold_threshold;
+	uint32_t client_ring_size;
+	uint32_t recovery_memory_limit;
+	uint32_t vacuum_chains_per_run;
 };
 
 struct ctdb_tickle_list {
@@ -825,10 +844,20 @@ struct ctdb_db_statistics {
 	} locks;
 	struct {
 		struct ctdb_latency_counter latency;
+		uint32_t num_queued;
+		uint32_t num_deleted;
+		uint32_t queue_len;
+		uint32_t pass_time;
 	} vacuum;
 	uint32_t db_ro_delegations;
 	uint32_t db_ro_revokes;
 	uint32_t hop_count_bucket[MAX_COUNT_BUCKETS];
+	struct {
+		uint32_t num_total;
+		uint32_t num_hot;
+		uint32_t num_held;
+		uint32_t num_batched;
+	} migrations;
 	uint32_t num_hot_keys;
 	struct {
 		uint32_t count;
@@ -914,6 +943,7 @@ struct ctdb_reply_control_data {
 		struct ctdb_node_map *nodemap;
 		const char *reclock_file;
 		struct ctdb_ban_state *ban_state;
+		const char *ring_path;
 		uint64_t seqnum;
 		const char *reason;
 		struct ctdb_public_ip_info *ipinfo;
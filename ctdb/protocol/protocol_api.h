@@ -609,6 +609,11 @@ void ctdb_req_control_tunnel_deregister(struct ctdb_req_control *request,
 					uint64_t tunnel_id);
 int ctdb_reply_control_tunnel_deregister(struct ctdb_reply_control *reply);
 
+void ctdb_req_control_client_ring(struct ctdb_req_control *request);
+int ctdb_reply_control_client_ring(struct ctdb_reply_control *reply,
+				   TALLOC_CTX *mem_ctx,
+				   const char **ring_path);
+
 /* From protocol/protocol_debug.c */
 
 void ctdb_packet_print(uint8_t *buf, size_t buflen, FILE *fp);
@@ -2371,3 +2371,30 @@ int ctdb_reply_control_tunnel_deregister(struct ctdb_reply_control *reply)
 
 	return reply->status;
 }
+
+/* CTDB_CONTROL_CLIENT_RING */
+
+void ctdb_req_control_client_ring(struct ctdb_req_control *request)
+{
+	request->opcode = CTDB_CONTROL_CLIENT_RING;
+	request->pad = 0;
+	request->srvid = 0;
+	request->client_id = 0;
+	request->flags = 0;
+
+	request->rdata.opcode = CTDB_CONTROL_CLIENT_RING;
+}
+
+int ctdb_reply_control_client_ring(struct ctdb_reply_control *reply,
+				   TALLOC_CTX *mem_ctx,
+				   const char **ring_path)
+{
+	if (reply->rdata.opcode != CTDB_CONTROL_CLIENT_RING) {
+		return EPROTO;
+	}
+
+	if (reply->status == 0) {
+		*ring_path = talloc_steal(mem_ctx, reply->rdata.data.ring_path);
+	}
+	return reply->status;
+}
@@ -426,6 +426,9 @@ static size_t ctdb_req_control_data_len(struct ctdb_req_control_data *cd)
 
 	case CTDB_CONTROL_TUNNEL_DEREGISTER:
 		break;
+
+	case CTDB_CONTROL_CLIENT_RING:
+		break;
 	}
 
 	return len;
@@ -1428,6 +1431,10 @@ static size_t ctdb_reply_control_data_len(struct ctdb_reply_control_data *cd)
 
 	case CTDB_CONTROL_TUNNEL_DEREGISTER:
 		break;
+
+	case CTDB_CONTROL_CLIENT_RING:
+		len = ctdb_string_len(&cd->data.ring_path);
+		break;
 	}
 
 	return len;
@@ -1592,6 +1599,10 @@ static void ctdb_reply_control_data_push(struct ctdb_reply_control_data *cd,
 
 	case CTDB_CONTROL_CHECK_PID_SRVID:
 		break;
+
+	case CTDB_CONTROL_CLIENT_RING:
+		ctdb_string_push(&cd->data.ring_path, buf, &np);
+		break;
 	}
 
 	*npush = np;
@@ -1787,6 +1798,11 @@ static int ctdb_reply_control_data_pull(uint8_t *buf, size_t buflen,
 
 	case CTDB_CONTROL_CHECK_PID_SRVID:
 		break;
+
+	case CTDB_CONTROL_CLIENT_RING:
+		ret = ctdb_string_pull(buf, buflen, mem_ctx,
+				       &cd->data.ring_path, &np);
+		break;
 	}
 
 	if (ret != 0) {
@@ -240,7 +240,15 @@ size_t ctdb_statistics_len(struct ctdb_statistics *in)
 		ctdb_timeval_len(&in->statistics_start_time) +
 		ctdb_timeval_len(&in->statistics_current_time) +
 		ctdb_uint32_len(&in->total_ro_delegations) +
-		ctdb_uint32_len(&in->total_ro_revokes);
+		ctdb_uint32_len(&in->total_ro_revokes) +
+		ctdb_uint32_len(&in->num_io_threads) +
+		MAX_IO_THREADS * (
+			ctdb_uint32_len(&in->io_threads[0].num_conns) +
+			ctdb_uint32_len(&in->io_threads[0].packets_recv) +
+			ctdb_uint32_len(&in->io_threads[0].packets_sent) +
+			ctdb_uint32_len(&in->io_threads[0].wakeups) +
+			ctdb_uint32_len(&in->io_threads[0].busy_ms)) +
+		ctdb_padding_len(4);
 }
 
 void ctdb_statistics_push(struct ctdb_statistics *in, uint8_t *buf,
@@ -406,6 +414,34 @@ void ctdb_statistics_push(struct ctdb_statistics *in, uint8_t *buf,
 	ctdb_uint32_push(&in->total_ro_revokes, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->num_io_threads, buf+offset, &np);
+	offset += np;
+
+	for (i=0; i<MAX_IO_THREADS; i++) {
+		ctdb_uint32_push(&in->io_threads[i].num_conns,
+				 buf+offset, &np);
+		offset += np;
+
+		ctdb_uint32_push(&in->io_threads[i].packets_recv,
+				 buf+offset, &np);
+		offset += np;
+
+		ctdb_uint32_push(&in->io_threads[i].packets_sent,
+				 buf+offset, &np);
+		offset += np;
+
+		ctdb_uint32_push(&in->io_threads[i].wakeups,
+				 buf+offset, &np);
+		offset += np;
+
+		ctdb_uint32_push(&in->io_threads[i].busy_ms,
+				 buf+offset, &np);
+		offset += np;
+	}
+
+	ctdb_padding_push(4, buf+offset, &np);
+	offset += np;
+
 	*npush = offset;
 }
 
@@ -774,6 +810,56 @@ static int ctdb_statistics_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->num_io_threads, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	for (i=0; i<MAX_IO_THREADS; i++) {
+		ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+				       &out->io_threads[i].num_conns, &np);
+		if (ret != 0) {
+			return ret;
+		}
+		offset += np;
+
+		ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+				       &out->io_threads[i].packets_recv, &np);
+		if (ret != 0) {
+			return ret;
+		}
+		offset += np;
+
+		ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+				       &out->io_threads[i].packets_sent, &np);
+		if (ret != 0) {
+			return ret;
+		}
+		offset += np;
+
+		ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+				       &out->io_threads[i].wakeups, &np);
+		if (ret != 0) {
+			return ret;
+		}
+		offset += np;
+
+		ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+				       &out->io_threads[i].busy_ms, &np);
+		if (ret != 0) {
+			return ret;
+		}
+		offset += np;
+	}
+
+	ret = ctdb_padding_pull(buf+offset, buflen-offset, 4, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	*npull = offset;
 	return 0;
 }
@@ -2560,7 +2646,13 @@ size_t ctdb_tunable_list_len(struct ctdb_tunable_list *in)
 		ctdb_uint32_len(&in->rec_buffer_size_limit) +
 		ctdb_uint32_len(&in->queue_buffer_size) +
 		ctdb_uint32_len(&in->ip_alloc_algorithm) +
-		ctdb_uint32_len(&in->allow_mixed_versions);
+		ctdb_uint32_len(&in->allow_mixed_versions) +
+		ctdb_uint32_len(&in->io_threads) +
+		ctdb_uint32_len(&in->migration_hold_time) +
+		ctdb_uint32_len(&in->migration_hold_threshold) +
+		ctdb_uint32_len(&in->client_ring_size) +
+		ctdb_uint32_len(&in->recovery_memory_limit) +
+		ctdb_uint32_len(&in->vacuum_chains_per_run);
 }
 
 void ctdb_tunable_list_push(struct ctdb_tunable_list *in, uint8_t *buf,
@@ -2754,6 +2846,24 @@ void ctdb_tunable_list_push(struct ctdb_tunable_list *in, uint8_t *buf,
 	ctdb_uint32_push(&in->allow_mixed_versions, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->io_threads, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->migration_hold_time, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->migration_hold_threshold, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->client_ring_size, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->recovery_memory_limit, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->vacuum_chains_per_run, buf+offset, &np);
+	offset += np;
+
 	*npush = offset;
 }
 
@@ -3199,6 +3309,48 @@ static int ctdb_tunable_list_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->io_threads, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->migration_hold_time, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->migration_hold_threshold, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->client_ring_size, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->recovery_memory_limit, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->vacuum_chains_per_run, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	*npull = offset;
 	return 0;
 }
@@ -4488,10 +4640,18 @@ size_t ctdb_db_statistics_len(struct ctdb_db_statistics *in)
 		MAX_COUNT_BUCKETS *
 			ctdb_uint32_len(&in->locks.buckets[0]) +
 		ctdb_latency_counter_len(&in->vacuum.latency) +
+		ctdb_uint32_len(&in->vacuum.num_queued) +
+		ctdb_uint32_len(&in->vacuum.num_deleted) +
+		ctdb_uint32_len(&in->vacuum.queue_len) +
+		ctdb_uint32_len(&in->vacuum.pass_time) +
 		ctdb_uint32_len(&in->db_ro_delegations) +
 		ctdb_uint32_len(&in->db_ro_revokes) +
 		MAX_COUNT_BUCKETS *
 			ctdb_uint32_len(&in->hop_count_bucket[0]) +
+		ctdb_uint32_len(&in->migrations.num_total) +
+		ctdb_uint32_len(&in->migrations.num_hot) +
+		ctdb_uint32_len(&in->migrations.num_held) +
+		ctdb_uint32_len(&in->migrations.num_batched) +
 		ctdb_uint32_len(&in->num_hot_keys) +
 		ctdb_padding_len(4) +
 		MAX_HOT_KEYS *
@@ -4535,6 +4695,18 @@ void ctdb_db_statistics_push(struct ctdb_db_statistics *in, uint8_t *buf,
 	ctdb_latency_counter_push(&in->vacuum.latency, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->vacuum.num_queued, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->vacuum.num_deleted, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->vacuum.queue_len, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->vacuum.pass_time, buf+offset, &np);
+	offset += np;
+
 	ctdb_uint32_push(&in->db_ro_delegations, buf+offset, &np);
 	offset += np;
 
@@ -4546,6 +4718,18 @@ void ctdb_db_statistics_push(struct ctdb_db_statistics *in, uint8_t *buf,
 		offset += np;
 	}
 
+	ctdb_uint32_push(&in->migrations.num_total, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->migrations.num_hot, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->migrations.num_held, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->migrations.num_batched, buf+offset, &np);
+	offset += np;
+
 	num_hot_keys = MAX_HOT_KEYS;
 	ctdb_uint32_push(&num_hot_keys, buf+offset, &np);
 	offset += np;
@@ -4631,6 +4815,34 @@ static int ctdb_db_statistics_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->vacuum.num_queued, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->vacuum.num_deleted, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->vacuum.queue_len, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->vacuum.pass_time, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
 			       &out->db_ro_delegations, &np);
 	if (ret != 0) {
@@ -4654,6 +4866,34 @@ static int ctdb_db_statistics_pull_elems(uint8_t *buf, size_t buflen,
 		offset += np;
 	}
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->migrations.num_total, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->migrations.num_hot, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->migrations.num_held, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->migrations.num_batched, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
 			       &out->num_hot_keys, &np);
 	if (ret != 0) {
@@ -417,6 +417,7 @@ static void ctdb_become_dmaster(struct ctdb_db_context *ctdb_db,
 		return;
 	}
 
+	CTDB_INCREMENT_DB_STAT(ctdb_db, migrations.num_total);
 	(void) hash_count_increment(ctdb_db->migratedb, key);
 
 	ctdb_call_local(ctdb_db, state->call, &header, state, &data, true);
@@ -456,22 +457,27 @@ static void dmaster_defer_reprocess(struct tevent_context *ev,
 	talloc_free(call);
 }
 
-static int dmaster_defer_queue_destructor(struct dmaster_defer_queue *ddq)
+static void dmaster_defer_requeue(struct dmaster_defer_call **calls)
 {
-	/* Ignore requests, if database recovery happens in-between. */
-	if (ddq->generation != ddq->ctdb_db->generation) {
-		return 0;
-	}
+	while (*calls != NULL) {
+		struct dmaster_defer_call *call = *calls;
 
-	while (ddq->deferred_calls != NULL) {
-		struct dmaster_defer_call *call = ddq->deferred_calls;
-
-		DLIST_REMOVE(ddq->deferred_calls, call);
+		DLIST_REMOVE(*calls, call);
 
 		talloc_steal(call->ctdb, call);
 		tevent_add_timer(call->ctdb->ev, call, timeval_zero(),
 				 dmaster_defer_reprocess, call);
 	}
+}
+
+static int dmaster_defer_queue_destructor(struct dmaster_defer_queue *ddq)
+{
+	/* Ignore requests, if database recovery happens in-between. */
+	if (ddq->generation != ddq->ctdb_db->generation) {
+		return 0;
+	}
+
+	dmaster_defer_requeue(&ddq->deferred_calls);
 	return 0;
 }
 
@@ -574,6 +580,207 @@ static int dmaster_defer_add(struct ctdb_db_context *ctdb_db,
 	return 0;
 }
 
+/*
+ * When a hot record has been migrated onto this node, requests for it
+ * from other nodes are held for MigrationHoldTime milliseconds.  This
+ * lets the local callers queued up behind the migration use the record
+ * before it is migrated away again.
+ *
+ * When the hold ends, the first held request is processed and migrates
+ * the record.  The other held requests from the new dmaster are sent
+ * straight after the migration, the rest are requeued.
+ */
+struct migration_hold {
+	struct ctdb_db_context *ctdb_db;
+	uint32_t generation;
+	bool released;
+	struct dmaster_defer_call *held_calls;
+};
+
+static int migration_hold_destructor(struct migration_hold *hold)
+{
+	/* Requests are resent after a recovery */
+	if (hold->generation != hold->ctdb_db->generation) {
+		return 0;
+	}
+
+	dmaster_defer_requeue(&hold->held_calls);
+	return 0;
+}
+
+static void migration_hold_timeout(struct tevent_context *ev,
+				   struct tevent_timer *te,
+				   struct timeval t,
+				   void *private_data)
+{
+	struct migration_hold *hold = talloc_get_type_abort(
+		private_data, struct migration_hold);
+	struct dmaster_defer_call *call = hold->held_calls;
+
+	if (call != NULL && hold->generation == hold->ctdb_db->generation) {
+		hold->released = true;
+
+		DLIST_REMOVE(hold->held_calls, call);
+		talloc_steal(call->ctdb, call);
+
+		ctdb_input_pkt(call->ctdb, call->hdr);
+		talloc_free(call);
+	}
+
+	talloc_free(hold);
+}
+
+static void ctdb_migration_hold_setup(struct ctdb_db_context *ctdb_db,
+				      TDB_DATA key)
+{
+	struct ctdb_context *ctdb = ctdb_db->ctdb;
+	uint32_t hold_time = ctdb->tunable.migration_hold_time;
+	struct migration_hold *hold;
+	struct tevent_timer *te;
+	uint32_t *k;
+
+	k = ctdb_key_to_idkey(ctdb_db, key);
+	if (k == NULL) {
+		DEBUG(DEBUG_ERR, ("Failed to allocate key for migration hold\n"));
+		return;
+	}
+
+	hold = trbt_lookuparray32(ctdb_db->migration_holds, k[0], k);
+	if (hold != NULL) {
+		talloc_free(k);
+		return;
+	}
+
+	hold = talloc(ctdb_db->migration_holds, struct migration_hold);
+	if (hold == NULL) {
+		DEBUG(DEBUG_ERR, ("Failed to allocate migration hold\n"));
+		talloc_free(k);
+		return;
+	}
+	hold->ctdb_db = ctdb_db;
+	hold->generation = ctdb_db->generation;
+	hold->released = false;
+	hold->held_calls = NULL;
+
+	te = tevent_add_timer(ctdb->ev, hold,
+			      timeval_current_ofs(hold_time / 1000,
+						  (hold_time * 1000) % 1000000),
+			      migration_hold_timeout, hold);
+	if (te == NULL) {
+		DEBUG(DEBUG_ERR, ("Failed to set up migration hold timer\n"));
+		talloc_free(hold);
+		talloc_free(k);
+		return;
+	}
+
+	trbt_insertarray32_callback(ctdb_db->migration_holds, k[0], k,
+				    insert_ddq_callback, hold);
+	talloc_set_destructor(hold, migration_hold_destructor);
+
+	CTDB_INCREMENT_DB_STAT(ctdb_db, migrations.num_hot);
+
+	talloc_free(k);
+}
+
+static struct migration_hold *ctdb_migration_hold_find(
+					struct ctdb_db_context *ctdb_db,
+					TDB_DATA key)
+{
+	struct migration_hold *hold;
+	uint32_t *k;
+
+	if (ctdb_db->ctdb->tunable.migration_hold_time == 0) {
+		return NULL;
+	}
+
+	k = ctdb_key_to_idkey(ctdb_db, key);
+	if (k == NULL) {
+		DEBUG(DEBUG_ERR, ("Failed to allocate key for migration hold\n"));
+		return NULL;
+	}
+
+	hold = trbt_lookuparray32(ctdb_db->migration_holds, k[0], k);
+	talloc_free(k);
+
+	return hold;
+}
+
+static int ctdb_migration_hold_add(struct ctdb_db_context *ctdb_db,
+				   struct ctdb_req_header *hdr,
+				   TDB_DATA key)
+{
+	struct migration_hold *hold;
+	struct dmaster_defer_call *call;
+
+	if (hdr->srcnode == ctdb_db->ctdb->pnn) {
+		return -1;
+	}
+
+	hold = ctdb_migration_hold_find(ctdb_db, key);
+	if (hold == NULL || hold->released) {
+		return -1;
+	}
+
+	if (hold->generation != ctdb_db->generation) {
+		talloc_set_destructor(hold, NULL);
+		talloc_free(hold);
+		return -1;
+	}
+
+	call = talloc(hold, struct dmaster_defer_call);
+	if (call == NULL) {
+		DEBUG(DEBUG_ERR, ("Failed to allocate migration hold call\n"));
+		return -1;
+	}
+
+	call->ctdb = ctdb_db->ctdb;
+	call->hdr = talloc_steal(call, hdr);
+
+	DLIST_ADD_END(hold->held_calls, call);
+
+	CTDB_INCREMENT_DB_STAT(ctdb_db, migrations.num_held);
+
+	return 0;
+}
+
+/*
+  called after a released hold has migrated the record to new_dmaster.
+  Send the other held requests from the new dmaster straight there,
+  they do not need to go through the lmaster.
+*/
+static void ctdb_migration_hold_batch(struct ctdb_db_context *ctdb_db,
+				      TDB_DATA key, uint32_t new_dmaster)
+{
+	struct migration_hold *hold;
+	struct dmaster_defer_call *call, *next;
+
+	hold = ctdb_migration_hold_find(ctdb_db, key);
+	if (hold == NULL || !hold->released) {
+		return;
+	}
+
+	for (call = hold->held_calls; call != NULL; call = next) {
+		struct ctdb_req_call_old *c =
+			(struct ctdb_req_call_old *)call->hdr;
+
+		next = call->next;
+
+		if (c->hdr.srcnode != new_dmaster) {
+			continue;
+		}
+
+		DLIST_REMOVE(hold->held_calls, call);
+
+		c->hdr.destnode = new_dmaster;
+		c->hopcount++;
+		ctdb_queue_packet(ctdb_db->ctdb, &c->hdr);
+
+		CTDB_INCREMENT_DB_STAT(ctdb_db, migrations.num_batched);
+
+		talloc_free(call);
+	}
+}
+
 /*
   called when a CTDB_REQ_DMASTER packet comes in
 
@@ -943,6 +1150,14 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 		return;
 	}
 
+	if (ctdb_migration_hold_add(ctdb_db, hdr, call->key) == 0) {
+		DEBUG(DEBUG_DEBUG,
+		      ("Hold request for migrated record in %s\n",
+		       ctdb_db->db_name));
+		talloc_free(call);
+		return;
+	}
+
 	/* determine if we are the dmaster for this key. This also
 	   fetches the record data (if any), thus avoiding a 2nd fetch of the data 
 	   if the call will be answered locally */
@@ -1130,6 +1345,9 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 			if (ret != 0) {
 				DEBUG(DEBUG_ERR,(__location__ " ctdb_ltdb_unlock() failed with error %d\n", ret));
 			}
+
+			ctdb_migration_hold_batch(ctdb_db, call->key,
+						  c->hdr.srcnode);
 		}
 		talloc_free(call);
 		return;
@@ -1954,6 +2172,11 @@ static void ctdb_migration_count_handler(TDB_DATA key, uint64_t counter,
 
 	value = (counter < INT_MAX ? counter : INT_MAX);
 	ctdb_update_db_stat_hot_keys(ctdb_db, key, value);
+
+	if (ctdb_db->ctdb->tunable.migration_hold_time != 0 &&
+	    counter >= ctdb_db->ctdb->tunable.migration_hold_threshold) {
+		ctdb_migration_hold_setup(ctdb_db, key);
+	}
 }
 
 static void ctdb_migration_cleandb_event(struct tevent_context *ev,
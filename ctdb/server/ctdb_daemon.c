@@ -20,6 +20,7 @@
 #include "replace.h"
 #include "system/network.h"
 #include "system/filesys.h"
+#include "system/shmem.h"
 #include "system/wait.h"
 #include "system/time.h"
 
@@ -47,6 +48,7 @@
 #include "common/logging.h"
 #include "common/pidfile.h"
 #include "common/sock_io.h"
+#include "common/io_thread.h"
 
 struct ctdb_client_pid_list {
 	struct ctdb_client_pid_list *next, *prev;
@@ -126,12 +128,321 @@ static void ignore_signal(int signum)
 }
 
 
+/*
+  shared memory ring to a client, see struct ctdb_client_ring
+ */
+struct daemon_ring_pkt {
+	struct daemon_ring_pkt *prev, *next;
+	struct ctdb_req_header *hdr;
+};
+
+struct daemon_client_ring {
+	struct ctdb_client *client;
+	struct ctdb_client_ring *shm;
+	size_t maplen;
+	uint32_t size;
+	uint32_t head;
+	char *path;
+	bool active;
+	struct daemon_ring_pkt *overflow;
+	unsigned int overflow_len;
+};
+
+static int daemon_client_ring_destructor(struct daemon_client_ring *ring)
+{
+	if (ring->shm != NULL) {
+		munmap(ring->shm, ring->maplen);
+	}
+	if (ring->path != NULL &&
+	    getpid() == ring->client->ctdb->ctdbd_pid) {
+		/* Normally the client has removed it already */
+		unlink(ring->path);
+	}
+	return 0;
+}
+
+/*
+  send a CTDB_SRVID_CLIENT_RING message on the socket
+ */
+static void daemon_ring_notify(struct daemon_client_ring *ring)
+{
+	struct ctdb_client *client = ring->client;
+	struct ctdb_req_message_old *r;
+	size_t len;
+
+	len = offsetof(struct ctdb_req_message_old, data);
+	r = ctdbd_allocate_pkt(client->ctdb, client, CTDB_REQ_MESSAGE,
+			       len, struct ctdb_req_message_old);
+	CTDB_NO_MEMORY_VOID(client->ctdb, r);
+
+	r->hdr.destnode = client->ctdb->pnn;
+	r->srvid = CTDB_SRVID_CLIENT_RING;
+	r->datalen = 0;
+
+	ctdb_queue_send(client->queue, (uint8_t *)r, r->hdr.length);
+
+	talloc_free(r);
+}
+
+/*
+  put a packet into the ring, packets that use up more than a quarter
+  of the ring go on the socket with a marker in the ring
+ */
+static bool daemon_ring_put(struct daemon_client_ring *ring,
+			    struct ctdb_req_header *hdr)
+{
+	struct ctdb_client_ring *shm = ring->shm;
+	uint32_t size = ring->size;
+	uint32_t head = ring->head;
+	uint32_t tail, ofs, len, needed;
+	bool on_socket;
+
+	on_socket = (hdr->length > size / 4);
+	len = on_socket ? CTDB_DS_ALIGNMENT :
+		CTDB_CLIENT_RING_ALIGN(hdr->length);
+
+	ofs = head & (size - 1);
+	needed = len;
+	if (ofs + len > size) {
+		needed += size - ofs;
+	}
+
+	__sync_synchronize();
+	tail = shm->tail;
+
+	if (head - tail > size) {
+		/*
+		 * Not a tail we have handed out. Treat the ring as full,
+		 * the client is dropped when too much is queued for it.
+		 */
+		DEBUG(DEBUG_ERR, ("Client %u: bad ring tail %u, head %u\n",
+				  ring->client->client_id, tail, head));
+		return false;
+	}
+
+	if (head - tail + needed > size) {
+		return false;
+	}
+
+	if (ofs + len > size) {
+		uint32_t wrap = CTDB_CLIENT_RING_WRAP;
+
+		memcpy(&shm->data[ofs], &wrap, sizeof(wrap));
+		head += size - ofs;
+		ofs = 0;
+	}
+
+	if (on_socket) {
+		uint32_t marker = CTDB_CLIENT_RING_SOCKET;
+
+		memcpy(&shm->data[ofs], &marker, sizeof(marker));
+	} else {
+		memcpy(&shm->data[ofs], hdr, hdr->length);
+	}
+
+	/* Packet contents must be visible before the new head */
+	__sync_synchronize();
+	ring->head = head + len;
+	shm->head = ring->head;
+
+	/* ... and head must be visible before looking for a sleeper */
+	__sync_synchronize();
+	if (shm->reader_sleeping != 0) {
+		shm->reader_sleeping = 0;
+		daemon_ring_notify(ring);
+	}
+
+	if (on_socket) {
+		ctdb_queue_send(ring->client->queue, (uint8_t *)hdr,
+				hdr->length);
+	}
+
+	return true;
+}
+
+/*
+  move packets that did not fit into the ring earlier
+ */
+static void daemon_ring_flush(struct daemon_client_ring *ring)
+{
+	while (ring->overflow != NULL) {
+		struct daemon_ring_pkt *pkt = ring->overflow;
+
+		if (!daemon_ring_put(ring, pkt->hdr)) {
+			/*
+			 * Ask for a message when there is space and check
+			 * again, the client might have made space just
+			 * before seeing writer_waiting.
+			 */
+			ring->shm->writer_waiting = 1;
+			__sync_synchronize();
+			if (!daemon_ring_put(ring, pkt->hdr)) {
+				return;
+			}
+		}
+
+		DLIST_REMOVE(ring->overflow, pkt);
+		ring->overflow_len -= 1;
+		talloc_free(pkt);
+	}
+}
+
+static int daemon_ring_send(struct daemon_client_ring *ring,
+			    struct ctdb_req_header *hdr)
+{
+	struct ctdb_client *client = ring->client;
+	struct daemon_ring_pkt *pkt;
+
+	if (ring->overflow == NULL && daemon_ring_put(ring, hdr)) {
+		return 0;
+	}
+
+	if (hdr->operation == CTDB_REQ_MESSAGE &&
+	    ring->overflow_len > client->ctdb->tunable.max_queue_depth_drop_msg) {
+		DEBUG(DEBUG_ERR, ("CTDB_REQ_MESSAGE ring full - "
+				  "killing client connection.\n"));
+		talloc_free(client);
+		return -1;
+	}
+
+	pkt = talloc(ring, struct daemon_ring_pkt);
+	if (pkt == NULL) {
+		DEBUG(DEBUG_ERR, (__location__ " Memory error\n"));
+		return -1;
+	}
+	pkt->hdr = talloc_memdup(pkt, hdr, hdr->length);
+	if (pkt->hdr == NULL) {
+		DEBUG(DEBUG_ERR, (__location__ " Memory error\n"));
+		talloc_free(pkt);
+		return -1;
+	}
+
+	DLIST_ADD_END(ring->overflow, pkt);
+	ring->overflow_len += 1;
+
+	daemon_ring_flush(ring);
+	return 0;
+}
+
+/*
+  CTDB_SRVID_CLIENT_RING message from a client: the first one says the
+  client has mapped the ring, later ones that it has made space
+ */
+static void daemon_ring_message(struct daemon_client_ring *ring)
+{
+	if (!ring->active) {
+		/*
+		 * Everything sent on the socket so far comes before
+		 * this, the client switches to the ring when it sees it.
+		 */
+		daemon_ring_notify(ring);
+		ring->active = true;
+		DEBUG(DEBUG_INFO, ("Client %u uses ring %s\n",
+				   ring->client->client_id, ring->path));
+		return;
+	}
+
+	daemon_ring_flush(ring);
+}
+
+/*
+  create a ring for a client, the client maps it and removes the file
+ */
+int32_t ctdb_control_client_ring(struct ctdb_context *ctdb,
+				 uint32_t client_id, TDB_DATA *outdata)
+{
+	struct ctdb_client *client;
+	struct daemon_client_ring *ring;
+	uint32_t size;
+	void *shm;
+	int fd, ret;
+
+	if (ctdb->tunable.client_ring_size == 0) {
+		DEBUG(DEBUG_INFO, ("Client rings are disabled\n"));
+		return -1;
+	}
+
+	client = reqid_find(ctdb->idr, client_id, struct ctdb_client);
+	if (client == NULL) {
+		DEBUG(DEBUG_ERR, ("Bad client_id in ctdb_control_client_ring\n"));
+		return -1;
+	}
+	if (client->ring != NULL) {
+		DEBUG(DEBUG_ERR, ("Client %u already has a ring\n", client_id));
+		return -1;
+	}
+
+	/* Between 4KB and 64MB, a power of 2 */
+	size = 4096;
+	while (size < MIN(ctdb->tunable.client_ring_size, 65536) * 1024) {
+		size *= 2;
+	}
+
+	ring = talloc_zero(client, struct daemon_client_ring);
+	CTDB_NO_MEMORY(ctdb, ring);
+
+	ring->client = client;
+	ring->maplen = offsetof(struct ctdb_client_ring, data) + size;
+	ring->path = talloc_asprintf(ring, "%s.ring.%u.%u", ctdb->daemon.name,
+				     (unsigned int)client->pid, client_id);
+	if (ring->path == NULL) {
+		DEBUG(DEBUG_ERR, (__location__ " Memory error\n"));
+		talloc_free(ring);
+		return -1;
+	}
+
+	/* A leftover from an earlier ctdbd */
+	unlink(ring->path);
+
+	fd = open(ring->path, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd == -1) {
+		DEBUG(DEBUG_ERR, ("Failed to create %s: %s\n",
+				  ring->path, strerror(errno)));
+		talloc_free(ring);
+		return -1;
+	}
+	talloc_set_destructor(ring, daemon_client_ring_destructor);
+
+	ret = ftruncate(fd, ring->maplen);
+	if (ret != 0) {
+		DEBUG(DEBUG_ERR, ("Failed to size %s: %s\n",
+				  ring->path, strerror(errno)));
+		close(fd);
+		talloc_free(ring);
+		return -1;
+	}
+
+	shm = mmap(NULL, ring->maplen, PROT_READ|PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		DEBUG(DEBUG_ERR, ("Failed to map %s: %s\n",
+				  ring->path, strerror(errno)));
+		talloc_free(ring);
+		return -1;
+	}
+
+	ring->size = size;
+	ring->shm = (struct ctdb_client_ring *)shm;
+	ring->shm->magic = CTDB_CLIENT_RING_MAGIC;
+	ring->shm->size = size;
+
+	outdata->dptr = (uint8_t *)ring->path;
+	outdata->dsize = strlen(ring->path) + 1;
+
+	client->ring = ring;
+	return 0;
+}
+
 /*
   send a packet to a client
  */
 static int daemon_queue_send(struct ctdb_client *client, struct ctdb_req_header *hdr)
 {
 	CTDB_INCREMENT_STAT(client->ctdb, client_packets_sent);
+	if (client->ring != NULL && client->ring->active) {
+		return daemon_ring_send(client->ring, hdr);
+	}
 	if (hdr->operation == CTDB_REQ_MESSAGE) {
 		if (ctdb_queue_length(client->queue) > client->ctdb->tunable.max_queue_depth_drop_msg) {
 			DEBUG(DEBUG_ERR,("CTDB_REQ_MESSAGE queue full - killing client connection.\n"));
@@ -282,6 +593,11 @@ static void daemon_request_message_from_client(struct ctdb_client *client,
 	TDB_DATA data;
 	int res;
 
+	if (c->srvid == CTDB_SRVID_CLIENT_RING && client->ring != NULL) {
+		daemon_ring_message(client->ring);
+		return;
+	}
+
 	if (c->hdr.destnode == CTDB_CURRENT_NODE) {
 		c->hdr.destnode = ctdb_get_pnn(client->ctdb);
 	}
@@ -929,6 +1245,31 @@ static int ctdb_clientpid_destructor(struct ctdb_client_pid_list *client_pid)
 	return 0;
 }
 
+/*
+  the I/O threads for new connections, NULL if IOThreads is 0
+
+  Changes to the tunable only affect connections set up afterwards.
+ */
+struct io_thread_pool *ctdb_io_thread_pool(struct ctdb_context *ctdb)
+{
+	int ret;
+
+	if (ctdb->io_pool == NULL) {
+		return NULL;
+	}
+
+	ret = io_thread_pool_set_size(ctdb->io_pool, ctdb->tunable.io_threads);
+	if (ret != 0) {
+		DEBUG(DEBUG_ERR, ("Failed to start %u I/O threads (%s)\n",
+				  ctdb->tunable.io_threads, strerror(ret)));
+	}
+
+	if (io_thread_pool_size(ctdb->io_pool) == 0) {
+		return NULL;
+	}
+	return ctdb->io_pool;
+}
+
 
 static void ctdb_accept_client(struct tevent_context *ev,
 			       struct tevent_fd *fde, uint16_t flags,
@@ -990,6 +1331,10 @@ static void ctdb_accept_client(struct tevent_context *ev,
 	client->queue = ctdb_queue_setup(ctdb, client, fd, CTDB_DS_ALIGNMENT, 
 					 ctdb_daemon_read_cb, client,
 					 "client-%u", client->pid);
+	if (client->queue != NULL) {
+		ctdb_queue_set_io_pool(client->queue,
+				       ctdb_io_thread_pool(ctdb));
+	}
 
 	talloc_set_destructor(client, ctdb_client_destructor);
 	talloc_set_destructor(client_pid, ctdb_clientpid_destructor);
@@ -1299,6 +1644,12 @@ int ctdb_start_daemon(struct ctdb_context *ctdb, bool do_fork)
 		exit(1);
 	}
 
+	TALLOC_FREE(ctdb->io_pool);
+	if (io_thread_pool_init(ctdb, ctdb->ev, &ctdb->io_pool) != 0) {
+		DEBUG(DEBUG_ERR, ("Failed to setup I/O thread pool\n"));
+		exit(1);
+	}
+
 	/* initialize statistics collection */
 	ctdb_statistics_init(ctdb);
 
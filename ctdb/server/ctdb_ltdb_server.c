@@ -973,6 +973,14 @@ again:
 		return -1;
 	}
 
+	ctdb_db->migration_holds = trbt_create(ctdb_db, 0);
+	if (ctdb_db->migration_holds == NULL) {
+		DEBUG(DEBUG_ERR, ("Failed to create migration hold rb tree for %s\n",
+				  ctdb_db->db_name));
+		talloc_free(ctdb_db);
+		return -1;
+	}
+
 	DLIST_ADD(ctdb->db_list, ctdb_db);
 
 	/* setting this can help some high churn databases */
@@ -1625,6 +1633,9 @@ int32_t ctdb_control_get_db_statistics(struct ctdb_context *ctdb,
 		return -1;
 	}
 
+	ctdb_db->statistics.vacuum.queue_len =
+		ctdb_vacuum_delete_queue_len(ctdb_db);
+
 	len = offsetof(struct ctdb_db_statistics_old, hot_keys_wire);
 	for (i = 0; i < MAX_HOT_KEYS; i++) {
 		len += ctdb_db->statistics.hot_keys[i].key.dsize;
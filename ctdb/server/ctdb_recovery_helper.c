@@ -156,6 +156,20 @@ struct recdb_add_traverse_state {
 	int mypnn;
 };
 
+static int recdb_header_parser(TDB_DATA key, TDB_DATA data,
+			       void *private_data)
+{
+	struct ctdb_ltdb_header *header =
+		(struct ctdb_ltdb_header *)private_data;
+
+	if (data.dsize < sizeof(struct ctdb_ltdb_header)) {
+		return -1;
+	}
+
+	memcpy(header, data.dptr, sizeof(struct ctdb_ltdb_header));
+	return 0;
+}
+
 static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 			      TDB_DATA key, TDB_DATA data,
 			      void *private_data)
@@ -163,7 +177,7 @@ static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 	struct recdb_add_traverse_state *state =
 		(struct recdb_add_traverse_state *)private_data;
 	struct ctdb_ltdb_header *hdr;
-	TDB_DATA prev_data;
+	struct ctdb_ltdb_header prev_hdr;
 	int ret;
 
 	/* header is not marshalled separately in the pulldb control */
@@ -173,14 +187,13 @@ static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 
 	hdr = (struct ctdb_ltdb_header *)data.dptr;
 
-	/* fetch the existing record, if any */
-	prev_data = tdb_fetch(recdb_tdb(state->recdb), key);
-
-	if (prev_data.dptr != NULL) {
-		struct ctdb_ltdb_header prev_hdr;
-
-		prev_hdr = *(struct ctdb_ltdb_header *)prev_data.dptr;
-		free(prev_data.dptr);
+	/*
+	 * Only the header of the existing record, if any, is needed to
+	 * decide which copy to keep, so don't copy the data out
+	 */
+	ret = tdb_parse_record(recdb_tdb(state->recdb), key,
+			       recdb_header_parser, &prev_hdr);
+	if (ret == 0) {
 		if (hdr->rsn < prev_hdr.rsn ||
 		    (hdr->rsn == prev_hdr.rsn &&
 		     prev_hdr.dmaster != state->mypnn)) {
@@ -1319,6 +1332,9 @@ static bool collect_highseqnum_db_recv(struct tevent_req *req, int *perr)
 
 /*
  * Collect all databases
+ *
+ * The database is pulled from all the nodes at the same time and the
+ * records are merged into the recovery database by RSN as they arrive.
  */
 
 struct collect_all_db_state {
@@ -1330,8 +1346,13 @@ struct collect_all_db_state {
 	uint32_t *ban_credits;
 	uint32_t db_id;
 	struct recdb_context *recdb;
-	struct ctdb_pulldb pulldb;
-	int index;
+	int num_done;
+	int err;
+};
+
+struct collect_all_db_one_state {
+	struct tevent_req *req;
+	uint32_t pnn;
 };
 
 static void collect_all_db_pulldb_done(struct tevent_req *subreq);
@@ -1346,7 +1367,7 @@ static struct tevent_req *collect_all_db_send(
 {
 	struct tevent_req *req, *subreq;
 	struct collect_all_db_state *state;
-	uint32_t pnn;
+	int i;
 
 	req = tevent_req_create(mem_ctx, &state,
 				struct collect_all_db_state);
@@ -1362,51 +1383,68 @@ static struct tevent_req *collect_all_db_send(
 	state->ban_credits = ban_credits;
 	state->db_id = db_id;
 	state->recdb = recdb;
-	state->index = 0;
+	state->num_done = 0;
+	state->err = 0;
 
-	pnn = state->pnn_list[state->index];
+	for (i=0; i<count; i++) {
+		struct collect_all_db_one_state *substate;
+		uint32_t pnn = pnn_list[i];
 
-	subreq = pull_database_send(state, ev, client, pnn, caps[pnn], recdb);
-	if (tevent_req_nomem(subreq, req)) {
-		return tevent_req_post(req, ev);
+		substate = talloc(state, struct collect_all_db_one_state);
+		if (tevent_req_nomem(substate, req)) {
+			return tevent_req_post(req, ev);
+		}
+
+		substate->req = req;
+		substate->pnn = pnn;
+
+		subreq = pull_database_send(state, ev, client, pnn, caps[pnn],
+					    recdb);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, collect_all_db_pulldb_done,
+					substate);
 	}
-	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, req);
 
 	return req;
 }
 
 static void collect_all_db_pulldb_done(struct tevent_req *subreq)
 {
-	struct tevent_req *req = tevent_req_callback_data(
-		subreq, struct tevent_req);
+	struct collect_all_db_one_state *substate = tevent_req_callback_data(
+		subreq, struct collect_all_db_one_state);
+	struct tevent_req *req = substate->req;
 	struct collect_all_db_state *state = tevent_req_data(
 		req, struct collect_all_db_state);
-	uint32_t pnn;
 	int ret;
 	bool status;
 
 	status = pull_database_recv(subreq, &ret);
 	TALLOC_FREE(subreq);
 	if (! status) {
-		pnn = state->pnn_list[state->index];
-		state->ban_credits[pnn] += 1;
-		tevent_req_error(req, ret);
-		return;
+		state->ban_credits[substate->pnn] += 1;
+		if (state->err == 0) {
+			state->err = ret;
+		}
 	}
+	talloc_free(substate);
 
-	state->index += 1;
-	if (state->index == state->count) {
-		tevent_req_done(req);
+	/*
+	 * Wait for the other pulls even if one has failed.  They have
+	 * message handlers registered that refer to their requests.
+	 */
+	state->num_done += 1;
+	if (state->num_done < state->count) {
 		return;
 	}
 
-	pnn = state->pnn_list[state->index];
-	subreq = pull_database_send(state, state->ev, state->client,
-				    pnn, state->caps[pnn], state->recdb);
-	if (tevent_req_nomem(subreq, req)) {
+	if (state->err != 0) {
+		tevent_req_error(req, state->err);
 		return;
 	}
-	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, req);
+
+	tevent_req_done(req);
 }
 
 static bool collect_all_db_recv(struct tevent_req *req, int *perr)
@@ -1444,6 +1482,7 @@ struct recover_db_state {
 
 	const char *db_name, *db_path;
 	struct recdb_context *recdb;
+	struct timeval start;
 };
 
 static void recover_db_name_done(struct tevent_req *subreq);
@@ -1488,6 +1527,7 @@ static struct tevent_req *recover_db_send(TALLOC_CTX *mem_ctx,
 	state->destnode = ctdb_client_pnn(client);
 	state->transdb.db_id = db_id;
 	state->transdb.tid = generation;
+	state->start = tevent_timeval_current();
 
 	ctdb_req_control_get_dbname(&request, db_id);
 	subreq = ctdb_client_control_send(state, ev, client, state->destnode,
@@ -1865,6 +1905,9 @@ static void recover_db_thaw_done(struct tevent_req *subreq)
 		return;
 	}
 
+	D_INFO("Recovered db %s in %.3lf seconds\n",
+	       state->db_name, timeval_elapsed(&state->start));
+
 	tevent_req_done(req);
 }
 
@@ -1877,12 +1920,25 @@ static bool recover_db_recv(struct tevent_req *req)
 /*
  * Start database recovery for each database
  *
+ * Databases are recovered in parallel, as long as the combined size of
+ * the databases being recovered stays within RecoveryMemoryLimit.  The
+ * size of each database is estimated from the local copy.  There is
+ * always at least one database being recovered, however large it is.
+ *
  * Try to recover each database 5 times before failing recovery.
  */
 
+struct db_recovery_one_state;
+
 struct db_recovery_state {
 	struct tevent_context *ev;
+	struct ctdb_client_context *client;
 	struct ctdb_dbid_map *dbmap;
+	struct db_recovery_one_state **substate;
+	uint64_t mem_limit;
+	uint64_t mem_used;
+	int num_sized;
+	int num_active;
 	int num_replies;
 	int num_failed;
 };
@@ -1899,9 +1955,13 @@ struct db_recovery_one_state {
 	uint32_t generation;
 	uint32_t db_id;
 	uint8_t db_flags;
+	uint64_t db_size;
+	bool started;
 	int num_fails;
 };
 
+static void db_recovery_path_done(struct tevent_req *subreq);
+static void db_recovery_schedule(struct tevent_req *req);
 static void db_recovery_one_done(struct tevent_req *subreq);
 
 static struct tevent_req *db_recovery_send(TALLOC_CTX *mem_ctx,
@@ -1924,7 +1984,13 @@ static struct tevent_req *db_recovery_send(TALLOC_CTX *mem_ctx,
 	}
 
 	state->ev = ev;
+	state->client = client;
 	state->dbmap = dbmap;
+	state->mem_limit = (uint64_t)tun_list->recovery_memory_limit *
+			   1024 * 1024;
+	state->mem_used = 0;
+	state->num_sized = 0;
+	state->num_active = 0;
 	state->num_replies = 0;
 	state->num_failed = 0;
 
@@ -1933,6 +1999,12 @@ static struct tevent_req *db_recovery_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	state->substate = talloc_array(state, struct db_recovery_one_state *,
+				       dbmap->num);
+	if (tevent_req_nomem(state->substate, req)) {
+		return tevent_req_post(req, ev);
+	}
+
 	for (i=0; i<dbmap->num; i++) {
 		struct db_recovery_one_state *substate;
 
@@ -1953,19 +2025,120 @@ static struct tevent_req *db_recovery_send(TALLOC_CTX *mem_ctx,
 		substate->db_id = dbmap->dbs[i].db_id;
 		substate->db_flags = dbmap->dbs[i].flags;
 
-		subreq = recover_db_send(state, ev, client, tun_list,
-					 pnn_list, count, caps, ban_credits,
-					 generation, substate->db_id,
-					 substate->db_flags);
+		state->substate[i] = substate;
+	}
+
+	if (state->mem_limit == 0) {
+		db_recovery_schedule(req);
+		if (! tevent_req_is_in_progress(req)) {
+			return tevent_req_post(req, ev);
+		}
+		return req;
+	}
+
+	for (i=0; i<dbmap->num; i++) {
+		struct db_recovery_one_state *substate = state->substate[i];
+		struct ctdb_req_control request;
+
+		ctdb_req_control_getdbpath(&request, substate->db_id);
+		subreq = ctdb_client_control_send(state, ev, client,
+						  ctdb_client_pnn(client),
+						  TIMEOUT(), &request);
 		if (tevent_req_nomem(subreq, req)) {
 			return tevent_req_post(req, ev);
 		}
+		tevent_req_set_callback(subreq, db_recovery_path_done,
+					substate);
+	}
+
+	return req;
+}
+
+static void db_recovery_path_done(struct tevent_req *subreq)
+{
+	struct db_recovery_one_state *substate = tevent_req_callback_data(
+		subreq, struct db_recovery_one_state);
+	struct tevent_req *req = substate->req;
+	struct db_recovery_state *state = tevent_req_data(
+		req, struct db_recovery_state);
+	struct ctdb_reply_control *reply;
+	const char *db_path;
+	struct stat st;
+	int ret;
+	bool status;
+
+	status = ctdb_client_control_recv(subreq, &ret, state, &reply);
+	TALLOC_FREE(subreq);
+	if (status) {
+		ret = ctdb_reply_control_getdbpath(reply, reply, &db_path);
+		if (ret == 0) {
+			ret = stat(db_path, &st);
+			if (ret == 0) {
+				substate->db_size = st.st_size;
+			}
+		}
+		talloc_free(reply);
+	}
+
+	/*
+	 * Without a size, the database is recovered alongside others.
+	 * If the database is really not there, recover_db will fail.
+	 */
+	D_DEBUG("Size of database 0x%08x is %"PRIu64"\n",
+		substate->db_id, substate->db_size);
+
+	state->num_sized += 1;
+	if (state->num_sized == state->dbmap->num) {
+		db_recovery_schedule(req);
+	}
+}
+
+static void db_recovery_schedule(struct tevent_req *req)
+{
+	struct db_recovery_state *state = tevent_req_data(
+		req, struct db_recovery_state);
+	struct tevent_req *subreq;
+	int i;
+
+	for (i=0; i<state->dbmap->num; i++) {
+		struct db_recovery_one_state *substate = state->substate[i];
+
+		if (substate->started) {
+			continue;
+		}
+
+		if (state->mem_limit != 0 && state->num_active > 0 &&
+		    state->mem_used + substate->db_size > state->mem_limit) {
+			continue;
+		}
+
+		substate->started = true;
+
+		subreq = recover_db_send(state, state->ev, substate->client,
+					 substate->tun_list,
+					 substate->pnn_list, substate->count,
+					 substate->caps, substate->ban_credits,
+					 substate->generation, substate->db_id,
+					 substate->db_flags);
+		if (subreq == NULL) {
+			D_ERR("Failed to start recovery of database 0x%08x\n",
+			      substate->db_id);
+			state->num_failed += 1;
+			state->num_replies += 1;
+			continue;
+		}
 		tevent_req_set_callback(subreq, db_recovery_one_done,
 					substate);
+
+		state->mem_used += substate->db_size;
+		state->num_active += 1;
+
 		D_NOTICE("recover database 0x%08x\n", substate->db_id);
 	}
 
-	return req;
+	if (state->num_replies == state->dbmap->num) {
+		tevent_req_done(req);
+	}
 }
 
 static void db_recovery_one_done(struct tevent_req *subreq)
@@ -1981,7 +2154,6 @@ static void db_recovery_one_done(struct tevent_req *subreq)
 	TALLOC_FREE(subreq);
 
 	if (status) {
-		talloc_free(substate);
 		goto done;
 	}
 
@@ -1993,7 +2165,7 @@ static void db_recovery_one_done(struct tevent_req *subreq)
 					 substate->caps, substate->ban_credits,
 					 substate->generation, substate->db_id,
 					 substate->db_flags);
-		if (tevent_req_nomem(subreq, req)) {
+		if (subreq == NULL) {
 			goto failed;
 		}
 		tevent_req_set_callback(subreq, db_recovery_one_done, substate);
@@ -2007,10 +2179,10 @@ failed:
 
 done:
 	state->num_replies += 1;
+	state->num_active -= 1;
+	state->mem_used -= substate->db_size;
 
-	if (state->num_replies == state->dbmap->num) {
-		tevent_req_done(req);
-	}
+	db_recovery_schedule(req);
 }
 
 static bool db_recovery_recv(struct tevent_req *req, int *count)
@@ -2063,6 +2235,7 @@ struct recovery_state {
 	struct ctdb_tunable_list *tun_list;
 	struct ctdb_vnn_map *vnnmap;
 	struct ctdb_dbid_map *dbmap;
+	struct timeval db_recovery_start;
 };
 
 static void recovery_tunables_done(struct tevent_req *subreq);
@@ -2515,6 +2688,8 @@ static void recovery_vnnmap_update_done(struct tevent_req *subreq)
 
 	D_NOTICE("updated VNNMAP\n");
 
+	state->db_recovery_start = tevent_timeval_current();
+
 	subreq = db_recovery_send(state, state->ev, state->client,
 				  state->dbmap, state->tun_list,
 				  state->pnn_list, state->count,
@@ -2539,7 +2714,9 @@ static void recovery_db_recovery_done(struct tevent_req *subreq)
 	status = db_recovery_recv(subreq, &count);
 	TALLOC_FREE(subreq);
 
-	D_ERR("%d of %d databases recovered\n", count, state->dbmap->num);
+	D_ERR("%d of %d databases recovered in %.3lf seconds\n",
+	      count, state->dbmap->num,
+	      timeval_elapsed(&state->db_recovery_start));
 
 	if (! status) {
 		uint32_t max_pnn = CTDB_UNKNOWN_PNN, max_credits = 0;
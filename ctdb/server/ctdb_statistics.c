@@ -30,6 +30,50 @@
 #include "ctdb_private.h"
 
 #include "common/logging.h"
+#include "common/io_thread.h"
+
+static void ctdb_statistics_add_io_thread(struct ctdb_statistics *s,
+					  unsigned int i,
+					  struct io_thread_stats *stats)
+{
+	s->io_threads[i].num_conns = stats->num_conns;
+	s->io_threads[i].packets_recv += stats->packets_recv;
+	s->io_threads[i].packets_sent += stats->packets_sent;
+	s->io_threads[i].wakeups += stats->wakeups;
+	s->io_threads[i].busy_ms += stats->busy_ms;
+}
+
+/*
+  collect the counters of the I/O threads since the last update
+ */
+void ctdb_statistics_update_io_threads(struct ctdb_context *ctdb)
+{
+	unsigned int i, num_threads;
+
+	if (ctdb->io_pool == NULL) {
+		return;
+	}
+
+	num_threads = io_thread_pool_num_threads(ctdb->io_pool);
+	num_threads = MIN(num_threads, MAX_IO_THREADS);
+
+	ctdb->statistics.num_io_threads = num_threads;
+	ctdb->statistics_current.num_io_threads = num_threads;
+
+	for (i=0; i<num_threads; i++) {
+		struct io_thread_stats stats;
+		int ret;
+
+		ret = io_thread_pool_stats(ctdb->io_pool, i, true, &stats);
+		if (ret != 0) {
+			continue;
+		}
+
+		ctdb_statistics_add_io_thread(&ctdb->statistics, i, &stats);
+		ctdb_statistics_add_io_thread(&ctdb->statistics_current, i,
+					      &stats);
+	}
+}
 
 static void ctdb_statistics_update(struct tevent_context *ev,
 				   struct tevent_timer *te,
@@ -37,6 +81,8 @@ static void ctdb_statistics_update(struct tevent_context *ev,
 {
 	struct ctdb_context *ctdb = talloc_get_type(p, struct ctdb_context);
 
+	ctdb_statistics_update_io_threads(ctdb);
+
 	memmove(&ctdb->statistics_history[1], &ctdb->statistics_history[0], (MAX_STAT_HISTORY-1)*sizeof(struct ctdb_statistics));
 	memcpy(&ctdb->statistics_history[0], &ctdb->statistics_current, sizeof(struct ctdb_statistics));
 	ctdb->statistics_history[0].statistics_current_time = timeval_current();
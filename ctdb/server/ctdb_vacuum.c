@@ -53,12 +53,24 @@ struct ctdb_vacuum_child_context {
 	pid_t child_pid;
 	enum vacuum_child_status status;
 	struct timeval start_time;
+	/* hash chains scanned by the child in an incremental run */
+	uint32_t num_chains;
+};
+
+/* what the child writes to the parent when it is done */
+struct ctdb_vacuum_child_result {
+	char status;
+	uint32_t num_deleted;
 };
 
 struct ctdb_vacuum_handle {
 	struct ctdb_db_context *ctdb_db;
 	struct ctdb_vacuum_child_context *child_ctx;
 	uint32_t fast_path_count;
+	/* first hash chain to scan in the next incremental run */
+	uint32_t next_chain;
+	/* start of the current scan over all hash chains */
+	struct timeval pass_start;
 };
 
 
@@ -752,6 +764,55 @@ static void ctdb_vacuum_traverse_db(struct ctdb_db_context *ctdb_db,
 	return;
 }
 
+/**
+ * read-only traverse of a range of hash chains, looking for records
+ * that might be able to be vacuumed.
+ *
+ * This is the incremental variant of ctdb_vacuum_traverse_db(), used
+ * when VacuumChainsPerRun is set.  Successive runs scan successive
+ * ranges, so the whole database is covered every
+ * hash_size/VacuumChainsPerRun runs without a long traverse.
+ */
+static void ctdb_vacuum_traverse_chains(struct ctdb_db_context *ctdb_db,
+					struct vacuum_data *vdata,
+					uint32_t first_chain,
+					uint32_t num_chains)
+{
+	int ret;
+
+	ret = tdb_traverse_chains_read(ctdb_db->ltdb->tdb,
+				       first_chain, num_chains,
+				       vacuum_traverse, vdata);
+	if (ret == -1 || vdata->traverse_error) {
+		DEBUG(DEBUG_ERR, (__location__ " Traverse error in vacuuming "
+				  "'%s' chains %u-%u\n", ctdb_db->db_name,
+				  (unsigned)first_chain,
+				  (unsigned)(first_chain + num_chains - 1)));
+		return;
+	}
+
+	if (vdata->count.db_traverse.total > 0) {
+		DEBUG(DEBUG_INFO,
+		      (__location__
+		       " incremental vacuuming db traverse statistics: "
+		       "db[%s] "
+		       "chains[%u-%u] "
+		       "total[%u] "
+		       "skp[%u] "
+		       "err[%u] "
+		       "sched[%u]\n",
+		       ctdb_db->db_name,
+		       (unsigned)first_chain,
+		       (unsigned)(first_chain + num_chains - 1),
+		       (unsigned)vdata->count.db_traverse.total,
+		       (unsigned)vdata->count.db_traverse.skipped,
+		       (unsigned)vdata->count.db_traverse.error,
+		       (unsigned)vdata->count.db_traverse.scheduled));
+	}
+
+	return;
+}
+
 /**
  * Process the vacuum fetch lists:
  * For records for which we are not the lmaster, tell the lmaster to
@@ -1233,6 +1294,11 @@ fail:
  *    in order to use the traditional heuristics on empty records
  *    to trigger deletion.
  *    This is done only every VacuumFastPathCount'th vacuuming run.
+ *  - If VacuumChainsPerRun is set, there are no full runs.  Instead
+ *    every run traverses the next num_chains hash chains, starting
+ *    at first_chain.  This spreads the scan of the database over
+ *    many short runs.  The delete queue, which holds the records
+ *    known to be deleted, is still processed in full on every run.
  *
  * The traverse runs fill two lists:
  *
@@ -1254,10 +1320,15 @@ fail:
  *   The lmaster then migrates all these records to itelf
  *   so that they can be vacuumed there.
  *
+ * The number of records deleted is returned in num_deleted.
+ *
  * This executes in the child context.
  */
 static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
-			  bool full_vacuum_run)
+			  bool full_vacuum_run,
+			  uint32_t first_chain,
+			  uint32_t num_chains,
+			  uint32_t *num_deleted)
 {
 	struct ctdb_context *ctdb = ctdb_db->ctdb;
 	int ret, pnn;
@@ -1266,7 +1337,8 @@ static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
 
 	DEBUG(DEBUG_INFO, (__location__ " Entering %s vacuum run for db "
 			   "%s db_id[0x%08x]\n",
-			   full_vacuum_run ? "full" : "fast",
+			   full_vacuum_run ? "full" :
+			   num_chains > 0 ? "incremental" : "fast",
 			   ctdb_db->db_name, ctdb_db->db_id));
 
 	ret = ctdb_ctrl_getvnnmap(ctdb, TIMELIMIT(), CTDB_CURRENT_NODE, ctdb, &ctdb->vnn_map);
@@ -1297,6 +1369,9 @@ static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
 
 	if (full_vacuum_run) {
 		ctdb_vacuum_traverse_db(ctdb_db, vdata);
+	} else if (num_chains > 0) {
+		ctdb_vacuum_traverse_chains(ctdb_db, vdata,
+					    first_chain, num_chains);
 	}
 
 	ctdb_process_delete_queue(ctdb_db, vdata);
@@ -1305,6 +1380,9 @@ static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
 
 	ctdb_process_delete_list(ctdb_db, vdata);
 
+	*num_deleted = vdata->count.delete_queue.deleted +
+		       vdata->count.delete_list.deleted;
+
 	talloc_free(tmp_ctx);
 
 	/* this ensures we run our event queue */
@@ -1318,14 +1396,20 @@ static int ctdb_vacuum_db(struct ctdb_db_context *ctdb_db,
  * called from the child context
  */
 static int ctdb_vacuum_and_repack_db(struct ctdb_db_context *ctdb_db,
-				     bool full_vacuum_run)
+				     bool full_vacuum_run,
+				     uint32_t first_chain,
+				     uint32_t num_chains,
+				     uint32_t *num_deleted)
 {
 	uint32_t repack_limit = ctdb_db->ctdb->tunable.repack_limit;
 	const char *name = ctdb_db->db_name;
 	int freelist_size = 0;
 	int ret;
 
-	if (ctdb_vacuum_db(ctdb_db, full_vacuum_run) != 0) {
+	*num_deleted = 0;
+
+	if (ctdb_vacuum_db(ctdb_db, full_vacuum_run, first_chain, num_chains,
+			   num_deleted) != 0) {
 		DEBUG(DEBUG_ERR,(__location__ " Failed to vacuum '%s'\n", name));
 	}
 
@@ -1365,7 +1449,8 @@ static uint32_t get_vacuum_interval(struct ctdb_db_context *ctdb_db)
 static int vacuum_child_destructor(struct ctdb_vacuum_child_context *child_ctx)
 {
 	double l = timeval_elapsed(&child_ctx->start_time);
-	struct ctdb_db_context *ctdb_db = child_ctx->vacuum_handle->ctdb_db;
+	struct ctdb_vacuum_handle *vacuum_handle = child_ctx->vacuum_handle;
+	struct ctdb_db_context *ctdb_db = vacuum_handle->ctdb_db;
 	struct ctdb_context *ctdb = ctdb_db->ctdb;
 
 	CTDB_UPDATE_DB_LATENCY(ctdb_db, "vacuum", vacuum.latency, l);
@@ -1375,7 +1460,14 @@ static int vacuum_child_destructor(struct ctdb_vacuum_child_context *child_ctx)
 		ctdb_kill(ctdb, child_ctx->child_pid, SIGKILL);
 	} else {
 		/* Bump the number of successful fast-path runs. */
-		child_ctx->vacuum_handle->fast_path_count++;
+		vacuum_handle->fast_path_count++;
+
+		/* Continue the incremental scan after the scanned chains. */
+		vacuum_handle->next_chain += child_ctx->num_chains;
+		if (vacuum_handle->next_chain >=
+		    tdb_hash_size(ctdb_db->ltdb->tdb)) {
+			vacuum_handle->next_chain = 0;
+		}
 	}
 
 	DLIST_REMOVE(ctdb->vacuumers, child_ctx);
@@ -1412,18 +1504,22 @@ static void vacuum_child_handler(struct tevent_context *ev,
 				 uint16_t flags, void *private_data)
 {
 	struct ctdb_vacuum_child_context *child_ctx = talloc_get_type(private_data, struct ctdb_vacuum_child_context);
-	char c = 0;
+	struct ctdb_db_context *ctdb_db = child_ctx->vacuum_handle->ctdb_db;
+	struct ctdb_vacuum_child_result result;
 	int ret;
 
-	DEBUG(DEBUG_INFO,("Vacuuming child process %d finished for db %s\n", child_ctx->child_pid, child_ctx->vacuum_handle->ctdb_db->db_name));
+	DEBUG(DEBUG_INFO,("Vacuuming child process %d finished for db %s\n", child_ctx->child_pid, ctdb_db->db_name));
 	child_ctx->child_pid = -1;
 
-	ret = sys_read(child_ctx->fd[0], &c, 1);
-	if (ret != 1 || c != 0) {
+	ZERO_STRUCT(result);
+
+	ret = sys_read(child_ctx->fd[0], &result, sizeof(result));
+	if (ret != sizeof(result) || result.status != 0) {
 		child_ctx->status = VACUUM_ERROR;
-		DEBUG(DEBUG_ERR, ("A vacuum child process failed with an error for database %s. ret=%d c=%d\n", child_ctx->vacuum_handle->ctdb_db->db_name, ret, c));
+		DEBUG(DEBUG_ERR, ("A vacuum child process failed with an error for database %s. ret=%d c=%d\n", ctdb_db->db_name, ret, result.status));
 	} else {
 		child_ctx->status = VACUUM_OK;
+		ctdb_db->statistics.vacuum.num_deleted += result.num_deleted;
 	}
 
 	talloc_free(child_ctx);
@@ -1441,6 +1537,8 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 	struct ctdb_context *ctdb = ctdb_db->ctdb;
 	struct ctdb_vacuum_child_context *child_ctx;
 	struct tevent_fd *fde;
+	bool full_vacuum_run = false;
+	uint32_t first_chain = 0;
 	int ret;
 
 	/* we don't vacuum if we are in recovery mode, or db frozen */
@@ -1487,6 +1585,25 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 		vacuum_handle->fast_path_count = 0;
 	}
 
+	/*
+	 * Either scan the next VacuumChainsPerRun hash chains, or
+	 * scan the whole database every VacuumFastPathCount runs.
+	 */
+	child_ctx->num_chains = 0;
+	if (ctdb->tunable.vacuum_chains_per_run > 0) {
+		uint32_t hash_size = tdb_hash_size(ctdb_db->ltdb->tdb);
+
+		if (vacuum_handle->next_chain >= hash_size) {
+			vacuum_handle->next_chain = 0;
+		}
+		first_chain = vacuum_handle->next_chain;
+		child_ctx->num_chains = MIN(ctdb->tunable.vacuum_chains_per_run,
+					    hash_size - first_chain);
+	} else if ((ctdb->tunable.vacuum_fast_path_count > 0) &&
+		   (vacuum_handle->fast_path_count == 0)) {
+		full_vacuum_run = true;
+	}
+
 	child_ctx->child_pid = ctdb_fork(ctdb);
 	if (child_ctx->child_pid == (pid_t)-1) {
 		close(child_ctx->fd[0]);
@@ -1501,8 +1618,7 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 
 
 	if (child_ctx->child_pid == 0) {
-		char cc = 0;
-		bool full_vacuum_run = false;
+		struct ctdb_vacuum_child_result result;
 		close(child_ctx->fd[0]);
 
 		DEBUG(DEBUG_INFO,("Vacuuming child process %d for db %s started\n", getpid(), ctdb_db->db_name));
@@ -1512,14 +1628,14 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 			_exit(1);
 		}
 
-		if ((ctdb->tunable.vacuum_fast_path_count > 0) &&
-		    (vacuum_handle->fast_path_count == 0))
-		{
-			full_vacuum_run = true;
-		}
-		cc = ctdb_vacuum_and_repack_db(ctdb_db, full_vacuum_run);
+		ZERO_STRUCT(result);
+		result.status = ctdb_vacuum_and_repack_db(ctdb_db,
+							  full_vacuum_run,
+							  first_chain,
+							  child_ctx->num_chains,
+							  &result.num_deleted);
 
-		sys_write(child_ctx->fd[1], &cc, 1);
+		sys_write(child_ctx->fd[1], &result, sizeof(result));
 		_exit(0);
 	}
 
@@ -1532,6 +1648,23 @@ static void ctdb_vacuum_event(struct tevent_context *ev,
 	DLIST_ADD(ctdb->vacuumers, child_ctx);
 	talloc_set_destructor(child_ctx, vacuum_child_destructor);
 
+	/*
+	 * A new scan over all hash chains starts with this run.
+	 * The time between the starts of two scans is the longest
+	 * an empty record not in the delete queue waits for vacuuming.
+	 */
+	if (full_vacuum_run ||
+	    (child_ctx->num_chains > 0 && first_chain == 0)) {
+		if (!timeval_is_zero(&vacuum_handle->pass_start)) {
+			ctdb_db->statistics.vacuum.pass_time =
+				timeval_elapsed(&vacuum_handle->pass_start);
+		}
+		vacuum_handle->pass_start = child_ctx->start_time;
+	}
+
+	ctdb_db->statistics.vacuum.num_queued +=
+		ctdb_vacuum_delete_queue_len(ctdb_db);
+
 	/*
 	 * Clear the fastpath vacuuming list in the parent.
 	 */
@@ -1586,6 +1719,8 @@ int ctdb_vacuum_init(struct ctdb_db_context *ctdb_db)
 
 	ctdb_db->vacuum_handle->ctdb_db         = ctdb_db;
 	ctdb_db->vacuum_handle->fast_path_count = 0;
+	ctdb_db->vacuum_handle->next_chain      = 0;
+	ctdb_db->vacuum_handle->pass_start      = timeval_zero();
 
 	tevent_add_timer(ctdb_db->ctdb->ev, ctdb_db->vacuum_handle,
 			 timeval_current_ofs(get_vacuum_interval(ctdb_db), 0),
@@ -1810,3 +1945,29 @@ void ctdb_local_remove_from_delete_queue(struct ctdb_db_context *ctdb_db,
 
 	return;
 }
+
+static int delete_queue_count_traverse(void *param, void *data)
+{
+	uint32_t *count = (uint32_t *)param;
+
+	(*count)++;
+
+	return 0;
+}
+
+/**
+ * Return the number of records waiting in the delete queue.
+ */
+uint32_t ctdb_vacuum_delete_queue_len(struct ctdb_db_context *ctdb_db)
+{
+	uint32_t count = 0;
+
+	if (ctdb_db->delete_queue == NULL) {
+		return 0;
+	}
+
+	trbt_traversearray32(ctdb_db->delete_queue, 1,
+			     delete_queue_count_traverse, &count);
+
+	return count;
+}
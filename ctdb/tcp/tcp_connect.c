@@ -117,6 +117,7 @@ static void ctdb_node_connect_write(struct tevent_context *ev,
 				      strerror(errno)));
 	}
 
+	ctdb_queue_set_io_pool(tnode->out_queue, ctdb_io_thread_pool(ctdb));
 	ctdb_queue_set_fd(tnode->out_queue, tnode->fd);
 
 	/* the queue subsystem now owns this fd */
@@ -284,6 +285,9 @@ static void ctdb_listen_event(struct tevent_context *ev, struct tevent_fd *fde,
 
 	in->queue = ctdb_queue_setup(ctdb, in, in->fd, CTDB_TCP_ALIGNMENT,
 				     ctdb_tcp_read_cb, in, "ctdbd-%s", ctdb_addr_to_str(&addr));
+	if (in->queue != NULL) {
+		ctdb_queue_set_io_pool(in->queue, ctdb_io_thread_pool(ctdb));
+	}
 }
 
 
@@ -0,0 +1,136 @@
+#!/bin/bash
+
+test_info()
+{
+    cat <<EOF
+Measure how long it takes to recover a set of volatile databases that
+have copies of the same records on all nodes.
+
+Databases are pulled from all nodes in parallel and the records are
+merged by RSN.  Several databases are recovered at the same time, as
+long as their combined size stays within RecoveryMemoryLimit.
+
+Each key is written on every node in turn, so the copy on the last
+node has the highest RSN.  Recovery is timed with RecoveryMemoryLimit
+set to 0 (all databases in parallel) and to 1MB (one database at a
+time).
+
+Environment variables:
+
+* RECOVERY_BENCH_DBS: number of databases (default 4)
+* RECOVERY_BENCH_RECORDS: number of records per database (default 500)
+* RECOVERY_BENCH_ROUNDS: recoveries for each setting (default 3)
+
+Expected results:
+
+* All recoveries complete and every database has all the records, with
+  the values written on the last node
+
+EOF
+}
+
+. "${TEST_SCRIPTS_DIR}/integration.bash"
+
+ctdb_test_init "$@"
+
+set -e
+
+cluster_is_healthy
+
+# Reset configuration
+ctdb_restart_when_done
+
+num_dbs="${RECOVERY_BENCH_DBS:-4}"
+num_records="${RECOVERY_BENCH_RECORDS:-500}"
+num_rounds="${RECOVERY_BENCH_ROUNDS:-3}"
+
+try_command_on_node 0 "$CTDB listnodes"
+num_nodes=$(echo "$out" | wc -l)
+last_pnn=$(($num_nodes - 1))
+
+echo "Find out which node is recmaster"
+try_command_on_node 0 $CTDB recmaster
+recmaster="$out"
+
+# 1000 bytes of record data
+v1="1234567890"
+v2="$v1$v1$v1$v1$v1$v1$v1$v1$v1$v1"
+v3="$v2$v2$v2$v2$v2$v2$v2$v2$v2$v2"
+
+for d in $(seq 1 $num_dbs) ; do
+    db="recovery_bench_${d}.tdb"
+
+    echo "create test database $db"
+    try_command_on_node 0 $CTDB attach $db
+    try_command_on_node 0 $CTDB wipedb $db
+
+    for pnn in $(seq 0 $last_pnn) ; do
+	echo "Writing $num_records records to $db on node $pnn"
+	try_command_on_node $pnn \
+	    "for i in \$(seq 1 $num_records) ; do \
+		$CTDB writekey $db record\$i pnn${pnn}_$v3 || exit 1 ; \
+	     done"
+    done
+done
+
+# Force a recovery and set $duration to the time it took in seconds, as
+# recorded by the recovery master
+recover_and_time ()
+{
+    try_command_on_node $recmaster $CTDB recover
+    wait_until_node_has_status $recmaster recovered
+
+    try_command_on_node $recmaster $CTDB uptime
+    duration=$(echo "$out" |
+	sed -n -e 's@^Duration of last recovery/failover: \([.0-9]*\) seconds$@\1@p')
+    if [ -z "$duration" ] ; then
+	echo "BAD: unable to get duration of recovery"
+	echo "$out"
+	exit 1
+    fi
+}
+
+check_databases ()
+{
+    local d db num i
+
+    for d in $(seq 1 $num_dbs) ; do
+	db="recovery_bench_${d}.tdb"
+
+	num=$(db_ctdb_cattdb_count_records $recmaster $db)
+	if [ "$num" != "$num_records" ] ; then
+	    echo "BAD: $db has $num of $num_records records"
+	    exit 1
+	fi
+
+	for i in 1 $num_records ; do
+	    try_command_on_node $recmaster $CTDB readkey $db record$i
+	    case "$out" in
+	    *"ptr:[pnn${last_pnn}_"*) ;;
+	    *)
+		echo "BAD: $db record$i did not come from node $last_pnn"
+		echo "$out"
+		exit 1
+	    esac
+	done
+    done
+}
+
+for limit in 0 1 ; do
+    try_command_on_node $recmaster $CTDB setvar RecoveryMemoryLimit $limit
+
+    total=0
+    for r in $(seq 1 $num_rounds) ; do
+	recover_and_time
+	echo "RecoveryMemoryLimit=$limit round $r: recovery took ${duration}s"
+	total=$(echo "$total $duration" | awk '{ print $1 + $2 }')
+    done
+
+    check_databases
+
+    average=$(echo "$total $num_rounds" | awk '{ printf "%.6f", $1 / $2 }')
+    echo "RecoveryMemoryLimit=$limit: average ${average}s" \
+	 "for $num_dbs databases with $num_records records on $num_nodes nodes"
+done
+
+echo "OK: all databases recovered correctly"
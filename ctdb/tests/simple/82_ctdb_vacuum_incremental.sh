@@ -0,0 +1,100 @@
+#!/bin/bash
+
+test_info()
+{
+    cat <<EOF
+Check that incremental vacuuming deletes records and reports statistics.
+
+With VacuumChainsPerRun set, each vacuuming run scans only a range of
+hash chains, while records queued for deletion are processed on every
+run.  Records deleted with "ctdb deletekey" should be vacuumed on all
+nodes and "ctdb dbstatistics" should show the deleted records and the
+time taken by a scan of the whole database.
+
+Expected results:
+
+* All deleted records are vacuumed on all nodes
+* vacuum.num_deleted and vacuum.pass_time are set
+
+EOF
+}
+
+. "${TEST_SCRIPTS_DIR}/integration.bash"
+
+ctdb_test_init "$@"
+
+set -e
+
+cluster_is_healthy
+
+# Reset configuration
+ctdb_restart_when_done
+
+num_records=100
+
+try_command_on_node 0 "$CTDB listnodes"
+num_nodes=$(echo "$out" | wc -l)
+
+echo "Vacuum every second, in 2 or 3 runs per scan of the database"
+try_command_on_node all $CTDB setvar VacuumInterval 1
+try_command_on_node all $CTDB setvar VacuumChainsPerRun 50000
+
+test_db="vacuum_incremental.tdb"
+
+echo "create test database $test_db"
+try_command_on_node 0 $CTDB attach $test_db
+try_command_on_node 0 $CTDB wipedb $test_db
+
+echo "Writing and deleting $num_records records on node 0"
+try_command_on_node 0 \
+    "for i in \$(seq 1 $num_records) ; do \
+	$CTDB writekey $test_db record\$i value\$i || exit 1 ; \
+	$CTDB deletekey $test_db record\$i || exit 1 ; \
+     done"
+
+db_is_empty ()
+{
+    local num
+
+    num=$(db_ctdb_cattdb_count_records $1 $test_db)
+    [ "$num" -eq 0 ]
+}
+
+for pnn in $(seq 0 $(($num_nodes - 1))) ; do
+    echo "Waiting until $test_db is empty on node $pnn"
+    wait_until 60 db_is_empty $pnn
+done
+
+# $1: pnn, $2: field name
+get_vacuum_statistic ()
+{
+    try_command_on_node $1 $CTDB dbstatistics $test_db
+    echo "$out" | awk -v name="$2" '$1 == name { print $2 }'
+}
+
+num_deleted=0
+for pnn in $(seq 0 $(($num_nodes - 1))) ; do
+    n=$(get_vacuum_statistic $pnn num_deleted)
+    echo "node $pnn: vacuum.num_deleted = $n"
+    num_deleted=$(($num_deleted + $n))
+done
+
+if [ $num_deleted -lt $num_records ] ; then
+    echo "BAD: only $num_deleted of $num_records records counted as deleted"
+    exit 1
+fi
+
+pass_time_is_set ()
+{
+    local t
+
+    t=$(get_vacuum_statistic 0 pass_time)
+    [ -n "$t" ] && [ "$t" -gt 0 ]
+}
+
+echo "Waiting until node 0 has completed a scan of $test_db"
+wait_until 60 pass_time_is_set
+
+try_command_on_node -v 0 $CTDB dbstatistics $test_db
+
+echo "OK: incremental vacuuming deleted all records"
@@ -0,0 +1,324 @@
+/*
+   io_thread tests
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/wait.h"
+
+#include <assert.h>
+
+#include "common/io_thread.c"
+
+#define NUM_CONNS	5
+#define NUM_PKTS	200
+
+struct test_conn {
+	struct io_thread_conn *conn;
+	int peer;
+	uint32_t next;
+	bool closed;
+	bool eof;
+};
+
+/* Packets are <length> <sequence> <sequence bytes> */
+static size_t test_pkt(uint8_t *buf, uint32_t seq)
+{
+	uint32_t len = 2 * sizeof(uint32_t) + (seq * 37) % 3000;
+
+	memcpy(buf, &len, sizeof(len));
+	memcpy(buf + sizeof(len), &seq, sizeof(seq));
+	memset(buf + 2 * sizeof(uint32_t), seq & 0xff,
+	       len - 2 * sizeof(uint32_t));
+	return len;
+}
+
+static void test_pkt_check(uint8_t *buf, size_t buflen, uint32_t seq)
+{
+	uint8_t expected[4096];
+	size_t len;
+
+	len = test_pkt(expected, seq);
+	assert(buflen == len);
+	assert(memcmp(buf, expected, len) == 0);
+}
+
+static void test_read_handler(uint8_t *buf, size_t buflen,
+			      void *private_data)
+{
+	struct test_conn *tc = (struct test_conn *)private_data;
+	int ret;
+
+	if (buf == NULL) {
+		assert(buflen == 0);
+		tc->eof = true;
+		return;
+	}
+
+	test_pkt_check(buf, buflen, tc->next);
+	tc->next += 1;
+
+	/* Echo back */
+	ret = io_thread_conn_write(tc->conn, buf, buflen);
+	assert(ret == 0 || (tc->closed && ret == EPIPE));
+
+	talloc_free(buf);
+}
+
+static void test_peer_write(int fd, uint32_t seq)
+{
+	uint8_t buf[4096];
+	size_t len;
+	ssize_t n;
+
+	len = test_pkt(buf, seq);
+	n = sys_write(fd, buf, len);
+	assert(n == len);
+}
+
+static void test_peer_read(int fd, uint32_t seq)
+{
+	uint8_t buf[4096];
+	uint32_t len;
+	ssize_t n;
+
+	n = sys_read(fd, buf, sizeof(len));
+	assert(n == sizeof(len));
+	memcpy(&len, buf, sizeof(len));
+	assert(len <= sizeof(buf));
+
+	n = sys_read(fd, buf + sizeof(len), len - sizeof(len));
+	assert(n == len - sizeof(len));
+
+	test_pkt_check(buf, len, seq);
+}
+
+static void do_test1(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct tevent_context *ev;
+	struct io_thread_pool *pool;
+	struct io_thread_stats stats;
+	struct test_conn tc[NUM_CONNS];
+	uint32_t recv, sent, conns;
+	unsigned int i;
+	uint32_t j;
+	bool done;
+	int ret;
+
+	ev = tevent_context_init(mem_ctx);
+	assert(ev != NULL);
+
+	ret = io_thread_pool_init(mem_ctx, ev, &pool);
+	assert(ret == 0);
+	assert(io_thread_pool_size(pool) == 0);
+
+	ret = io_thread_conn_setup(mem_ctx, pool, 0, 1024,
+				   test_read_handler, NULL, &tc[0].conn);
+	assert(ret == EINVAL);
+
+	ret = io_thread_pool_set_size(pool, IO_THREAD_MAX + 1);
+	assert(ret == 0);
+	assert(io_thread_pool_size(pool) == IO_THREAD_MAX);
+
+	ret = io_thread_pool_set_size(pool, 2);
+	assert(ret == 0);
+	assert(io_thread_pool_size(pool) == 2);
+	assert(io_thread_pool_num_threads(pool) == IO_THREAD_MAX);
+
+	for (i=0; i<NUM_CONNS; i++) {
+		int fd[2];
+
+		ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fd);
+		assert(ret == 0);
+		set_blocking(fd[0], false);
+
+		tc[i] = (struct test_conn) { .peer = fd[1] };
+
+		/* Small reads to split packets across reads */
+		ret = io_thread_conn_setup(mem_ctx, pool, fd[0], 100,
+					   test_read_handler, &tc[i],
+					   &tc[i].conn);
+		assert(ret == 0);
+	}
+
+	/* Connections go to the first two threads only */
+	conns = 0;
+	for (i=0; i<IO_THREAD_MAX; i++) {
+		ret = io_thread_pool_stats(pool, i, false, &stats);
+		assert(ret == 0);
+		if (i >= 2) {
+			assert(stats.num_conns == 0);
+		}
+		conns += stats.num_conns;
+	}
+	assert(conns == NUM_CONNS);
+
+	ret = io_thread_pool_stats(pool, IO_THREAD_MAX, false, &stats);
+	assert(ret == EINVAL);
+
+	for (j=0; j<NUM_PKTS; j++) {
+		for (i=0; i<NUM_CONNS; i++) {
+			test_peer_write(tc[i].peer, j);
+		}
+	}
+
+	done = false;
+	while (!done) {
+		tevent_loop_once(ev);
+
+		done = true;
+		for (i=0; i<NUM_CONNS; i++) {
+			if (tc[i].next < NUM_PKTS) {
+				done = false;
+			}
+		}
+	}
+
+	for (i=0; i<NUM_CONNS; i++) {
+		for (j=0; j<NUM_PKTS; j++) {
+			test_peer_read(tc[i].peer, j);
+		}
+		assert(io_thread_conn_queue_length(tc[i].conn) == 0);
+	}
+
+	recv = sent = 0;
+	for (i=0; i<2; i++) {
+		ret = io_thread_pool_stats(pool, i, true, &stats);
+		assert(ret == 0);
+		recv += stats.packets_recv;
+		sent += stats.packets_sent;
+		assert(stats.wakeups > 0);
+	}
+	assert(recv == NUM_CONNS * NUM_PKTS);
+	assert(sent == NUM_CONNS * NUM_PKTS);
+
+	ret = io_thread_pool_stats(pool, 0, false, &stats);
+	assert(ret == 0);
+	assert(stats.packets_recv == 0);
+	assert(stats.packets_sent == 0);
+
+	/* Packets before EOF are passed up first */
+	test_peer_write(tc[0].peer, NUM_PKTS);
+	close(tc[0].peer);
+	tc[0].closed = true;
+	while (!tc[0].eof) {
+		tevent_loop_once(ev);
+	}
+	assert(tc[0].next == NUM_PKTS + 1);
+
+	ret = io_thread_conn_write(tc[0].conn, (uint8_t *)"\x8\0\0\0\0\0\0\0",
+				   8);
+	assert(ret == EPIPE);
+	TALLOC_FREE(tc[0].conn);
+
+	/* Freeing a connection closes the socket */
+	TALLOC_FREE(tc[1].conn);
+	{
+		uint8_t c;
+		ssize_t n;
+
+		n = sys_read(tc[1].peer, &c, 1);
+		assert(n == 0);
+	}
+
+	/* Connections left over are cleaned up with the pool */
+	talloc_free(pool);
+	for (i=1; i<NUM_CONNS; i++) {
+		close(tc[i].peer);
+	}
+	for (i=2; i<NUM_CONNS; i++) {
+		assert(io_thread_conn_queue_length(tc[i].conn) == 0);
+		ret = io_thread_conn_write(tc[i].conn,
+					   (uint8_t *)"\x4\0\0\0", 4);
+		assert(ret == EPIPE);
+		talloc_free(tc[i].conn);
+	}
+
+	talloc_free(mem_ctx);
+}
+
+static void do_test2(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct tevent_context *ev;
+	struct io_thread_pool *pool;
+	struct test_conn tc;
+	int fd[2];
+	pid_t pid;
+	int ret, status;
+
+	ev = tevent_context_init(mem_ctx);
+	assert(ev != NULL);
+
+	ret = io_thread_pool_init(mem_ctx, ev, &pool);
+	assert(ret == 0);
+
+	ret = io_thread_pool_set_size(pool, 1);
+	assert(ret == 0);
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fd);
+	assert(ret == 0);
+	set_blocking(fd[0], false);
+
+	tc = (struct test_conn) { .peer = fd[1] };
+	ret = io_thread_conn_setup(mem_ctx, pool, fd[0], 1024,
+				   test_read_handler, &tc, &tc.conn);
+	assert(ret == 0);
+
+	pid = fork();
+	assert(pid != -1);
+
+	if (pid == 0) {
+		/* The threads are not there in the child */
+		assert(io_thread_pool_size(pool) == 0);
+		assert(io_thread_pool_num_threads(pool) == 0);
+		ret = io_thread_pool_set_size(pool, 2);
+		assert(ret == 0);
+		assert(io_thread_pool_size(pool) == 0);
+
+		ret = io_thread_conn_write(tc.conn,
+					   (uint8_t *)"\x4\0\0\0", 4);
+		assert(ret == EPIPE);
+
+		talloc_free(mem_ctx);
+		_exit(0);
+	}
+
+	ret = waitpid(pid, &status, 0);
+	assert(ret == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	/* The parent is not affected */
+	test_peer_write(tc.peer, 1);
+	tc.next = 1;
+	while (tc.next == 1) {
+		tevent_loop_once(ev);
+	}
+	test_peer_read(tc.peer, 1);
+
+	close(tc.peer);
+	talloc_free(mem_ctx);
+}
+
+int main(void)
+{
+	do_test1();
+	do_test2();
+
+	return 0;
+}
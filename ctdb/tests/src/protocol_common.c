@@ -353,6 +353,14 @@ void fill_ctdb_statistics(TALLOC_CTX *mem_ctx, struct ctdb_statistics *p)
 	fill_ctdb_timeval(&p->statistics_current_time);
 	p->total_ro_delegations = rand32();
 	p->total_ro_revokes = rand32();
+	p->num_io_threads = rand32();
+	for (i=0; i<MAX_IO_THREADS; i++) {
+		p->io_threads[i].num_conns = rand32();
+		p->io_threads[i].packets_recv = rand32();
+		p->io_threads[i].packets_sent = rand32();
+		p->io_threads[i].wakeups = rand32();
+		p->io_threads[i].busy_ms = rand32();
+	}
 }
 
 void verify_ctdb_statistics(struct ctdb_statistics *p1,
@@ -419,6 +427,19 @@ void verify_ctdb_statistics(struct ctdb_statistics *p1,
 			    &p2->statistics_current_time);
 	assert(p1->total_ro_delegations == p2->total_ro_delegations);
 	assert(p1->total_ro_revokes == p2->total_ro_revokes);
+	assert(p1->num_io_threads == p2->num_io_threads);
+	for (i=0; i<MAX_IO_THREADS; i++) {
+		assert(p1->io_threads[i].num_conns ==
+		       p2->io_threads[i].num_conns);
+		assert(p1->io_threads[i].packets_recv ==
+		       p2->io_threads[i].packets_recv);
+		assert(p1->io_threads[i].packets_sent ==
+		       p2->io_threads[i].packets_sent);
+		assert(p1->io_threads[i].wakeups ==
+		       p2->io_threads[i].wakeups);
+		assert(p1->io_threads[i].busy_ms ==
+		       p2->io_threads[i].busy_ms);
+	}
 }
 
 void fill_ctdb_vnn_map(TALLOC_CTX *mem_ctx, struct ctdb_vnn_map *p)
@@ -848,6 +869,12 @@ void fill_ctdb_tunable_list(TALLOC_CTX *mem_ctx, struct ctdb_tunable_list *p)
 	p->queue_buffer_size = rand32();
 	p->ip_alloc_algorithm = rand32();
 	p->allow_mixed_versions = rand32();
+	p->io_threads = rand32();
+	p->migration_hold_time = rand32();
+	p->migration_hold_threshold = rand32();
+	p->client_ring_size = rand32();
+	p->recovery_memory_limit = rand32();
+	p->vacuum_chains_per_run = rand32();
 }
 
 void verify_ctdb_tunable_list(struct ctdb_tunable_list *p1,
@@ -915,6 +942,13 @@ void verify_ctdb_tunable_list(struct ctdb_tunable_list *p1,
 	assert(p1->queue_buffer_size == p2->queue_buffer_size);
 	assert(p1->ip_alloc_algorithm == p2->ip_alloc_algorithm);
 	assert(p1->allow_mixed_versions == p2->allow_mixed_versions);
+	assert(p1->io_threads == p2->io_threads);
+	assert(p1->migration_hold_time == p2->migration_hold_time);
+	assert(p1->migration_hold_threshold ==
+	       p2->migration_hold_threshold);
+	assert(p1->client_ring_size == p2->client_ring_size);
+	assert(p1->recovery_memory_limit == p2->recovery_memory_limit);
+	assert(p1->vacuum_chains_per_run == p2->vacuum_chains_per_run);
 }
 
 void fill_ctdb_tickle_list(TALLOC_CTX *mem_ctx, struct ctdb_tickle_list *p)
@@ -1269,6 +1303,10 @@ void fill_ctdb_db_statistics(TALLOC_CTX *mem_ctx,
 	}
 
 	fill_ctdb_latency_counter(&p->vacuum.latency);
+	p->vacuum.num_queued = rand32();
+	p->vacuum.num_deleted = rand32();
+	p->vacuum.queue_len = rand32();
+	p->vacuum.pass_time = rand32();
 
 	p->db_ro_delegations = rand32();
 	p->db_ro_revokes = rand32();
@@ -1276,6 +1314,11 @@ void fill_ctdb_db_statistics(TALLOC_CTX *mem_ctx,
 		p->hop_count_bucket[i] = rand32();
 	}
 
+	p->migrations.num_total = rand32();
+	p->migrations.num_hot = rand32();
+	p->migrations.num_held = rand32();
+	p->migrations.num_batched = rand32();
+
 	p->num_hot_keys = MAX_HOT_KEYS;
 	for (i=0; i<p->num_hot_keys; i++) {
 		p->hot_keys[i].count = rand32();
@@ -1298,6 +1341,10 @@ void verify_ctdb_db_statistics(struct ctdb_db_statistics *p1,
 	}
 
 	verify_ctdb_latency_counter(&p1->vacuum.latency, &p2->vacuum.latency);
+	assert(p1->vacuum.num_queued == p2->vacuum.num_queued);
+	assert(p1->vacuum.num_deleted == p2->vacuum.num_deleted);
+	assert(p1->vacuum.queue_len == p2->vacuum.queue_len);
+	assert(p1->vacuum.pass_time == p2->vacuum.pass_time);
 
 	assert(p1->db_ro_delegations == p2->db_ro_delegations);
 	assert(p1->db_ro_revokes == p2->db_ro_revokes);
@@ -1305,6 +1352,11 @@ void verify_ctdb_db_statistics(struct ctdb_db_statistics *p1,
 		assert(p1->hop_count_bucket[i] == p2->hop_count_bucket[i]);
 	}
 
+	assert(p1->migrations.num_total == p2->migrations.num_total);
+	assert(p1->migrations.num_hot == p2->migrations.num_hot);
+	assert(p1->migrations.num_held == p2->migrations.num_held);
+	assert(p1->migrations.num_batched == p2->migrations.num_batched);
+
 	assert(p1->num_hot_keys == p2->num_hot_keys);
 	for (i=0; i<p1->num_hot_keys; i++) {
 		assert(p1->hot_keys[i].count == p2->hot_keys[i].count);
@@ -615,6 +615,9 @@ void fill_ctdb_req_control_data(TALLOC_CTX *mem_ctx,
 
 	case CTDB_CONTROL_TUNNEL_DEREGISTER:
 		break;
+
+	case CTDB_CONTROL_CLIENT_RING:
+		break;
 	}
 }
 
@@ -1026,6 +1029,9 @@ void verify_ctdb_req_control_data(struct ctdb_req_control_data *cd,
 
 	case CTDB_CONTROL_TUNNEL_DEREGISTER:
 		break;
+
+	case CTDB_CONTROL_CLIENT_RING:
+		break;
 	}
 }
 
@@ -1447,6 +1453,11 @@ void fill_ctdb_reply_control_data(TALLOC_CTX *mem_ctx,
 	case CTDB_CONTROL_TUNNEL_DEREGISTER:
 		break;
 
+	case CTDB_CONTROL_CLIENT_RING:
+		fill_ctdb_string(mem_ctx, &cd->data.ring_path);
+		assert(cd->data.ring_path != NULL);
+		break;
+
 	}
 }
 
@@ -1801,6 +1812,10 @@ void verify_ctdb_reply_control_data(struct ctdb_reply_control_data *cd,
 	case CTDB_CONTROL_TUNNEL_DEREGISTER:
 		break;
 
+	case CTDB_CONTROL_CLIENT_RING:
+		verify_ctdb_string(&cd->data.ring_path, &cd2->data.ring_path);
+		break;
+
 	}
 }
 
@@ -65,6 +65,12 @@ RecBufferSizeLimit         = 1000000
 QueueBufferSize            = 1024
 IPAllocAlgorithm           = 2
 AllowMixedVersions         = 0
+IOThreads                  = 0
+MigrationHoldTime          = 0
+MigrationHoldThreshold     = 10
+ClientRingSize             = 0
+RecoveryMemoryLimit        = 1024
+VacuumChainsPerRun         = 0
 EOF
 
 simple_test
@@ -1180,6 +1180,7 @@ const struct {
 	STATISTICS_FIELD(max_hop_count),
 	STATISTICS_FIELD(total_ro_delegations),
 	STATISTICS_FIELD(total_ro_revokes),
+	STATISTICS_FIELD(num_io_threads),
 };
 
 #define LATENCY_AVG(v)	((v).num ? (v).total / (v).num : 0.0 )
@@ -1301,6 +1302,15 @@ static void print_statistics(struct ctdb_statistics *s)
 		printf(" %d", s->locks.buckets[i]);
 	}
 	printf("\n");
+	for (i=0; i<s->num_io_threads && i<MAX_IO_THREADS; i++) {
+		printf(" io_thread_%d: num_conns %u packets_recv %u"
+		       " packets_sent %u wakeups %u busy_ms %u\n", i,
+		       s->io_threads[i].num_conns,
+		       s->io_threads[i].packets_recv,
+		       s->io_threads[i].packets_sent,
+		       s->io_threads[i].wakeups,
+		       s->io_threads[i].busy_ms);
+	}
 	printf(" %-30s     %.6f/%.6f/%.6f sec out of %d\n",
 	       "locks_latency      MIN/AVG/MAX",
 	       s->locks.latency.min, LATENCY_AVG(s->locks.latency),
@@ -5588,6 +5598,14 @@ const struct {
 	DBSTATISTICS_FIELD(locks.num_current),
 	DBSTATISTICS_FIELD(locks.num_pending),
 	DBSTATISTICS_FIELD(locks.num_failed),
+	DBSTATISTICS_FIELD(vacuum.num_queued),
+	DBSTATISTICS_FIELD(vacuum.num_deleted),
+	DBSTATISTICS_FIELD(vacuum.queue_len),
+	DBSTATISTICS_FIELD(vacuum.pass_time),
+	DBSTATISTICS_FIELD(migrations.num_total),
+	DBSTATISTICS_FIELD(migrations.num_hot),
+	DBSTATISTICS_FIELD(migrations.num_held),
+	DBSTATISTICS_FIELD(migrations.num_batched),
 };
 
 static void print_dbstatistics(const char *db_name,
@@ -5638,6 +5656,11 @@ static void print_dbstatistics(const char *db_name,
 	       s->vacuum.latency.min, LATENCY_AVG(s->vacuum.latency),
 	       s->vacuum.latency.max, s->vacuum.latency.num);
 
+	printf(" %-30s     %.1f records/sec\n",
+	       "vacuum_throughput",
+	       s->vacuum.latency.total > 0 ?
+	       s->vacuum.num_deleted / s->vacuum.latency.total : 0.0);
+
 	printf(" Num Hot Keys:     %d\n", s->num_hot_keys);
 	for (i=0; i<s->num_hot_keys; i++) {
 		int j;
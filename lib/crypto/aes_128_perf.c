@@ -0,0 +1,231 @@
+/*
+   AES-GCM-128 and AES-CCM-128 throughput
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/time.h"
+#include "../lib/crypto/crypto.h"
+
+/*
+ * Encrypts and signs buffers like a SMB3 transform with 'smb encrypt',
+ * first with the accelerated implementation (if available) and then
+ * with the portable one. The results have to be identical.
+ */
+
+static const uint8_t key[AES_BLOCK_SIZE] = {
+	0x8B, 0xF9, 0xFB, 0xC2, 0xB8, 0x14, 0x94, 0x84,
+	0xFF, 0x11, 0xAB, 0x1F, 0x3A, 0x54, 0x4F, 0xF6,
+};
+
+static const uint8_t nonce[AES_GCM_128_IV_SIZE] = {
+	0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x77, 0xF7, 0xA8, 0xFF,
+};
+
+/* the part of the SMB2 transform header that is authenticated */
+static const uint8_t aad[32] = { 0x01, };
+
+static void gcm_encrypt(uint8_t *buf, size_t len, uint8_t T[AES_BLOCK_SIZE])
+{
+	struct aes_gcm_128_context ctx;
+
+	aes_gcm_128_init(&ctx, key, nonce);
+	aes_gcm_128_updateA(&ctx, aad, sizeof(aad));
+	aes_gcm_128_crypt(&ctx, buf, len);
+	aes_gcm_128_updateC(&ctx, buf, len);
+	aes_gcm_128_digest(&ctx, T);
+}
+
+static void ccm_encrypt(uint8_t *buf, size_t len, uint8_t T[AES_BLOCK_SIZE])
+{
+	struct aes_ccm_128_context ctx;
+
+	aes_ccm_128_init(&ctx, key, nonce, sizeof(aad), len);
+	aes_ccm_128_update(&ctx, aad, sizeof(aad));
+	aes_ccm_128_update(&ctx, buf, len);
+	aes_ccm_128_crypt(&ctx, buf, len);
+	aes_ccm_128_digest(&ctx, T);
+}
+
+/*
+ * Like a message split over several iovecs, to test the handling
+ * of partial blocks.
+ */
+static const size_t chunks[] = { 5, 27, 16, 100, 1, 250, 64 };
+
+static void gcm_encrypt_chunked(uint8_t *buf, size_t len,
+				uint8_t T[AES_BLOCK_SIZE])
+{
+	struct aes_gcm_128_context ctx;
+	size_t ofs, i;
+
+	aes_gcm_128_init(&ctx, key, nonce);
+	aes_gcm_128_updateA(&ctx, aad, sizeof(aad));
+	for (ofs = 0, i = 0; ofs < len; i++) {
+		size_t n = MIN(chunks[i % ARRAY_SIZE(chunks)], len - ofs);
+
+		aes_gcm_128_crypt(&ctx, buf + ofs, n);
+		aes_gcm_128_updateC(&ctx, buf + ofs, n);
+		ofs += n;
+	}
+	aes_gcm_128_digest(&ctx, T);
+}
+
+static void ccm_encrypt_chunked(uint8_t *buf, size_t len,
+				uint8_t T[AES_BLOCK_SIZE])
+{
+	struct aes_ccm_128_context ctx;
+	size_t ofs, i;
+
+	aes_ccm_128_init(&ctx, key, nonce, sizeof(aad), len);
+	aes_ccm_128_update(&ctx, aad, sizeof(aad));
+	for (ofs = 0, i = 0; ofs < len; i++) {
+		size_t n = MIN(chunks[i % ARRAY_SIZE(chunks)], len - ofs);
+
+		aes_ccm_128_update(&ctx, buf + ofs, n);
+		aes_ccm_128_crypt(&ctx, buf + ofs, n);
+		ofs += n;
+	}
+	aes_ccm_128_digest(&ctx, T);
+}
+
+struct mode {
+	const char *name;
+	void (*fn)(uint8_t *buf, size_t len, uint8_t T[AES_BLOCK_SIZE]);
+};
+
+static double run(const struct mode *m, uint8_t *buf, size_t len,
+		  double secs)
+{
+	struct timeval start, now;
+	uint8_t T[AES_BLOCK_SIZE];
+	double elapsed;
+	size_t count = 0;
+
+	gettimeofday(&start, NULL);
+	do {
+		m->fn(buf, len, T);
+		count += 1;
+		gettimeofday(&now, NULL);
+		elapsed = (now.tv_sec - start.tv_sec) +
+			(now.tv_usec - start.tv_usec) / 1000000.0;
+	} while (elapsed < secs);
+
+	return (count * (double)len) / elapsed / (1024 * 1024);
+}
+
+static bool check(const struct mode *m, size_t len)
+{
+	uint8_t *b1 = malloc(len + 1);
+	uint8_t *b2 = malloc(len + 1);
+	uint8_t T1[AES_BLOCK_SIZE], T2[AES_BLOCK_SIZE];
+	size_t i;
+	bool ok;
+
+	if (b1 == NULL || b2 == NULL) {
+		abort();
+	}
+	for (i = 0; i < len + 1; i++) {
+		b1[i] = b2[i] = (uint8_t)(i * 7 + len);
+	}
+
+	/* Unaligned on purpose */
+	aes_accel_128_disable(false);
+	m->fn(b1 + 1, len, T1);
+	aes_accel_128_disable(true);
+	m->fn(b2 + 1, len, T2);
+	aes_accel_128_disable(false);
+
+	ok = (memcmp(b1, b2, len + 1) == 0) &&
+	     (memcmp(T1, T2, sizeof(T1)) == 0);
+	if (!ok) {
+		fprintf(stderr, "%s: mismatch for length %zu\n", m->name, len);
+	}
+
+	free(b1);
+	free(b2);
+	return ok;
+}
+
+int main(int argc, const char *argv[])
+{
+	static const struct mode modes[] = {
+		{ .name = "AES-128-GCM", .fn = gcm_encrypt, },
+		{ .name = "AES-128-CCM", .fn = ccm_encrypt, },
+	};
+	static const struct mode chunked_modes[] = {
+		{ .name = "AES-128-GCM chunked", .fn = gcm_encrypt_chunked, },
+		{ .name = "AES-128-CCM chunked", .fn = ccm_encrypt_chunked, },
+	};
+	static const size_t sizes[] = { 64, 1024, 8192, 65536, 1024*1024 };
+	double secs = 1.0;
+	uint8_t *buf;
+	size_t i, j;
+	bool ok = true;
+
+	if (argc > 2) {
+		fprintf(stderr, "aes_128_perf [seconds]\n");
+		exit(1);
+	}
+	if (argc == 2) {
+		secs = atof(argv[1]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		for (j = 0; j < 1100; j++) {
+			ok &= check(&modes[i], j);
+		}
+		ok &= check(&modes[i], 1024*1024 + 3);
+	}
+	for (i = 0; i < ARRAY_SIZE(chunked_modes); i++) {
+		for (j = 0; j < 1100; j++) {
+			ok &= check(&chunked_modes[i], j);
+		}
+	}
+	if (!ok) {
+		return 1;
+	}
+
+	buf = calloc(1, sizes[ARRAY_SIZE(sizes) - 1]);
+	if (buf == NULL) {
+		abort();
+	}
+
+	printf("accelerated implementation %savailable\n",
+	       aes_accel_128_available() ? "" : "not ");
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		for (j = 0; j < ARRAY_SIZE(sizes); j++) {
+			double accel = 0, portable;
+
+			if (aes_accel_128_available()) {
+				accel = run(&modes[i], buf, sizes[j], secs);
+			}
+			aes_accel_128_disable(true);
+			portable = run(&modes[i], buf, sizes[j], secs);
+			aes_accel_128_disable(false);
+
+			printf("%s %8zu bytes: %10.1f MB/s accelerated, "
+			       "%10.1f MB/s portable\n",
+			       modes[i].name, sizes[j], accel, portable);
+		}
+	}
+
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,518 @@
+/*
+   AES-128 bulk helpers for the AES-GCM-128 and AES-CCM-128 modes
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "../lib/crypto/crypto.h"
+#include "lib/util/byteorder.h"
+
+static bool aes_accel_128_disabled;
+
+void aes_accel_128_disable(bool disable)
+{
+	aes_accel_128_disabled = disable;
+}
+
+#if defined(HAVE_AES_PCLMUL_INTRINSICS)
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+#if defined(HAVE_VAES_AVX2_INTRINSICS)
+#include <immintrin.h>
+#endif
+
+#define AES_ACCEL_TARGET __attribute__((target("aes,pclmul,ssse3")))
+#define AES_ACCEL_VAES_TARGET __attribute__((target("aes,pclmul,ssse3,avx2,vaes")))
+
+/*
+ * -1: not checked yet, 0: not available,
+ * 1: AES-NI and PCLMULQDQ, 2: additionally VAES and AVX2
+ */
+static int aes_accel_128_level = -1;
+
+static int aes_accel_128_cpu_level(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int level = 0;
+
+	if (aes_accel_128_level != -1) {
+		return aes_accel_128_level;
+	}
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+		goto done;
+	}
+	if ((ecx & bit_AES) == 0 ||
+	    (ecx & bit_PCLMUL) == 0 ||
+	    (ecx & bit_SSSE3) == 0) {
+		goto done;
+	}
+	level = 1;
+
+#if defined(HAVE_VAES_AVX2_INTRINSICS)
+	if ((ecx & bit_OSXSAVE) != 0 && (ecx & bit_AVX) != 0) {
+		uint32_t xcr0_lo, xcr0_hi;
+
+		/* The OS has to save the YMM registers */
+		asm volatile("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+		if ((xcr0_lo & 0x6) == 0x6 &&
+		    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) != 0 &&
+		    (ebx & bit_AVX2) != 0 &&
+		    (ecx & (1 << 9)) != 0 /* VAES */) {
+			level = 2;
+		}
+	}
+#endif
+
+done:
+	aes_accel_128_level = level;
+	return level;
+}
+
+bool aes_accel_128_available(void)
+{
+	if (aes_accel_128_disabled) {
+		return false;
+	}
+	return aes_accel_128_cpu_level() > 0;
+}
+
+#define AES_ACCEL_KEY_EXP(k, rcon) \
+	aes_accel_128_key_exp(k, _mm_aeskeygenassist_si128(k, rcon))
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_128_key_exp(__m128i k,
+							      __m128i kg)
+{
+	kg = _mm_shuffle_epi32(kg, _MM_SHUFFLE(3,3,3,3));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, kg);
+}
+
+AES_ACCEL_TARGET
+void aes_accel_128_set_key(struct aes_accel_128_key *key,
+			   const uint8_t K[AES_BLOCK_SIZE])
+{
+	__m128i rk[11];
+	size_t i;
+
+	rk[0] = _mm_loadu_si128((const __m128i *)K);
+	rk[1] = AES_ACCEL_KEY_EXP(rk[0], 0x01);
+	rk[2] = AES_ACCEL_KEY_EXP(rk[1], 0x02);
+	rk[3] = AES_ACCEL_KEY_EXP(rk[2], 0x04);
+	rk[4] = AES_ACCEL_KEY_EXP(rk[3], 0x08);
+	rk[5] = AES_ACCEL_KEY_EXP(rk[4], 0x10);
+	rk[6] = AES_ACCEL_KEY_EXP(rk[5], 0x20);
+	rk[7] = AES_ACCEL_KEY_EXP(rk[6], 0x40);
+	rk[8] = AES_ACCEL_KEY_EXP(rk[7], 0x80);
+	rk[9] = AES_ACCEL_KEY_EXP(rk[8], 0x1B);
+	rk[10] = AES_ACCEL_KEY_EXP(rk[9], 0x36);
+
+	for (i = 0; i < ARRAY_SIZE(rk); i++) {
+		_mm_storeu_si128((__m128i *)key->rk[i], rk[i]);
+	}
+}
+
+/*
+ * The counter block with the given 32 bit counter value.
+ */
+static inline AES_ACCEL_TARGET __m128i aes_accel_128_ctr_block(__m128i base,
+								uint32_t ctr)
+{
+	return _mm_xor_si128(base,
+			     _mm_set_epi32(__builtin_bswap32(ctr), 0, 0, 0));
+}
+
+#define AES_ACCEL_CTR_BLOCKS 8
+
+#if defined(HAVE_VAES_AVX2_INTRINSICS)
+/*
+ * Returns the number of blocks processed, always a multiple of
+ * AES_ACCEL_CTR_BLOCKS.
+ */
+static AES_ACCEL_VAES_TARGET size_t aes_accel_128_ctr32_xor_vaes(
+					const struct aes_accel_128_key *key,
+					__m128i base, uint32_t *pctr,
+					uint8_t *m, size_t num_blocks)
+{
+	__m256i rk[11];
+	uint32_t ctr = *pctr;
+	size_t done = 0;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(rk); i++) {
+		__m128i k = _mm_loadu_si128((const __m128i *)key->rk[i]);
+		rk[i] = _mm256_broadcastsi128_si256(k);
+	}
+
+	while (num_blocks - done >= AES_ACCEL_CTR_BLOCKS) {
+		__m256i b[AES_ACCEL_CTR_BLOCKS/2];
+		size_t j;
+
+		for (j = 0; j < ARRAY_SIZE(b); j++) {
+			__m128i lo = aes_accel_128_ctr_block(base, ctr + 1);
+			__m128i hi = aes_accel_128_ctr_block(base, ctr + 2);
+
+			b[j] = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(lo), hi, 1);
+			b[j] = _mm256_xor_si256(b[j], rk[0]);
+			ctr += 2;
+		}
+		for (i = 1; i < 10; i++) {
+			for (j = 0; j < ARRAY_SIZE(b); j++) {
+				b[j] = _mm256_aesenc_epi128(b[j], rk[i]);
+			}
+		}
+		for (j = 0; j < ARRAY_SIZE(b); j++) {
+			__m256i *p = (__m256i *)(m + (done + j*2) * AES_BLOCK_SIZE);
+			__m256i d = _mm256_loadu_si256(p);
+
+			b[j] = _mm256_aesenclast_epi128(b[j], rk[10]);
+			_mm256_storeu_si256(p, _mm256_xor_si256(d, b[j]));
+		}
+		done += AES_ACCEL_CTR_BLOCKS;
+	}
+
+	*pctr = ctr;
+	return done;
+}
+#endif
+
+AES_ACCEL_TARGET
+void aes_accel_128_ctr32_xor(const struct aes_accel_128_key *key,
+			     uint8_t ctr_block[AES_BLOCK_SIZE],
+			     uint8_t *m, size_t num_blocks)
+{
+	const __m128i ctr_mask = _mm_set_epi32(0, -1, -1, -1);
+	__m128i rk[11];
+	__m128i base;
+	uint32_t ctr;
+	size_t i;
+
+	base = _mm_loadu_si128((const __m128i *)ctr_block);
+	base = _mm_and_si128(base, ctr_mask);
+	ctr = RIVAL(ctr_block, AES_BLOCK_SIZE - 4);
+
+#if defined(HAVE_VAES_AVX2_INTRINSICS)
+	if (aes_accel_128_cpu_level() >= 2) {
+		size_t done;
+
+		done = aes_accel_128_ctr32_xor_vaes(key, base, &ctr,
+						    m, num_blocks);
+		m += done * AES_BLOCK_SIZE;
+		num_blocks -= done;
+	}
+#endif
+
+	for (i = 0; i < ARRAY_SIZE(rk); i++) {
+		rk[i] = _mm_loadu_si128((const __m128i *)key->rk[i]);
+	}
+
+	/*
+	 * Keep AES_ACCEL_CTR_BLOCKS independent blocks in flight
+	 * to hide the latency of the aesenc instruction.
+	 */
+	while (num_blocks >= AES_ACCEL_CTR_BLOCKS) {
+		__m128i b[AES_ACCEL_CTR_BLOCKS];
+		size_t j;
+
+		for (j = 0; j < AES_ACCEL_CTR_BLOCKS; j++) {
+			ctr += 1;
+			b[j] = aes_accel_128_ctr_block(base, ctr);
+			b[j] = _mm_xor_si128(b[j], rk[0]);
+		}
+		for (i = 1; i < 10; i++) {
+			for (j = 0; j < AES_ACCEL_CTR_BLOCKS; j++) {
+				b[j] = _mm_aesenc_si128(b[j], rk[i]);
+			}
+		}
+		for (j = 0; j < AES_ACCEL_CTR_BLOCKS; j++) {
+			__m128i *p = (__m128i *)(m + j * AES_BLOCK_SIZE);
+			__m128i d = _mm_loadu_si128(p);
+
+			b[j] = _mm_aesenclast_si128(b[j], rk[10]);
+			_mm_storeu_si128(p, _mm_xor_si128(d, b[j]));
+		}
+		m += AES_ACCEL_CTR_BLOCKS * AES_BLOCK_SIZE;
+		num_blocks -= AES_ACCEL_CTR_BLOCKS;
+	}
+
+	while (num_blocks > 0) {
+		__m128i *p = (__m128i *)m;
+		__m128i b;
+
+		ctr += 1;
+		b = aes_accel_128_ctr_block(base, ctr);
+		b = _mm_xor_si128(b, rk[0]);
+		for (i = 1; i < 10; i++) {
+			b = _mm_aesenc_si128(b, rk[i]);
+		}
+		b = _mm_aesenclast_si128(b, rk[10]);
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), b));
+		m += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+
+	RSIVAL(ctr_block, AES_BLOCK_SIZE - 4, ctr);
+}
+
+AES_ACCEL_TARGET
+void aes_accel_128_cbc_mac(const struct aes_accel_128_key *key,
+			   uint8_t X[AES_BLOCK_SIZE],
+			   const uint8_t *in, size_t num_blocks)
+{
+	__m128i rk[11];
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(rk); i++) {
+		rk[i] = _mm_loadu_si128((const __m128i *)key->rk[i]);
+	}
+
+	x = _mm_loadu_si128((const __m128i *)X);
+
+	while (num_blocks > 0) {
+		__m128i d = _mm_loadu_si128((const __m128i *)in);
+
+		x = _mm_xor_si128(x, d);
+		x = _mm_xor_si128(x, rk[0]);
+		for (i = 1; i < 10; i++) {
+			x = _mm_aesenc_si128(x, rk[i]);
+		}
+		x = _mm_aesenclast_si128(x, rk[10]);
+
+		in += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+
+	_mm_storeu_si128((__m128i *)X, x);
+}
+
+/*
+ * GHASH with PCLMULQDQ, see the Intel white paper "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing the GCM Mode".
+ *
+ * All values are kept byte reflected, so that the bit order matches
+ * the one of the pclmulqdq instruction.
+ */
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_gcm_128_bswap(__m128i v)
+{
+	const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					  8, 9, 10, 11, 12, 13, 14, 15);
+	return _mm_shuffle_epi8(v, mask);
+}
+
+/*
+ * The 256 bit carry-less product of a and b, in lo and hi.
+ */
+static inline AES_ACCEL_TARGET void aes_accel_gcm_128_clmul(__m128i a,
+							    __m128i b,
+							    __m128i *lo,
+							    __m128i *hi)
+{
+	__m128i t0, t1, t2, t3;
+
+	t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t1 = _mm_xor_si128(t1, t2);
+	*lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+	*hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+}
+
+/*
+ * Reduce the 256 bit value lo/hi modulo x^128 + x^7 + x^2 + x + 1.
+ */
+static inline AES_ACCEL_TARGET __m128i aes_accel_gcm_128_reduce(__m128i lo,
+								 __m128i hi)
+{
+	__m128i t7, t8, t9, t2, t4, t5;
+
+	/* shift the product left by one bit, because of the reflection */
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	/* first phase of the reduction */
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	/* second phase of the reduction */
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_gcm_128_mul(__m128i a,
+							      __m128i b)
+{
+	__m128i lo, hi;
+
+	aes_accel_gcm_128_clmul(a, b, &lo, &hi);
+	return aes_accel_gcm_128_reduce(lo, hi);
+}
+
+AES_ACCEL_TARGET
+void aes_accel_gcm_128_init_H(uint8_t H_table[4][AES_BLOCK_SIZE],
+			      const uint8_t H[AES_BLOCK_SIZE])
+{
+	__m128i h1, h2, h3, h4;
+
+	h1 = aes_accel_gcm_128_bswap(_mm_loadu_si128((const __m128i *)H));
+	h2 = aes_accel_gcm_128_mul(h1, h1);
+	h3 = aes_accel_gcm_128_mul(h2, h1);
+	h4 = aes_accel_gcm_128_mul(h3, h1);
+
+	_mm_storeu_si128((__m128i *)H_table[0], h1);
+	_mm_storeu_si128((__m128i *)H_table[1], h2);
+	_mm_storeu_si128((__m128i *)H_table[2], h3);
+	_mm_storeu_si128((__m128i *)H_table[3], h4);
+}
+
+AES_ACCEL_TARGET
+void aes_accel_gcm_128_ghash(const uint8_t H_table[4][AES_BLOCK_SIZE],
+			     uint8_t Y[AES_BLOCK_SIZE],
+			     const uint8_t *in, size_t num_blocks)
+{
+	__m128i h1, h2, h3, h4;
+	__m128i y;
+
+	h1 = _mm_loadu_si128((const __m128i *)H_table[0]);
+	h2 = _mm_loadu_si128((const __m128i *)H_table[1]);
+	h3 = _mm_loadu_si128((const __m128i *)H_table[2]);
+	h4 = _mm_loadu_si128((const __m128i *)H_table[3]);
+
+	y = aes_accel_gcm_128_bswap(_mm_loadu_si128((const __m128i *)Y));
+
+	/*
+	 * Y' = (Y ^ X1)*H^4 ^ X2*H^3 ^ X3*H^2 ^ X4*H,
+	 * with only one reduction per 4 blocks.
+	 */
+	while (num_blocks >= 4) {
+		const __m128i *p = (const __m128i *)in;
+		__m128i x1, x2, x3, x4;
+		__m128i lo, hi, l, h;
+
+		x1 = aes_accel_gcm_128_bswap(_mm_loadu_si128(p + 0));
+		x2 = aes_accel_gcm_128_bswap(_mm_loadu_si128(p + 1));
+		x3 = aes_accel_gcm_128_bswap(_mm_loadu_si128(p + 2));
+		x4 = aes_accel_gcm_128_bswap(_mm_loadu_si128(p + 3));
+
+		x1 = _mm_xor_si128(x1, y);
+
+		aes_accel_gcm_128_clmul(x1, h4, &lo, &hi);
+		aes_accel_gcm_128_clmul(x2, h3, &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		aes_accel_gcm_128_clmul(x3, h2, &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+		aes_accel_gcm_128_clmul(x4, h1, &l, &h);
+		lo = _mm_xor_si128(lo, l);
+		hi = _mm_xor_si128(hi, h);
+
+		y = aes_accel_gcm_128_reduce(lo, hi);
+
+		in += 4 * AES_BLOCK_SIZE;
+		num_blocks -= 4;
+	}
+
+	while (num_blocks > 0) {
+		__m128i x;
+
+		x = aes_accel_gcm_128_bswap(_mm_loadu_si128((const __m128i *)in));
+		y = aes_accel_gcm_128_mul(_mm_xor_si128(x, y), h1);
+
+		in += AES_BLOCK_SIZE;
+		num_blocks -= 1;
+	}
+
+	_mm_storeu_si128((__m128i *)Y, aes_accel_gcm_128_bswap(y));
+}
+
+#else /* defined(HAVE_AES_PCLMUL_INTRINSICS) */
+
+/*
+ * Dummy implementations if the compiler doesn't support the
+ * instructions. Only aes_accel_128_available() will ever be called.
+ */
+
+bool aes_accel_128_available(void)
+{
+	return false;
+}
+
+void aes_accel_128_set_key(struct aes_accel_128_key *key,
+			   const uint8_t K[AES_BLOCK_SIZE])
+{
+	abort();
+}
+
+void aes_accel_128_ctr32_xor(const struct aes_accel_128_key *key,
+			     uint8_t ctr[AES_BLOCK_SIZE],
+			     uint8_t *m, size_t num_blocks)
+{
+	abort();
+}
+
+void aes_accel_128_cbc_mac(const struct aes_accel_128_key *key,
+			   uint8_t X[AES_BLOCK_SIZE],
+			   const uint8_t *in, size_t num_blocks)
+{
+	abort();
+}
+
+void aes_accel_gcm_128_init_H(uint8_t H_table[4][AES_BLOCK_SIZE],
+			      const uint8_t H[AES_BLOCK_SIZE])
+{
+	abort();
+}
+
+void aes_accel_gcm_128_ghash(const uint8_t H_table[4][AES_BLOCK_SIZE],
+			     uint8_t Y[AES_BLOCK_SIZE],
+			     const uint8_t *in, size_t num_blocks)
+{
+	abort();
+}
+
+#endif /* defined(HAVE_AES_PCLMUL_INTRINSICS) */
@@ -0,0 +1,74 @@
+/*
+   AES-128 bulk helpers for the AES-GCM-128 and AES-CCM-128 modes
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIB_CRYPTO_AES_ACCEL_H
+#define LIB_CRYPTO_AES_ACCEL_H
+
+/*
+ * These functions process many blocks at once using the
+ * AES-NI and PCLMULQDQ instructions (and VAES with AVX2 if
+ * available). They can only be used if aes_accel_128_available()
+ * returned true, the portable code in aes_gcm_128.c and
+ * aes_ccm_128.c is used otherwise.
+ */
+
+struct aes_accel_128_key {
+	uint8_t rk[11][AES_BLOCK_SIZE];
+};
+
+bool aes_accel_128_available(void);
+/*
+ * Only for tests and benchmarks: make aes_accel_128_available()
+ * return false, so that the portable code is used.
+ */
+void aes_accel_128_disable(bool disable);
+
+void aes_accel_128_set_key(struct aes_accel_128_key *key,
+			   const uint8_t K[AES_BLOCK_SIZE]);
+
+/*
+ * Increment the last 32 bits of ctr (big endian) and xor the
+ * encrypted counter into each of the num_blocks blocks of m.
+ */
+void aes_accel_128_ctr32_xor(const struct aes_accel_128_key *key,
+			     uint8_t ctr[AES_BLOCK_SIZE],
+			     uint8_t *m, size_t num_blocks);
+
+/*
+ * X = E(X ^ in[i]) for each of the num_blocks blocks of in.
+ */
+void aes_accel_128_cbc_mac(const struct aes_accel_128_key *key,
+			   uint8_t X[AES_BLOCK_SIZE],
+			   const uint8_t *in, size_t num_blocks);
+
+/*
+ * H_table holds H^1 ... H^4 in the format used by
+ * aes_accel_gcm_128_ghash().
+ */
+void aes_accel_gcm_128_init_H(uint8_t H_table[4][AES_BLOCK_SIZE],
+			      const uint8_t H[AES_BLOCK_SIZE]);
+
+/*
+ * Y = (Y ^ in[i]) * H for each of the num_blocks blocks of in.
+ */
+void aes_accel_gcm_128_ghash(const uint8_t H_table[4][AES_BLOCK_SIZE],
+			     uint8_t Y[AES_BLOCK_SIZE],
+			     const uint8_t *in, size_t num_blocks);
+
+#endif /* LIB_CRYPTO_AES_ACCEL_H */
@@ -32,6 +32,10 @@ void aes_ccm_128_init(struct aes_ccm_128_context *ctx,
 	ZERO_STRUCTP(ctx);
 
 	AES_set_encrypt_key(K, 128, &ctx->aes_key);
+	if (aes_accel_128_available()) {
+		ctx->accel = true;
+		aes_accel_128_set_key(&ctx->accel_key, K);
+	}
 	memcpy(ctx->nonce, N, AES_CCM_128_NONCE_SIZE);
 	ctx->a_remain = a_total;
 	ctx->m_remain = m_total;
@@ -113,6 +117,15 @@ void aes_ccm_128_update(struct aes_ccm_128_context *ctx,
 		ctx->B_i_ofs = 0;
 	}
 
+	if (ctx->accel && v_len >= AES_BLOCK_SIZE) {
+		size_t n = v_len / AES_BLOCK_SIZE;
+
+		aes_accel_128_cbc_mac(&ctx->accel_key, ctx->X_i, v, n);
+		v += n * AES_BLOCK_SIZE;
+		v_len -= n * AES_BLOCK_SIZE;
+		*remain -= n * AES_BLOCK_SIZE;
+	}
+
 	while (v_len >= AES_BLOCK_SIZE) {
 		aes_block_xor(ctx->X_i, v, ctx->B_i);
 		AES_encrypt(ctx->B_i, ctx->X_i, &ctx->aes_key);
@@ -152,6 +165,26 @@ static inline void aes_ccm_128_S_i(struct aes_ccm_128_context *ctx,
 void aes_ccm_128_crypt(struct aes_ccm_128_context *ctx,
 		       uint8_t *m, size_t m_len)
 {
+	if (ctx->accel && m_len >= AES_BLOCK_SIZE &&
+	    (ctx->S_i_ofs == 0 || ctx->S_i_ofs == AES_BLOCK_SIZE)) {
+		size_t n;
+
+		if (ctx->S_i_ofs == 0) {
+			/* use the already prepared key stream block */
+			aes_block_xor(m, ctx->S_i, m);
+			m += AES_BLOCK_SIZE;
+			m_len -= AES_BLOCK_SIZE;
+			ctx->S_i_ofs = AES_BLOCK_SIZE;
+		}
+
+		n = m_len / AES_BLOCK_SIZE;
+		RSIVAL(ctx->A_i, (AES_BLOCK_SIZE - AES_CCM_128_L), ctx->S_i_ctr);
+		aes_accel_128_ctr32_xor(&ctx->accel_key, ctx->A_i, m, n);
+		ctx->S_i_ctr += n;
+		m += n * AES_BLOCK_SIZE;
+		m_len -= n * AES_BLOCK_SIZE;
+	}
+
 	while (m_len > 0) {
 		if (ctx->S_i_ofs == AES_BLOCK_SIZE) {
 			ctx->S_i_ctr += 1;
@@ -42,6 +42,9 @@ struct aes_ccm_128_context {
 	size_t B_i_ofs;
 	size_t S_i_ofs;
 	size_t S_i_ctr;
+
+	bool accel;
+	struct aes_accel_128_key accel_key;
 };
 
 void aes_ccm_128_init(struct aes_ccm_128_context *ctx,
@@ -66,6 +66,11 @@ static inline void aes_gcm_128_mul(const uint8_t x[AES_BLOCK_SIZE],
 static inline void aes_gcm_128_ghash_block(struct aes_gcm_128_context *ctx,
 					   const uint8_t in[AES_BLOCK_SIZE])
 {
+	if (ctx->accel) {
+		aes_accel_gcm_128_ghash(ctx->accel_H, ctx->Y, in, 1);
+		return;
+	}
+
 	aes_block_xor(ctx->Y, in, ctx->y.block);
 	aes_gcm_128_mul(ctx->y.block, ctx->H, ctx->v.block, ctx->Y);
 }
@@ -83,6 +88,12 @@ void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
 	 */
 	AES_encrypt(ctx->Y, ctx->H, &ctx->aes_key);
 
+	if (aes_accel_128_available()) {
+		ctx->accel = true;
+		aes_accel_128_set_key(&ctx->accel_key, K);
+		aes_accel_gcm_128_init_H(ctx->accel_H, ctx->H);
+	}
+
 	/*
 	 * Step 2: generate J0
 	 */
@@ -116,6 +127,14 @@ static inline void aes_gcm_128_update_tmp(struct aes_gcm_128_context *ctx,
 		tmp->ofs = 0;
 	}
 
+	if (ctx->accel && v_len >= AES_BLOCK_SIZE) {
+		size_t n = v_len / AES_BLOCK_SIZE;
+
+		aes_accel_gcm_128_ghash(ctx->accel_H, ctx->Y, v, n);
+		v += n * AES_BLOCK_SIZE;
+		v_len -= n * AES_BLOCK_SIZE;
+	}
+
 	while (v_len >= AES_BLOCK_SIZE) {
 		aes_gcm_128_ghash_block(ctx, v);
 		v += AES_BLOCK_SIZE;
@@ -154,6 +173,24 @@ static inline void aes_gcm_128_crypt_tmp(struct aes_gcm_128_context *ctx,
 {
 	tmp->total += m_len;
 
+	if (ctx->accel && m_len >= AES_BLOCK_SIZE &&
+	    (tmp->ofs == 0 || tmp->ofs == AES_BLOCK_SIZE)) {
+		size_t n;
+
+		if (tmp->ofs == 0) {
+			/* use the already prepared key stream block */
+			aes_block_xor(m, tmp->block, m);
+			m += AES_BLOCK_SIZE;
+			m_len -= AES_BLOCK_SIZE;
+			tmp->ofs = AES_BLOCK_SIZE;
+		}
+
+		n = m_len / AES_BLOCK_SIZE;
+		aes_accel_128_ctr32_xor(&ctx->accel_key, ctx->CB, m, n);
+		m += n * AES_BLOCK_SIZE;
+		m_len -= n * AES_BLOCK_SIZE;
+	}
+
 	while (m_len > 0) {
 		if (tmp->ofs == AES_BLOCK_SIZE) {
 			aes_gcm_128_inc32(ctx->CB);
@@ -38,6 +38,10 @@ struct aes_gcm_128_context {
 	uint8_t CB[AES_BLOCK_SIZE];
 	uint8_t Y[AES_BLOCK_SIZE];
 	uint8_t AC[AES_BLOCK_SIZE];
+
+	bool accel;
+	struct aes_accel_128_key accel_key;
+	uint8_t accel_H[4][AES_BLOCK_SIZE];
 };
 
 void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
@@ -28,6 +28,7 @@
 #include "../lib/crypto/hmacsha256.h"
 #include "../lib/crypto/arcfour.h"
 #include "../lib/crypto/aes.h"
+#include "../lib/crypto/aes_accel.h"
 #include "../lib/crypto/aes_cmac_128.h"
 #include "../lib/crypto/aes_ccm_128.h"
 #include "../lib/crypto/aes_gcm_128.h"
@@ -27,6 +27,8 @@
 #include "dbwrap/dbwrap_private.h"
 #include "lib/util/util_tdb.h"
 #include "lib/util/tevent_ntstatus.h"
+#include "libcli/util/error.h"
+#include "lib/pthreadpool/pthreadpool_pipe.h"
 
 /*
  * Fall back using fetch if no genuine exists operation is provided
@@ -386,6 +388,158 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 	return NT_STATUS_OK;
 }
 
+struct dbwrap_traverse_partition_state {
+	struct db_context *db;
+	unsigned partition;
+	unsigned num_partitions;
+	int (*f)(struct db_record *rec, unsigned partition,
+		 void *private_data);
+	void *private_data;
+
+	/*
+	 * Shared by all partitions. Set once from any thread, a stale
+	 * read only delays the stop.
+	 */
+	volatile bool *stop;
+
+	NTSTATUS status;
+	int count;
+};
+
+static int dbwrap_traverse_partition_fn(struct db_record *rec,
+					void *private_data)
+{
+	struct dbwrap_traverse_partition_state *state = private_data;
+	int ret;
+
+	if (*state->stop) {
+		return 1;
+	}
+
+	ret = state->f(rec, state->partition, state->private_data);
+	if (ret != 0) {
+		*state->stop = true;
+	}
+	return ret;
+}
+
+static void dbwrap_traverse_partition_job(void *private_data)
+{
+	struct dbwrap_traverse_partition_state *state = private_data;
+
+	state->status = state->db->traverse_read_partition(
+		state->db, state->partition, state->num_partitions,
+		dbwrap_traverse_partition_fn, state, &state->count);
+}
+
+NTSTATUS dbwrap_traverse_read_parallel(
+	struct db_context *db, unsigned num_partitions,
+	int (*f)(struct db_record *rec, unsigned partition,
+		 void *private_data),
+	void *private_data, int *count)
+{
+	struct dbwrap_traverse_partition_state *states = NULL;
+	struct pthreadpool_pipe *pool = NULL;
+	volatile bool stop = false;
+	unsigned i, num_jobs = 0;
+	NTSTATUS status = NT_STATUS_OK;
+	int total = 0;
+	int ret;
+
+	if (num_partitions == 0) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if ((db->traverse_read_partition == NULL) ||
+	    (db->traverse_read_partition_possible == NULL) ||
+	    !db->traverse_read_partition_possible(db)) {
+		/*
+		 * Not possible right now, for example in a
+		 * transaction. Decide before any record is looked at,
+		 * a partial parallel traverse can't be completed serially.
+		 */
+		num_partitions = 1;
+	}
+
+	states = talloc_zero_array(talloc_tos(),
+				   struct dbwrap_traverse_partition_state,
+				   num_partitions);
+	if (states == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	for (i=0; i<num_partitions; i++) {
+		states[i] = (struct dbwrap_traverse_partition_state) {
+			.db = db, .partition = i,
+			.num_partitions = num_partitions,
+			.f = f, .private_data = private_data,
+			.stop = &stop,
+		};
+	}
+
+	if (num_partitions == 1) {
+		status = dbwrap_traverse_read(db, dbwrap_traverse_partition_fn,
+					      &states[0], count);
+		TALLOC_FREE(states);
+		return status;
+	}
+
+	ret = pthreadpool_pipe_init(num_partitions, &pool);
+	if (ret != 0) {
+		TALLOC_FREE(states);
+		return map_nt_error_from_unix_common(ret);
+	}
+
+	for (i=0; i<num_partitions; i++) {
+		ret = pthreadpool_pipe_add_job(pool, i,
+					       dbwrap_traverse_partition_job,
+					       &states[i]);
+		if (ret != 0) {
+			status = map_nt_error_from_unix_common(ret);
+			stop = true;
+			break;
+		}
+		num_jobs += 1;
+	}
+
+	while (num_jobs > 0) {
+		int jobid;
+
+		ret = pthreadpool_pipe_finished_jobs(pool, &jobid, 1);
+		if (ret < 0) {
+			/*
+			 * We can't leave while threads still look at
+			 * "states".
+			 */
+			smb_panic("pthreadpool_pipe_finished_jobs failed");
+		}
+		num_jobs -= ret;
+	}
+	pthreadpool_pipe_destroy(pool);
+
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(states);
+		return status;
+	}
+
+	for (i=0; i<num_partitions; i++) {
+		if (!NT_STATUS_IS_OK(states[i].status)) {
+			status = states[i].status;
+		}
+		total += states[i].count;
+	}
+	TALLOC_FREE(states);
+
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (count != NULL) {
+		*count = total;
+	}
+	return NT_STATUS_OK;
+}
+
 static void dbwrap_null_parser(TDB_DATA key, TDB_DATA val, void* data)
 {
 	return;
@@ -402,6 +556,52 @@ NTSTATUS dbwrap_parse_record(struct db_context *db, TDB_DATA key,
 	return db->parse_record(db, key, parser, private_data);
 }
 
+struct dbwrap_parse_records_state {
+	void (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+		       void *private_data);
+	void *private_data;
+	size_t idx;
+};
+
+static void dbwrap_parse_records_parser(TDB_DATA key, TDB_DATA data,
+					void *private_data)
+{
+	struct dbwrap_parse_records_state *state = private_data;
+	state->parser(state->idx, key, data, state->private_data);
+}
+
+NTSTATUS dbwrap_parse_records(struct db_context *db,
+			      const TDB_DATA *keys, size_t num_keys,
+			      void (*parser)(size_t idx, TDB_DATA key,
+					     TDB_DATA data,
+					     void *private_data),
+			      void *private_data)
+{
+	struct dbwrap_parse_records_state state = {
+		.parser = parser, .private_data = private_data
+	};
+
+	if (db->parse_records != NULL) {
+		return db->parse_records(db, keys, num_keys, parser,
+					 private_data);
+	}
+
+	for (state.idx = 0; state.idx < num_keys; state.idx++) {
+		NTSTATUS status;
+
+		status = db->parse_record(db, keys[state.idx],
+					  dbwrap_parse_records_parser, &state);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+			continue;
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
 struct dbwrap_parse_record_state {
 	struct db_context *db;
 	TDB_DATA key;
@@ -565,6 +765,22 @@ int dbwrap_check(struct db_context *db)
 	return db->check(db);
 }
 
+NTSTATUS dbwrap_compact_step(struct db_context *db, unsigned max_records,
+			     int *moved)
+{
+	int dummy;
+
+	if (moved == NULL) {
+		moved = &dummy;
+	}
+	*moved = 0;
+
+	if (db->compact_step == NULL) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+	return db->compact_step(db, max_records, moved);
+}
+
 int dbwrap_get_seqnum(struct db_context *db)
 {
 	return db->get_seqnum(db);
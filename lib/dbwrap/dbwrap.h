@@ -102,6 +102,39 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 			      int (*f)(struct db_record*, void*),
 			      void *private_data,
 			      int *count);
+
+/**
+ * Traverse the database read-only with several threads
+ *
+ * The database is split into "num_partitions" parts that are traversed
+ * at the same time, one thread each. "f" is called with the partition
+ * a record is in. Calls for the same partition are never concurrent,
+ * calls for different partitions are: "f" must only touch per-partition
+ * state and must not use talloc contexts, debug or the database itself.
+ *
+ * A non-zero return from "f" stops all partitions, some records might
+ * still be seen in other partitions.
+ *
+ * Backends that can't do this (and databases inside transactions)
+ * fall back to dbwrap_traverse_read() with everything in partition 0.
+ *
+ * @param[in]  db             Database to traverse
+ *
+ * @param[in]  num_partitions Number of partitions and threads
+ *
+ * @param[in]  f              Callback function
+ *
+ * @param[in]  private_data   Private data for the callback function
+ *
+ * @param[out] count          Number of records seen, may be NULL
+ *
+ * @return NT_STATUS_OK on success
+ **/
+NTSTATUS dbwrap_traverse_read_parallel(
+	struct db_context *db, unsigned num_partitions,
+	int (*f)(struct db_record *rec, unsigned partition,
+		 void *private_data),
+	void *private_data, int *count);
 NTSTATUS dbwrap_parse_record(struct db_context *db, TDB_DATA key,
 			     void (*parser)(TDB_DATA key, TDB_DATA data,
 					    void *private_data),
@@ -138,8 +171,50 @@ struct tevent_req *dbwrap_parse_record_send(
 	void *private_data,
 	enum dbwrap_req_state *req_state);
 NTSTATUS dbwrap_parse_record_recv(struct tevent_req *req);
+
+/**
+ * Look up a batch of records
+ *
+ * This calls "parser" for every key in "keys" that exists, passing the
+ * index of the key in "keys". The order of the calls is undefined:
+ * Backends sort the keys to look them up with as few locks as possible.
+ * Keys that don't exist are silently skipped.
+ *
+ * @param[in]  db           Database to query
+ *
+ * @param[in]  keys         Record keys
+ *
+ * @param[in]  num_keys     Number of keys
+ *
+ * @param[in]  parser       Parser callback function
+ *
+ * @param[in]  private_data Private data for the callback function
+ *
+ * @return NT_STATUS_OK if all keys were looked up
+ **/
+NTSTATUS dbwrap_parse_records(struct db_context *db,
+			      const TDB_DATA *keys, size_t num_keys,
+			      void (*parser)(size_t idx, TDB_DATA key,
+					     TDB_DATA data,
+					     void *private_data),
+			      void *private_data);
 int dbwrap_wipe(struct db_context *db);
 int dbwrap_check(struct db_context *db);
+/**
+ * @brief Do one step of an online compaction of the database file.
+ *
+ * Moves at most max_records records from the end of the file into free
+ * space further down and gives back free space at the end of the file.
+ * This never waits for locks held by others, call it periodically.
+ *
+ * @param[in]  db           The database to compact.
+ * @param[in]  max_records  The maximum number of records to move.
+ * @param[out] moved        The number of records moved, may be NULL.
+ *
+ * @return NT_STATUS_NOT_SUPPORTED if the backend can't do it
+ **/
+NTSTATUS dbwrap_compact_step(struct db_context *db, unsigned max_records,
+			     int *moved);
 int dbwrap_get_seqnum(struct db_context *db);
 /* Returns 0 if unknown. */
 int dbwrap_transaction_start(struct db_context *db);
@@ -50,6 +50,12 @@ struct db_context {
 			     int (*f)(struct db_record *rec,
 				      void *private_data),
 			     void *private_data);
+	NTSTATUS (*traverse_read_partition)(
+		struct db_context *db, unsigned partition,
+		unsigned num_partitions,
+		int (*f)(struct db_record *rec, void *private_data),
+		void *private_data, int *count);
+	bool (*traverse_read_partition_possible)(struct db_context *db);
 	int (*get_seqnum)(struct db_context *db);
 	int (*transaction_start)(struct db_context *db);
 	NTSTATUS (*transaction_start_nonblock)(struct db_context *db);
@@ -68,6 +74,12 @@ struct db_context {
 		void *private_data,
 		enum dbwrap_req_state *req_state);
 	NTSTATUS (*parse_record_recv)(struct tevent_req *req);
+	NTSTATUS (*parse_records)(struct db_context *db,
+				  const TDB_DATA *keys, size_t num_keys,
+				  void (*parser)(size_t idx, TDB_DATA key,
+						 TDB_DATA data,
+						 void *private_data),
+				  void *private_data);
 	NTSTATUS (*do_locked)(struct db_context *db, TDB_DATA key,
 			      void (*fn)(struct db_record *rec,
 					 void *private_data),
@@ -75,6 +87,8 @@ struct db_context {
 	int (*exists)(struct db_context *db,TDB_DATA key);
 	int (*wipe)(struct db_context *db);
 	int (*check)(struct db_context *db);
+	NTSTATUS (*compact_step)(struct db_context *db, unsigned max_records,
+				 int *moved);
 	size_t (*id)(struct db_context *db, uint8_t *id, size_t idlen);
 
 	const char *name;
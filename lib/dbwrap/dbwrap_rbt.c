@@ -420,6 +420,26 @@ static NTSTATUS db_rbt_parse_record(struct db_context *db, TDB_DATA key,
 	return NT_STATUS_OK;
 }
 
+static NTSTATUS db_rbt_parse_records(struct db_context *db,
+				     const TDB_DATA *keys, size_t num_keys,
+				     void (*parser)(size_t idx, TDB_DATA key,
+						    TDB_DATA data,
+						    void *private_data),
+				     void *private_data)
+{
+	size_t i;
+
+	for (i=0; i<num_keys; i++) {
+		struct db_rbt_search_result res;
+		bool found = db_rbt_search_internal(db, keys[i], &res);
+
+		if (found) {
+			parser(i, res.key, res.val, private_data);
+		}
+	}
+	return NT_STATUS_OK;
+}
+
 static int db_rbt_traverse_internal(struct db_context *db,
 				    int (*f)(struct db_record *db,
 					     void *private_data),
@@ -567,6 +587,7 @@ struct db_context *db_open_rbt(TALLOC_CTX *mem_ctx)
 	result->exists = db_rbt_exists;
 	result->wipe = db_rbt_wipe;
 	result->parse_record = db_rbt_parse_record;
+	result->parse_records = db_rbt_parse_records;
 	result->id = db_rbt_id;
 	result->name = "dbwrap rbt";
 
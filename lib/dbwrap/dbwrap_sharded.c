@@ -0,0 +1,460 @@
+/*
+   Unix SMB/CIFS implementation.
+   Database interface spreading keys over several backend databases
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Every key lives in exactly one of a number of independent backend
+ * databases. With tdb each shard has its own hash chains, freelist and
+ * file, so processes working on different keys (for locking.tdb:
+ * different file ids) don't contend for the same chain or freelist
+ * locks. Operations on a single key are simply passed to its shard,
+ * the records handed out are the shard's records.
+ *
+ * There is no cross-shard atomicity, so only non-persistent databases
+ * can be sharded. dbwrap refuses transactions on those anyway.
+ */
+
+#include "includes.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_private.h"
+#include "dbwrap/dbwrap_sharded.h"
+
+struct db_sharded_ctx {
+	size_t num_shards;
+	struct db_context **shards;
+};
+
+static size_t db_sharded_shard_idx(struct db_sharded_ctx *ctx, TDB_DATA key)
+{
+	uint64_t hash;
+
+	/*
+	 * The shard is always picked with the jenkins hash, on
+	 * purpose independent of the hash function the shard's tdb
+	 * uses for its chains (jenkins by default, wyhash with
+	 * TDB_WYHASH). That keeps the layout of a sharded database
+	 * stable whatever the shards are opened with.
+	 *
+	 * Use the upper bits: a jenkins-hashed tdb picks the hash
+	 * chain from the lower ones, so taking "hash % num_shards"
+	 * would leave most chains in each shard unused.
+	 */
+	hash = tdb_jenkins_hash(&key);
+	return (hash * ctx->num_shards) >> 32;
+}
+
+static struct db_context *db_sharded_shard(struct db_context *db,
+					   TDB_DATA key)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+
+	return ctx->shards[db_sharded_shard_idx(ctx, key)];
+}
+
+static struct db_record *db_sharded_fetch_locked(struct db_context *db,
+						 TALLOC_CTX *mem_ctx,
+						 TDB_DATA key)
+{
+	return dbwrap_fetch_locked(db_sharded_shard(db, key), mem_ctx, key);
+}
+
+static struct db_record *db_sharded_try_fetch_locked(struct db_context *db,
+						     TALLOC_CTX *mem_ctx,
+						     TDB_DATA key)
+{
+	return dbwrap_try_fetch_locked(db_sharded_shard(db, key), mem_ctx,
+				       key);
+}
+
+static NTSTATUS db_sharded_do_locked(struct db_context *db, TDB_DATA key,
+				     void (*fn)(struct db_record *rec,
+						void *private_data),
+				     void *private_data)
+{
+	return dbwrap_do_locked(db_sharded_shard(db, key), key, fn,
+				private_data);
+}
+
+static NTSTATUS db_sharded_parse_record(
+	struct db_context *db, TDB_DATA key,
+	void (*parser)(TDB_DATA key, TDB_DATA data, void *private_data),
+	void *private_data)
+{
+	return dbwrap_parse_record(db_sharded_shard(db, key), key, parser,
+				   private_data);
+}
+
+struct db_sharded_parse_records_state {
+	const size_t *idxs;
+	void (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+		       void *private_data);
+	void *private_data;
+};
+
+static void db_sharded_parse_records_parser(size_t idx, TDB_DATA key,
+					    TDB_DATA data, void *private_data)
+{
+	struct db_sharded_parse_records_state *state = private_data;
+	state->parser(state->idxs[idx], key, data, state->private_data);
+}
+
+/*
+ * Hand every shard the part of the batch it holds
+ */
+static NTSTATUS db_sharded_parse_records(
+	struct db_context *db, const TDB_DATA *keys, size_t num_keys,
+	void (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+		       void *private_data),
+	void *private_data)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	struct db_sharded_parse_records_state state = {
+		.parser = parser, .private_data = private_data
+	};
+	TDB_DATA *shard_keys = NULL;
+	size_t *shard_of = NULL;
+	size_t *idxs = NULL;
+	NTSTATUS status = NT_STATUS_OK;
+	size_t i, s;
+
+	if (num_keys == 0) {
+		return NT_STATUS_OK;
+	}
+
+	shard_keys = talloc_array(talloc_tos(), TDB_DATA, num_keys);
+	shard_of = talloc_array(shard_keys, size_t, num_keys);
+	idxs = talloc_array(shard_keys, size_t, num_keys);
+	if ((shard_keys == NULL) || (shard_of == NULL) || (idxs == NULL)) {
+		TALLOC_FREE(shard_keys);
+		return NT_STATUS_NO_MEMORY;
+	}
+	state.idxs = idxs;
+
+	for (i=0; i<num_keys; i++) {
+		shard_of[i] = db_sharded_shard_idx(ctx, keys[i]);
+	}
+
+	for (s=0; s<ctx->num_shards; s++) {
+		size_t num_shard_keys = 0;
+
+		for (i=0; i<num_keys; i++) {
+			if (shard_of[i] == s) {
+				shard_keys[num_shard_keys] = keys[i];
+				idxs[num_shard_keys] = i;
+				num_shard_keys += 1;
+			}
+		}
+		if (num_shard_keys == 0) {
+			continue;
+		}
+
+		status = dbwrap_parse_records(
+			ctx->shards[s], shard_keys, num_shard_keys,
+			db_sharded_parse_records_parser, &state);
+		if (!NT_STATUS_IS_OK(status)) {
+			break;
+		}
+	}
+
+	TALLOC_FREE(shard_keys);
+	return status;
+}
+
+static int db_sharded_exists(struct db_context *db, TDB_DATA key)
+{
+	return dbwrap_exists(db_sharded_shard(db, key), key);
+}
+
+struct db_sharded_traverse_state {
+	int (*fn)(struct db_record *rec, void *private_data);
+	void *private_data;
+	bool stopped;
+};
+
+static int db_sharded_traverse_fn(struct db_record *rec, void *private_data)
+{
+	struct db_sharded_traverse_state *state = private_data;
+	int ret;
+
+	ret = state->fn(rec, state->private_data);
+	if (ret != 0) {
+		state->stopped = true;
+	}
+	return ret;
+}
+
+static int db_sharded_traverse_shards(
+	struct db_context *db,
+	NTSTATUS (*traverse)(struct db_context *db,
+			     int (*f)(struct db_record*, void*),
+			     void *private_data,
+			     int *count),
+	int (*fn)(struct db_record *rec, void *private_data),
+	void *private_data)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	struct db_sharded_traverse_state state = {
+		.fn = fn, .private_data = private_data
+	};
+	int total = 0;
+	size_t i;
+
+	for (i=0; i<ctx->num_shards; i++) {
+		NTSTATUS status;
+		int count = 0;
+
+		status = traverse(ctx->shards[i], db_sharded_traverse_fn,
+				  &state, &count);
+		if (!NT_STATUS_IS_OK(status)) {
+			return -1;
+		}
+		total += count;
+
+		if (state.stopped) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+static int db_sharded_traverse(struct db_context *db,
+			       int (*fn)(struct db_record *rec,
+					 void *private_data),
+			       void *private_data)
+{
+	return db_sharded_traverse_shards(db, dbwrap_traverse, fn,
+					  private_data);
+}
+
+static int db_sharded_traverse_read(struct db_context *db,
+				    int (*fn)(struct db_record *rec,
+					      void *private_data),
+				    void *private_data)
+{
+	return db_sharded_traverse_shards(db, dbwrap_traverse_read, fn,
+					  private_data);
+}
+
+/*
+ * Partition "partition" of every shard, so the threads of
+ * dbwrap_traverse_read_parallel() each walk a slice of all shards.
+ */
+static NTSTATUS db_sharded_traverse_read_partition(
+	struct db_context *db, unsigned partition, unsigned num_partitions,
+	int (*fn)(struct db_record *rec, void *private_data),
+	void *private_data, int *count)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	int total = 0;
+	size_t i;
+
+	for (i=0; i<ctx->num_shards; i++) {
+		struct db_context *shard = ctx->shards[i];
+		NTSTATUS status;
+		int shard_count = 0;
+
+		status = shard->traverse_read_partition(
+			shard, partition, num_partitions, fn, private_data,
+			&shard_count);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		total += shard_count;
+	}
+
+	*count = total;
+	return NT_STATUS_OK;
+}
+
+static bool db_sharded_traverse_read_partition_possible(
+	struct db_context *db)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	size_t i;
+
+	for (i=0; i<ctx->num_shards; i++) {
+		struct db_context *shard = ctx->shards[i];
+
+		if ((shard->traverse_read_partition == NULL) ||
+		    (shard->traverse_read_partition_possible == NULL) ||
+		    !shard->traverse_read_partition_possible(shard)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int db_sharded_get_seqnum(struct db_context *db)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	unsigned seqnum = 0;
+	size_t i;
+
+	/*
+	 * Any change in any shard changes the sum. Callers only compare
+	 * seqnums for equality.
+	 */
+	for (i=0; i<ctx->num_shards; i++) {
+		seqnum += (unsigned)dbwrap_get_seqnum(ctx->shards[i]);
+	}
+
+	return (int)seqnum;
+}
+
+static int db_sharded_wipe(struct db_context *db)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	size_t i;
+
+	for (i=0; i<ctx->num_shards; i++) {
+		int ret = dbwrap_wipe(ctx->shards[i]);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int db_sharded_check(struct db_context *db)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	size_t i;
+
+	for (i=0; i<ctx->num_shards; i++) {
+		int ret = dbwrap_check(ctx->shards[i]);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static NTSTATUS db_sharded_compact_step(struct db_context *db,
+					unsigned max_records, int *moved)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+	size_t i;
+
+	for (i=0; i<ctx->num_shards; i++) {
+		NTSTATUS status;
+		int shard_moved;
+
+		status = dbwrap_compact_step(ctx->shards[i], max_records,
+					     &shard_moved);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		*moved += shard_moved;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static size_t db_sharded_id(struct db_context *db, uint8_t *id, size_t idlen)
+{
+	struct db_sharded_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_sharded_ctx);
+
+	return dbwrap_db_id(ctx->shards[0], id, idlen);
+}
+
+struct db_context *db_open_sharded(TALLOC_CTX *mem_ctx,
+				   const char *name,
+				   struct db_context **shards,
+				   size_t num_shards)
+{
+	struct db_context *db;
+	struct db_sharded_ctx *ctx;
+	size_t i;
+
+	if ((num_shards == 0) || (num_shards > UINT32_MAX)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i=0; i<num_shards; i++) {
+		if (shards[i]->persistent ||
+		    (shards[i]->lock_order != shards[0]->lock_order)) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
+	db = talloc_zero(mem_ctx, struct db_context);
+	if (db == NULL) {
+		return NULL;
+	}
+	ctx = talloc_zero(db, struct db_sharded_ctx);
+	if (ctx == NULL) {
+		TALLOC_FREE(db);
+		return NULL;
+	}
+	db->private_data = ctx;
+
+	ctx->shards = talloc_array(ctx, struct db_context *, num_shards);
+	if (ctx->shards == NULL) {
+		TALLOC_FREE(db);
+		return NULL;
+	}
+	ctx->num_shards = num_shards;
+
+	db->name = talloc_strdup(db, name);
+	if (db->name == NULL) {
+		TALLOC_FREE(db);
+		return NULL;
+	}
+
+	db->lock_order = shards[0]->lock_order;
+
+	for (i=0; i<num_shards; i++) {
+		shards[i]->lock_order = DBWRAP_LOCK_ORDER_NONE;
+		ctx->shards[i] = talloc_move(ctx->shards, &shards[i]);
+	}
+
+	db->fetch_locked = db_sharded_fetch_locked;
+	db->try_fetch_locked = db_sharded_try_fetch_locked;
+	db->do_locked = db_sharded_do_locked;
+	db->traverse = db_sharded_traverse;
+	db->traverse_read = db_sharded_traverse_read;
+	db->traverse_read_partition = db_sharded_traverse_read_partition;
+	db->traverse_read_partition_possible =
+		db_sharded_traverse_read_partition_possible;
+	db->get_seqnum = db_sharded_get_seqnum;
+	db->parse_record = db_sharded_parse_record;
+	db->parse_records = db_sharded_parse_records;
+	db->exists = db_sharded_exists;
+	db->wipe = db_sharded_wipe;
+	db->check = db_sharded_check;
+	db->compact_step = db_sharded_compact_step;
+	db->id = db_sharded_id;
+	db->persistent = false;
+
+	return db;
+}
@@ -0,0 +1,36 @@
+/*
+   Unix SMB/CIFS implementation.
+   Database interface spreading keys over several backend databases
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DBWRAP_SHARDED_H__
+#define __DBWRAP_SHARDED_H__
+
+#include <talloc.h>
+
+struct db_context;
+
+/*
+ * Takes ownership of the shards array members. All shards must be
+ * opened with the same lock order, the sharded db takes it over.
+ */
+struct db_context *db_open_sharded(TALLOC_CTX *mem_ctx,
+				   const char *name,
+				   struct db_context **shards,
+				   size_t num_shards);
+
+#endif /* __DBWRAP_SHARDED_H__ */
@@ -241,6 +241,21 @@ static int db_tdb_check(struct db_context *db)
 	return tdb_check(ctx->wtdb->tdb, NULL, NULL);
 }
 
+static NTSTATUS db_tdb_compact_step(struct db_context *db,
+				    unsigned max_records, int *moved)
+{
+	struct db_tdb_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_tdb_ctx);
+	int ret;
+
+	ret = tdb_compact_step(ctx->wtdb->tdb, max_records);
+	if (ret == -1) {
+		return map_nt_error_from_tdb(tdb_error(ctx->wtdb->tdb));
+	}
+	*moved = ret;
+	return NT_STATUS_OK;
+}
+
 struct db_tdb_parse_state {
 	void (*parser)(TDB_DATA key, TDB_DATA data,
 		       void *private_data);
@@ -282,6 +297,44 @@ static NTSTATUS db_tdb_parse(struct db_context *db, TDB_DATA key,
 	return NT_STATUS_OK;
 }
 
+struct db_tdb_parse_records_state {
+	void (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+		       void *private_data);
+	void *private_data;
+};
+
+static int db_tdb_records_parser(size_t idx, TDB_DATA key, TDB_DATA data,
+				 void *private_data)
+{
+	struct db_tdb_parse_records_state *state =
+		(struct db_tdb_parse_records_state *)private_data;
+	state->parser(idx, key, data, state->private_data);
+	return 0;
+}
+
+static NTSTATUS db_tdb_parse_records(struct db_context *db,
+				     const TDB_DATA *keys, size_t num_keys,
+				     void (*parser)(size_t idx, TDB_DATA key,
+						    TDB_DATA data,
+						    void *private_data),
+				     void *private_data)
+{
+	struct db_tdb_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_tdb_ctx);
+	struct db_tdb_parse_records_state state = {
+		.parser = parser, .private_data = private_data
+	};
+	int ret;
+
+	ret = tdb_parse_records(ctx->wtdb->tdb, keys, num_keys,
+				db_tdb_records_parser, &state);
+
+	if (ret != 0) {
+		return map_nt_error_from_tdb(tdb_error(ctx->wtdb->tdb));
+	}
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS db_tdb_storev(struct db_record *rec,
 			      const TDB_DATA *dbufs, int num_dbufs, int flag)
 {
@@ -395,6 +448,59 @@ static int db_tdb_traverse_read(struct db_context *db,
 	return tdb_traverse_read(db_ctx->wtdb->tdb, db_tdb_traverse_read_func, &ctx);
 }
 
+/*
+ * Runs in a thread: tdb_traverse_chains_read() allows this for disjoint
+ * chain ranges.
+ */
+static NTSTATUS db_tdb_traverse_read_partition(
+	struct db_context *db, unsigned partition, unsigned num_partitions,
+	int (*f)(struct db_record *rec, void *private_data),
+	void *private_data, int *count)
+{
+	struct db_tdb_ctx *db_ctx =
+		talloc_get_type_abort(db->private_data, struct db_tdb_ctx);
+	struct tdb_context *tdb = db_ctx->wtdb->tdb;
+	struct db_tdb_traverse_ctx ctx = {
+		.db = db, .f = f, .private_data = private_data
+	};
+	uint64_t hash_size = tdb_hash_size(tdb);
+	uint32_t first = hash_size * partition / num_partitions;
+	uint32_t end = hash_size * (partition+1) / num_partitions;
+	enum TDB_ERROR err;
+	int ret;
+
+	/*
+	 * Other threads run on the same tdb, use our own error code,
+	 * not tdb_error().
+	 */
+	ret = tdb_traverse_chains_read(tdb, first, end - first,
+				       db_tdb_traverse_read_func, &ctx, &err);
+	if (ret == -1) {
+		if (err == TDB_ERR_EINVAL) {
+			return NT_STATUS_NOT_SUPPORTED;
+		}
+		return map_nt_error_from_tdb(err);
+	}
+
+	*count = ret;
+	return NT_STATUS_OK;
+}
+
+/*
+ * An empty range of chains looks at no records, it just checks whether
+ * tdb_traverse_chains_read() can run right now.
+ */
+static bool db_tdb_traverse_read_partition_possible(struct db_context *db)
+{
+	struct db_tdb_ctx *db_ctx =
+		talloc_get_type_abort(db->private_data, struct db_tdb_ctx);
+	int ret;
+
+	ret = tdb_traverse_chains_read(db_ctx->wtdb->tdb, 0, 0, NULL, NULL,
+				       NULL);
+	return (ret != -1);
+}
+
 static int db_tdb_get_seqnum(struct db_context *db)
 
 {
@@ -495,7 +601,11 @@ struct db_context *db_open_tdb(TALLOC_CTX *mem_ctx,
 	result->do_locked = db_tdb_do_locked;
 	result->traverse = db_tdb_traverse;
 	result->traverse_read = db_tdb_traverse_read;
+	result->traverse_read_partition = db_tdb_traverse_read_partition;
+	result->traverse_read_partition_possible =
+		db_tdb_traverse_read_partition_possible;
 	result->parse_record = db_tdb_parse;
+	result->parse_records = db_tdb_parse_records;
 	result->get_seqnum = db_tdb_get_seqnum;
 	result->persistent = ((tdb_flags & TDB_CLEAR_IF_FIRST) == 0);
 	result->transaction_start = db_tdb_transaction_start;
@@ -506,6 +616,7 @@ struct db_context *db_open_tdb(TALLOC_CTX *mem_ctx,
 	result->wipe = db_tdb_wipe;
 	result->id = db_tdb_id;
 	result->check = db_tdb_check;
+	result->compact_step = db_tdb_compact_step;
 	result->name = tdb_name(db_tdb->wtdb->tdb);
 	return result;
 
@@ -56,7 +56,7 @@ static bool tdb_check_header(struct tdb_context *tdb, tdb_off_t *recovery)
 		goto corrupt;
 
 	if (hdr.recovery_start != 0 &&
-	    hdr.recovery_start < TDB_DATA_START(tdb->hash_size))
+	    hdr.recovery_start < TDB_DATA_START(tdb))
 		goto corrupt;
 
 	*recovery = hdr.recovery_start;
@@ -76,7 +76,7 @@ static bool tdb_check_record(struct tdb_context *tdb,
 	tdb_off_t tailer;
 
 	/* Check rec->next: 0 or points to record offset, aligned. */
-	if (rec->next > 0 && rec->next < TDB_DATA_START(tdb->hash_size)){
+	if (rec->next > 0 && rec->next < TDB_DATA_START(tdb)){
 		TDB_LOG((tdb, TDB_DEBUG_ERROR,
 			 "Record offset %u too small next %u\n",
 			 off, rec->next));
@@ -309,6 +309,31 @@ static bool tdb_check_free_record(struct tdb_context *tdb,
 	return true;
 }
 
+/* Check a record on the freelist of a hash chain. */
+static bool tdb_check_chain_free_record(struct tdb_context *tdb,
+					tdb_off_t off,
+					const struct tdb_record *rec,
+					unsigned char **hashes)
+{
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR,
+			 "Unexpected chain free record at offset %u\n", off));
+		return false;
+	}
+
+	if (!tdb_check_record(tdb, off, rec))
+		return false;
+
+	/*
+	 * Same bitmap as the chain's used records: every offset has to
+	 * show up exactly twice in it anyway.
+	 */
+	record_offset(hashes[BUCKET(rec->full_hash)+1], off);
+	if (rec->next)
+		record_offset(hashes[BUCKET(rec->full_hash)+1], rec->next);
+	return true;
+}
+
 /* Slow, but should be very rare. */
 size_t tdb_dead_space(struct tdb_context *tdb, tdb_off_t off)
 {
@@ -354,7 +379,7 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 		goto unlock;
 
 	/* We should have the whole header, too. */
-	if (tdb->map_size < TDB_DATA_START(tdb->hash_size)) {
+	if (tdb->map_size < TDB_DATA_START(tdb)) {
 		tdb->ecode = TDB_ERR_CORRUPT;
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "File too short for hashes\n"));
 		goto unlock;
@@ -383,8 +408,16 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			record_offset(hashes[h], off);
 	}
 
+	/* Per-chain freelist heads are behind the hash table. */
+	for (h = 0; h < TDB_CHAIN_FREELISTS_SIZE(tdb)/sizeof(tdb_off_t); h++) {
+		if (tdb_ofs_read(tdb, TDB_CHAIN_FREELIST_TOP(h), &off) == -1)
+			goto free;
+		if (off)
+			record_offset(hashes[h+1], off);
+	}
+
 	/* For each record, read it in and check it's ok. */
-	for (off = TDB_DATA_START(tdb->hash_size);
+	for (off = TDB_DATA_START(tdb);
 	     off < tdb->map_size;
 	     off += sizeof(rec) + rec.rec_len) {
 		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
@@ -401,6 +434,11 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			if (!tdb_check_free_record(tdb, off, &rec, hashes))
 				goto free;
 			break;
+		case TDB_CHAIN_FREE_MAGIC:
+			if (!tdb_check_chain_free_record(tdb, off, &rec,
+							 hashes))
+				goto free;
+			break;
 		/* If we crash after ftruncate, we can get zeroes or fill. */
 		case TDB_RECOVERY_INVALID_MAGIC:
 		case 0x42424242:
@@ -0,0 +1,405 @@
+ /*
+   Unix SMB/CIFS implementation.
+
+   trivial database library
+
+   Copyright (C) Samba Team 2018
+
+     ** NOTE! The following LGPL license applies to the tdb
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Online compaction: Records at the end of the file are moved into
+ * free space further down, one record at a time under its chain lock.
+ * The free space collecting at the end of the file is then cut off.
+ *
+ * Cutting the file needs care: Other processes have the old size
+ * mapped. Touching a page beyond the end of the file kills them with
+ * SIGBUS. So we only cut what was already free at the end of the file
+ * when the previous step looked, under the allrecord lock. Nothing can
+ * point there anymore. Processes with a stale map only notice the new
+ * size when they expand the file, see tdb_oob().
+ *
+ * With TDB_MUTEX_LOCKING the file is never cut: TDB_MUTEX_SEQLOCK
+ * readers don't take any lock that would keep them out of the cut
+ * area, and the allrecord lock waits for the chain mutexes even with
+ * TDB_LOCK_NOWAIT. Records are still moved.
+ */
+
+#include "tdb_private.h"
+
+/* the smallest free record tdb_allocate_ofs() leaves behind */
+#define COMPACT_MIN_REC_SIZE (sizeof(struct tdb_record) + sizeof(tdb_off_t) + 8)
+
+/*
+ * Find the record that ends at "end" via its tailer. Returns -1 if
+ * there is none or what we find does not look like a record.
+ */
+static int tdb_compact_record_before(struct tdb_context *tdb, tdb_off_t end,
+				     tdb_off_t *poff, struct tdb_record *rec)
+{
+	tdb_off_t size;
+
+	if ((end > tdb->map_size) ||
+	    (end < TDB_DATA_START(tdb) + sizeof(*rec) + sizeof(tdb_off_t))) {
+		return -1;
+	}
+	if (tdb_ofs_read(tdb, end - sizeof(tdb_off_t), &size) == -1) {
+		return -1;
+	}
+	if ((size < sizeof(*rec) + sizeof(tdb_off_t)) ||
+	    (size > end - TDB_DATA_START(tdb))) {
+		return -1;
+	}
+	if (tdb->methods->tdb_read(tdb, end - size, rec, sizeof(*rec),
+				   DOCONV()) == -1) {
+		return -1;
+	}
+	if (sizeof(*rec) + rec->rec_len != size) {
+		return -1;
+	}
+	*poff = end - size;
+	return 0;
+}
+
+/*
+ * Start of the free records at the end of the file, map_size if the
+ * last record is in use. Caller holds the freelist lock.
+ */
+static tdb_off_t tdb_compact_free_tail(struct tdb_context *tdb)
+{
+	tdb_off_t off = tdb->map_size;
+	tdb_off_t prev;
+	struct tdb_record rec;
+
+	while ((tdb_compact_record_before(tdb, off, &prev, &rec) == 0) &&
+	       (rec.magic == TDB_FREE_MAGIC)) {
+		off = prev;
+	}
+	return off;
+}
+
+/*
+ * Cut off the free space at the end of the file, as far as it was free
+ * at the previous step already. This is the only part that needs the
+ * allrecord lock, we don't wait for it. Not done with mutexes, see above.
+ */
+static int tdb_compact_shrink(struct tdb_context *tdb)
+{
+	tdb_off_t cut, off, prev, last_ptr, rec_ptr;
+	tdb_len_t min_cut;
+	struct tdb_record rec;
+	int ret = -1;
+
+	if (tdb_have_mutexes(tdb)) {
+		return 0;
+	}
+
+	if (tdb_allrecord_lock(tdb, F_WRLCK, TDB_LOCK_NOWAIT|TDB_LOCK_PROBE,
+			       false) == -1) {
+		return 0;
+	}
+
+	/* Covered by the allrecord lock, this does not really lock */
+	if (tdb_lock(tdb, -1, F_WRLCK) == -1) {
+		goto unlock_all;
+	}
+
+	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
+
+	if (tdb->map_size != tdb->compact_map_size) {
+		/* Someone else changed the size, look again next time */
+		ret = 0;
+		goto unlock;
+	}
+
+	cut = MAX(tdb_compact_free_tail(tdb), tdb->compact_tail);
+
+	/*
+	 * Don't leave a stub too small for a free record in front of
+	 * the cut
+	 */
+	off = tdb->map_size;
+	while (off > cut) {
+		if (tdb_compact_record_before(tdb, off, &prev, &rec) == -1) {
+			ret = 0;
+			goto unlock;
+		}
+		if (prev < cut) {
+			if (cut - prev < COMPACT_MIN_REC_SIZE) {
+				cut = off;
+			}
+			break;
+		}
+		off = prev;
+	}
+
+	/* Not worth it, tdb_expand() would grow the file right away */
+	min_cut = MAX((tdb_len_t)tdb->page_size, tdb->map_size / 8);
+	if ((cut >= tdb->map_size) || (tdb->map_size - cut < min_cut)) {
+		ret = 0;
+		goto unlock;
+	}
+
+	/*
+	 * Take everything beyond the cut off the freelist, shorten the
+	 * record the cut goes through
+	 */
+	last_ptr = FREELIST_TOP;
+	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1) {
+		goto unlock;
+	}
+	while (rec_ptr != 0) {
+		if (tdb_rec_free_read(tdb, rec_ptr, &rec) == -1) {
+			goto unlock;
+		}
+		if (rec_ptr >= cut) {
+			if (tdb_ofs_write(tdb, last_ptr, &rec.next) == -1) {
+				goto unlock;
+			}
+			rec_ptr = rec.next;
+			continue;
+		}
+		if (rec_ptr + sizeof(rec) + rec.rec_len > cut) {
+			tdb_off_t totalsize = cut - rec_ptr;
+
+			rec.rec_len = totalsize - sizeof(rec);
+			if ((tdb_rec_write(tdb, rec_ptr, &rec) == -1) ||
+			    (tdb_ofs_write(tdb, cut - sizeof(tdb_off_t),
+					   &totalsize) == -1)) {
+				goto unlock;
+			}
+		}
+		last_ptr = rec_ptr;
+		rec_ptr = rec.next;
+	}
+
+	ret = tdb_shrink(tdb, cut);
+
+unlock:
+	tdb_unlock(tdb, -1, F_WRLCK);
+unlock_all:
+	tdb_allrecord_unlock(tdb, F_WRLCK, false);
+	return ret;
+}
+
+/*
+ * Move the record in front of the free space at the end of the file
+ * into the lowest free record below it that fits. Dead records and
+ * records on a chain's freelist are just given to the global freelist.
+ *
+ * Returns 1 if a record was moved, 0 if there is nothing we can move
+ * right now.
+ */
+static int tdb_compact_move(struct tdb_context *tdb, tdb_off_t *ptail)
+{
+	tdb_off_t rec_ptr, last_ptr, new_ptr, ptr, top;
+	struct tdb_record rec, newrec;
+	uint32_t magic, hash;
+	unsigned char *buf = NULL;
+	bool record_locked = false;
+	int ret = -1;
+
+	if (tdb_lock(tdb, -1, F_WRLCK) == -1) {
+		return -1;
+	}
+
+	/* Someone else might have cut the file in the meantime */
+	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
+
+	if ((tdb_compact_record_before(tdb, *ptail, &rec_ptr, &rec) == -1) ||
+	    (rec.magic == TDB_FREE_MAGIC)) {
+		/* Our idea of the tail is outdated */
+		*ptail = tdb_compact_free_tail(tdb);
+		if (tdb_compact_record_before(tdb, *ptail, &rec_ptr,
+					      &rec) == -1) {
+			ret = 0;
+			goto unlock_freelist;
+		}
+	}
+
+	magic = rec.magic;
+	hash = BUCKET(rec.full_hash);
+
+	switch (magic) {
+	case TDB_MAGIC:
+	case TDB_DEAD_MAGIC:
+		top = TDB_HASH_TOP(hash);
+		break;
+	case TDB_CHAIN_FREE_MAGIC:
+		top = TDB_CHAIN_FREELIST_TOP(hash);
+		break;
+	default:
+		/* The recovery area or the like, leave it alone */
+		ret = 0;
+		goto unlock_freelist;
+	}
+
+	/* Against the usual lock order, so we must not wait */
+	if (tdb_lock_nonblock(tdb, hash, F_WRLCK) == -1) {
+		ret = 0;
+		goto unlock_freelist;
+	}
+
+	/* It might have changed before we got the chain lock */
+	if ((tdb->methods->tdb_read(tdb, rec_ptr, &rec, sizeof(rec),
+				    DOCONV()) == -1)) {
+		goto unlock;
+	}
+	if ((rec.magic != magic) || (BUCKET(rec.full_hash) != hash)) {
+		ret = 0;
+		goto unlock;
+	}
+
+	/* find the previous record in the list */
+	last_ptr = top;
+	if (tdb_ofs_read(tdb, last_ptr, &ptr) == -1) {
+		goto unlock;
+	}
+	while (ptr != rec_ptr) {
+		if (ptr == 0) {
+			ret = 0;
+			goto unlock;
+		}
+		/* next ptr is at start of record */
+		last_ptr = ptr;
+		if (tdb_ofs_read(tdb, ptr, &ptr) == -1) {
+			goto unlock;
+		}
+	}
+
+	if (magic != TDB_CHAIN_FREE_MAGIC) {
+		/* A traverse sits on it */
+		if (tdb_write_lock_record(tdb, rec_ptr) == -1) {
+			ret = 0;
+			goto unlock;
+		}
+		record_locked = true;
+	}
+
+	if (magic != TDB_MAGIC) {
+		if ((tdb_ofs_write(tdb, last_ptr, &rec.next) == -1) ||
+		    (tdb_free(tdb, rec_ptr, &rec) == -1)) {
+			goto unlock;
+		}
+		*ptail = rec_ptr;
+		ret = 1;
+		goto unlock;
+	}
+
+	buf = tdb_alloc_read(tdb, rec_ptr + sizeof(rec),
+			     rec.key_len + rec.data_len);
+	if (buf == NULL) {
+		goto unlock;
+	}
+
+	new_ptr = tdb_allocate_below(tdb, rec.key_len + rec.data_len, rec_ptr,
+				     &newrec);
+	if (new_ptr == 0) {
+		/* No room further down */
+		ret = 0;
+		goto unlock;
+	}
+
+	newrec.next = rec.next;
+	newrec.key_len = rec.key_len;
+	newrec.data_len = rec.data_len;
+	newrec.full_hash = rec.full_hash;
+	newrec.magic = TDB_MAGIC;
+
+	if ((tdb->methods->tdb_write(tdb, new_ptr + sizeof(newrec), buf,
+				     rec.key_len + rec.data_len) == -1) ||
+	    (tdb_rec_write(tdb, new_ptr, &newrec) == -1)) {
+		tdb_free(tdb, new_ptr, &newrec);
+		goto unlock;
+	}
+
+	/* Only now readers find it at the new place */
+	if (tdb_ofs_write(tdb, last_ptr, &new_ptr) == -1) {
+		tdb_free(tdb, new_ptr, &newrec);
+		goto unlock;
+	}
+
+	if (tdb_free(tdb, rec_ptr, &rec) == -1) {
+		goto unlock;
+	}
+
+	*ptail = rec_ptr;
+	ret = 1;
+
+unlock:
+	SAFE_FREE(buf);
+	if (record_locked) {
+		tdb_write_unlock_record(tdb, rec_ptr);
+	}
+	tdb_unlock(tdb, hash, F_WRLCK);
+unlock_freelist:
+	tdb_unlock(tdb, -1, F_WRLCK);
+	return ret;
+}
+
+/*
+ * One step of an online compaction, see tdb.h
+ */
+_PUBLIC_ int tdb_compact_step(struct tdb_context *tdb, unsigned max_records)
+{
+	tdb_off_t tail;
+	int moved = 0;
+	int ret;
+
+	if (tdb->read_only || tdb->traverse_read) {
+		tdb->ecode = TDB_ERR_RDONLY;
+		return -1;
+	}
+
+	if ((tdb->transaction != NULL) || (tdb->travlocks.next != NULL) ||
+	    tdb_have_extra_locks(tdb)) {
+		tdb->ecode = TDB_ERR_EINVAL;
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_compact_step: "
+			 "not possible with locks held or in a transaction\n"));
+		return -1;
+	}
+
+	if (tdb_compact_shrink(tdb) == -1) {
+		return -1;
+	}
+
+	tail = tdb->map_size;
+
+	while ((unsigned)moved < max_records) {
+		ret = tdb_compact_move(tdb, &tail);
+		if (ret == -1) {
+			return -1;
+		}
+		if (ret == 0) {
+			break;
+		}
+		moved += 1;
+	}
+
+	/* What the next step may cut off */
+	if (tdb_lock(tdb, -1, F_WRLCK) == -1) {
+		return -1;
+	}
+	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
+	tdb->compact_tail = tdb_compact_free_tail(tdb);
+	tdb->compact_map_size = tdb->map_size;
+	tdb_unlock(tdb, -1, F_WRLCK);
+
+	return moved;
+}
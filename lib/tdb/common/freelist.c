@@ -112,7 +112,7 @@ static int read_record_on_left(struct tdb_context *tdb, tdb_off_t rec_ptr,
 
 	left_ptr = rec_ptr - sizeof(tdb_off_t);
 
-	if (left_ptr <= TDB_DATA_START(tdb->hash_size)) {
+	if (left_ptr <= TDB_DATA_START(tdb)) {
 		/* no record on the left */
 		return -1;
 	}
@@ -136,7 +136,7 @@ static int read_record_on_left(struct tdb_context *tdb, tdb_off_t rec_ptr,
 
 	left_ptr = rec_ptr - left_size;
 
-	if (left_ptr < TDB_DATA_START(tdb->hash_size)) {
+	if (left_ptr < TDB_DATA_START(tdb)) {
 		return -1;
 	}
 
@@ -580,6 +580,54 @@ static tdb_off_t tdb_allocate_from_freelist(
 	return 0;
 }
 
+/*
+ * Allocate space for a record being moved by tdb_compact_step(). Other
+ * than tdb_allocate_from_freelist() this takes the free record with
+ * the lowest offset that fits, it has to be below "limit". We don't
+ * over-allocate and never expand the file.
+ *
+ * The caller holds the freelist lock. 0 is returned if nothing fits.
+ */
+tdb_off_t tdb_allocate_below(struct tdb_context *tdb, tdb_len_t length,
+			     tdb_off_t limit, struct tdb_record *rec)
+{
+	tdb_off_t rec_ptr, last_ptr;
+	tdb_off_t best_rec_ptr = 0;
+	tdb_off_t best_last_ptr = 0;
+
+	/* Extra bytes required for tailer */
+	length += sizeof(tdb_off_t);
+	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+	last_ptr = FREELIST_TOP;
+
+	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1) {
+		return 0;
+	}
+
+	while (rec_ptr) {
+		if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
+			return 0;
+		}
+		if ((rec_ptr < limit) && (rec->rec_len >= length) &&
+		    ((best_rec_ptr == 0) || (rec_ptr < best_rec_ptr))) {
+			best_rec_ptr = rec_ptr;
+			best_last_ptr = last_ptr;
+		}
+		last_ptr = rec_ptr;
+		rec_ptr = rec->next;
+	}
+
+	if (best_rec_ptr == 0) {
+		return 0;
+	}
+
+	if (tdb_rec_free_read(tdb, best_rec_ptr, rec) == -1) {
+		return 0;
+	}
+	return tdb_allocate_ofs(tdb, length, best_rec_ptr, rec, best_last_ptr);
+}
+
 static bool tdb_alloc_dead(
 	struct tdb_context *tdb, int hash, tdb_len_t length,
 	tdb_off_t *rec_ptr, struct tdb_record *rec)
@@ -597,6 +645,132 @@ static bool tdb_alloc_dead(
 	return (tdb_ofs_write(tdb, last_ptr, &rec->next) == 0);
 }
 
+/*
+ * Put a record on the freelist of its hash chain. The chain lock
+ * protects it, so no allocation lock is needed. Records there are
+ * never merged with their neighbours, the TDB_CHAIN_FREE_MAGIC keeps
+ * tdb_free() from touching them.
+ *
+ * If the chain already has TDB_CHAIN_FREELIST_MAX free records, the
+ * oldest one goes to the global freelist. This way records too small
+ * for what the chain stores don't stay around forever.
+ *
+ * Chain "hash" is assumed to be locked
+ */
+int tdb_free_chain(struct tdb_context *tdb, uint32_t hash, tdb_off_t offset,
+		   struct tdb_record *rec)
+{
+	tdb_off_t top = TDB_CHAIN_FREELIST_TOP(hash);
+	tdb_off_t last_ptr = top;
+	tdb_off_t ptr;
+	int count = 0;
+
+	if (tdb_ofs_read(tdb, top, &ptr) == -1) {
+		return -1;
+	}
+	while (ptr != 0) {
+		count += 1;
+		if (count >= TDB_CHAIN_FREELIST_MAX) {
+			struct tdb_record oldest;
+			tdb_off_t zero = 0;
+
+			if (tdb->methods->tdb_read(tdb, ptr, &oldest,
+						   sizeof(oldest),
+						   DOCONV()) == -1) {
+				return -1;
+			}
+			if (oldest.magic != TDB_CHAIN_FREE_MAGIC) {
+				tdb->ecode = TDB_ERR_CORRUPT;
+				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free_chain: "
+					 "bad magic 0x%x at offset=%u\n",
+					 oldest.magic, ptr));
+				return -1;
+			}
+			if (tdb_ofs_write(tdb, last_ptr, &zero) == -1 ||
+			    tdb_free(tdb, ptr, &oldest) == -1) {
+				return -1;
+			}
+			break;
+		}
+		/* next ptr is at start of record */
+		last_ptr = ptr;
+		if (tdb_ofs_read(tdb, ptr, &ptr) == -1) {
+			return -1;
+		}
+	}
+
+	rec->magic = TDB_CHAIN_FREE_MAGIC;
+
+	if (tdb_ofs_read(tdb, top, &rec->next) == -1 ||
+	    tdb_rec_write(tdb, offset, rec) == -1 ||
+	    tdb_ofs_write(tdb, top, &offset) == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free_chain record write "
+			 "failed at offset=%u\n", offset));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Best fit from the freelist of hash chain "hash", like
+ * tdb_find_dead() does for the dead records. *pofs is 0 if nothing
+ * fits.
+ */
+static int tdb_allocate_from_chain(
+	struct tdb_context *tdb, int hash, tdb_len_t length,
+	struct tdb_record *rec, tdb_off_t *pofs)
+{
+	tdb_off_t rec_ptr, last_ptr;
+	tdb_off_t best_rec_ptr = 0;
+	tdb_off_t best_last_ptr = 0;
+	struct tdb_record best = { .rec_len = UINT32_MAX };
+
+	length += sizeof(tdb_off_t); /* tailer */
+
+	*pofs = 0;
+
+	last_ptr = TDB_CHAIN_FREELIST_TOP(hash);
+
+	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1) {
+		return -1;
+	}
+
+	while (rec_ptr) {
+		if (tdb->methods->tdb_read(tdb, rec_ptr, rec, sizeof(*rec),
+					   DOCONV()) == -1) {
+			return -1;
+		}
+		if (rec->magic != TDB_CHAIN_FREE_MAGIC) {
+			tdb->ecode = TDB_ERR_CORRUPT;
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,
+				 "tdb_allocate_from_chain: bad magic 0x%x "
+				 "at offset=%u\n", rec->magic, rec_ptr));
+			return -1;
+		}
+		if ((rec->rec_len >= length) &&
+		    (rec->rec_len < best.rec_len)) {
+			best_rec_ptr = rec_ptr;
+			best_last_ptr = last_ptr;
+			best = *rec;
+		}
+		last_ptr = rec_ptr;
+		rec_ptr = rec->next;
+	}
+
+	if (best_rec_ptr == 0) {
+		return 0;
+	}
+
+	/* unlink it from the chain's freelist */
+	if (tdb_ofs_write(tdb, best_last_ptr, &best.next) == -1) {
+		return -1;
+	}
+
+	*rec = best;
+	*pofs = best_rec_ptr;
+	return 0;
+}
+
 /*
  * Chain "hash" is assumed to be locked
  */
@@ -607,6 +781,16 @@ tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 	tdb_off_t ret;
 	int i;
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS) {
+		if (tdb_allocate_from_chain(tdb, hash, length, rec,
+					    &ret) == -1) {
+			return 0;
+		}
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
 	if (tdb->max_dead_records == 0) {
 		/*
 		 * No dead records to expect anywhere. Do the blocking
@@ -343,3 +343,133 @@ _PUBLIC_ unsigned int tdb_jenkins_hash(TDB_DATA *key)
 {
 	return hashlittle(key->dptr, key->dsize);
 }
+
+/*
+ * Based on wyhash by Wang Yi, released into the public domain.
+ * The values are part of the file format of tdbs created with
+ * TDB_WYHASH, so this must never change.
+ *
+ * This reads the key 8 bytes at a time through memcpy, so unaligned
+ * keys don't fall back to a byte loop, and keys up to 16 bytes are
+ * covered with at most four overlapping loads and no loop at all.
+ * The words are read little-endian everywhere so the hash value of a
+ * key, and with it the file format, does not depend on the platform.
+ */
+
+static const uint64_t wyhash_secret[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL,
+};
+
+static inline void wyhash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+	r *= *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wyhash_mix(uint64_t a, uint64_t b)
+{
+	wyhash_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t wyhash_r4(const uint8_t *p)
+{
+#ifndef WORDS_BIGENDIAN
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+#else
+	return ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24);
+#endif
+}
+
+static inline uint64_t wyhash_r8(const uint8_t *p)
+{
+#ifndef WORDS_BIGENDIAN
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+#else
+	return wyhash_r4(p) | (wyhash_r4(p + 4) << 32);
+#endif
+}
+
+static inline uint64_t wyhash_r3(const uint8_t *p, size_t k)
+{
+	return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) |
+		p[k - 1];
+}
+
+static uint64_t wyhash(const uint8_t *p, size_t len, uint64_t seed)
+{
+	const uint64_t *s = wyhash_secret;
+	uint64_t a, b;
+
+	seed ^= wyhash_mix(seed ^ s[0], s[1]);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			size_t m = (len >> 3) << 2;
+			a = (wyhash_r4(p) << 32) | wyhash_r4(p + m);
+			b = (wyhash_r4(p + len - 4) << 32) |
+				wyhash_r4(p + len - 4 - m);
+		} else if (len > 0) {
+			a = wyhash_r3(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wyhash_mix(wyhash_r8(p) ^ s[1],
+						  wyhash_r8(p + 8) ^ seed);
+				see1 = wyhash_mix(wyhash_r8(p + 16) ^ s[2],
+						  wyhash_r8(p + 24) ^ see1);
+				see2 = wyhash_mix(wyhash_r8(p + 32) ^ s[3],
+						  wyhash_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wyhash_mix(wyhash_r8(p) ^ s[1],
+					  wyhash_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = wyhash_r8(p + i - 16);
+		b = wyhash_r8(p + i - 8);
+	}
+
+	a ^= s[1];
+	b ^= seed;
+	wyhash_mum(&a, &b);
+	return wyhash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+unsigned int tdb_wyhash(TDB_DATA *key)
+{
+	uint64_t h = wyhash(key->dptr, key->dsize, 0);
+	return (uint32_t)(h ^ (h >> 32));
+}
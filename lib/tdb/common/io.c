@@ -81,6 +81,38 @@ static ssize_t tdb_pread(struct tdb_context *tdb, void *buf,
 	return ret;
 }
 
+/*
+ * Read from the mmap area or the file without touching tdb_context: No
+ * remapping, no logging, no error code. This can be used from several
+ * threads at a time, see tdb_traverse_chains_read().
+ */
+int tdb_read_threadsafe(struct tdb_context *tdb, tdb_off_t off, void *buf,
+			tdb_len_t len)
+{
+	ssize_t ret;
+
+	if (len + off < len) {
+		return -1;
+	}
+	if ((tdb->map_ptr != NULL) && (off + len <= tdb->map_size)) {
+		memcpy(buf, off + (char *)tdb->map_ptr, len);
+		return 0;
+	}
+	if (tdb->flags & TDB_INTERNAL) {
+		return -1;
+	}
+
+	/*
+	 * Beyond the map: Another process extended the file after we
+	 * last looked.
+	 */
+	ret = tdb_pread(tdb, buf, len, off);
+	if (ret != (ssize_t)len) {
+		return -1;
+	}
+	return 0;
+}
+
 static int tdb_ftruncate(struct tdb_context *tdb, off_t length)
 {
 	ssize_t ret;
@@ -216,6 +248,13 @@ static int tdb_write(struct tdb_context *tdb, tdb_off_t off,
 		return -1;
 	}
 
+	if ((tdb->wal != NULL) && (tdb->transaction == NULL)) {
+		/* replaying the log later must not undo this write */
+		if (tdb_wal_before_write(tdb) == -1) {
+			return -1;
+		}
+	}
+
 	if (tdb->methods->tdb_oob(tdb, off, len, 0) != 0)
 		return -1;
 
@@ -662,6 +701,56 @@ int tdb_expand(struct tdb_context *tdb, tdb_off_t size)
 	return -1;
 }
 
+/*
+ * Cut the database file down to "size" bytes. The caller has made sure
+ * nothing beyond that is referenced anymore, see tdb_compact_step().
+ * Other processes find out in tdb_oob() when they next expand.
+ */
+int tdb_shrink(struct tdb_context *tdb, tdb_off_t size)
+{
+	if (size >= tdb->map_size) {
+		return 0;
+	}
+
+	if (tdb->flags & TDB_INTERNAL) {
+		char *new_map_ptr;
+
+		new_map_ptr = (char *)realloc(tdb->map_ptr, size);
+		if (!new_map_ptr) {
+			tdb->ecode = TDB_ERR_OOM;
+			return -1;
+		}
+		tdb->map_ptr = new_map_ptr;
+		tdb->map_size = size;
+		return 0;
+	}
+
+	if (tdb_have_mutexes(tdb)) {
+		/* Lock-free readers might still look beyond the new end */
+		tdb->ecode = TDB_ERR_EINVAL;
+		return -1;
+	}
+
+	/* A pending log must not write beyond the new end later */
+	if ((tdb->wal != NULL) && (tdb_wal_before_write(tdb) == -1)) {
+		return -1;
+	}
+
+	if (tdb_ftruncate(tdb, size) != 0) {
+		tdb->ecode = TDB_ERR_IO;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_shrink: ftruncate to %u "
+			 "failed (%s)\n", (unsigned)size, strerror(errno)));
+		return -1;
+	}
+
+	tdb_munmap(tdb);
+	tdb->map_size = size;
+	if (tdb_mmap(tdb) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
 /* read/write a tdb_off_t */
 int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d)
 {
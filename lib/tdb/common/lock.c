@@ -332,6 +332,11 @@ static struct tdb_lock_type *find_nestlock(struct tdb_context *tdb,
 	return NULL;
 }
 
+bool tdb_have_nest_lock(struct tdb_context *tdb, uint32_t offset)
+{
+	return (find_nestlock(tdb, offset) != NULL);
+}
+
 /* lock an offset in the database. */
 int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 		  enum tdb_lock_flags flags)
@@ -577,6 +582,42 @@ _PUBLIC_ int tdb_unlock(struct tdb_context *tdb, int list, int ltype)
 	return tdb_nest_unlock(tdb, lock_offset(list), ltype, false);
 }
 
+/*
+ * Lock a hash chain bypassing the nesting bookkeeping in tdb->lockrecs.
+ * Only for tdb_traverse_chains_read(), which runs in threads and holds
+ * one chain lock at a time. Unlike tdb_brlock() this neither sets
+ * tdb->ecode nor logs, errno tells what went wrong.
+ */
+int tdb_chain_brlock(struct tdb_context *tdb, uint32_t list, int ltype)
+{
+	int ret;
+
+	if (tdb->flags & TDB_NOLOCK) {
+		return 0;
+	}
+
+	do {
+		ret = fcntl_lock(tdb, ltype, lock_offset(list), 1, true);
+	} while (ret == -1 && errno == EINTR);
+
+	return ret;
+}
+
+int tdb_chain_brunlock(struct tdb_context *tdb, uint32_t list, int ltype)
+{
+	int ret;
+
+	if (tdb->flags & TDB_NOLOCK) {
+		return 0;
+	}
+
+	do {
+		ret = fcntl_unlock(tdb, ltype, lock_offset(list), 1);
+	} while (ret == -1 && errno == EINTR);
+
+	return ret;
+}
+
 /*
   get the transaction lock
  */
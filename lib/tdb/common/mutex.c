@@ -73,6 +73,12 @@ struct tdb_mutexes {
 	 * one mutex per hashchain.
 	 */
 	pthread_mutex_t hashchains[1];
+
+	/*
+	 * With TDB_FEATURE_FLAG_MUTEX_SEQLOCK, hashchains[] is
+	 * followed by hash_size+1 uint32_t sequence counters, see
+	 * tdb_mutex_seqs().
+	 */
 };
 
 bool tdb_have_mutexes(struct tdb_context *tdb)
@@ -91,6 +97,10 @@ size_t tdb_mutex_size(struct tdb_context *tdb)
 	mutex_size = sizeof(struct tdb_mutexes);
 	mutex_size += tdb->hash_size * sizeof(pthread_mutex_t);
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK) {
+		mutex_size += (tdb->hash_size + 1) * sizeof(uint32_t);
+	}
+
 	return TDB_ALIGN(mutex_size, tdb->page_size);
 }
 
@@ -124,7 +134,7 @@ static bool tdb_mutex_index(struct tdb_context *tdb, off_t off, off_t len,
 		/* tdb not initialized yet, called from tdb_open_ex() */
 		return false;
 	}
-	if (off >= TDB_DATA_START(tdb->hash_size)) {
+	if (off >= TDB_DATA_START(tdb)) {
 		/* Single record lock from traverses */
 		return false;
 	}
@@ -174,6 +184,103 @@ static bool tdb_have_mutex_chainlocks(struct tdb_context *tdb)
 	return false;
 }
 
+/*
+ * Sequence counters for lock-free readers.
+ *
+ * Every chain mutex has a counter next to it. It is odd while the
+ * mutex is held, and it changes with every lock/unlock cycle. A
+ * reader that finds the same even value before and after walking a
+ * hash chain knows that nobody could have changed the chain in
+ * between. Index 0 belongs to the freelist mutex, which does not
+ * protect anything readers look at. We use it for the allrecord
+ * lock instead, it is odd while someone holds it for writing.
+ *
+ * The counters are only written with their mutex held, so a plain
+ * increment is enough. The __sync builtin is used as a full memory
+ * barrier around it.
+ */
+
+static uint32_t *tdb_mutex_seqs(struct tdb_context *tdb)
+{
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK) == 0) {
+		return NULL;
+	}
+	return (uint32_t *)&tdb->mutexes->hashchains[tdb->hash_size+1];
+}
+
+static void tdb_mutex_seq_write_begin(struct tdb_context *tdb, unsigned idx)
+{
+#ifdef USE_TDB_MUTEX_SEQLOCK
+	uint32_t *seqs = tdb_mutex_seqs(tdb);
+
+	if (seqs != NULL) {
+		/*
+		 * If a previous holder died in its critical section,
+		 * the counter is already odd. Keep it odd.
+		 */
+		__sync_fetch_and_add(&seqs[idx], (seqs[idx] & 1) ? 2 : 1);
+	}
+#endif
+}
+
+static void tdb_mutex_seq_write_end(struct tdb_context *tdb, unsigned idx)
+{
+#ifdef USE_TDB_MUTEX_SEQLOCK
+	uint32_t *seqs = tdb_mutex_seqs(tdb);
+
+	if (seqs != NULL) {
+		__sync_fetch_and_add(&seqs[idx], 1);
+	}
+#endif
+}
+
+/*
+ * Start a lock-free read of chain "hash". Returns false if a writer
+ * is active, the caller has to take the chain lock then.
+ */
+bool tdb_mutex_seqlock_read_begin(struct tdb_context *tdb, uint32_t hash,
+				  uint32_t seqs[2])
+{
+#ifdef USE_TDB_MUTEX_SEQLOCK
+	volatile uint32_t *s;
+
+	if ((tdb->mutexes == NULL) || (tdb->flags & TDB_NOLOCK)) {
+		return false;
+	}
+	s = tdb_mutex_seqs(tdb);
+	if (s == NULL) {
+		return false;
+	}
+
+	seqs[0] = s[0];
+	seqs[1] = s[BUCKET(hash)+1];
+	__sync_synchronize();
+
+	return (((seqs[0] | seqs[1]) & 1) == 0);
+#else
+	return false;
+#endif
+}
+
+/*
+ * Returns true if chain "hash" might have changed since
+ * tdb_mutex_seqlock_read_begin(), so what was read must be thrown
+ * away.
+ */
+bool tdb_mutex_seqlock_read_retry(struct tdb_context *tdb, uint32_t hash,
+				  const uint32_t seqs[2])
+{
+#ifdef USE_TDB_MUTEX_SEQLOCK
+	volatile uint32_t *s = tdb_mutex_seqs(tdb);
+
+	__sync_synchronize();
+
+	return ((s[0] != seqs[0]) || (s[BUCKET(hash)+1] != seqs[1]));
+#else
+	return true;
+#endif
+}
+
 static int chain_mutex_lock(pthread_mutex_t *m, bool waitflag)
 {
 	int ret;
@@ -193,8 +300,10 @@ static int chain_mutex_lock(pthread_mutex_t *m, bool waitflag)
 	return pthread_mutex_consistent(m);
 }
 
-static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
+static int allrecord_mutex_lock(struct tdb_context *tdb, bool waitflag)
 {
+	struct tdb_mutexes *m = tdb->mutexes;
+	uint32_t *seqs;
 	int ret;
 
 	if (waitflag) {
@@ -213,6 +322,14 @@ static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
 	 */
 	m->allrecord_lock = F_UNLCK;
 
+	/*
+	 * Also let lock-free readers in again
+	 */
+	seqs = tdb_mutex_seqs(tdb);
+	if ((seqs != NULL) && (seqs[0] & 1)) {
+		tdb_mutex_seq_write_end(tdb, 0);
+	}
+
 	return pthread_mutex_consistent(&m->allrecord_mutex);
 }
 
@@ -268,6 +385,7 @@ again:
 		 * chain lock.
 		 */
 
+		tdb_mutex_seq_write_begin(tdb, idx);
 		*pret = 0;
 		return true;
 	}
@@ -293,6 +411,7 @@ again:
 	}
 
 	if (allrecord_ok) {
+		tdb_mutex_seq_write_begin(tdb, idx);
 		*pret = 0;
 		return true;
 	}
@@ -304,7 +423,7 @@ again:
 		errno = ret;
 		goto fail;
 	}
-	ret = allrecord_mutex_lock(m, waitflag);
+	ret = allrecord_mutex_lock(tdb, waitflag);
 	if (ret == EBUSY) {
 		ret = EAGAIN;
 	}
@@ -344,6 +463,10 @@ bool tdb_mutex_unlock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 	}
 	chain = &m->hashchains[idx];
 
+	if (idx != 0) {
+		tdb_mutex_seq_write_end(tdb, idx);
+	}
+
 	ret = pthread_mutex_unlock(chain);
 	if (ret == 0) {
 		*pret = 0;
@@ -371,7 +494,7 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 		return 0;
 	}
 
-	ret = allrecord_mutex_lock(m, waitflag);
+	ret = allrecord_mutex_lock(tdb, waitflag);
 	if (!waitflag && (ret == EBUSY)) {
 		errno = EAGAIN;
 		tdb->ecode = TDB_ERR_LOCK;
@@ -422,6 +545,10 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 			goto fail_unroll_allrecord_lock;
 		}
 	}
+	if (m->allrecord_lock == F_WRLCK) {
+		tdb_mutex_seq_write_begin(tdb, 0);
+	}
+
 	/*
 	 * We leave this routine with m->allrecord_mutex locked
 	 */
@@ -488,6 +615,8 @@ int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb)
 		}
 	}
 
+	tdb_mutex_seq_write_begin(tdb, 0);
+
 	return 0;
 
 fail_unroll_allrecord_lock:
@@ -513,6 +642,8 @@ void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb)
 		return;
 	}
 
+	tdb_mutex_seq_write_end(tdb, 0);
+
 	m->allrecord_lock = F_RDLCK;
 	return;
 }
@@ -545,8 +676,15 @@ int tdb_mutex_allrecord_unlock(struct tdb_context *tdb)
 	old = m->allrecord_lock;
 	m->allrecord_lock = F_UNLCK;
 
+	if (old == F_WRLCK) {
+		tdb_mutex_seq_write_end(tdb, 0);
+	}
+
 	ret = pthread_mutex_unlock(&m->allrecord_mutex);
 	if (ret != 0) {
+		if (old == F_WRLCK) {
+			tdb_mutex_seq_write_begin(tdb, 0);
+		}
 		m->allrecord_lock = old;
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "pthread_mutex_unlock"
 			 "(allrecord_mutex) failed: %s\n", strerror(ret)));
@@ -595,6 +733,11 @@ int tdb_mutex_init(struct tdb_context *tdb)
 
 	m->allrecord_lock = F_UNLCK;
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK) {
+		uint32_t *seqs = tdb_mutex_seqs(tdb);
+		memset(seqs, 0, (tdb->hash_size + 1) * sizeof(uint32_t));
+	}
+
 	ret = pthread_mutex_init(&m->allrecord_mutex, &ma);
 	if (ret != 0) {
 		goto fail;
@@ -1051,6 +1194,18 @@ void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb)
 	return;
 }
 
+bool tdb_mutex_seqlock_read_begin(struct tdb_context *tdb, uint32_t hash,
+				  uint32_t seqs[2])
+{
+	return false;
+}
+
+bool tdb_mutex_seqlock_read_retry(struct tdb_context *tdb, uint32_t hash,
+				  const uint32_t seqs[2])
+{
+	return true;
+}
+
 int tdb_mutex_mmap(struct tdb_context *tdb)
 {
 	errno = ENOSYS;
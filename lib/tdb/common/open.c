@@ -60,6 +60,10 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 
 	/* We make it up in memory, then write it out if not internal */
 	size = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off_t);
+	if (tdb->flags & TDB_CHAIN_FREELISTS) {
+		/* The per-chain freelist heads follow the hash table */
+		size += hash_size*sizeof(tdb_off_t);
+	}
 	if (!(newdb = (struct tdb_header *)calloc(size, 1))) {
 		tdb->ecode = TDB_ERR_OOM;
 		return -1;
@@ -73,7 +77,7 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 
 	/* Make sure older tdbs (which don't check the magic hash fields)
 	 * will refuse to open this TDB. */
-	if (tdb->flags & TDB_INCOMPATIBLE_HASH)
+	if (tdb->flags & (TDB_INCOMPATIBLE_HASH|TDB_WYHASH))
 		newdb->rwlocks = TDB_HASH_RWLOCK_MAGIC;
 
 	/*
@@ -85,6 +89,24 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
 	}
 
+	if (tdb->flags & TDB_CHAIN_FREELISTS) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_CHAIN_FREELISTS;
+	}
+
+	if (tdb->flags & TDB_WAL) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_WAL;
+	}
+
+#ifdef USE_TDB_MUTEX_SEQLOCK
+	/*
+	 * Sequence counters in the mutex area, checked by
+	 * tdb_open_ex() to come with TDB_MUTEX_LOCKING.
+	 */
+	if (tdb->flags & TDB_MUTEX_SEQLOCK) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX_SEQLOCK;
+	}
+#endif
+
 	/*
 	 * If we have any features we add the FEATURE_FLAG_MAGIC, overwriting the
 	 * TDB_HASH_RWLOCK_MAGIC above.
@@ -209,6 +231,12 @@ static bool check_header_hash(struct tdb_context *tdb,
 			      struct tdb_header *header,
 			      bool default_hash, uint32_t *m1, uint32_t *m2)
 {
+	static const tdb_hash_func inbuilt_hashes[] = {
+		tdb_old_hash, tdb_jenkins_hash, tdb_wyhash,
+	};
+	tdb_hash_func hash_fn = tdb->hash_fn;
+	size_t i;
+
 	tdb_header_hash(tdb, m1, m2);
 	if (header->magic1_hash == *m1 &&
 	    header->magic2_hash == *m2) {
@@ -219,12 +247,26 @@ static bool check_header_hash(struct tdb_context *tdb,
 	if (!default_hash)
 		return false;
 
-	/* Otherwise, try the other inbuilt hash. */
-	if (tdb->hash_fn == tdb_old_hash)
-		tdb->hash_fn = tdb_jenkins_hash;
-	else
-		tdb->hash_fn = tdb_old_hash;
-	return check_header_hash(tdb, header, false, m1, m2);
+	/* Otherwise, try the other inbuilt hashes. */
+	for (i = 0; i < sizeof(inbuilt_hashes)/sizeof(inbuilt_hashes[0]); i++) {
+		uint32_t h1, h2;
+
+		if (inbuilt_hashes[i] == hash_fn) {
+			continue;
+		}
+		tdb->hash_fn = inbuilt_hashes[i];
+		tdb_header_hash(tdb, &h1, &h2);
+		if (header->magic1_hash == h1 &&
+		    header->magic2_hash == h2) {
+			*m1 = h1;
+			*m2 = h2;
+			return true;
+		}
+	}
+
+	/* Report the magic values of the hash we started with */
+	tdb->hash_fn = hash_fn;
+	return false;
 }
 
 static bool tdb_mutex_open_ok(struct tdb_context *tdb,
@@ -279,6 +321,15 @@ check_local_settings:
 		return false;
 	}
 
+#ifndef USE_TDB_MUTEX_SEQLOCK
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mutex_open_ok[%s]: "
+			 "Can't update the mutex sequence counters\n",
+			 tdb->name));
+		return false;
+	}
+#endif
+
 	if (tdb_mutex_size(tdb) != header->mutex_size) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mutex_open_ok[%s]: "
 			 "Mutex size changed from %u to %u\n.",
@@ -302,6 +353,7 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 	struct stat st;
 	int rev = 0;
 	bool locked = false;
+	bool created = false;
 	unsigned char *vp;
 	uint32_t vertest;
 	unsigned v;
@@ -371,12 +423,14 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		hash_alg = "the user defined";
 	} else {
 		/* This controls what we use when creating a tdb. */
-		if (tdb->flags & TDB_INCOMPATIBLE_HASH) {
+		if (tdb->flags & TDB_WYHASH) {
+			tdb->hash_fn = tdb_wyhash;
+		} else if (tdb->flags & TDB_INCOMPATIBLE_HASH) {
 			tdb->hash_fn = tdb_jenkins_hash;
 		} else {
 			tdb->hash_fn = tdb_old_hash;
 		}
-		hash_alg = "either default";
+		hash_alg = "any default";
 	}
 
 	/* cache the page size */
@@ -400,7 +454,8 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		tdb->read_only = 1;
 		/* read only databases don't do locking or clear if first */
 		tdb->flags |= TDB_NOLOCK;
-		tdb->flags &= ~(TDB_CLEAR_IF_FIRST|TDB_MUTEX_LOCKING);
+		tdb->flags &= ~(TDB_CLEAR_IF_FIRST|TDB_MUTEX_LOCKING|
+				TDB_MUTEX_SEQLOCK);
 	}
 
 	if ((tdb->flags & TDB_ALLOW_NESTING) &&
@@ -412,6 +467,23 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		goto fail;
 	}
 
+	if ((tdb->flags & TDB_MUTEX_SEQLOCK) &&
+	    !(tdb->flags & TDB_MUTEX_LOCKING)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+			"invalid flags for %s - TDB_MUTEX_SEQLOCK "
+			"requires TDB_MUTEX_LOCKING\n", name));
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if ((tdb->flags & TDB_WAL) && (tdb->flags & TDB_CLEAR_IF_FIRST)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+			"invalid flags for %s - TDB_WAL and "
+			"TDB_CLEAR_IF_FIRST are not allowed together\n", name));
+		errno = EINVAL;
+		goto fail;
+	}
+
 	if (tdb->flags & TDB_MUTEX_LOCKING) {
 		/*
 		 * Here we catch bugs in the callers,
@@ -485,7 +557,7 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 	/* internal databases don't mmap or lock, and start off cleared */
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->flags |= (TDB_NOLOCK | TDB_NOMMAP);
-		tdb->flags &= ~TDB_CLEAR_IF_FIRST;
+		tdb->flags &= ~(TDB_CLEAR_IF_FIRST|TDB_WAL);
 		if (tdb_new_database(tdb, &header, hash_size) != 0) {
 			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: tdb_new_database failed!"));
 			goto fail;
@@ -563,6 +635,7 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 			goto fail;
 		}
 		rev = (tdb->flags & TDB_CONVERT);
+		created = true;
 	} else if (header.version != TDB_VERSION
 		   && !(rev = (header.version==TDB_BYTEREV(TDB_VERSION)))) {
 		/* wrong version */
@@ -708,6 +781,13 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		}
 	}
 
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_WAL) && !tdb->read_only) {
+		/* this also takes the active lock */
+		if (tdb_wal_open(tdb, created) == -1) {
+			goto fail;
+		}
+	}
+
 	/* if needed, run recovery */
 	if (tdb_transaction_recover(tdb) == -1) {
 		goto fail;
@@ -750,6 +830,7 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 #ifdef TDB_TRACE
 	close(tdb->tracefd);
 #endif
+	tdb_wal_close(tdb);
 	if (tdb->map_ptr) {
 		if (tdb->flags & TDB_INTERNAL)
 			SAFE_FREE(tdb->map_ptr);
@@ -791,6 +872,10 @@ _PUBLIC_ int tdb_close(struct tdb_context *tdb)
 	}
 	tdb_trace(tdb, "tdb_close");
 
+	if (tdb_wal_close(tdb) != 0) {
+		ret = -1;
+	}
+
 	if (tdb->map_ptr) {
 		if (tdb->flags & TDB_INTERNAL)
 			SAFE_FREE(tdb->map_ptr);
@@ -919,7 +1004,10 @@ fail:
    seek pointer from our parent and to re-establish locks */
 _PUBLIC_ int tdb_reopen(struct tdb_context *tdb)
 {
-	return tdb_reopen_internal(tdb, tdb->flags & TDB_CLEAR_IF_FIRST);
+	bool active_lock = (tdb->flags & TDB_CLEAR_IF_FIRST) ||
+		(tdb->wal != NULL);
+
+	return tdb_reopen_internal(tdb, active_lock);
 }
 
 /* reopen all tdb's */
@@ -928,7 +1016,8 @@ _PUBLIC_ int tdb_reopen_all(int parent_longlived)
 	struct tdb_context *tdb;
 
 	for (tdb=tdbs; tdb; tdb = tdb->next) {
-		bool active_lock = (tdb->flags & TDB_CLEAR_IF_FIRST);
+		bool active_lock = (tdb->flags & TDB_CLEAR_IF_FIRST) ||
+			(tdb->wal != NULL);
 
 		/*
 		 * If the parent is longlived (ie. a
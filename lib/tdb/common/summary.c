@@ -24,6 +24,9 @@
 	"Incompatible hash: %s\n" \
 	"Active/supported feature flags: 0x%08x/0x%08x\n" \
 	"Robust mutexes locking: %s\n" \
+	"Per-chain freelists: %s\n" \
+	"Lock-free record parsing: %s\n" \
+	"Write-ahead log: %s\n" \
 	"Smallest/average/largest keys: %zu/%zu/%zu\n" \
 	"Smallest/average/largest data: %zu/%zu/%zu\n" \
 	"Smallest/average/largest padding: %zu/%zu/%zu\n" \
@@ -31,6 +34,7 @@
 	"Smallest/average/largest dead records: %zu/%zu/%zu\n" \
 	"Number of free records: %zu\n" \
 	"Smallest/average/largest free records: %zu/%zu/%zu\n" \
+	"Unused bytes below/after the last record in use: %zu/%zu\n" \
 	"Number of hash chains: %zu\n" \
 	"Smallest/average/largest hash chains: %zu/%zu/%zu\n" \
 	"Number of uncoalesced records: %zu\n" \
@@ -97,6 +101,8 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	char *ret = NULL;
 	bool locked;
 	size_t unc = 0;
+	size_t unused = 0, unused_below = 0;
+	tdb_off_t used_end;
 	int len;
 	struct tdb_record recovery;
 
@@ -110,6 +116,9 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		locked = true;
 	}
 
+	/* The file might have been cut by tdb_compact_step() */
+	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
+
 	if (tdb_recovery_area(tdb, tdb->methods, &rec_off, &recovery) != 0) {
 		goto unlock;
 	}
@@ -121,8 +130,9 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	tally_init(&extra);
 	tally_init(&hashval);
 	tally_init(&uncoal);
+	used_end = TDB_DATA_START(tdb);
 
-	for (off = TDB_DATA_START(tdb->hash_size);
+	for (off = TDB_DATA_START(tdb);
 	     off < tdb->map_size - 1;
 	     off += sizeof(rec) + rec.rec_len) {
 		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
@@ -137,11 +147,21 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 			if (unc > 1)
 				tally_add(&uncoal, unc - 1);
 			unc = 0;
+			/* what tdb_compact_step() could move down */
+			unused_below += unused;
+			unused = 0;
+			used_end = off + sizeof(rec) + rec.rec_len;
 			break;
 		case TDB_FREE_MAGIC:
 			tally_add(&freet, rec.rec_len);
+			unused += sizeof(rec) + rec.rec_len;
 			unc++;
 			break;
+		case TDB_CHAIN_FREE_MAGIC:
+			/* Never coalesced, don't count them in "unc" */
+			tally_add(&freet, rec.rec_len);
+			unused += sizeof(rec) + rec.rec_len;
+			break;
 		/* If we crash after ftruncate, we can get zeroes or fill. */
 		case TDB_RECOVERY_INVALID_MAGIC:
 		case 0x42424242:
@@ -154,6 +174,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 			/* Fall through */
 		case TDB_DEAD_MAGIC:
 			tally_add(&dead, rec.rec_len);
+			unused += sizeof(rec) + rec.rec_len;
 			break;
 		default:
 			TDB_LOG((tdb, TDB_DEBUG_ERROR,
@@ -174,9 +195,15 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 (unsigned long long)file_size, keys.total+data.total,
 		 (size_t)tdb->hdr_ofs, (size_t)tdb->map_size,
 		 keys.num,
+		 (tdb->hash_fn == tdb_wyhash)?"wyhash":
 		 (tdb->hash_fn == tdb_jenkins_hash)?"yes":"no",
 		 (unsigned)tdb->feature_flags, TDB_SUPPORTED_FEATURE_FLAGS,
 		 (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX)?"yes":"no",
+		 (tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS)?
+		 "yes":"no",
+		 (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK)?
+		 "yes":"no",
+		 (tdb->feature_flags & TDB_FEATURE_FLAG_WAL)?"yes":"no",
 		 keys.min, tally_mean(&keys), keys.max,
 		 data.min, tally_mean(&data), data.max,
 		 extra.min, tally_mean(&extra), extra.max,
@@ -184,6 +211,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 dead.min, tally_mean(&dead), dead.max,
 		 freet.num,
 		 freet.min, tally_mean(&freet), freet.max,
+		 unused_below, (size_t)(tdb->map_size - used_end),
 		 hashval.num,
 		 hashval.min, tally_mean(&hashval), hashval.max,
 		 uncoal.total,
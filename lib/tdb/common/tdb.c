@@ -266,9 +266,150 @@ _PUBLIC_ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
  * This is interesting for all readers of potentially large data structures in
  * the tdb records, ldb indexes being one example.
  *
+ * With TDB_FEATURE_FLAG_MUTEX_SEQLOCK the chain is first read without any
+ * lock, see tdb_parse_record_seqlock(). The parser then gets a copy of the
+ * data.
+ *
  * Return -1 if the record was not found.
  */
 
+/*
+ * Records larger than this are parsed under the chain lock directly
+ * from the mmap area instead of being copied.
+ */
+#define TDB_SEQLOCK_MAX_COPY 65536
+
+/*
+ * Look up "key" in the mmap area without locking its hash chain. The
+ * chain's sequence counter tells us whether a writer interfered, all
+ * we read must be treated as garbage until it is checked: Pointers
+ * and lengths are bounds checked against the map, nothing is logged.
+ *
+ * Returns false if the caller has to do the locked lookup. This is
+ * the case if writers keep interfering, if the mmap is out of date or
+ * if the record is too large.
+ */
+static bool tdb_parse_record_seqlock(struct tdb_context *tdb, TDB_DATA key,
+				     uint32_t hash,
+				     int (*parser)(TDB_DATA key,
+						   TDB_DATA data,
+						   void *private_data),
+				     void *private_data, int *pret)
+{
+	const uint8_t *map = (const uint8_t *)tdb->map_ptr;
+	tdb_len_t map_size = tdb->map_size;
+	uint8_t buf[1024];
+	int tries;
+
+	if ((tdb->transaction != NULL) || (map == NULL) ||
+	    (tdb->flags & TDB_CONVERT)) {
+		return false;
+	}
+
+	for (tries = 0; tries < 3; tries++) {
+		uint32_t seqs[2];
+		struct tdb_record rec;
+		tdb_off_t rec_ptr;
+		size_t steps = 0;
+		uint8_t *copy = NULL;
+		bool found = false;
+		bool ok = true;
+
+		if (!tdb_mutex_seqlock_read_begin(tdb, hash, seqs)) {
+			/* A writer is active, queue behind it */
+			return false;
+		}
+
+		memcpy(&rec_ptr, map + TDB_HASH_TOP(hash), sizeof(rec_ptr));
+
+		while (rec_ptr != 0) {
+			uint64_t rec_end;
+
+			if ((++steps > map_size / sizeof(rec)) ||
+			    ((size_t)rec_ptr + sizeof(rec) > map_size)) {
+				ok = false;
+				break;
+			}
+			memcpy(&rec, map + rec_ptr, sizeof(rec));
+
+			if (TDB_DEAD(&rec)) {
+				rec_ptr = rec.next;
+				continue;
+			}
+			if (rec.magic != TDB_MAGIC) {
+				ok = false;
+				break;
+			}
+			if ((rec.full_hash != hash) ||
+			    (rec.key_len != key.dsize)) {
+				rec_ptr = rec.next;
+				continue;
+			}
+
+			rec_end = (uint64_t)rec_ptr + sizeof(rec) +
+				rec.key_len + rec.data_len;
+			if (rec_end > map_size) {
+				ok = false;
+				break;
+			}
+			if (memcmp(map + rec_ptr + sizeof(rec), key.dptr,
+				   key.dsize) != 0) {
+				rec_ptr = rec.next;
+				continue;
+			}
+
+			if (rec.data_len > TDB_SEQLOCK_MAX_COPY) {
+				ok = false;
+				break;
+			}
+			copy = buf;
+			if (rec.data_len > sizeof(buf)) {
+				copy = malloc(rec.data_len);
+				if (copy == NULL) {
+					ok = false;
+					break;
+				}
+			}
+			memcpy(copy, map + rec_ptr + sizeof(rec) + key.dsize,
+			       rec.data_len);
+			found = true;
+			break;
+		}
+
+		if (tdb_mutex_seqlock_read_retry(tdb, hash, seqs)) {
+			if (copy != buf) {
+				SAFE_FREE(copy);
+			}
+			continue;
+		}
+
+		if (!ok) {
+			/*
+			 * Consistent, but not usable here. Let the
+			 * locked path remap or report corruption.
+			 */
+			return false;
+		}
+
+		if (!found) {
+			tdb->ecode = TDB_ERR_NOEXIST;
+			*pret = -1;
+			return true;
+		}
+
+		*pret = parser(key,
+			       (TDB_DATA) { .dptr = copy,
+					    .dsize = rec.data_len },
+			       private_data);
+		if (copy != buf) {
+			SAFE_FREE(copy);
+		}
+		return true;
+	}
+
+	return false;
+}
+
 _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 		     int (*parser)(TDB_DATA key, TDB_DATA data,
 				   void *private_data),
@@ -282,6 +423,13 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
 
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK) &&
+	    tdb_parse_record_seqlock(tdb, key, hash, parser, private_data,
+				     &ret)) {
+		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, ret);
+		return ret;
+	}
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec))) {
 		/* record not found */
 		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, -1);
@@ -298,6 +446,151 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 	return ret;
 }
 
+struct tdb_parse_records_key {
+	uint32_t hash;
+	uint32_t bucket;
+	size_t idx;
+};
+
+static int tdb_parse_records_cmp(const void *p1, const void *p2)
+{
+	const struct tdb_parse_records_key *k1 = p1;
+	const struct tdb_parse_records_key *k2 = p2;
+
+	if (k1->bucket != k2->bucket) {
+		return (k1->bucket < k2->bucket) ? -1 : 1;
+	}
+	if (k1->idx != k2->idx) {
+		return (k1->idx < k2->idx) ? -1 : 1;
+	}
+	return 0;
+}
+
+struct tdb_parse_records_state {
+	int (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+		      void *private_data);
+	void *private_data;
+	size_t idx;
+	bool found;
+};
+
+static int tdb_parse_records_parser(TDB_DATA key, TDB_DATA data,
+				    void *private_data)
+{
+	struct tdb_parse_records_state *state = private_data;
+
+	state->found = true;
+	return state->parser(state->idx, key, data, state->private_data);
+}
+
+/*
+  look up a batch of keys, visiting the hash chains in order and
+  locking each of them only once
+*/
+_PUBLIC_ int tdb_parse_records(struct tdb_context *tdb,
+			       const TDB_DATA *keys, size_t num_keys,
+			       int (*parser)(size_t idx, TDB_DATA key,
+					     TDB_DATA data,
+					     void *private_data),
+			       void *private_data)
+{
+	struct tdb_parse_records_state state = {
+		.parser = parser, .private_data = private_data
+	};
+	struct tdb_parse_records_key *sorted;
+	bool locked = false;
+	uint32_t bucket = 0;
+	size_t i;
+	int ret = 0;
+
+	if (num_keys == 0) {
+		return 0;
+	}
+
+	if (num_keys > SIZE_MAX / sizeof(*sorted)) {
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+	sorted = (struct tdb_parse_records_key *)malloc(
+		num_keys * sizeof(*sorted));
+	if (sorted == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+
+	for (i=0; i<num_keys; i++) {
+		TDB_DATA key = keys[i];
+		uint32_t hash = tdb->hash_fn(&key);
+
+		sorted[i] = (struct tdb_parse_records_key) {
+			.hash = hash, .bucket = BUCKET(hash), .idx = i
+		};
+	}
+	qsort(sorted, num_keys, sizeof(*sorted), tdb_parse_records_cmp);
+
+	for (i=0; i<num_keys; i++) {
+		struct tdb_parse_records_key *k = &sorted[i];
+		TDB_DATA key = keys[k->idx];
+		struct tdb_record rec;
+		tdb_off_t rec_ptr;
+
+		state.idx = k->idx;
+		state.found = false;
+
+		if ((tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK) &&
+		    tdb_parse_record_seqlock(tdb, key, k->hash,
+					     tdb_parse_records_parser, &state,
+					     &ret)) {
+			if (!state.found) {
+				ret = 0;
+				continue;
+			}
+			if (ret != 0) {
+				break;
+			}
+			continue;
+		}
+
+		if (!locked || (k->bucket != bucket)) {
+			if (locked) {
+				tdb_unlock(tdb, bucket, F_RDLCK);
+				locked = false;
+			}
+			if (tdb_lock(tdb, k->bucket, F_RDLCK) == -1) {
+				ret = -1;
+				break;
+			}
+			locked = true;
+			bucket = k->bucket;
+		}
+
+		rec_ptr = tdb_find(tdb, key, k->hash, &rec);
+		if (rec_ptr == 0) {
+			if (tdb->ecode != TDB_ERR_NOEXIST) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		ret = tdb_parse_data(tdb, key,
+				     rec_ptr + sizeof(rec) + rec.key_len,
+				     rec.data_len, tdb_parse_records_parser,
+				     &state);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	if (locked) {
+		tdb_unlock(tdb, bucket, F_RDLCK);
+	}
+	free(sorted);
+
+	tdb_trace_ret(tdb, "tdb_parse_records", ret);
+	return ret;
+}
+
 /* check if an entry in the database exists
 
    note that 1 is returned if the key is found and 0 is returned if not found
@@ -355,6 +648,12 @@ int tdb_do_delete(struct tdb_context *tdb, tdb_off_t rec_ptr, struct tdb_record
 		return -1;
 
 	/* recover the space */
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS) {
+		/* All callers hold the record's chain lock */
+		if (tdb_free_chain(tdb, rec->full_hash, rec_ptr, rec) == -1)
+			return -1;
+		return 0;
+	}
 	if (tdb_free(tdb, rec_ptr, rec) == -1)
 		return -1;
 	return 0;
@@ -894,6 +1193,9 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 
 	tdb_trace(tdb, "tdb_wipe_all");
 
+	/* The file might have been cut by tdb_compact_step() */
+	tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
+
 	/* see if the tdb has a recovery area, and remember its size
 	   if so. We don't want to lose this as otherwise each
 	   tdb_wipe_all() in a transaction will increase the size of
@@ -926,12 +1228,24 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 		goto failed;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS) {
+		for (i=0;i<tdb->hash_size;i++) {
+			if (tdb_ofs_write(tdb, TDB_CHAIN_FREELIST_TOP(i),
+					  &offset) == -1) {
+				TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: "
+					 "failed to write chain freelist %d\n",
+					 i));
+				goto failed;
+			}
+		}
+	}
+
 	/* add all the rest of the file to the freelist, possibly leaving a gap
 	   for the recovery area */
 	if (recovery_size == 0) {
 		/* the simple case - the whole file can be used as a freelist */
-		data_len = (tdb->map_size - TDB_DATA_START(tdb->hash_size));
-		if (tdb_free_region(tdb, TDB_DATA_START(tdb->hash_size), data_len) != 0) {
+		data_len = (tdb->map_size - TDB_DATA_START(tdb));
+		if (tdb_free_region(tdb, TDB_DATA_START(tdb), data_len) != 0) {
 			goto failed;
 		}
 	} else {
@@ -943,8 +1257,8 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 		   move the recovery area or we risk subtle data
 		   corruption
 		*/
-		data_len = (recovery_head - TDB_DATA_START(tdb->hash_size));
-		if (tdb_free_region(tdb, TDB_DATA_START(tdb->hash_size), data_len) != 0) {
+		data_len = (recovery_head - TDB_DATA_START(tdb));
+		if (tdb_free_region(tdb, TDB_DATA_START(tdb), data_len) != 0) {
 			goto failed;
 		}
 		/* and the 2nd free list entry after the recovery area - if any */
@@ -54,6 +54,7 @@ typedef uint32_t tdb_off_t;
 #define TDB_RECOVERY_INVALID_MAGIC (0x0)
 #define TDB_HASH_RWLOCK_MAGIC (0xbad1a51U)
 #define TDB_FEATURE_FLAG_MAGIC (0xbad1a52U)
+#define TDB_CHAIN_FREE_MAGIC (0xf4ee1c4aU)
 #define TDB_ALIGNMENT 4
 #define DEFAULT_HASH_SIZE 131
 #define FREELIST_TOP (sizeof(struct tdb_header))
@@ -63,18 +64,39 @@ typedef uint32_t tdb_off_t;
 #define TDB_BAD_MAGIC(r) ((r)->magic != TDB_MAGIC && !TDB_DEAD(r))
 #define TDB_HASH_TOP(hash) (FREELIST_TOP + (BUCKET(hash)+1)*sizeof(tdb_off_t))
 #define TDB_HASHTABLE_SIZE(tdb) ((tdb->hash_size+1)*sizeof(tdb_off_t))
-#define TDB_DATA_START(hash_size) (TDB_HASH_TOP(hash_size-1) + sizeof(tdb_off_t))
+#define TDB_HASHTABLE_END(hash_size) (TDB_HASH_TOP(hash_size-1) + sizeof(tdb_off_t))
+#define TDB_CHAIN_FREELIST_TOP(hash) (TDB_HASHTABLE_END(tdb->hash_size) + BUCKET(hash)*sizeof(tdb_off_t))
+#define TDB_CHAIN_FREELISTS_SIZE(tdb) \
+	(((tdb)->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS) ? \
+	 (tdb)->hash_size*sizeof(tdb_off_t) : 0)
+#define TDB_DATA_START(tdb) (TDB_HASHTABLE_END((tdb)->hash_size) + TDB_CHAIN_FREELISTS_SIZE(tdb))
 #define TDB_RECOVERY_HEAD offsetof(struct tdb_header, recovery_start)
 #define TDB_SEQNUM_OFS    offsetof(struct tdb_header, sequence_number)
 #define TDB_PAD_BYTE 0x42
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_CHAIN_FREELISTS 0x00000002
+#define TDB_FEATURE_FLAG_MUTEX_SEQLOCK 0x00000004
+#define TDB_FEATURE_FLAG_WAL 0x00000008
+
+/*
+ * Number of free records kept per hash chain with
+ * TDB_FEATURE_FLAG_CHAIN_FREELISTS, more go to the global freelist.
+ */
+#define TDB_CHAIN_FREELIST_MAX 4
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_CHAIN_FREELISTS | \
+	TDB_FEATURE_FLAG_MUTEX_SEQLOCK | \
+	TDB_FEATURE_FLAG_WAL | \
 	0)
 
+#if defined(USE_TDB_MUTEX_LOCKING) && defined(HAVE___SYNC_FETCH_AND_ADD)
+#define USE_TDB_MUTEX_SEQLOCK 1
+#endif
+
 /* NB assumes there is a local variable called "tdb" that is the
  * current context, also takes doubly-parenthesized print-style
  * argument. */
@@ -120,6 +142,7 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
 #define OPEN_LOCK        0
 #define ACTIVE_LOCK      4
 #define TRANSACTION_LOCK 8
+#define WAL_LOCK         12
 
 /* free memory if the pointer is valid and zero the pointer */
 #ifndef SAFE_FREE
@@ -217,6 +240,7 @@ struct tdb_methods {
 };
 
 struct tdb_mutexes;
+struct tdb_wal;
 
 struct tdb_context {
 	char *name; /* the name of the database */
@@ -233,6 +257,9 @@ struct tdb_context {
 
 	tdb_off_t hdr_ofs; /* this is 0 or header.mutex_size */
 	struct tdb_mutexes *mutexes; /* mmap of the mutex area */
+	struct tdb_wal *wal; /* set with TDB_FEATURE_FLAG_WAL */
+	tdb_off_t compact_tail; /* free tail seen by the last compact step */
+	tdb_len_t compact_map_size; /* map_size at the last compact step */
 
 	enum TDB_ERROR ecode; /* error code for last tdb error */
 	uint32_t hash_size;
@@ -273,7 +300,10 @@ int tdb_brlock(struct tdb_context *tdb,
 	       enum tdb_lock_flags flags);
 int tdb_brunlock(struct tdb_context *tdb,
 		 int rw_type, tdb_off_t offset, size_t len);
+int tdb_chain_brlock(struct tdb_context *tdb, uint32_t list, int ltype);
+int tdb_chain_brunlock(struct tdb_context *tdb, uint32_t list, int ltype);
 bool tdb_have_extra_locks(struct tdb_context *tdb);
+bool tdb_have_nest_lock(struct tdb_context *tdb, uint32_t offset);
 void tdb_release_transaction_locks(struct tdb_context *tdb);
 int tdb_transaction_lock(struct tdb_context *tdb, int ltype,
 			 enum tdb_lock_flags lockflags);
@@ -292,14 +322,20 @@ int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 void *tdb_convert(void *buf, uint32_t size);
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+int tdb_free_chain(struct tdb_context *tdb, uint32_t hash, tdb_off_t offset,
+		   struct tdb_record *rec);
 tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 		       struct tdb_record *rec);
+tdb_off_t tdb_allocate_below(struct tdb_context *tdb, tdb_len_t length,
+			     tdb_off_t limit, struct tdb_record *rec);
 int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_lock_record(struct tdb_context *tdb, tdb_off_t off);
 int tdb_unlock_record(struct tdb_context *tdb, tdb_off_t off);
 bool tdb_needs_recovery(struct tdb_context *tdb);
 int tdb_rec_read(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+int tdb_read_threadsafe(struct tdb_context *tdb, tdb_off_t off, void *buf,
+			tdb_len_t len);
 int tdb_rec_write(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
 int tdb_do_delete(struct tdb_context *tdb, tdb_off_t rec_ptr, struct tdb_record *rec);
 unsigned char *tdb_alloc_read(struct tdb_context *tdb, tdb_off_t offset, tdb_len_t len);
@@ -316,14 +352,20 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 int tdb_purge_dead(struct tdb_context *tdb, uint32_t hash);
 void tdb_io_init(struct tdb_context *tdb);
 int tdb_expand(struct tdb_context *tdb, tdb_off_t size);
+int tdb_shrink(struct tdb_context *tdb, tdb_off_t size);
 tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size);
 int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off,
 		      struct tdb_record *rec);
 bool tdb_write_all(int fd, const void *buf, size_t count);
 int tdb_transaction_recover(struct tdb_context *tdb);
+int tdb_wal_open(struct tdb_context *tdb, bool created);
+int tdb_wal_close(struct tdb_context *tdb);
+int tdb_wal_checkpoint(struct tdb_context *tdb);
+int tdb_wal_before_write(struct tdb_context *tdb);
 void tdb_header_hash(struct tdb_context *tdb,
 		     uint32_t *magic1_hash, uint32_t *magic2_hash);
 unsigned int tdb_old_hash(TDB_DATA *key);
+unsigned int tdb_wyhash(TDB_DATA *key);
 size_t tdb_dead_space(struct tdb_context *tdb, tdb_off_t off);
 bool tdb_add_off_t(tdb_off_t a, tdb_off_t b, tdb_off_t *pret);
 
@@ -344,5 +386,9 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 int tdb_mutex_allrecord_unlock(struct tdb_context *tdb);
 int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb);
 void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb);
+bool tdb_mutex_seqlock_read_begin(struct tdb_context *tdb, uint32_t hash,
+				  uint32_t seqs[2]);
+bool tdb_mutex_seqlock_read_retry(struct tdb_context *tdb, uint32_t hash,
+				  const uint32_t seqs[2]);
 
 #endif /* TDB_PRIVATE_H */
@@ -101,6 +101,11 @@
     An attempt create a nested transaction will fail with TDB_ERR_NESTING.
     The default is that transaction nesting is allowed.
     Note: this default may change in future versions of tdb.
+
+  - databases created with TDB_WAL don't use the recovery area. Their
+    commits append the new contents of the modified blocks to a
+    write-ahead log and only sync that, see the description further
+    down.
 */
 
 
@@ -136,6 +141,9 @@ struct tdb_transaction {
 	bool prepared;
 	tdb_off_t magic_offset;
 
+	/* with TDB_FEATURE_FLAG_WAL: our record in the log once prepared */
+	tdb_off_t wal_offset;
+
 	/* old file size before transaction */
 	tdb_len_t old_map_size;
 
@@ -590,6 +598,707 @@ static int transaction_sync(struct tdb_context *tdb, tdb_off_t offset, tdb_len_t
 }
 
 
+/*
+  write-ahead log design:
+
+  - with TDB_FEATURE_FLAG_WAL a commit appends the new contents of
+    all modified blocks as one record to "<name>.wal". Syncing the log
+    is the only sync in a commit, afterwards the blocks are written
+    into the database without syncing it.
+
+  - tdb_transaction_prepare_commit() writes the record with
+    TDB_WAL_PREPARED_MAGIC. The commit overwrites that with
+    TDB_WAL_COMMIT_MAGIC and syncs the log, which makes the
+    transaction durable. Cancelling a prepared transaction truncates
+    the record away again.
+
+  - "applying" in the log header is set before the commit magic is
+    written and cleared when all blocks are written. If another
+    process finds it set, the committer died and the log is replayed
+    from tdb_transaction_recover(). The records contain whole blocks
+    in commit order, so applying older records again does no harm.
+
+  - the log is emptied by tdb_wal_checkpoint(), after syncing the
+    database. This happens when the log grows beyond
+    TDB_WAL_CHECKPOINT_SIZE, when the last user closes the database,
+    and before the database is written to outside a transaction:
+    replaying the log later would overwrite such changes.
+
+  - every user holds ACTIVE_LOCK. Whoever opens the database and gets
+    it exclusively replays the log before emptying it. This restores
+    the changes that were only in the page cache when the machine
+    crashed.
+
+  - tdb only allows one transaction at a time, so there are never
+    several committers waiting for the log to be synced. What is done
+    in batches is syncing the database itself, once per checkpoint
+    for all transactions logged since the previous one.
+
+  The log header is mmap'ed and shared by all users, records are
+  written and read with pwrite/pread.
+*/
+
+#define TDB_WAL_MAGIC_STR "TDB write-ahead log\n"
+#define TDB_WAL_VERSION 1
+#define TDB_WAL_PREPARED_MAGIC (0xf53bc0e8U)
+#define TDB_WAL_COMMIT_MAGIC (0xf53bc0e9U)
+#define TDB_WAL_CHECKPOINT_SIZE (1024*1024)
+
+struct tdb_wal_header {
+	char magic[32]; /* TDB_WAL_MAGIC_STR */
+	uint32_t version;
+	uint32_t generation; /* changed by every checkpoint */
+	tdb_off_t end; /* where the next record is written */
+	uint32_t applying; /* a commit is writing to the database */
+};
+
+#define TDB_WAL_DATA_START sizeof(struct tdb_wal_header)
+
+struct tdb_wal_record {
+	uint32_t magic;
+	uint32_t checksum; /* of everything following this field */
+	tdb_len_t len; /* including this header */
+	uint32_t generation; /* of the log when it was written */
+	tdb_len_t map_size; /* database size after the transaction */
+	/* followed by offset/length/data for every block */
+};
+
+struct tdb_wal {
+	int fd;
+	struct tdb_wal_header *hdr;
+	bool replaying;
+};
+
+static int tdb_wal_sync(struct tdb_context *tdb)
+{
+	struct tdb_wal *wal = tdb->wal;
+
+	if (tdb->flags & TDB_NOSYNC) {
+		return 0;
+	}
+
+#ifdef HAVE_MMAP
+	if (msync((void *)wal->hdr, sizeof(*wal->hdr), MS_SYNC) != 0) {
+		tdb->ecode = TDB_ERR_IO;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_sync: msync failed - %s\n",
+			 strerror(errno)));
+		return -1;
+	}
+#endif
+#ifdef HAVE_FDATASYNC
+	if (fdatasync(wal->fd) != 0) {
+#else
+	if (fsync(wal->fd) != 0) {
+#endif
+		tdb->ecode = TDB_ERR_IO;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_sync: fsync failed - %s\n",
+			 strerror(errno)));
+		return -1;
+	}
+	return 0;
+}
+
+static int tdb_wal_pwrite(struct tdb_context *tdb, const void *buf,
+			  size_t len, off_t offset)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+
+	while (len > 0) {
+		ssize_t ret = pwrite(tdb->wal->fd, p, len, offset);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			tdb->ecode = TDB_ERR_IO;
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_pwrite: failed "
+				 "to write %zu bytes at %ju - %s\n", len,
+				 (uintmax_t)offset,
+				 (ret == -1) ? strerror(errno) : "short write"));
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+		offset += ret;
+	}
+	return 0;
+}
+
+/*
+  append the modified blocks to the log as a prepared record
+*/
+static int tdb_wal_append(struct tdb_context *tdb, tdb_off_t *wal_offset)
+{
+	struct tdb_transaction *transaction = tdb->transaction;
+	struct tdb_wal_record *rec;
+	tdb_len_t rec_len = sizeof(*rec);
+	tdb_off_t offset, end;
+	unsigned char *data, *p;
+	TDB_DATA payload;
+	uint32_t i;
+
+	for (i=0;i<transaction->num_blocks;i++) {
+		tdb_len_t length = transaction->block_size;
+
+		if (transaction->blocks[i] == NULL) {
+			continue;
+		}
+		if (i == transaction->num_blocks-1) {
+			length = transaction->last_block_size;
+		}
+		if (!tdb_add_len_t(rec_len, 2*sizeof(tdb_off_t), &rec_len) ||
+		    !tdb_add_len_t(rec_len, length, &rec_len)) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_append: "
+				 "overflow record size\n"));
+			tdb->ecode = TDB_ERR_IO;
+			return -1;
+		}
+	}
+
+	offset = tdb->wal->hdr->end;
+	if (!tdb_add_off_t(offset, rec_len, &end)) {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_append: "
+			 "overflow log size\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	data = (unsigned char *)malloc(rec_len);
+	if (data == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+
+	rec = (struct tdb_wal_record *)data;
+	rec->magic = TDB_WAL_PREPARED_MAGIC;
+	rec->len = rec_len;
+	rec->generation = tdb->wal->hdr->generation;
+	rec->map_size = tdb->map_size;
+
+	p = data + sizeof(*rec);
+	for (i=0;i<transaction->num_blocks;i++) {
+		tdb_off_t block_offset;
+		tdb_len_t length;
+
+		if (transaction->blocks[i] == NULL) {
+			continue;
+		}
+
+		block_offset = i * transaction->block_size;
+		length = transaction->block_size;
+		if (i == transaction->num_blocks-1) {
+			length = transaction->last_block_size;
+		}
+
+		memcpy(p, &block_offset, 4);
+		memcpy(p+4, &length, 4);
+		memcpy(p+8, transaction->blocks[i], length);
+		p += 8 + length;
+	}
+
+	payload.dptr = data + offsetof(struct tdb_wal_record, len);
+	payload.dsize = rec_len - offsetof(struct tdb_wal_record, len);
+	rec->checksum = tdb_jenkins_hash(&payload);
+
+	if (tdb_wal_pwrite(tdb, data, rec_len, offset) == -1) {
+		free(data);
+		return -1;
+	}
+	free(data);
+
+	tdb->wal->hdr->end = end;
+	*wal_offset = offset;
+	return 0;
+}
+
+/*
+  mark a prepared record as committed and make sure it's on disk
+*/
+static int tdb_wal_commit_record(struct tdb_context *tdb, tdb_off_t wal_offset)
+{
+	uint32_t magic = TDB_WAL_COMMIT_MAGIC;
+
+	/* from here on a dead committer leaves a replay behind */
+	tdb->wal->hdr->applying = 1;
+
+	if (tdb_wal_pwrite(tdb, &magic, sizeof(magic),
+			   wal_offset + offsetof(struct tdb_wal_record, magic))
+	    == -1) {
+		return -1;
+	}
+	return tdb_wal_sync(tdb);
+}
+
+/*
+  throw away a record that did not get committed
+*/
+static int tdb_wal_truncate(struct tdb_context *tdb, tdb_off_t wal_offset)
+{
+	if (ftruncate(tdb->wal->fd, wal_offset) == -1) {
+		tdb->ecode = TDB_ERR_IO;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_truncate: ftruncate "
+			 "to %u failed - %s\n", wal_offset, strerror(errno)));
+		return -1;
+	}
+	tdb->wal->hdr->end = wal_offset;
+	tdb->wal->hdr->applying = 0;
+	return 0;
+}
+
+static int tdb_wal_apply(struct tdb_context *tdb,
+			 const unsigned char *data, tdb_len_t len)
+{
+	const struct tdb_wal_record *rec = (const struct tdb_wal_record *)data;
+	const unsigned char *p = data + sizeof(*rec);
+	const unsigned char *end = data + len;
+
+	if (rec->map_size > tdb->map_size) {
+		if (tdb->methods->tdb_expand_file(
+			    tdb, tdb->map_size,
+			    rec->map_size - tdb->map_size) == -1) {
+			return -1;
+		}
+		tdb->methods->tdb_oob(tdb, tdb->map_size, 1, 1);
+	}
+
+	while (p + 8 <= end) {
+		uint32_t ofs, length;
+
+		memcpy(&ofs, p, 4);
+		memcpy(&length, p+4, 4);
+		p += 8;
+
+		if (length > end - p) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_apply: "
+				 "block of %u bytes at %u exceeds record\n",
+				 length, ofs));
+			tdb->ecode = TDB_ERR_CORRUPT;
+			return -1;
+		}
+		if (tdb->methods->tdb_write(tdb, ofs, p, length) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_apply: failed "
+				 "to write %u bytes at %u\n", length, ofs));
+			return -1;
+		}
+		p += length;
+	}
+
+	return 0;
+}
+
+/*
+  write all committed records of the log into the database again. The
+  caller needs to make sure nobody else writes to the database.
+*/
+static int tdb_wal_replay(struct tdb_context *tdb, tdb_off_t *pend)
+{
+	struct tdb_wal *wal = tdb->wal;
+	struct tdb_wal_record rec;
+	unsigned char *data = NULL;
+	tdb_off_t offset = TDB_WAL_DATA_START;
+	unsigned num_records = 0;
+	struct stat st;
+	int ret = -1;
+
+	/*
+	 * A dead committer might not have synced its record, and we
+	 * must not write anything into the database the log would not
+	 * bring back after a crash.
+	 */
+	if (tdb_wal_sync(tdb) == -1) {
+		return -1;
+	}
+
+	if (fstat(wal->fd, &st) == -1) {
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
+
+	wal->replaying = true;
+
+	while (offset + sizeof(rec) <= st.st_size) {
+		TDB_DATA payload;
+		ssize_t nread;
+
+		nread = pread(wal->fd, &rec, sizeof(rec), offset);
+		if (nread != sizeof(rec)) {
+			break;
+		}
+		if ((rec.magic != TDB_WAL_PREPARED_MAGIC &&
+		     rec.magic != TDB_WAL_COMMIT_MAGIC) ||
+		    (rec.generation != wal->hdr->generation) ||
+		    (rec.len < sizeof(rec)) ||
+		    (rec.len > st.st_size - offset)) {
+			/* torn or stale: the end of the log */
+			break;
+		}
+
+		data = (unsigned char *)malloc(rec.len);
+		if (data == NULL) {
+			tdb->ecode = TDB_ERR_OOM;
+			goto fail;
+		}
+		nread = pread(wal->fd, data, rec.len, offset);
+		if (nread != rec.len) {
+			tdb->ecode = TDB_ERR_IO;
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_replay: failed "
+				 "to read %u bytes at %u\n", rec.len, offset));
+			goto fail;
+		}
+
+		payload.dptr = data + offsetof(struct tdb_wal_record, len);
+		payload.dsize = rec.len - offsetof(struct tdb_wal_record, len);
+		if (tdb_jenkins_hash(&payload) != rec.checksum) {
+			break;
+		}
+
+		if (rec.magic == TDB_WAL_COMMIT_MAGIC) {
+			if (tdb_wal_apply(tdb, data, rec.len) == -1) {
+				goto fail;
+			}
+			num_records += 1;
+		}
+		SAFE_FREE(data);
+
+		offset += rec.len;
+	}
+
+	if (num_records != 0) {
+		TDB_LOG((tdb, TDB_DEBUG_TRACE, "tdb_wal_replay: replayed "
+			 "%u records of %s\n", num_records, tdb->name));
+	}
+
+	*pend = offset;
+	ret = 0;
+fail:
+	wal->replaying = false;
+	SAFE_FREE(data);
+	return ret;
+}
+
+/*
+  replay the log if a committer died. Called like
+  tdb_transaction_recover().
+*/
+static int tdb_wal_recover(struct tdb_context *tdb)
+{
+	tdb_off_t end;
+	int ret;
+
+	if (!tdb->wal->hdr->applying) {
+		return 0;
+	}
+
+	if (tdb_nest_lock(tdb, WAL_LOCK, F_WRLCK, TDB_LOCK_WAIT) == -1) {
+		return -1;
+	}
+
+	ret = tdb_wal_replay(tdb, &end);
+	if (ret == 0) {
+		tdb->wal->hdr->applying = 0;
+	} else {
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_recover: failed to "
+			 "replay the log of %s\n", tdb->name));
+	}
+
+	tdb_nest_unlock(tdb, WAL_LOCK, F_WRLCK, false);
+	return ret;
+}
+
+/*
+  do we have the exclusive access tdb_wal_replay() needs?
+*/
+static bool tdb_wal_exclusive(struct tdb_context *tdb)
+{
+	return (tdb->allrecord_lock.count != 0) &&
+		(tdb->allrecord_lock.ltype == F_WRLCK);
+}
+
+/*
+  sync the database and empty the log
+*/
+int tdb_wal_checkpoint(struct tdb_context *tdb)
+{
+	struct tdb_wal *wal = tdb->wal;
+	bool allrecord = false;
+	int ret = -1;
+
+	if (wal->hdr->end == TDB_WAL_DATA_START) {
+		return 0;
+	}
+
+again:
+	if (wal->hdr->applying && !tdb_wal_exclusive(tdb)) {
+		/*
+		 * A dead committer. Replaying its log needs exclusive
+		 * access to the database like tdb_transaction_recover(),
+		 * tdb_allrecord_lock() does the replay for us.
+		 */
+		if (tdb_allrecord_lock(tdb, F_WRLCK, TDB_LOCK_WAIT,
+				       false) == -1) {
+			return -1;
+		}
+		allrecord = true;
+	}
+
+	if (tdb_nest_lock(tdb, WAL_LOCK, F_WRLCK, TDB_LOCK_WAIT) == -1) {
+		goto unlock;
+	}
+
+	if (wal->hdr->applying && !tdb_wal_exclusive(tdb)) {
+		/* The committer died while we waited for the log */
+		tdb_nest_unlock(tdb, WAL_LOCK, F_WRLCK, false);
+		goto again;
+	}
+
+	if (wal->hdr->end == TDB_WAL_DATA_START) {
+		ret = 0;
+		goto done;
+	}
+
+	if (wal->hdr->applying) {
+		/* A dead committer, don't sync half its changes */
+		tdb_off_t end;
+		if (tdb_wal_replay(tdb, &end) == -1) {
+			goto done;
+		}
+		wal->hdr->applying = 0;
+	}
+
+	if (transaction_sync(tdb, 0, tdb->map_size) == -1) {
+		goto done;
+	}
+
+	/*
+	 * Records of the old generation are ignored, even if the
+	 * truncate does not make it to disk.
+	 */
+	wal->hdr->generation += 1;
+	wal->hdr->end = TDB_WAL_DATA_START;
+
+	if (ftruncate(wal->fd, TDB_WAL_DATA_START) == -1) {
+		tdb->ecode = TDB_ERR_IO;
+		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wal_checkpoint: ftruncate "
+			 "failed - %s\n", strerror(errno)));
+		goto done;
+	}
+	if (tdb_wal_sync(tdb) == -1) {
+		goto done;
+	}
+
+	ret = 0;
+done:
+	tdb_nest_unlock(tdb, WAL_LOCK, F_WRLCK, false);
+unlock:
+	if (allrecord) {
+		tdb_allrecord_unlock(tdb, F_WRLCK, false);
+	}
+	return ret;
+}
+
+/*
+  called before writing to the database outside a transaction
+*/
+int tdb_wal_before_write(struct tdb_context *tdb)
+{
+	if (tdb->wal->replaying) {
+		return 0;
+	}
+	return tdb_wal_checkpoint(tdb);
+}
+
+/*
+  open the log of a database with TDB_FEATURE_FLAG_WAL, called by
+  tdb_open_ex() with the OPEN_LOCK held
+*/
+int tdb_wal_open(struct tdb_context *tdb, bool created)
+{
+#ifdef HAVE_MMAP
+	struct tdb_wal *wal;
+	struct stat st;
+	char *name;
+	size_t namelen;
+	int ret;
+
+	if (tdb->flags & (TDB_CONVERT|TDB_CLEAR_IF_FIRST)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+			 "%s can't be used with %s\n", tdb->name,
+			 (tdb->flags & TDB_CONVERT) ?
+			 "a different endianness" : "TDB_CLEAR_IF_FIRST"));
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (fstat(tdb->fd, &st) == -1) {
+		return -1;
+	}
+
+	wal = (struct tdb_wal *)calloc(1, sizeof(struct tdb_wal));
+	if (wal == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	wal->fd = -1;
+	wal->hdr = MAP_FAILED;
+	tdb->wal = wal;
+
+	namelen = strlen(tdb->name) + sizeof(".wal");
+	name = (char *)malloc(namelen);
+	if (name == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	snprintf(name, namelen, "%s.wal", tdb->name);
+
+	wal->fd = open(name, O_RDWR|O_CREAT, st.st_mode & 0777);
+	if (wal->fd == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+			 "could not open %s: %s\n", name, strerror(errno)));
+		free(name);
+		goto fail;
+	}
+	free(name);
+	fcntl(wal->fd, F_SETFD, fcntl(wal->fd, F_GETFD, 0) | FD_CLOEXEC);
+
+	if (fstat(wal->fd, &st) == -1) {
+		goto fail;
+	}
+
+	if (created || st.st_size < TDB_WAL_DATA_START) {
+		struct tdb_wal_header hdr;
+		ssize_t nread;
+
+		/* Start a new log, nothing in an old one applies */
+		nread = pread(wal->fd, &hdr, sizeof(hdr), 0);
+		if (nread != sizeof(hdr)) {
+			ZERO_STRUCT(hdr);
+		}
+		hdr.generation += 1;
+		strncpy(hdr.magic, TDB_WAL_MAGIC_STR, sizeof(hdr.magic));
+		hdr.version = TDB_WAL_VERSION;
+		hdr.end = TDB_WAL_DATA_START;
+		hdr.applying = 0;
+
+		if (ftruncate(wal->fd, 0) == -1 ||
+		    tdb_wal_pwrite(tdb, &hdr, sizeof(hdr), 0) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+				 "could not initialise the log of %s: %s\n",
+				 tdb->name, strerror(errno)));
+			goto fail;
+		}
+	}
+
+	wal->hdr = (struct tdb_wal_header *)mmap(
+		NULL, sizeof(struct tdb_wal_header), PROT_READ|PROT_WRITE,
+		MAP_SHARED, wal->fd, 0);
+	if (wal->hdr == MAP_FAILED) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+			 "mmap of the log of %s failed: %s\n", tdb->name,
+			 strerror(errno)));
+		goto fail;
+	}
+
+	if ((strncmp(wal->hdr->magic, TDB_WAL_MAGIC_STR,
+		     sizeof(wal->hdr->magic)) != 0) ||
+	    (wal->hdr->version != TDB_WAL_VERSION)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+			 "invalid log for %s\n", tdb->name));
+		errno = EIO;
+		goto fail;
+	}
+
+	/*
+	 * If we're the only user, the log might hold changes that
+	 * never made it into the database on disk.
+	 */
+	ret = tdb_nest_lock(tdb, ACTIVE_LOCK, F_WRLCK,
+			    TDB_LOCK_NOWAIT|TDB_LOCK_PROBE);
+	if (ret == 0) {
+		tdb_off_t end;
+
+		ret = tdb_wal_replay(tdb, &end);
+		if (ret == 0) {
+			wal->hdr->applying = 0;
+			/* also get rid of a torn record at the end */
+			wal->hdr->end = MAX(end, st.st_size);
+			ret = tdb_wal_checkpoint(tdb);
+		}
+
+		if (tdb_nest_unlock(tdb, ACTIVE_LOCK, F_WRLCK, false) == -1) {
+			ret = -1;
+		}
+		if (ret == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+				 "could not replay the log of %s\n",
+				 tdb->name));
+			errno = EIO;
+			goto fail;
+		}
+	}
+
+	if (tdb_nest_lock(tdb, ACTIVE_LOCK, F_RDLCK, TDB_LOCK_WAIT) == -1) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	{
+		int save_errno = errno;
+
+		if (wal->hdr != MAP_FAILED) {
+			munmap((void *)wal->hdr, sizeof(struct tdb_wal_header));
+		}
+		if (wal->fd != -1) {
+			close(wal->fd);
+		}
+		SAFE_FREE(tdb->wal);
+		errno = save_errno;
+		return -1;
+	}
+#else
+	TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_wal_open: "
+		 "%s needs mmap for its write-ahead log\n", tdb->name));
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+  close the log, the last user writes it back
+*/
+int tdb_wal_close(struct tdb_context *tdb)
+{
+	struct tdb_wal *wal = tdb->wal;
+	int ret = 0;
+
+	if (wal == NULL) {
+		return 0;
+	}
+
+	/*
+	 * Drop our active lock before probing: of several users
+	 * closing at the same time the last one gets it.
+	 */
+	if (tdb_have_nest_lock(tdb, ACTIVE_LOCK)) {
+		tdb_nest_unlock(tdb, ACTIVE_LOCK, F_RDLCK, false);
+	}
+	if (tdb_nest_lock(tdb, ACTIVE_LOCK, F_WRLCK,
+			  TDB_LOCK_NOWAIT|TDB_LOCK_PROBE) == 0) {
+		ret = tdb_wal_checkpoint(tdb);
+		tdb_nest_unlock(tdb, ACTIVE_LOCK, F_WRLCK, false);
+	}
+
+#ifdef HAVE_MMAP
+	munmap((void *)wal->hdr, sizeof(struct tdb_wal_header));
+#endif
+	if (close(wal->fd) != 0) {
+		ret = -1;
+	}
+	SAFE_FREE(tdb->wal);
+
+	return ret;
+}
+
 static int _tdb_transaction_cancel(struct tdb_context *tdb)
 {
 	int i, ret = 0;
@@ -615,6 +1324,14 @@ static int _tdb_transaction_cancel(struct tdb_context *tdb)
 	}
 	SAFE_FREE(tdb->transaction->blocks);
 
+	if (tdb->transaction->wal_offset) {
+		/* remove the prepared record from the log */
+		if (tdb_wal_truncate(tdb, tdb->transaction->wal_offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_cancel: failed to remove log record\n"));
+			ret = -1;
+		}
+	}
+
 	if (tdb->transaction->magic_offset) {
 		const struct tdb_methods *methods = tdb->transaction->io_methods;
 		const uint32_t invalid = TDB_RECOVERY_INVALID_MAGIC;
@@ -1031,11 +1748,25 @@ static int _tdb_transaction_prepare_commit(struct tdb_context *tdb)
 		return -1;
 	}
 
-	/* write the recovery data to the end of the file */
-	if (transaction_setup_recovery(tdb, &tdb->transaction->magic_offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_prepare_commit: failed to setup recovery data\n"));
-		_tdb_transaction_cancel(tdb);
-		return -1;
+	if (tdb->wal != NULL) {
+		/* the log replaces the recovery area */
+		if (tdb_nest_lock(tdb, WAL_LOCK, F_WRLCK, TDB_LOCK_WAIT) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_transaction_prepare_commit: failed to get log lock\n"));
+			_tdb_transaction_cancel(tdb);
+			return -1;
+		}
+		if (tdb_wal_append(tdb, &tdb->transaction->wal_offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_prepare_commit: failed to write log record\n"));
+			_tdb_transaction_cancel(tdb);
+			return -1;
+		}
+	} else {
+		/* write the recovery data to the end of the file */
+		if (transaction_setup_recovery(tdb, &tdb->transaction->magic_offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_prepare_commit: failed to setup recovery data\n"));
+			_tdb_transaction_cancel(tdb);
+			return -1;
+		}
 	}
 
 	tdb->transaction->prepared = true;
@@ -1098,6 +1829,7 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 	const struct tdb_methods *methods;
 	int i;
 	bool need_repack = false;
+	bool wal = false;
 
 	if (tdb->transaction == NULL) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_transaction_commit: no transaction\n"));
@@ -1133,6 +1865,16 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 
 	methods = tdb->transaction->io_methods;
 
+	if (tdb->transaction->wal_offset) {
+		/* once the log is synced the transaction is durable */
+		if (tdb_wal_commit_record(tdb, tdb->transaction->wal_offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_commit: failed to commit log record\n"));
+			_tdb_transaction_cancel(tdb);
+			return -1;
+		}
+		wal = true;
+	}
+
 	/* perform all the writes */
 	for (i=0;i<tdb->transaction->num_blocks;i++) {
 		tdb_off_t offset;
@@ -1153,7 +1895,10 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 
 			/* we've overwritten part of the data and
 			   possibly expanded the file, so we need to
-			   run the crash recovery code */
+			   run the crash recovery code. With a log
+			   that means writing it out again, the
+			   committed record must stay. */
+			tdb->transaction->wal_offset = 0;
 			tdb->methods = methods;
 			tdb_transaction_recover(tdb);
 
@@ -1173,9 +1918,15 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 	SAFE_FREE(tdb->transaction->blocks);
 	tdb->transaction->num_blocks = 0;
 
-	/* ensure the new data is on disk */
-	if (transaction_sync(tdb, 0, tdb->map_size) == -1) {
-		return -1;
+	if (wal) {
+		/* the log has it, the next checkpoint syncs the data */
+		tdb->transaction->wal_offset = 0;
+		tdb->wal->hdr->applying = 0;
+	} else {
+		/* ensure the new data is on disk */
+		if (transaction_sync(tdb, 0, tdb->map_size) == -1) {
+			return -1;
+		}
 	}
 
 	/*
@@ -1197,6 +1948,19 @@ _PUBLIC_ int tdb_transaction_commit(struct tdb_context *tdb)
 	   transaction locks */
 	_tdb_transaction_cancel(tdb);
 
+	if (wal && (tdb->wal->hdr->end - TDB_WAL_DATA_START >
+		    TDB_WAL_CHECKPOINT_SIZE)) {
+		/*
+		 * The transaction is durable in the log, a later
+		 * checkpoint will retry.
+		 */
+		if (tdb_wal_checkpoint(tdb) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR,
+				 "tdb_transaction_commit: checkpoint of "
+				 "%s failed\n", tdb->name));
+		}
+	}
+
 	if (need_repack) {
 		return tdb_repack(tdb);
 	}
@@ -1217,6 +1981,10 @@ int tdb_transaction_recover(struct tdb_context *tdb)
 	uint32_t zero = 0;
 	struct tdb_record rec;
 
+	if (tdb->wal != NULL) {
+		return tdb_wal_recover(tdb);
+	}
+
 	/* find the recovery area */
 	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &recovery_head) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_transaction_recover: failed to read recovery head\n"));
@@ -1328,6 +2096,10 @@ bool tdb_needs_recovery(struct tdb_context *tdb)
 	tdb_off_t recovery_head;
 	struct tdb_record rec;
 
+	if (tdb->wal != NULL) {
+		return (tdb->wal->hdr->applying != 0);
+	}
+
 	/* find the recovery area */
 	if (tdb_ofs_read(tdb, TDB_RECOVERY_HEAD, &recovery_head) == -1) {
 		return true;
@@ -304,6 +304,178 @@ _PUBLIC_ int tdb_traverse(struct tdb_context *tdb,
 }
 
 
+struct tdb_chain_buf {
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+};
+
+/*
+ * Copy all live records of chain "list" into "cb" under the chain
+ * lock: For every record a struct tdb_record header followed by key
+ * and data. Only uses what tdb_read_threadsafe() and the chain lock
+ * touch in the tdb_context, errors are returned instead of being put
+ * into tdb->ecode.
+ */
+static enum TDB_ERROR tdb_chain_copy(struct tdb_context *tdb, uint32_t list,
+				     struct tdb_chain_buf *cb)
+{
+	struct tdb_record rec;
+	tdb_off_t off;
+	enum TDB_ERROR ecode;
+
+	cb->used = 0;
+
+	if (tdb_chain_brlock(tdb, list, F_RDLCK) != 0) {
+		return TDB_ERR_LOCK;
+	}
+
+	if (tdb_read_threadsafe(tdb, TDB_HASH_TOP(list), &off,
+				sizeof(off)) != 0) {
+		ecode = TDB_ERR_IO;
+		goto done;
+	}
+	if (DOCONV()) {
+		tdb_convert(&off, sizeof(off));
+	}
+
+	while (off != 0) {
+		size_t needed;
+
+		if (tdb_read_threadsafe(tdb, off, &rec, sizeof(rec)) != 0) {
+			ecode = TDB_ERR_IO;
+			goto done;
+		}
+		if (DOCONV()) {
+			tdb_convert(&rec, sizeof(rec));
+		}
+		if (TDB_BAD_MAGIC(&rec) || (off == rec.next)) {
+			ecode = TDB_ERR_CORRUPT;
+			goto done;
+		}
+		if (TDB_DEAD(&rec)) {
+			off = rec.next;
+			continue;
+		}
+
+		needed = cb->used + sizeof(rec) + rec.key_len + rec.data_len;
+		if (needed < cb->used) {
+			ecode = TDB_ERR_CORRUPT;
+			goto done;
+		}
+		if (needed > cb->size) {
+			size_t new_size = MAX(needed, cb->size * 2);
+			uint8_t *tmp = realloc(cb->buf, new_size);
+			if (tmp == NULL) {
+				ecode = TDB_ERR_OOM;
+				goto done;
+			}
+			cb->buf = tmp;
+			cb->size = new_size;
+		}
+
+		memcpy(cb->buf + cb->used, &rec, sizeof(rec));
+		if (tdb_read_threadsafe(tdb, off + sizeof(rec),
+					cb->buf + cb->used + sizeof(rec),
+					rec.key_len + rec.data_len) != 0) {
+			ecode = TDB_ERR_IO;
+			goto done;
+		}
+		cb->used = needed;
+		off = rec.next;
+	}
+
+	ecode = TDB_SUCCESS;
+done:
+	tdb_chain_brunlock(tdb, list, F_RDLCK);
+	return ecode;
+}
+
+/*
+  traverse a range of hash chains, see tdb.h for the rules
+ */
+_PUBLIC_ int tdb_traverse_chains_read(struct tdb_context *tdb,
+				      uint32_t first_chain,
+				      uint32_t num_chains,
+				      tdb_traverse_func fn,
+				      void *private_data,
+				      enum TDB_ERROR *perr)
+{
+	struct tdb_chain_buf cb = { .buf = NULL };
+	enum TDB_ERROR ecode = TDB_SUCCESS;
+	uint32_t list, end;
+	int count = 0;
+
+	end = first_chain + num_chains;
+
+#ifdef HAVE_INCOHERENT_MMAP
+	/* We can't look beyond the map without remapping */
+	ecode = TDB_ERR_EINVAL;
+	count = -1;
+	goto out;
+#endif
+
+	if ((end < first_chain) || (end > tdb->hash_size) ||
+	    (tdb->transaction != NULL) || tdb_have_extra_locks(tdb)) {
+		/*
+		 * Our chain locks would interfere with the ones
+		 * tdb_context knows about, and the transaction's view
+		 * is not in the file.
+		 */
+		ecode = TDB_ERR_EINVAL;
+		count = -1;
+		goto out;
+	}
+
+	for (list = first_chain; list < end; list++) {
+		size_t ofs = 0;
+
+		if (list != first_chain) {
+			tdb_off_t top;
+
+			/*
+			 * Unlocked pre-check for empty chains, see
+			 * tdb_next_lock(). The first chain is always
+			 * locked to get a coherent view of memory.
+			 */
+			if ((tdb_read_threadsafe(tdb, TDB_HASH_TOP(list),
+						 &top, sizeof(top)) == 0) &&
+			    (top == 0)) {
+				continue;
+			}
+		}
+
+		ecode = tdb_chain_copy(tdb, list, &cb);
+		if (ecode != TDB_SUCCESS) {
+			count = -1;
+			break;
+		}
+
+		while (ofs < cb.used) {
+			struct tdb_record rec;
+			TDB_DATA key, data;
+
+			memcpy(&rec, cb.buf + ofs, sizeof(rec));
+			key.dptr = cb.buf + ofs + sizeof(rec);
+			key.dsize = rec.key_len;
+			data.dptr = key.dptr + rec.key_len;
+			data.dsize = rec.data_len;
+			ofs += sizeof(rec) + rec.key_len + rec.data_len;
+
+			count++;
+			if (fn && fn(tdb, key, data, private_data)) {
+				goto out;
+			}
+		}
+	}
+out:
+	SAFE_FREE(cb.buf);
+	if (perr != NULL) {
+		*perr = ecode;
+	}
+	return count;
+}
+
 /* find the first entry in the database and return its key */
 _PUBLIC_ TDB_DATA tdb_firstkey(struct tdb_context *tdb)
 {
@@ -84,6 +84,13 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_CHAIN_FREELISTS 8192 /** Keep a freelist per hash chain, protected by the chain lock,
+                                     only with tdb >= 1.3.16, used when creating a new tdb */
+#define TDB_WYHASH 16384 /** Faster hashing: can't be opened by tdb < 1.3.16. */
+#define TDB_MUTEX_SEQLOCK 32768 /** Lock-free tdb_parse_record() for TDB_MUTEX_LOCKING,
+                                    only with tdb >= 1.3.16, used when creating a new tdb */
+#define TDB_WAL 65536 /** Commit transactions through a write-ahead log,
+                          only with tdb >= 1.3.16, used when creating a new tdb */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
@@ -152,6 +159,25 @@ struct tdb_logging_context {
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_CHAIN_FREELISTS - Keep some free records per hash chain,
+ *                                               so that deletes and stores don't need
+ *                                               the global freelist lock,
+ *                                               can't be opened by tdb < 1.3.16.\n
+ *                         TDB_WYHASH - Faster hashing, used instead of
+ *                                      TDB_INCOMPATIBLE_HASH if both are given:
+ *                                      can't be opened by tdb < 1.3.16.\n
+ *                         TDB_MUTEX_SEQLOCK - Let tdb_parse_record() read without
+ *                                             taking the chain mutex, retrying if
+ *                                             a writer got in the way. Only valid
+ *                                             in combination with TDB_MUTEX_LOCKING,
+ *                                             can't be opened by tdb < 1.3.16.\n
+ *                         TDB_WAL - Commit transactions by appending to a
+ *                                   write-ahead log next to the database
+ *                                   ("<name>.wal"), syncing only that. The
+ *                                   database file is synced when the log
+ *                                   is written back. Not valid with
+ *                                   TDB_CLEAR_IF_FIRST,
+ *                                   can't be opened by tdb < 1.3.16.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -193,6 +219,25 @@ struct tdb_context *tdb_open(const char *name, int hash_size, int tdb_flags,
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_CHAIN_FREELISTS - Keep some free records per hash chain,
+ *                                               so that deletes and stores don't need
+ *                                               the global freelist lock,
+ *                                               can't be opened by tdb < 1.3.16.\n
+ *                         TDB_WYHASH - Faster hashing, used instead of
+ *                                      TDB_INCOMPATIBLE_HASH if both are given:
+ *                                      can't be opened by tdb < 1.3.16.\n
+ *                         TDB_MUTEX_SEQLOCK - Let tdb_parse_record() read without
+ *                                             taking the chain mutex, retrying if
+ *                                             a writer got in the way. Only valid
+ *                                             in combination with TDB_MUTEX_LOCKING,
+ *                                             can't be opened by tdb < 1.3.16.\n
+ *                         TDB_WAL - Commit transactions by appending to a
+ *                                   write-ahead log next to the database
+ *                                   ("<name>.wal"), syncing only that. The
+ *                                   database file is synced when the log
+ *                                   is written back. Not valid with
+ *                                   TDB_CLEAR_IF_FIRST,
+ *                                   can't be opened by tdb < 1.3.16.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -324,6 +369,39 @@ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 					    void *private_data),
 			      void *private_data);
 
+/**
+ * @brief Hand a number of records to a parser function.
+ *
+ * This works like calling tdb_parse_record() for each key, but the keys
+ * are looked up ordered by hash chain, and every hash chain is locked
+ * only once for all the keys it holds. The order in which "parser" sees
+ * the records is undefined, keys that don't exist are skipped.
+ *
+ * @warning The same restrictions as for tdb_parse_record() apply to the
+ * parser.
+ *
+ * @param[in]  tdb      The tdb to parse the records.
+ *
+ * @param[in]  keys     The keys to parse.
+ *
+ * @param[in]  num_keys The number of keys.
+ *
+ * @param[in]  parser   The parser to use to parse the data. It gets the index
+ *                      of the key in "keys" passed.
+ *
+ * @param[in]  private_data A private data pointer which is passed to the parser
+ *                          function.
+ *
+ * @return              0 if all keys were looked up, -1 on error. If
+ *                      "parser" returns non-zero, no more records are parsed
+ *                      and its return value is passed up to the caller.
+ */
+int tdb_parse_records(struct tdb_context *tdb,
+		      const TDB_DATA *keys, size_t num_keys,
+		      int (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+				    void *private_data),
+		      void *private_data);
+
 /**
  * @brief Delete an entry in the database given a key.
  *
@@ -480,6 +558,50 @@ int tdb_traverse(struct tdb_context *tdb, tdb_traverse_func fn, void *private_da
  */
 int tdb_traverse_read(struct tdb_context *tdb, tdb_traverse_func fn, void *private_data);
 
+/**
+ * @brief Traverse a range of hash chains read-only.
+ *
+ * This calls fn(tdb, key, data, state) for every record in the hash chains
+ * first_chain to first_chain+num_chains-1. Splitting [0, tdb_hash_size()) into
+ * ranges partitions the database, every record is seen in exactly one range.
+ *
+ * Each chain is read under its lock, the lock is dropped before fn is called
+ * on the chain's records. fn gets copies, so records might have changed or
+ * be gone when fn sees them.
+ *
+ * Unlike all other tdb calls, this can run in several threads at the same
+ * time on the same tdb context for disjoint ranges. Nothing else may use the
+ * tdb context while this happens, and fn must not call into the tdb.
+ *
+ * It fails with TDB_ERR_EINVAL inside a transaction or while the caller holds
+ * locks on the database, before any record is looked at.
+ *
+ * The error is returned in *perr, tdb_error() is not updated: That is shared
+ * by all threads using the tdb context.
+ *
+ * @param[in]  tdb      The database to traverse.
+ *
+ * @param[in]  first_chain The first hash chain to look at.
+ *
+ * @param[in]  num_chains The number of hash chains to look at.
+ *
+ * @param[in]  fn       The function to call on each entry, may be NULL.
+ *
+ * @param[in]  private_data The private data which should be passed to the
+ *                          traversing function.
+ *
+ * @param[out] perr     The error code of this call, TDB_SUCCESS if it worked,
+ *                      may be NULL.
+ *
+ * @return              The record count traversed, -1 on error.
+ *
+ * @see tdb_hash_size()
+ */
+int tdb_traverse_chains_read(struct tdb_context *tdb,
+			     uint32_t first_chain, uint32_t num_chains,
+			     tdb_traverse_func fn, void *private_data,
+			     enum TDB_ERROR *perr);
+
 /**
  * @brief Check if an entry in the database exists.
  *
@@ -942,6 +1064,18 @@ void tdb_setalarm_sigptr(struct tdb_context *tdb, volatile sig_atomic_t *sigptr)
 int tdb_wipe_all(struct tdb_context *tdb);
 int tdb_repack(struct tdb_context *tdb);
 
+/*
+ * Online compaction without the allrecord lock tdb_repack() needs. Moves
+ * up to max_records records from the end of the file into free space
+ * further down, each under its chain lock, and cuts off the free space at
+ * the end of the file that was already free at the previous call. Locks
+ * held by others are never waited for, so a step might do nothing. Call
+ * it repeatedly with some time in between. With TDB_MUTEX_LOCKING records
+ * are only moved, the file is never cut. Returns the number of records
+ * moved, -1 on error.
+ */
+int tdb_compact_step(struct tdb_context *tdb, unsigned max_records);
+
 /* Debug functions. Not used in production. */
 void tdb_dump_all(struct tdb_context *tdb);
 int tdb_printfreelist(struct tdb_context *tdb);
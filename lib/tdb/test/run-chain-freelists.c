@@ -0,0 +1,134 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_KEYS 100
+#define NUM_LOOPS 1000
+
+static double timeval_elapsed(const struct timeval *tv1)
+{
+	struct timeval tv2;
+	gettimeofday(&tv2, NULL);
+	return (tv2.tv_sec - tv1->tv_sec) +
+	       (tv2.tv_usec - tv1->tv_usec)*1.0e-6;
+}
+
+/* Store and delete records of varying size, like locking.tdb sees it */
+static bool store_delete_loop(struct tdb_context *tdb, int loops)
+{
+	uint8_t buf[256] = { 0, };
+	int i, k;
+
+	for (i=0; i<loops; i++) {
+		for (k=0; k<NUM_KEYS; k++) {
+			TDB_DATA key = { .dptr = (uint8_t *)&k,
+					 .dsize = sizeof(k) };
+			TDB_DATA data = { .dptr = buf,
+					  .dsize = 16 + (i+k) % 200 };
+
+			if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+				return false;
+			}
+		}
+		for (k=0; k<NUM_KEYS; k++) {
+			TDB_DATA key = { .dptr = (uint8_t *)&k,
+					 .dsize = sizeof(k) };
+
+			if (tdb_delete(tdb, key) != 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static double bench(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	struct timeval start;
+	double elapsed;
+	bool ok;
+
+	tdb = tdb_open_ex("run-chain-freelists-bench.tdb", 131,
+			  tdb_flags|TDB_CLEAR_IF_FIRST,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return 0;
+	}
+
+	gettimeofday(&start, NULL);
+	ok = store_delete_loop(tdb, NUM_LOOPS);
+	elapsed = timeval_elapsed(&start);
+	tdb_close(tdb);
+
+	if (!ok) {
+		return 0;
+	}
+	return NUM_LOOPS * NUM_KEYS * 2 / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	tdb_off_t map_size;
+	TDB_DATA key, data;
+	double opsec;
+
+	plan_tests(14);
+	tdb = tdb_open_ex("run-chain-freelists.tdb", 7,
+			  TDB_CLEAR_IF_FIRST|TDB_CHAIN_FREELISTS,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	ok1(store_delete_loop(tdb, 200));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	/*
+	 * Records on the chain freelists are not merged, but once they
+	 * are there freed space gets reused: The file does not keep
+	 * growing.
+	 */
+	map_size = tdb->map_size;
+	ok1(store_delete_loop(tdb, 200));
+	ok1(tdb->map_size == map_size);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	key.dsize = strlen("hi");
+	key.dptr = discard_const_p(uint8_t, "hi");
+	data.dsize = strlen("world");
+	data.dptr = discard_const_p(uint8_t, "world");
+	ok1(tdb_store(tdb, key, data, TDB_INSERT) == 0);
+
+	ok1(tdb_wipe_all(tdb) == 0);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	ok1(!tdb_exists(tdb, key));
+	tdb_close(tdb);
+
+	/* The flag only counts at creation, reopening keeps the feature */
+	tdb = tdb_open_ex("run-chain-freelists.tdb", 7, 0, O_RDWR, 0,
+			  &taplogctx, NULL);
+	ok1(tdb && (tdb->feature_flags & TDB_FEATURE_FLAG_CHAIN_FREELISTS));
+	ok1(tdb && tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+
+	opsec = bench(0);
+	diag("global freelist: %.0f ops/sec", opsec);
+	opsec = bench(TDB_CHAIN_FREELISTS);
+	diag("per-chain freelists: %.0f ops/sec", opsec);
+
+	return exit_status();
+}
@@ -0,0 +1,213 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/summary.c"
+#include "../common/mutex.c"
+#include "../common/compact.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "system/wait.h"
+#include "logging.h"
+
+#define TEST_DBNAME "run-compact.tdb"
+#define NUM_KEYS 2000
+
+static bool store(struct tdb_context *tdb, int k, int flag)
+{
+	uint8_t buf[512];
+	TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+	TDB_DATA data = { .dptr = buf, .dsize = sizeof(k) + (k * 7) % 400 };
+
+	memset(buf, k, sizeof(buf));
+	memcpy(buf, &k, sizeof(k));
+	return (tdb_store(tdb, key, data, flag) == 0);
+}
+
+static bool have_key(struct tdb_context *tdb, int k)
+{
+	TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+	TDB_DATA data;
+	bool ok;
+
+	data = tdb_fetch(tdb, key);
+	if (data.dptr == NULL) {
+		return false;
+	}
+	ok = (data.dsize == sizeof(k) + (k * 7) % 400) &&
+		(memcmp(data.dptr, &k, sizeof(k)) == 0);
+	free(data.dptr);
+	return ok;
+}
+
+/* The stable keys are the multiples of 4, the rest is deleted */
+static bool have_stable_keys(struct tdb_context *tdb)
+{
+	int k;
+
+	for (k=0; k<NUM_KEYS; k+=4) {
+		if (!have_key(tdb, k)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Like tdbtool, until nothing moves and the size stays */
+static int compact(struct tdb_context *tdb, unsigned max_records)
+{
+	tdb_len_t size;
+	int moved = 0;
+	int ret;
+
+	do {
+		size = tdb->map_size;
+		ret = tdb_compact_step(tdb, max_records);
+		if (ret == -1) {
+			return -1;
+		}
+		moved += ret;
+	} while ((ret > 0) || (tdb->map_size != size));
+
+	return moved;
+}
+
+static pid_t start_writer(struct tdb_context *tdb)
+{
+	pid_t child = fork();
+
+	if (child == 0) {
+		int i;
+
+		if (tdb_reopen(tdb) != 0) {
+			_exit(1);
+		}
+		for (i=0; i<20000; i++) {
+			int k = NUM_KEYS + (i % 300);
+
+			if ((i / 300) % 2 == 0) {
+				store(tdb, k, TDB_REPLACE);
+			} else {
+				TDB_DATA key = { .dptr = (uint8_t *)&k,
+						 .dsize = sizeof(k) };
+				tdb_delete(tdb, key);
+			}
+			if ((i % 1000 == 0) && !have_stable_keys(tdb)) {
+				_exit(2);
+			}
+		}
+		_exit(0);
+	}
+	return child;
+}
+
+static int traverse_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		       void *private_data)
+{
+	int *ret = private_data;
+
+	*ret = tdb_compact_step(tdb, 10);
+	return 1;
+}
+
+static void test_tdb(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	tdb_len_t size;
+	pid_t writer;
+	char *summary;
+	int k, status, ret;
+
+	tdb = tdb_open_ex(TEST_DBNAME, 131, TDB_CLEAR_IF_FIRST|tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	for (k=0; k<NUM_KEYS; k++) {
+		store(tdb, k, TDB_INSERT);
+	}
+	for (k=0; k<NUM_KEYS; k++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		if (k % 4 != 0) {
+			tdb_delete(tdb, key);
+		}
+	}
+	size = tdb->map_size;
+
+	summary = tdb_summary(tdb);
+	ok1(summary && strstr(summary,
+			      "Unused bytes below/after the last record in use: "));
+	free(summary);
+
+	/* Most of the file is given back, but never with mutexes */
+	ok1(compact(tdb, 100) > 0);
+	if (tdb_flags & TDB_MUTEX_LOCKING) {
+		ok1(tdb->map_size == size);
+	} else {
+		ok1(tdb->map_size < size / 2);
+	}
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	ok1(have_stable_keys(tdb));
+
+	/* Compacting a compact file does nothing */
+	size = tdb->map_size;
+	ok1(compact(tdb, 100) == 0);
+	ok1(tdb->map_size == size);
+
+	/*
+	 * Another process keeps writing with its map of the old size.
+	 * It grows the file again while we cut it.
+	 */
+	for (k=1; k<NUM_KEYS; k+=4) {
+		store(tdb, k, TDB_INSERT);
+	}
+	for (k=1; k<NUM_KEYS; k+=4) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		tdb_delete(tdb, key);
+	}
+	writer = start_writer(tdb);
+	ok1(writer > 0);
+	ret = 0;
+	while (waitpid(writer, &status, WNOHANG) == 0) {
+		if (tdb_compact_step(tdb, 20) == -1) {
+			ret = -1;
+		}
+	}
+	ok1(ret == 0);
+	ok1(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	ok1(compact(tdb, 100) >= 0);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	ok1(have_stable_keys(tdb));
+
+	/* Not while traversing or in a transaction */
+	ret = 0;
+	ok1(tdb_traverse(tdb, traverse_fn, &ret) == 1);
+	ok1(ret == -1 && tdb_error(tdb) == TDB_ERR_EINVAL);
+	ok1(tdb_transaction_start(tdb) == 0);
+	ok1(tdb_compact_step(tdb, 10) == -1);
+	ok1(tdb_transaction_cancel(tdb) == 0);
+
+	tdb_close(tdb);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_tests(3 * 19);
+
+	test_tdb(TDB_DEFAULT);
+	test_tdb(TDB_CHAIN_FREELISTS);
+
+	if (tdb_runtime_check_for_robust_mutexes()) {
+		test_tdb(TDB_MUTEX_LOCKING|TDB_MUTEX_SEQLOCK);
+	} else {
+		test_tdb(TDB_DEFAULT);
+	}
+
+	return exit_status();
+}
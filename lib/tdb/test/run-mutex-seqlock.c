@@ -0,0 +1,261 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdarg.h>
+
+#define PARSE_SECONDS 2
+
+static TDB_DATA key;
+
+static void log_fn(struct tdb_context *tdb, enum tdb_debug_level level,
+		   const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+struct parse_state {
+	struct tdb_context *tdb;
+	int num_lockrecs; /* CLEAR_IF_FIRST keeps the active lock */
+	size_t num_locked;
+	size_t num_torn;
+};
+
+/*
+ * The writer child stores records of n bytes all set to n, so every
+ * consistent snapshot is easy to verify.
+ */
+static int parse_fn(TDB_DATA k, TDB_DATA d, void *private_data)
+{
+	struct parse_state *state = private_data;
+	size_t i;
+
+	if (state->tdb->num_lockrecs > state->num_lockrecs) {
+		state->num_locked += 1;
+	}
+
+	if (d.dsize == 0) {
+		state->num_torn += 1;
+		return 0;
+	}
+	for (i = 0; i < d.dsize; i++) {
+		if (d.dptr[i] != (uint8_t)d.dsize) {
+			state->num_torn += 1;
+			break;
+		}
+	}
+	return 0;
+}
+
+static void do_writer(struct tdb_context *tdb, int to, int from)
+{
+	uint8_t buf[255];
+	char c = 0;
+	int i;
+
+	if (tdb_reopen(tdb) != 0) {
+		exit(1);
+	}
+	write(to, &c, sizeof(c));
+	fcntl(from, F_SETFL, fcntl(from, F_GETFL) | O_NONBLOCK);
+
+	for (i = 0; ; i++) {
+		size_t len = 1 + (i * 7) % sizeof(buf);
+		TDB_DATA data = { .dptr = buf, .dsize = len };
+
+		if (read(from, &c, sizeof(c)) == 0) {
+			/* parent is done */
+			break;
+		}
+
+		memset(buf, len, len);
+
+		if ((i % 100) == 0) {
+			/* Make tdb_parse_record see the allrecord lock */
+			if (tdb_transaction_start(tdb) != 0 ||
+			    tdb_store(tdb, key, data, TDB_REPLACE) != 0 ||
+			    tdb_transaction_commit(tdb) != 0) {
+				exit(2);
+			}
+			continue;
+		}
+		if ((i % 10) == 0) {
+			tdb_delete(tdb, key);
+		}
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			exit(3);
+		}
+	}
+
+	tdb_close(tdb);
+	exit(0);
+}
+
+/* Take the chain lock and die with it */
+static void do_dying_locker(struct tdb_context *tdb, int to)
+{
+	char c = 0;
+
+	if (tdb_reopen(tdb) != 0) {
+		exit(1);
+	}
+	if (tdb_chainlock(tdb, key) != 0) {
+		exit(2);
+	}
+	write(to, &c, sizeof(c));
+	pause();
+	exit(3);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	unsigned int log_count;
+	struct tdb_logging_context log_ctx = { log_fn, &log_count };
+	struct parse_state state = { .tdb = NULL };
+	int tdb_flags;
+	int fromchild[2];
+	int tochild[2];
+	pid_t child;
+	char c;
+	int i, ret, status;
+	size_t num_parsed = 0;
+	struct timeval start;
+	TDB_DATA data;
+
+	if (!tdb_runtime_check_for_robust_mutexes()) {
+		skip(1, "No robust mutex support");
+		return exit_status();
+	}
+
+	key.dsize = strlen("hi");
+	key.dptr = discard_const_p(uint8_t, "hi");
+	data.dsize = strlen("world");
+	data.dptr = discard_const_p(uint8_t, "world");
+
+	tdb = tdb_open_ex("mutex-seqlock.tdb", 3,
+			  TDB_CLEAR_IF_FIRST|TDB_MUTEX_SEQLOCK,
+			  O_RDWR|O_CREAT, 0755, &log_ctx, NULL);
+	ok(tdb == NULL && errno == EINVAL,
+	   "TDB_MUTEX_SEQLOCK requires TDB_MUTEX_LOCKING");
+
+	tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_MUTEX_LOCKING|
+		TDB_MUTEX_SEQLOCK|TDB_CLEAR_IF_FIRST;
+
+	tdb = tdb_open_ex("mutex-seqlock.tdb", 3, tdb_flags,
+			  O_RDWR|O_CREAT, 0755, &log_ctx, NULL);
+	ok(tdb, "tdb_open_ex should succeed");
+	ok(tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_SEQLOCK,
+	   "feature flag should be set");
+	state.tdb = tdb;
+	state.num_lockrecs = tdb->num_lockrecs;
+
+	ret = tdb_parse_record(tdb, key, parse_fn, &state);
+	ok(ret == -1 && tdb_error(tdb) == TDB_ERR_NOEXIST,
+	   "tdb_parse_record should not find a record");
+
+	memset(data.dptr = malloc(5), 5, 5);
+	ret = tdb_store(tdb, key, data, TDB_INSERT);
+	ok(ret == 0, "tdb_store should succeed");
+	free(data.dptr);
+
+	ret = tdb_parse_record(tdb, key, parse_fn, &state);
+	ok(ret == 0 && state.num_torn == 0,
+	   "tdb_parse_record should succeed");
+	ok(state.num_locked == 0, "tdb_parse_record should not lock");
+
+	ret = tdb_chainlock(tdb, key);
+	ok(ret == 0, "tdb_chainlock should succeed");
+	ret = tdb_parse_record(tdb, key, parse_fn, &state);
+	ok(ret == 0 && state.num_locked == 1,
+	   "tdb_parse_record under our own chainlock should lock");
+	tdb_chainunlock(tdb, key);
+	state.num_locked = 0;
+
+	ret = pipe(fromchild);
+	ok(ret == 0, "pipe should succeed");
+	ret = pipe(tochild);
+	ok(ret == 0, "pipe should succeed");
+
+	child = fork();
+	if (child == 0) {
+		close(fromchild[0]);
+		close(tochild[1]);
+		do_writer(tdb, fromchild[1], tochild[0]);
+	}
+	close(fromchild[1]);
+	close(tochild[0]);
+	read(fromchild[0], &c, sizeof(c));
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; ; i++) {
+		ret = tdb_parse_record(tdb, key, parse_fn, &state);
+		if (ret == 0) {
+			num_parsed += 1;
+		}
+		if ((i % 1000) == 0) {
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			if (now.tv_sec - start.tv_sec >= PARSE_SECONDS) {
+				break;
+			}
+		}
+	}
+
+	close(tochild[1]);
+	close(fromchild[0]);
+	waitpid(child, &status, 0);
+
+	ok(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+	   "writer child should succeed");
+	ok(num_parsed > 0, "tdb_parse_record should find records");
+	ok(state.num_torn == 0, "tdb_parse_record should see no torn records");
+	diag("%zu parsed, %zu of them locked", num_parsed, state.num_locked);
+	ok(tdb_check(tdb, NULL, NULL) == 0, "tdb_check should succeed");
+
+	ret = pipe(fromchild);
+	ok(ret == 0, "pipe should succeed");
+
+	child = fork();
+	if (child == 0) {
+		close(fromchild[0]);
+		do_dying_locker(tdb, fromchild[1]);
+	}
+	close(fromchild[1]);
+	read(fromchild[0], &c, sizeof(c));
+	close(fromchild[0]);
+
+	kill(child, SIGKILL);
+	waitpid(child, &status, 0);
+
+	/* This has to take over the dead owner's chain mutex */
+	state.num_locked = 0;
+	ret = tdb_parse_record(tdb, key, parse_fn, &state);
+	ok(ret == 0 && state.num_locked == 1,
+	   "tdb_parse_record after the locker died should lock");
+
+	state.num_locked = 0;
+	ret = tdb_parse_record(tdb, key, parse_fn, &state);
+	ok(ret == 0 && state.num_locked == 0,
+	   "tdb_parse_record should not lock again");
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -0,0 +1,141 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define NUM_STORED 200
+#define NUM_KEYS 300
+
+struct parse_state {
+	int keys[NUM_KEYS];
+	int seen[NUM_KEYS];
+	size_t stop_after;
+	size_t num_parsed;
+	bool wrong_data;
+};
+
+static int parser(size_t idx, TDB_DATA key, TDB_DATA data,
+		  void *private_data)
+{
+	struct parse_state *state = private_data;
+	int k = state->keys[idx];
+
+	if ((key.dsize != sizeof(k)) || (memcmp(key.dptr, &k, sizeof(k)) != 0) ||
+	    (data.dsize != sizeof(k)) || (memcmp(data.dptr, &k, sizeof(k)) != 0)) {
+		state->wrong_data = true;
+	}
+	state->seen[idx] += 1;
+	state->num_parsed += 1;
+
+	if (state->num_parsed == state->stop_after) {
+		return 42;
+	}
+	return 0;
+}
+
+static int parse_records(struct tdb_context *tdb, struct parse_state *state)
+{
+	TDB_DATA keys[NUM_KEYS];
+	size_t i;
+
+	for (i=0; i<NUM_KEYS; i++) {
+		keys[i] = (TDB_DATA) { .dptr = (uint8_t *)&state->keys[i],
+				       .dsize = sizeof(int) };
+	}
+	memset(state->seen, 0, sizeof(state->seen));
+	state->num_parsed = 0;
+	state->wrong_data = false;
+
+	return tdb_parse_records(tdb, keys, NUM_KEYS, parser, state);
+}
+
+/* Every stored key parsed exactly once, the others not at all */
+static bool all_seen(struct parse_state *state, int num_stored)
+{
+	size_t i;
+
+	for (i=0; i<NUM_KEYS; i++) {
+		int expected = (state->keys[i] < num_stored) ? 1 : 0;
+		if (state->seen[i] != expected) {
+			return false;
+		}
+	}
+	return !state->wrong_data;
+}
+
+static bool store(struct tdb_context *tdb, int k)
+{
+	TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+	return (tdb_store(tdb, key, key, TDB_INSERT) == 0);
+}
+
+static void test_tdb(int tdb_flags)
+{
+	struct parse_state state = { .stop_after = 0 };
+	struct tdb_context *tdb;
+	size_t i;
+	int k;
+
+	tdb = tdb_open_ex("run-parse-records.tdb", 31,
+			  TDB_CLEAR_IF_FIRST|tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	for (k=0; k<NUM_STORED; k++) {
+		store(tdb, k);
+	}
+
+	/* Some keys twice, some not stored, in no particular order */
+	for (i=0; i<NUM_KEYS; i++) {
+		state.keys[i] = (i * 7) % (NUM_STORED + 50);
+	}
+
+	ok1(parse_records(tdb, &state) == 0);
+	ok1(all_seen(&state, NUM_STORED));
+
+	state.stop_after = 10;
+	ok1(parse_records(tdb, &state) == 42);
+	ok1(state.num_parsed == 10);
+	state.stop_after = 0;
+
+	/* Uncommitted records are visible in the transaction */
+	ok1(tdb_transaction_start(tdb) == 0);
+	for (k=NUM_STORED; k<NUM_STORED+50; k++) {
+		store(tdb, k);
+	}
+	ok1(parse_records(tdb, &state) == 0);
+	ok1(all_seen(&state, NUM_STORED+50));
+	ok1(tdb_transaction_cancel(tdb) == 0);
+
+	ok1(parse_records(tdb, &state) == 0);
+	ok1(all_seen(&state, NUM_STORED));
+	ok1(tdb_parse_records(tdb, NULL, 0, parser, &state) == 0);
+
+	tdb_close(tdb);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_tests(24);
+
+	test_tdb(TDB_DEFAULT);
+
+	if (tdb_runtime_check_for_robust_mutexes()) {
+		test_tdb(TDB_MUTEX_LOCKING|TDB_MUTEX_SEQLOCK);
+	} else {
+		test_tdb(TDB_DEFAULT);
+	}
+
+	return exit_status();
+}
@@ -0,0 +1,259 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "system/wait.h"
+#include "logging.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define TEST_DBNAME "run-traverse-chains.tdb"
+#define HASH_SIZE 1031
+#define NUM_KEYS 2000
+#define NUM_PARTITIONS 4
+
+struct partition {
+	struct tdb_context *tdb;
+	uint32_t first_chain;
+	uint32_t num_chains;
+	int seen[NUM_KEYS];
+	bool wrong_data;
+	int stop_after;
+	int count;
+	enum TDB_ERROR ecode;
+};
+
+/*
+ * The keys below NUM_KEYS are stored with the key as data and never
+ * touched by the writer child, which plays with the ones above.
+ */
+static int count_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		    void *private_data)
+{
+	struct partition *p = private_data;
+	int k;
+
+	if ((key.dsize != sizeof(k)) || (data.dsize < sizeof(k))) {
+		p->wrong_data = true;
+		return 0;
+	}
+	memcpy(&k, key.dptr, sizeof(k));
+	if (k < NUM_KEYS) {
+		if ((data.dsize != sizeof(k)) ||
+		    (memcmp(data.dptr, &k, sizeof(k)) != 0)) {
+			p->wrong_data = true;
+		}
+		p->seen[k] += 1;
+	}
+
+	p->stop_after -= 1;
+	return (p->stop_after == 0);
+}
+
+static void *traverse_partition(void *private_data)
+{
+	struct partition *p = private_data;
+
+	memset(p->seen, 0, sizeof(p->seen));
+	p->wrong_data = false;
+	p->count = tdb_traverse_chains_read(p->tdb, p->first_chain,
+					    p->num_chains, count_fn, p,
+					    &p->ecode);
+	return NULL;
+}
+
+static void setup_partitions(struct tdb_context *tdb,
+			     struct partition *parts)
+{
+	uint32_t hash_size = tdb_hash_size(tdb);
+	uint32_t chain = 0;
+	int i;
+
+	for (i=0; i<NUM_PARTITIONS; i++) {
+		uint32_t end = (uint64_t)hash_size * (i+1) / NUM_PARTITIONS;
+
+		parts[i].tdb = tdb;
+		parts[i].first_chain = chain;
+		parts[i].num_chains = end - chain;
+		parts[i].stop_after = -1;
+		chain = end;
+	}
+}
+
+/* Every stored key in exactly one partition */
+static bool all_seen_once(struct partition *parts)
+{
+	int i, k;
+
+	for (k=0; k<NUM_KEYS; k++) {
+		int seen = 0;
+		for (i=0; i<NUM_PARTITIONS; i++) {
+			seen += parts[i].seen[k];
+		}
+		if (seen != 1) {
+			return false;
+		}
+	}
+	for (i=0; i<NUM_PARTITIONS; i++) {
+		if ((parts[i].count == -1) ||
+		    (parts[i].ecode != TDB_SUCCESS) ||
+		    parts[i].wrong_data) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool traverse_threaded(struct tdb_context *tdb,
+			      struct partition *parts)
+{
+#ifdef HAVE_PTHREAD
+	pthread_t threads[NUM_PARTITIONS];
+	int i;
+
+	setup_partitions(tdb, parts);
+
+	for (i=0; i<NUM_PARTITIONS; i++) {
+		if (pthread_create(&threads[i], NULL, traverse_partition,
+				   &parts[i]) != 0) {
+			return false;
+		}
+	}
+	for (i=0; i<NUM_PARTITIONS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+#else
+	int i;
+
+	setup_partitions(tdb, parts);
+
+	for (i=0; i<NUM_PARTITIONS; i++) {
+		traverse_partition(&parts[i]);
+	}
+#endif
+	return all_seen_once(parts);
+}
+
+static pid_t start_writer(struct tdb_context *tdb)
+{
+	pid_t child = fork();
+
+	if (child == 0) {
+		uint8_t buf[300] = { 0, };
+		int i;
+
+		if (tdb_reopen(tdb) != 0) {
+			_exit(1);
+		}
+		for (i=0; ; i++) {
+			int k = NUM_KEYS + (i % 500);
+			TDB_DATA key = { .dptr = (uint8_t *)&k,
+					 .dsize = sizeof(k) };
+			TDB_DATA data = { .dptr = buf,
+					  .dsize = sizeof(k) + i % 250 };
+
+			memcpy(buf, &k, sizeof(k));
+			if ((i / 500) % 2 == 0) {
+				tdb_store(tdb, key, data, TDB_REPLACE);
+			} else {
+				tdb_delete(tdb, key);
+			}
+		}
+	}
+	return child;
+}
+
+static void test_tdb(int tdb_flags)
+{
+	struct partition parts[NUM_PARTITIONS];
+	struct tdb_context *tdb;
+	enum TDB_ERROR ecode;
+	pid_t writer;
+	bool ok;
+	int i, k;
+
+	tdb = tdb_open_ex(TEST_DBNAME, HASH_SIZE, TDB_CLEAR_IF_FIRST|tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	for (k=0; k<NUM_KEYS; k++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		tdb_store(tdb, key, key, TDB_INSERT);
+	}
+
+	/* One partition after the other */
+	setup_partitions(tdb, parts);
+	for (i=0; i<NUM_PARTITIONS; i++) {
+		traverse_partition(&parts[i]);
+	}
+	ok1(all_seen_once(parts));
+	ok1(parts[0].count + parts[1].count + parts[2].count +
+	    parts[3].count == NUM_KEYS);
+
+	/* All of them at the same time, while another process writes */
+	writer = start_writer(tdb);
+	ok1(writer > 0);
+	ok = true;
+	for (i=0; ok && (i<200); i++) {
+		ok = traverse_threaded(tdb, parts);
+	}
+	ok1(ok);
+	kill(writer, SIGKILL);
+	waitpid(writer, NULL, 0);
+
+	/* fn can stop the traversal */
+	setup_partitions(tdb, parts);
+	parts[0].stop_after = 5;
+	traverse_partition(&parts[0]);
+	ok1(parts[0].count == 5);
+
+	/* Chain ranges beyond the hash table are refused */
+	ok1(tdb_traverse_chains_read(tdb, HASH_SIZE - 1, 2, NULL, NULL,
+				     &ecode) == -1);
+	ok1(ecode == TDB_ERR_EINVAL);
+	ok1(tdb_traverse_chains_read(tdb, HASH_SIZE - 1, 1, NULL, NULL,
+				     &ecode) >= 0);
+
+	/* So are transactions and held locks */
+	ok1(tdb_transaction_start(tdb) == 0);
+	ok1(tdb_traverse_chains_read(tdb, 0, HASH_SIZE, NULL, NULL,
+				     &ecode) == -1);
+	ok1(ecode == TDB_ERR_EINVAL);
+	ok1(tdb_transaction_cancel(tdb) == 0);
+
+	ok1(tdb_chainlock(tdb, tdb_null) == 0);
+	ok1(tdb_traverse_chains_read(tdb, 0, HASH_SIZE, NULL, NULL,
+				     &ecode) == -1);
+	ok1(ecode == TDB_ERR_EINVAL);
+	ok1(tdb_chainunlock(tdb, tdb_null) == 0);
+	ok1(tdb_traverse_chains_read(tdb, 0, HASH_SIZE, NULL, NULL,
+				     NULL) >= NUM_KEYS);
+
+	tdb_close(tdb);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_tests(34);
+
+	test_tdb(TDB_DEFAULT);
+
+	if (tdb_runtime_check_for_robust_mutexes()) {
+		test_tdb(TDB_MUTEX_LOCKING);
+	} else {
+		test_tdb(TDB_DEFAULT);
+	}
+
+	return exit_status();
+}
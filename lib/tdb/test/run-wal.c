@@ -0,0 +1,257 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "system/wait.h"
+#include "logging.h"
+
+#define TEST_DBNAME "run-wal.tdb"
+#define TEST_WALNAME "run-wal.tdb.wal"
+#define NUM_COMMITS 100
+
+static double timeval_elapsed(const struct timeval *tv1)
+{
+	struct timeval tv2;
+	gettimeofday(&tv2, NULL);
+	return (tv2.tv_sec - tv1->tv_sec) +
+	       (tv2.tv_usec - tv1->tv_usec)*1.0e-6;
+}
+
+static bool store_in_transaction(struct tdb_context *tdb, int k)
+{
+	char buf[64];
+	TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+	TDB_DATA data = { .dptr = (uint8_t *)buf };
+
+	data.dsize = snprintf(buf, sizeof(buf), "value of key %d", k);
+
+	if (tdb_transaction_start(tdb) != 0) {
+		return false;
+	}
+	if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+		tdb_transaction_cancel(tdb);
+		return false;
+	}
+	return (tdb_transaction_commit(tdb) == 0);
+}
+
+static bool have_keys(struct tdb_context *tdb, int first, int last)
+{
+	int k;
+
+	for (k=first; k<last; k++) {
+		TDB_DATA key = { .dptr = (uint8_t *)&k, .dsize = sizeof(k) };
+		TDB_DATA data;
+		char buf[64];
+		bool ok;
+
+		data = tdb_fetch(tdb, key);
+		if (data.dptr == NULL) {
+			return false;
+		}
+		snprintf(buf, sizeof(buf), "value of key %d", k);
+		ok = (data.dsize == strlen(buf)) &&
+			(memcmp(data.dptr, buf, data.dsize) == 0);
+		free(data.dptr);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static off_t file_size(const char *name)
+{
+	struct stat st;
+
+	if (stat(name, &st) != 0) {
+		return -1;
+	}
+	return st.st_size;
+}
+
+/* what's on disk after syncing, anything later might get lost */
+static void *snapshot(const char *name, off_t *psize)
+{
+	off_t size = file_size(name);
+	void *buf;
+	int fd;
+
+	buf = malloc(size);
+	fd = open(name, O_RDONLY);
+	if (pread(fd, buf, size, 0) != size) {
+		free(buf);
+		buf = NULL;
+	}
+	close(fd);
+	*psize = size;
+	return buf;
+}
+
+static bool restore(const char *name, const void *buf, off_t size)
+{
+	int fd = open(name, O_RDWR);
+	bool ok;
+
+	ok = (ftruncate(fd, size) == 0) &&
+		(pwrite(fd, buf, size, 0) == size);
+	close(fd);
+	return ok;
+}
+
+/*
+ * Commit in a child that dies without closing the database, the log
+ * is not written back then.
+ */
+static bool commit_and_die(int first, int last)
+{
+	pid_t child;
+	int status;
+
+	child = fork();
+	if (child == 0) {
+		struct tdb_context *tdb;
+		int k;
+
+		tdb = tdb_open_ex(TEST_DBNAME, 0, TDB_DEFAULT, O_RDWR, 0,
+				  &taplogctx, NULL);
+		if (tdb == NULL) {
+			_exit(1);
+		}
+		for (k=first; k<last; k++) {
+			if (!store_in_transaction(tdb, k)) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+	if (child == -1 || waitpid(child, &status, 0) != child) {
+		return false;
+	}
+	return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static double bench(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	struct timeval start;
+	double elapsed;
+	bool ok = true;
+	int k;
+
+	unlink("run-wal-bench.tdb");
+	unlink("run-wal-bench.tdb.wal");
+	tdb = tdb_open_ex("run-wal-bench.tdb", 0, tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	if (tdb == NULL) {
+		return 0;
+	}
+
+	gettimeofday(&start, NULL);
+	for (k=0; ok && (k<NUM_COMMITS); k++) {
+		ok = store_in_transaction(tdb, k);
+	}
+	elapsed = timeval_elapsed(&start);
+	tdb_close(tdb);
+
+	if (!ok) {
+		return 0;
+	}
+	return NUM_COMMITS / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	TDB_DATA key = { .dptr = discard_const_p(uint8_t, "hi"), .dsize = 2 };
+	tdb_off_t end;
+	void *buf;
+	off_t size, wal_size;
+	int fd;
+
+	plan_tests(26);
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, TDB_WAL|TDB_CLEAR_IF_FIRST,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb == NULL && errno == EINVAL);
+
+	unlink(TEST_DBNAME);
+	unlink(TEST_WALNAME);
+	tdb = tdb_open_ex(TEST_DBNAME, 0, TDB_WAL,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb != NULL);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_WAL);
+	ok1(tdb->wal != NULL);
+
+	/* commits go to the log */
+	ok1(store_in_transaction(tdb, 0));
+	ok1(store_in_transaction(tdb, 1));
+	end = tdb->wal->hdr->end;
+	ok1(end > TDB_WAL_DATA_START);
+	ok1(file_size(TEST_WALNAME) == end);
+	ok1(have_keys(tdb, 0, 2));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	/* and are written back by a checkpoint */
+	ok1(tdb_wal_checkpoint(tdb) == 0);
+	ok1(tdb->wal->hdr->end == TDB_WAL_DATA_START);
+	ok1(file_size(TEST_WALNAME) == TDB_WAL_DATA_START);
+	ok1(have_keys(tdb, 0, 2));
+
+	/* as does writing outside a transaction */
+	ok1(store_in_transaction(tdb, 2));
+	ok1(tdb->wal->hdr->end > TDB_WAL_DATA_START);
+	ok1(tdb_store(tdb, key, key, TDB_REPLACE) == 0);
+	ok1(tdb->wal->hdr->end == TDB_WAL_DATA_START);
+	tdb_close(tdb);
+
+	/*
+	 * Lose everything that did not get synced: the log brings
+	 * all committed transactions back.
+	 */
+	buf = snapshot(TEST_DBNAME, &size);
+	ok1(commit_and_die(3, 50));
+	ok1(file_size(TEST_WALNAME) > TDB_WAL_DATA_START);
+	ok1(restore(TEST_DBNAME, buf, size));
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, TDB_DEFAULT, O_RDWR, 0,
+			  &taplogctx, NULL);
+	ok1(tdb != NULL && have_keys(tdb, 0, 50));
+	ok1(tdb != NULL && tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+	free(buf);
+
+	/*
+	 * A torn write at the end of the log only loses the last
+	 * transaction, which never got committed.
+	 */
+	buf = snapshot(TEST_DBNAME, &size);
+	ok1(commit_and_die(50, 60));
+	wal_size = file_size(TEST_WALNAME);
+	fd = open(TEST_WALNAME, O_RDWR);
+	ok1(ftruncate(fd, wal_size - 5) == 0);
+	close(fd);
+	restore(TEST_DBNAME, buf, size);
+
+	tdb = tdb_open_ex(TEST_DBNAME, 0, TDB_DEFAULT, O_RDWR, 0,
+			  &taplogctx, NULL);
+	ok1(tdb != NULL && have_keys(tdb, 0, 59) && !have_keys(tdb, 59, 60) &&
+	    tdb_check(tdb, NULL, NULL) == 0);
+	tdb_close(tdb);
+	free(buf);
+
+	diag("recovery area: %.0f commits/sec", bench(TDB_DEFAULT));
+	diag("write-ahead log: %.0f commits/sec", bench(TDB_WAL));
+
+	return exit_status();
+}
@@ -0,0 +1,159 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+
+static void log_fn(struct tdb_context *tdb, enum tdb_debug_level level, const char *fmt, ...)
+{
+	unsigned int *count = tdb_get_logging_private(tdb);
+	if (strstr(fmt, "hash"))
+		(*count)++;
+}
+
+static unsigned int hdr_rwlocks(const char *fname)
+{
+	struct tdb_header hdr;
+	ssize_t nread;
+
+	int fd = open(fname, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	nread = read(fd, &hdr, sizeof(hdr));
+	close(fd);
+	if (nread != sizeof(hdr)) {
+		return -1;
+	}
+	return hdr.rwlocks;
+}
+
+static unsigned int hash_str(const char *str)
+{
+	TDB_DATA key = { .dptr = discard_const_p(uint8_t, str),
+			 .dsize = strlen(str) };
+	return tdb_wyhash(&key);
+}
+
+static double hash_bench(tdb_hash_func fn)
+{
+	/* A file_id sized key at an odd address */
+	uint8_t buf[25] = { 0, };
+	TDB_DATA key = { .dptr = buf + 1, .dsize = 24 };
+	struct timeval start, end;
+	unsigned int sum = 0;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < 10000000; i++) {
+		buf[1 + (i % 24)] = i;
+		sum += fn(&key);
+	}
+	gettimeofday(&end, NULL);
+	if (sum == 0) {
+		diag("hash sum is 0");
+	}
+	return (end.tv_sec - start.tv_sec) +
+	       (end.tv_usec - start.tv_usec)*1.0e-6;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	unsigned int log_count, flags;
+	TDB_DATA d, r;
+	struct tdb_logging_context log_ctx = { log_fn, &log_count };
+
+	plan_tests(6 + 20 * 2);
+
+	/* The hash values are part of the file format */
+	ok1(hash_str("") == 0xe6b487d7);
+	ok1(hash_str("a") == 0x21008002);
+	ok1(hash_str("Hello") == 0xb8a4f9ec);
+	ok1(hash_str("0123456789abcdef") == 0xfb783505);
+	ok1(hash_str("0123456789abcdef0123456789abcdef0123456789abcdef"
+		     "0123456789abcdef") == 0x3e7d9e16);
+	ok1(hash_str(TDB_MAGIC_FOOD) == 0xe3a9fb61);
+
+	for (flags = 0; flags <= TDB_CONVERT; flags += TDB_CONVERT) {
+		unsigned int rwmagic = TDB_HASH_RWLOCK_MAGIC;
+
+		if (flags & TDB_CONVERT)
+			tdb_convert(&rwmagic, sizeof(rwmagic));
+
+		log_count = 0;
+		tdb = tdb_open_ex("run-wyhash.tdb", 0, flags|TDB_WYHASH,
+				  O_CREAT|O_RDWR|O_TRUNC, 0600, &log_ctx,
+				  NULL);
+		ok1(tdb);
+		ok1(log_count == 0);
+		ok1(tdb->hash_fn == tdb_wyhash);
+		d.dptr = discard_const_p(uint8_t, "Hello");
+		d.dsize = 5;
+		ok1(tdb_store(tdb, d, d, TDB_INSERT) == 0);
+		tdb_close(tdb);
+
+		/* Should have marked rwlocks field. */
+		ok1(hdr_rwlocks("run-wyhash.tdb") == rwmagic);
+
+		/* Cannot open with the other hashes. */
+		log_count = 0;
+		tdb = tdb_open_ex("run-wyhash.tdb", 0, 0,
+				  O_RDWR, 0600, &log_ctx, tdb_old_hash);
+		ok1(!tdb);
+		ok1(log_count == 1);
+
+		log_count = 0;
+		tdb = tdb_open_ex("run-wyhash.tdb", 0, 0,
+				  O_RDWR, 0600, &log_ctx, tdb_jenkins_hash);
+		ok1(!tdb);
+		ok1(log_count == 1);
+
+		/* Can open by letting it figure it out itself. */
+		log_count = 0;
+		tdb = tdb_open_ex("run-wyhash.tdb", 0, 0,
+				  O_RDWR, 0600, &log_ctx, NULL);
+		ok1(tdb);
+		ok1(log_count == 0);
+		ok1(tdb->hash_fn == tdb_wyhash);
+		r = tdb_fetch(tdb, d);
+		ok1(r.dsize == 5);
+		free(r.dptr);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		tdb_close(tdb);
+
+		/* Even when asking for the jenkins hash via flags. */
+		log_count = 0;
+		tdb = tdb_open_ex("run-wyhash.tdb", 0, TDB_INCOMPATIBLE_HASH,
+				  O_RDWR, 0600, &log_ctx, NULL);
+		ok1(tdb);
+		ok1(log_count == 0);
+		ok1(tdb->hash_fn == tdb_wyhash);
+		r = tdb_fetch(tdb, d);
+		ok1(r.dsize == 5);
+		free(r.dptr);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		tdb_close(tdb);
+
+		/* And jenkins files still open with the wyhash flag */
+		log_count = 0;
+		tdb = tdb_open_ex("test/jenkins-le-hash.tdb", 0, TDB_WYHASH,
+				  O_RDONLY, 0, &log_ctx, NULL);
+		ok1(tdb && tdb->hash_fn == tdb_jenkins_hash);
+		tdb_close(tdb);
+	}
+
+	diag("10M 24 byte keys: jenkins %f s, wyhash %f s",
+	     hash_bench(tdb_jenkins_hash), hash_bench(tdb_wyhash));
+
+	return exit_status();
+}
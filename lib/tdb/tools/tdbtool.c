@@ -65,6 +65,7 @@ enum commands {
 	CMD_SYSTEM,
 	CMD_CHECK,
 	CMD_REPACK,
+	CMD_COMPACT,
 	CMD_QUIT,
 	CMD_HELP
 };
@@ -105,6 +106,7 @@ COMMAND_TABLE cmd_table[] = {
 	{"q",		CMD_QUIT},
 	{"!",		CMD_SYSTEM},
 	{"repack",	CMD_REPACK},
+	{"compact",	CMD_COMPACT},
 	{NULL,		CMD_HELP}
 };
 
@@ -240,6 +242,7 @@ static void help(void)
 "  freelist_size        : print the number of records in the freelist\n"
 "  check                : check the integrity of an opened database\n"
 "  repack               : repack the database\n"
+"  compact   [records]  : compact the database online, in steps of records\n"
 "  speed                : perform speed tests on the database\n"
 "  ! command            : execute system command\n"
 "  1 | first            : print the first record\n"
@@ -695,6 +698,33 @@ static void check_db(TDB_CONTEXT *the_tdb)
 		       tdbcount);
 }
 
+static void compact_db(const char *records)
+{
+	unsigned max_records = records ? atoi(records) : 0;
+	size_t old_size = tdb_map_size(tdb);
+	size_t size = old_size;
+	int moved = 0;
+	int ret;
+
+	if (max_records == 0) {
+		max_records = 1000;
+	}
+
+	/* The file is only cut in the step after the records moved */
+	do {
+		size = tdb_map_size(tdb);
+		ret = tdb_compact_step(tdb, max_records);
+		if (ret == -1) {
+			printf("Error = %s\n", tdb_errorstr(tdb));
+			return;
+		}
+		moved += ret;
+	} while ((ret > 0) || (tdb_map_size(tdb) != size));
+
+	printf("Moved %d records, size %zu -> %zu\n", moved, old_size,
+	       tdb_map_size(tdb));
+}
+
 static int do_command(void)
 {
 	COMMAND_TABLE *ctp = cmd_table;
@@ -832,6 +862,10 @@ static int do_command(void)
 		case CMD_CHECK:
 			check_db(tdb);
 			return 0;
+		case CMD_COMPACT:
+			bIterate = 0;
+			compact_db(arg1);
+			return 0;
 		case CMD_HELP:
 			help();
 			return 0;
@@ -34,6 +34,8 @@ static int hash_size = 2;
 static int loopnum;
 static int count_pipe;
 static bool mutex = false;
+static bool chain_freelists = false;
+static bool wal = false;
 static struct tdb_logging_context log_ctx;
 
 #ifdef PRINTF_ATTRIBUTE
@@ -217,7 +219,7 @@ static int traverse_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA dbuf,
 
 static void usage(void)
 {
-	printf("Usage: tdbtorture [-t] [-k] [-m] [-n NUM_PROCS] [-l NUM_LOOPS] [-s SEED] [-H HASH_SIZE]\n");
+	printf("Usage: tdbtorture [-t] [-k] [-m] [-c] [-w] [-n NUM_PROCS] [-l NUM_LOOPS] [-s SEED] [-H HASH_SIZE]\n");
 	exit(0);
 }
 
@@ -240,6 +242,14 @@ static int run_child(const char *filename, int i, int seed, unsigned num_loops,
 	if (mutex) {
 		tdb_flags |= TDB_MUTEX_LOCKING;
 	}
+	if (chain_freelists) {
+		tdb_flags |= TDB_CHAIN_FREELISTS;
+	}
+	if (wal) {
+		/* the main process removes the old database */
+		tdb_flags &= ~TDB_CLEAR_IF_FIRST;
+		tdb_flags |= TDB_WAL;
+	}
 
 	db = tdb_open_ex(filename, hash_size, tdb_flags,
 			 O_RDWR | O_CREAT, 0600, &log_ctx, NULL);
@@ -313,7 +323,7 @@ int main(int argc, char * const *argv)
 
 	log_ctx.log_fn = tdb_log;
 
-	while ((c = getopt(argc, argv, "n:l:s:H:thkm")) != -1) {
+	while ((c = getopt(argc, argv, "n:l:s:H:thkmcw")) != -1) {
 		switch (c) {
 		case 'n':
 			num_procs = strtol(optarg, NULL, 0);
@@ -340,6 +350,12 @@ int main(int argc, char * const *argv)
 				exit(1);
 			}
 			break;
+		case 'c':
+			chain_freelists = true;
+			break;
+		case 'w':
+			wal = true;
+			break;
 		default:
 			usage();
 		}
@@ -348,6 +364,13 @@ int main(int argc, char * const *argv)
 	test_tdb = test_path("torture.tdb");
 
 	unlink(test_tdb);
+	if (wal) {
+		char *wal_tdb = NULL;
+		if (asprintf(&wal_tdb, "%s.wal", test_tdb) != -1) {
+			unlink(wal_tdb);
+			free(wal_tdb);
+		}
+	}
 
 	if (seed == -1) {
 		seed = (getpid() + time(NULL)) & 0x7FFFFFFF;
@@ -209,10 +209,14 @@ void smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 	memcpy(KO, digest, 16);
 }
 
-NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
-				  uint16_t cipher_id,
-				  struct iovec *vector,
-				  int count)
+/*
+ * Same as smb2_signing_encrypt_pdu(), but without any logging,
+ * so it can be called from a worker thread.
+ */
+NTSTATUS smb2_signing_encrypt_pdu_nolog(DATA_BLOB encryption_key,
+					uint16_t cipher_id,
+					struct iovec *vector,
+					int count)
 {
 	uint8_t *tf;
 	uint8_t sig[16];
@@ -236,8 +240,6 @@ NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (encryption_key.length == 0) {
-		DEBUG(2,("Wrong encryption key length %u for SMB2 signing\n",
-			 (unsigned)encryption_key.length));
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
@@ -298,6 +300,30 @@ NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
 
 	memcpy(tf + SMB2_TF_SIGNATURE, sig, 16);
 
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
+				  uint16_t cipher_id,
+				  struct iovec *vector,
+				  int count)
+{
+	NTSTATUS status;
+
+	if (encryption_key.length == 0) {
+		DEBUG(2,("Wrong encryption key length %u for SMB2 signing\n",
+			 (unsigned)encryption_key.length));
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	status = smb2_signing_encrypt_pdu_nolog(encryption_key,
+						cipher_id,
+						vector,
+						count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
 	DEBUG(5,("encrypt SMB2 message\n"));
 
 	return NT_STATUS_OK;
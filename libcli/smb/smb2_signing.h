@@ -42,6 +42,10 @@ NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
 				  uint16_t cipher_id,
 				  struct iovec *vector,
 				  int count);
+NTSTATUS smb2_signing_encrypt_pdu_nolog(DATA_BLOB encryption_key,
+					uint16_t cipher_id,
+					struct iovec *vector,
+					int count);
 NTSTATUS smb2_signing_decrypt_pdu(DATA_BLOB decryption_key,
 				  uint16_t cipher_id,
 				  struct iovec *vector,
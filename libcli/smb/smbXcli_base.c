@@ -35,6 +35,7 @@
 #include "libcli/smb/smb2_negotiate_context.h"
 #include "lib/crypto/sha512.h"
 #include "lib/crypto/aes.h"
+#include "lib/crypto/aes_accel.h"
 #include "lib/crypto/aes_ccm_128.h"
 #include "lib/crypto/aes_gcm_128.h"
 
@@ -803,6 +803,19 @@ sub setup_simpleserver($$)
         read only = no
         vfs_aio_fork:erratic_testing_mode=yes
 
+[vfs_io_uring]
+	path = $prefix_abs/share
+	vfs objects = io_uring
+	read only = no
+	io_uring:num_entries = 4
+
+[vfs_write_coalesce]
+	path = $prefix_abs/share
+	vfs objects = write_coalesce
+	read only = no
+	aio write size = 1
+	write_coalesce:max batch size = 65536
+
 [dosmode]
 	path = $prefix_abs/share
 	vfs objects =
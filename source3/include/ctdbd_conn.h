@@ -38,6 +38,7 @@ int ctdbd_reinit_connection(TALLOC_CTX *mem_ctx,
 			    const char *sockname, int timeout,
 			    struct ctdbd_connection *conn);
 int ctdbd_setup_fde(struct ctdbd_connection *conn, struct tevent_context *ev);
+int ctdbd_setup_ring(struct ctdbd_connection *conn);
 
 uint32_t ctdbd_vnn(const struct ctdbd_connection *conn);
 
@@ -41,6 +41,12 @@ struct tevent_context;
 	SMBPROFILE_STATS_BASIC(pop_sec_ctx) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
+	SMBPROFILE_STATS_SECTION_START(smb2_send_queue, "SMB2 Send Queue") \
+	SMBPROFILE_STATS_COUNT(smb2_send_queue_writes) \
+	SMBPROFILE_STATS_COUNT(smb2_send_queue_coalesced) \
+	SMBPROFILE_STATS_COUNT(smb2_send_queue_partial_writes) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
 	SMBPROFILE_STATS_SECTION_START(syscall, "System Calls") \
 	SMBPROFILE_STATS_BASIC(syscall_opendir) \
 	SMBPROFILE_STATS_BASIC(syscall_fdopendir) \
@@ -273,6 +279,26 @@ struct tevent_context;
 
 /* time values in the following structure are in microseconds */
 
+/*
+ * The basic, bytes and iobytes stats carry a latency histogram: bucket 0
+ * counts events that took less than 1 microsecond, bucket i those
+ * that took [2^(i-1), 2^i) microseconds. The last bucket takes
+ * everything above.
+ */
+#define SMBPROFILE_HISTOGRAM_BUCKETS 24
+
+static inline unsigned smbprofile_histogram_bucket(uint64_t usecs)
+{
+	unsigned bucket = 0;
+
+	while ((usecs != 0) && (bucket < SMBPROFILE_HISTOGRAM_BUCKETS - 1)) {
+		usecs >>= 1;
+		bucket += 1;
+	}
+
+	return bucket;
+}
+
 struct smbprofile_stats_count {
 	uint64_t count;		/* number of events */
 };
@@ -289,6 +315,7 @@ struct smbprofile_stats_time_async {
 struct smbprofile_stats_basic {
 	uint64_t count;		/* number of events */
 	uint64_t time;		/* microseconds */
+	uint64_t latency[SMBPROFILE_HISTOGRAM_BUCKETS];
 };
 
 struct smbprofile_stats_basic_async {
@@ -301,6 +328,7 @@ struct smbprofile_stats_bytes {
 	uint64_t time;		/* microseconds */
 	uint64_t idle;		/* idle time compared to 'time' microseconds */
 	uint64_t bytes;		/* bytes */
+	uint64_t latency[SMBPROFILE_HISTOGRAM_BUCKETS];
 };
 
 struct smbprofile_stats_bytes_async {
@@ -316,6 +344,7 @@ struct smbprofile_stats_iobytes {
 	uint64_t idle;		/* idle time compared to 'time' microseconds */
 	uint64_t inbytes;	/* bytes read */
 	uint64_t outbytes;	/* bytes written */
+	uint64_t latency[SMBPROFILE_HISTOGRAM_BUCKETS];
 };
 
 struct smbprofile_stats_iobytes_async {
@@ -400,7 +429,10 @@ struct profile_stats {
 	_SMBPROFILE_BASIC_ASYNC_START(_name##_stats, _area, _async)
 #define SMBPROFILE_BASIC_ASYNC_END(_async) do { \
 	if ((_async).start != 0) { \
-		(_async).stats->time += profile_timestamp() - (_async).start; \
+		uint64_t _elapsed = profile_timestamp() - (_async).start; \
+		(_async).stats->time += _elapsed; \
+		(_async).stats->latency[ \
+			smbprofile_histogram_bucket(_elapsed)] += 1; \
 		(_async) = (struct smbprofile_stats_basic_async) {}; \
 		smbprofile_dump_schedule(); \
 	} \
@@ -428,9 +460,13 @@ struct profile_stats {
 } while(0)
 #define _SMBPROFILE_TIMER_ASYNC_END(_async) do { \
 	if ((_async).start != 0) { \
+		uint64_t _elapsed; \
 		_SMBPROFILE_TIMER_ASYNC_SET_BUSY(_async); \
-		(_async).stats->time += profile_timestamp() - (_async).start; \
+		_elapsed = profile_timestamp() - (_async).start; \
+		(_async).stats->time += _elapsed; \
 		(_async).stats->idle += (_async).idle_time; \
+		(_async).stats->latency[ \
+			smbprofile_histogram_bucket(_elapsed)] += 1; \
 	} \
 } while(0)
 
@@ -35,6 +35,7 @@
 #include "lib/util/tevent_unix.c"
 #include "lib/util/sys_rw.h"
 #include "lib/util/blocking.h"
+#include "system/shmem.h"
 #include "ctdb/include/ctdb_protocol.h"
 
 /* paths to these include files come from --with-ctdb= in configure */
@@ -80,6 +81,16 @@ struct ctdbd_connection {
 	/* Lists of pending async reads and writes */
 	struct ctdb_pkt_recv_state *recv_list;
 	struct ctdb_pkt_send_state *send_list;
+
+	/* Shared memory ring from ctdbd, enabled via ctdbd_setup_ring() */
+	struct ctdb_client_ring *ring;
+	size_t ring_maplen;
+	bool ring_active;
+	uint32_t ring_next;
+
+	/* Packets from the ring are copied here to be processed */
+	uint8_t *ring_buf;
+	bool ring_buf_busy;
 };
 
 static void ctdbd_async_socket_handler(struct tevent_context *ev,
@@ -390,6 +401,203 @@ static int ctdb_read_packet(int fd, int timeout, TALLOC_CTX *mem_ctx,
 	return 0;
 }
 
+static bool ctdb_is_ring_message(struct ctdb_req_header *hdr)
+{
+	struct ctdb_req_message_old *msg;
+
+	if ((hdr->operation != CTDB_REQ_MESSAGE) ||
+	    (hdr->length < offsetof(struct ctdb_req_message_old, data))) {
+		return false;
+	}
+	msg = (struct ctdb_req_message_old *)hdr;
+
+	return (msg->srvid == CTDB_SRVID_CLIENT_RING);
+}
+
+/*
+ * Find the next record in the ring, skipping the unused end of data[]
+ */
+static struct ctdb_req_header *ctdbd_ring_peek(struct ctdbd_connection *conn)
+{
+	struct ctdb_client_ring *ring = conn->ring;
+
+	while (true) {
+		uint32_t head, ofs, len;
+
+		head = ring->head;
+		/* Read the packet only after seeing the new head */
+		__sync_synchronize();
+
+		if (head == conn->ring_next) {
+			return NULL;
+		}
+		if (head - conn->ring_next > ring->size) {
+			cluster_fatal("corrupt ctdbd ring\n");
+		}
+
+		ofs = conn->ring_next & (ring->size - 1);
+		memcpy(&len, &ring->data[ofs], sizeof(len));
+
+		if (len == CTDB_CLIENT_RING_WRAP) {
+			conn->ring_next += ring->size - ofs;
+			continue;
+		}
+
+		if ((len != CTDB_CLIENT_RING_SOCKET) &&
+		    ((len < sizeof(struct ctdb_req_header)) ||
+		     (len > ring->size - ofs))) {
+			cluster_fatal("corrupt ctdbd ring\n");
+		}
+
+		return (struct ctdb_req_header *)&ring->data[ofs];
+	}
+}
+
+/*
+ * Give the space of a record back to ctdbd
+ */
+static void ctdbd_ring_consume(struct ctdbd_connection *conn, uint32_t len)
+{
+	struct ctdb_client_ring *ring = conn->ring;
+
+	if (len == CTDB_CLIENT_RING_SOCKET) {
+		len = CTDB_DS_ALIGNMENT;
+	}
+	conn->ring_next += CTDB_CLIENT_RING_ALIGN(len);
+
+	/* Done with the record before ctdbd can see the new tail */
+	__sync_synchronize();
+	ring->tail = conn->ring_next;
+
+	/* ... and the new tail is visible before looking at ctdbd */
+	__sync_synchronize();
+	if (ring->writer_waiting != 0) {
+		struct iovec iov = { .iov_len = 0 };
+
+		ring->writer_waiting = 0;
+		ctdbd_messaging_send_iov(conn, conn->our_vnn,
+					 CTDB_SRVID_CLIENT_RING, &iov, 1);
+	}
+}
+
+/*
+ * Packets are copied out of the ring before they are processed, so that
+ * ctdbd can reuse the space while callbacks run and possibly send sync
+ * requests themselves. The copy goes into a buffer kept with the
+ * connection, only nested reads need a talloc'ed copy.
+ */
+static struct ctdb_req_header *ctdbd_ring_copy(struct ctdbd_connection *conn,
+					       TALLOC_CTX *mem_ctx,
+					       struct ctdb_req_header *src)
+{
+	uint32_t len = src->length;
+	uint8_t *buf;
+
+	if (conn->ring_buf_busy) {
+		buf = talloc_memdup(mem_ctx, src, len);
+		if (buf == NULL) {
+			return NULL;
+		}
+		talloc_set_name_const(buf, "struct ctdb_req_header");
+		return (struct ctdb_req_header *)buf;
+	}
+
+	if (talloc_array_length(conn->ring_buf) < len) {
+		buf = talloc_realloc(conn, conn->ring_buf, uint8_t, len);
+		if (buf == NULL) {
+			return NULL;
+		}
+		conn->ring_buf = buf;
+	}
+
+	memcpy(conn->ring_buf, src, len);
+	conn->ring_buf_busy = true;
+
+	return (struct ctdb_req_header *)conn->ring_buf;
+}
+
+static void ctdbd_pkt_free(struct ctdbd_connection *conn,
+			   struct ctdb_req_header *hdr)
+{
+	if ((uint8_t *)hdr == conn->ring_buf) {
+		conn->ring_buf_busy = false;
+		return;
+	}
+	TALLOC_FREE(hdr);
+}
+
+/*
+ * Read the next packet from ctdbd, from the ring if there is one. The
+ * packet has to be released with ctdbd_pkt_free(). timeout applies to
+ * waiting for ctdbd, with 0 this returns ETIMEDOUT if nothing is there.
+ */
+static int ctdbd_read_pkt(struct ctdbd_connection *conn, int timeout,
+			  TALLOC_CTX *mem_ctx, struct ctdb_req_header **result)
+{
+	struct ctdb_req_header *hdr;
+	bool on_socket = false;
+	int ret;
+
+ next_pkt:
+
+	if (conn->ring_active && !on_socket) {
+		hdr = ctdbd_ring_peek(conn);
+		if (hdr == NULL) {
+			/*
+			 * Ask for a message on the socket and look again,
+			 * ctdbd might not have seen reader_sleeping yet.
+			 */
+			conn->ring->reader_sleeping = 1;
+			__sync_synchronize();
+			hdr = ctdbd_ring_peek(conn);
+		}
+		if (hdr != NULL) {
+			uint32_t len = hdr->length;
+
+			conn->ring->reader_sleeping = 0;
+
+			if (len == CTDB_CLIENT_RING_SOCKET) {
+				ctdbd_ring_consume(conn, len);
+				on_socket = true;
+				timeout = conn->timeout;
+				goto next_pkt;
+			}
+
+			*result = ctdbd_ring_copy(conn, mem_ctx, hdr);
+			ctdbd_ring_consume(conn, len);
+			if (*result == NULL) {
+				return ENOMEM;
+			}
+			return 0;
+		}
+	}
+
+	ret = ctdb_read_packet(conn->fd, timeout, mem_ctx, &hdr);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (ctdb_is_ring_message(hdr)) {
+		/* The first one confirms the ring, then they are doorbells */
+		TALLOC_FREE(hdr);
+		conn->ring_active = (conn->ring != NULL);
+		goto next_pkt;
+	}
+
+	if (conn->ring_active && !on_socket) {
+		/* Arrived before we saw its marker */
+		struct ctdb_req_header *marker = ctdbd_ring_peek(conn);
+
+		if ((marker != NULL) &&
+		    (marker->length == CTDB_CLIENT_RING_SOCKET)) {
+			ctdbd_ring_consume(conn, marker->length);
+		}
+	}
+
+	*result = hdr;
+	return 0;
+}
+
 /*
  * Read a full ctdbd request. If we have a messaging context, defer incoming
  * messages that might come in between.
@@ -403,7 +611,7 @@ static int ctdb_read_req(struct ctdbd_connection *conn, uint32_t reqid,
 
  next_pkt:
 
-	ret = ctdb_read_packet(conn->fd, conn->timeout, mem_ctx, &hdr);
+	ret = ctdbd_read_pkt(conn, conn->timeout, mem_ctx, &hdr);
 	if (ret != 0) {
 		DEBUG(0, ("ctdb_read_packet failed: %s\n", strerror(ret)));
 		cluster_fatal("ctdbd died\n");
@@ -417,11 +625,11 @@ static int ctdb_read_req(struct ctdbd_connection *conn, uint32_t reqid,
 
 		ret = ctdbd_msg_call_back(NULL, conn, msg);
 		if (ret != 0) {
-			TALLOC_FREE(hdr);
+			ctdbd_pkt_free(conn, hdr);
 			return ret;
 		}
 
-		TALLOC_FREE(hdr);
+		ctdbd_pkt_free(conn, hdr);
 		goto next_pkt;
 	}
 
@@ -429,11 +637,39 @@ static int ctdb_read_req(struct ctdbd_connection *conn, uint32_t reqid,
 		/* we got the wrong reply */
 		DEBUG(0,("Discarding mismatched ctdb reqid %u should have "
 			 "been %u\n", hdr->reqid, reqid));
-		TALLOC_FREE(hdr);
+		ctdbd_pkt_free(conn, hdr);
 		goto next_pkt;
 	}
 
-	*result = talloc_move(mem_ctx, &hdr);
+	if ((uint8_t *)hdr == conn->ring_buf) {
+		*result = talloc_memdup(mem_ctx, hdr, hdr->length);
+		ctdbd_pkt_free(conn, hdr);
+		if (*result == NULL) {
+			return ENOMEM;
+		}
+		talloc_set_name_const(*result, "struct ctdb_req_header");
+	} else {
+		*result = talloc_move(mem_ctx, &hdr);
+	}
+
+	if (conn->ring_active) {
+		/*
+		 * Unlike on the socket, nothing wakes up the event loop
+		 * for messages behind the reply in the ring. Pass them on
+		 * now, like the ones that came before the reply.
+		 */
+		while (ctdbd_read_pkt(conn, 0, NULL, &hdr) == 0) {
+			if (hdr->operation == CTDB_REQ_MESSAGE) {
+				ctdbd_msg_call_back(
+					NULL, conn,
+					(struct ctdb_req_message_old *)hdr);
+			} else {
+				DBG_ERR("Discarding ctdb packet of type %"
+					PRIu32"\n", hdr->operation);
+			}
+			ctdbd_pkt_free(conn, hdr);
+		}
+	}
 
 	return 0;
 }
@@ -463,6 +699,89 @@ int ctdbd_setup_fde(struct ctdbd_connection *conn, struct tevent_context *ev)
 	return 0;
 }
 
+/**
+ * Ask ctdbd for a shared memory ring to receive packets on. This is for
+ * sync connections only. Without a ring, for example with an older
+ * ctdbd or ClientRingSize set to 0, everything stays on the socket.
+ **/
+int ctdbd_setup_ring(struct ctdbd_connection *conn)
+{
+	struct ctdb_client_ring *ring;
+	TDB_DATA path = { .dptr = NULL };
+	struct iovec iov = { .iov_len = 0 };
+	int32_t cstatus = 0;
+	struct stat st;
+	void *p;
+	int ret, fd;
+
+	if (ctdbd_conn_has_async_reqs(conn) || (conn->ring != NULL)) {
+		return EINVAL;
+	}
+
+	ret = ctdbd_control_local(conn, CTDB_CONTROL_CLIENT_RING, 0, 0,
+				  tdb_null, conn, &path, &cstatus);
+	if (ret != 0) {
+		return ret;
+	}
+	if (cstatus != 0) {
+		TALLOC_FREE(path.dptr);
+		return EOPNOTSUPP;
+	}
+	if ((path.dsize == 0) || (path.dptr[path.dsize-1] != '\0')) {
+		TALLOC_FREE(path.dptr);
+		return EIO;
+	}
+
+	fd = open((char *)path.dptr, O_RDWR);
+	if (fd == -1) {
+		ret = errno;
+		DBG_DEBUG("open(%s) failed: %s\n", (char *)path.dptr,
+			  strerror(ret));
+		TALLOC_FREE(path.dptr);
+		return ret;
+	}
+	unlink((char *)path.dptr);
+	TALLOC_FREE(path.dptr);
+
+	ret = fstat(fd, &st);
+	if (ret == -1) {
+		ret = errno;
+		close(fd);
+		return ret;
+	}
+	if ((size_t)st.st_size < offsetof(struct ctdb_client_ring, data)) {
+		close(fd);
+		return EIO;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return errno;
+	}
+	ring = (struct ctdb_client_ring *)p;
+
+	if ((ring->magic != CTDB_CLIENT_RING_MAGIC) ||
+	    (ring->size == 0) ||
+	    ((ring->size & (ring->size - 1)) != 0) ||
+	    (offsetof(struct ctdb_client_ring, data) + ring->size >
+	     (size_t)st.st_size)) {
+		munmap(p, st.st_size);
+		return EIO;
+	}
+
+	conn->ring = ring;
+	conn->ring_maplen = st.st_size;
+	conn->ring_next = ring->tail;
+
+	/*
+	 * ctdbd switches to the ring when it gets this and confirms on
+	 * the socket, see ctdbd_read_pkt()
+	 */
+	return ctdbd_messaging_send_iov(conn, conn->our_vnn,
+					CTDB_SRVID_CLIENT_RING, &iov, 1);
+}
+
 static int ctdbd_connection_destructor(struct ctdbd_connection *c);
 
 /*
@@ -599,20 +918,30 @@ void ctdbd_socket_readable(struct tevent_context *ev,
 	struct ctdb_req_header *hdr = NULL;
 	int ret;
 
-	ret = ctdb_read_packet(conn->fd, conn->timeout, talloc_tos(), &hdr);
-	if (ret != 0) {
-		DEBUG(0, ("ctdb_read_packet failed: %s\n", strerror(ret)));
-		cluster_fatal("ctdbd died\n");
-	}
+	/*
+	 * With a ring the socket mostly carries doorbells, handle
+	 * everything that is in the ring.
+	 */
+	do {
+		ret = ctdbd_read_pkt(conn, 0, talloc_tos(), &hdr);
+		if (ret == ETIMEDOUT) {
+			return;
+		}
+		if (ret != 0) {
+			DEBUG(0, ("ctdb_read_packet failed: %s\n",
+				  strerror(ret)));
+			cluster_fatal("ctdbd died\n");
+		}
 
-	ret = ctdb_handle_message(ev, conn, hdr);
+		ret = ctdb_handle_message(ev, conn, hdr);
 
-	TALLOC_FREE(hdr);
+		ctdbd_pkt_free(conn, hdr);
 
-	if (ret != 0) {
-		DEBUG(10, ("could not handle incoming message: %s\n",
-			   strerror(ret)));
-	}
+		if (ret != 0) {
+			DEBUG(10, ("could not handle incoming message: %s\n",
+				   strerror(ret)));
+		}
+	} while (conn->ring_active);
 }
 
 static int ctdb_pkt_send_handler(struct ctdbd_connection *conn);
@@ -1080,7 +1409,7 @@ int ctdbd_traverse(struct ctdbd_connection *conn, uint32_t db_id,
 		struct ctdb_req_message_old *m;
 		struct ctdb_rec_data_old *d;
 
-		ret = ctdb_read_packet(conn->fd, conn->timeout, conn, &hdr);
+		ret = ctdbd_read_pkt(conn, conn->timeout, conn, &hdr);
 		if (ret != 0) {
 			DEBUG(0, ("ctdb_read_packet failed: %s\n",
 				  strerror(ret)));
@@ -1090,6 +1419,7 @@ int ctdbd_traverse(struct ctdbd_connection *conn, uint32_t db_id,
 		if (hdr->operation != CTDB_REQ_MESSAGE) {
 			DEBUG(0, ("Got operation %u, expected a message\n",
 				  (unsigned)hdr->operation));
+			ctdbd_pkt_free(conn, hdr);
 			return EIO;
 		}
 
@@ -1098,6 +1428,7 @@ int ctdbd_traverse(struct ctdbd_connection *conn, uint32_t db_id,
 		if (m->datalen < sizeof(uint32_t) || m->datalen != d->length) {
 			DEBUG(0, ("Got invalid traverse data of length %d\n",
 				  (int)m->datalen));
+			ctdbd_pkt_free(conn, hdr);
 			return EIO;
 		}
 
@@ -1108,12 +1439,14 @@ int ctdbd_traverse(struct ctdbd_connection *conn, uint32_t db_id,
 
 		if (key.dsize == 0 && data.dsize == 0) {
 			/* end of traverse */
+			ctdbd_pkt_free(conn, hdr);
 			return 0;
 		}
 
 		if (data.dsize < sizeof(struct ctdb_ltdb_header)) {
 			DEBUG(0, ("Got invalid ltdb header length %d\n",
 				  (int)data.dsize));
+			ctdbd_pkt_free(conn, hdr);
 			return EIO;
 		}
 		data.dsize -= sizeof(struct ctdb_ltdb_header);
@@ -1122,6 +1455,8 @@ int ctdbd_traverse(struct ctdbd_connection *conn, uint32_t db_id,
 		if (fn != NULL) {
 			fn(key, data, private_data);
 		}
+
+		ctdbd_pkt_free(conn, hdr);
 	}
 	return 0;
 }
@@ -1773,6 +2108,14 @@ static int ctdbd_connection_destructor(struct ctdbd_connection *c)
 		c->fd = -1;
 	}
 
+	if (c->ring != NULL) {
+		munmap(c->ring, c->ring_maplen);
+		c->ring = NULL;
+	}
+	c->ring_active = false;
+	TALLOC_FREE(c->ring_buf);
+	c->ring_buf_busy = false;
+
 	TALLOC_FREE(c->read_state.hdr);
 	ZERO_STRUCT(c->read_state);
 
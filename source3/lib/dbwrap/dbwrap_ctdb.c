@@ -1519,6 +1519,151 @@ static NTSTATUS db_ctdb_parse_record_recv(struct tevent_req *req)
 	return tevent_req_simple_recv_ntstatus(req);
 }
 
+struct db_ctdb_parse_records_state {
+	void (*parser)(size_t idx, TDB_DATA key, TDB_DATA data,
+		       void *private_data);
+	void *private_data;
+	uint32_t my_vnn;
+	bool persistent;
+	size_t idx;
+	bool *done;
+	bool *ask_for_readonly_copy;
+};
+
+static void db_ctdb_parse_records_fn(TDB_DATA key, TDB_DATA data,
+				     void *private_data)
+{
+	struct db_ctdb_parse_records_state *state =
+		(struct db_ctdb_parse_records_state *)private_data;
+	state->parser(state->idx, key, data, state->private_data);
+}
+
+/*
+ * The batched version of db_ctdb_parse_record_parser_nonpersistent()
+ */
+static int db_ctdb_ltdb_records_parser(size_t idx, TDB_DATA key,
+				       TDB_DATA data, void *private_data)
+{
+	struct db_ctdb_parse_records_state *state =
+		(struct db_ctdb_parse_records_state *)private_data;
+	struct ctdb_ltdb_header *header;
+
+	if (data.dsize < sizeof(struct ctdb_ltdb_header)) {
+		return 0;
+	}
+	header = (struct ctdb_ltdb_header *)data.dptr;
+	data = make_tdb_data(data.dptr + sizeof(struct ctdb_ltdb_header),
+			     data.dsize - sizeof(struct ctdb_ltdb_header));
+
+	if (state->persistent) {
+		state->parser(idx, key, data, state->private_data);
+		state->done[idx] = true;
+		return 0;
+	}
+
+	if (db_ctdb_can_use_local_hdr(header, state->my_vnn, true)) {
+		/*
+		 * Empty records are reported as non-existing, see
+		 * db_ctdb_try_parse_local_record()
+		 */
+		if (data.dsize != 0) {
+			state->parser(idx, key, data, state->private_data);
+		}
+		state->done[idx] = true;
+	} else {
+		state->ask_for_readonly_copy[idx] = true;
+	}
+	return 0;
+}
+
+/*
+ * Look at the local copy for all keys in one go, only ask ctdbd for
+ * the records we can't use locally.
+ */
+static NTSTATUS db_ctdb_parse_records(struct db_context *db,
+				      const TDB_DATA *keys, size_t num_keys,
+				      void (*parser)(size_t idx, TDB_DATA key,
+						     TDB_DATA data,
+						     void *private_data),
+				      void *private_data)
+{
+	struct db_ctdb_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_ctdb_ctx);
+	struct db_ctdb_parse_records_state state = {
+		.parser = parser,
+		.private_data = private_data,
+		.my_vnn = get_my_vnn(),
+		.persistent = db->persistent,
+	};
+	NTSTATUS status = NT_STATUS_OK;
+	size_t i;
+	int ret;
+
+	if (num_keys == 0) {
+		return NT_STATUS_OK;
+	}
+
+	if (ctx->transaction != NULL) {
+		/*
+		 * Records in the transaction buffer take precedence,
+		 * look at them one by one.
+		 */
+		for (i=0; i<num_keys; i++) {
+			state.idx = i;
+			status = db_ctdb_parse_record(
+				db, keys[i], db_ctdb_parse_records_fn, &state);
+			if (NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+				continue;
+			}
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+		}
+		return NT_STATUS_OK;
+	}
+
+	state.done = talloc_zero_array(talloc_tos(), bool, num_keys);
+	state.ask_for_readonly_copy = talloc_zero_array(
+		state.done, bool, num_keys);
+	if ((state.done == NULL) || (state.ask_for_readonly_copy == NULL)) {
+		TALLOC_FREE(state.done);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	ret = tdb_parse_records(ctx->wtdb->tdb, keys, num_keys,
+				db_ctdb_ltdb_records_parser, &state);
+	if (ret != 0) {
+		status = map_nt_error_from_tdb(tdb_error(ctx->wtdb->tdb));
+		goto done;
+	}
+
+	if (db->persistent) {
+		/* Not in the local copy means not there */
+		goto done;
+	}
+
+	for (i=0; i<num_keys; i++) {
+		if (state.done[i]) {
+			continue;
+		}
+		state.idx = i;
+		ret = ctdbd_parse(messaging_ctdb_connection(), ctx->db_id,
+				  keys[i], state.ask_for_readonly_copy[i],
+				  db_ctdb_parse_records_fn, &state);
+		if (ret == ENOENT) {
+			continue;
+		}
+		if (ret != 0) {
+			status = map_nt_error_from_unix(ret);
+			break;
+		}
+	}
+
+done:
+	TALLOC_FREE(state.done);
+	return status;
+}
+
 struct traverse_state {
 	struct db_context *db;
 	int (*fn)(struct db_record *rec, void *private_data);
@@ -1962,6 +2107,7 @@ struct db_context *db_open_ctdb(TALLOC_CTX *mem_ctx,
 	result->parse_record = db_ctdb_parse_record;
 	result->parse_record_send = db_ctdb_parse_record_send;
 	result->parse_record_recv = db_ctdb_parse_record_recv;
+	result->parse_records = db_ctdb_parse_records;
 	result->traverse = db_ctdb_traverse;
 	result->traverse_read = db_ctdb_traverse_read;
 	result->get_seqnum = db_ctdb_get_seqnum;
@@ -24,6 +24,7 @@
 #include "dbwrap/dbwrap_open.h"
 #include "dbwrap/dbwrap_tdb.h"
 #include "dbwrap/dbwrap_ctdb.h"
+#include "dbwrap/dbwrap_sharded.h"
 #include "lib/param/param.h"
 #include "lib/cluster_support.h"
 #include "lib/messages_ctdb.h"
@@ -53,6 +54,67 @@ bool db_is_local(const char *name)
 	return true;
 }
 
+/*
+ * Open num_shards local databases "<name>.<i>" and spread the keys
+ * over them. The hash size configured for <name> is divided among
+ * the shards.
+ */
+static struct db_context *db_open_local_sharded(
+	TALLOC_CTX *mem_ctx, struct loadparm_context *lp_ctx,
+	const char *name, int num_shards,
+	int hash_size, int tdb_flags,
+	int open_flags, mode_t mode,
+	enum dbwrap_lock_order lock_order,
+	uint64_t dbwrap_flags)
+{
+	struct db_context **shards;
+	struct db_context *result = NULL;
+	int i;
+
+	if (hash_size == 0) {
+		/*
+		 * Look up "tdb_hashsize:<name>" here,
+		 * dbwrap_local_open() would use the shard name.
+		 */
+		hash_size = lpcfg_tdb_hash_size(lp_ctx, name);
+	}
+	if (hash_size != 0) {
+		hash_size = MAX(hash_size / num_shards, 1);
+	}
+
+	shards = talloc_zero_array(mem_ctx, struct db_context *, num_shards);
+	if (shards == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	for (i=0; i<num_shards; i++) {
+		char *shard_name;
+
+		shard_name = talloc_asprintf(shards, "%s.%d", name, i);
+		if (shard_name == NULL) {
+			errno = ENOMEM;
+			goto done;
+		}
+
+		shards[i] = dbwrap_local_open(shards, lp_ctx, shard_name,
+					      hash_size, tdb_flags,
+					      open_flags, mode,
+					      lock_order, dbwrap_flags);
+		if (shards[i] == NULL) {
+			DBG_WARNING("Could not open shard %s: %s\n",
+				    shard_name, strerror(errno));
+			goto done;
+		}
+		TALLOC_FREE(shard_name);
+	}
+
+	result = db_open_sharded(mem_ctx, name, shards, num_shards);
+done:
+	TALLOC_FREE(shards);
+	return result;
+}
+
 /**
  * open a database
  */
@@ -65,6 +127,7 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 {
 	struct db_context *result = NULL;
 	const char *sockname;
+	int num_shards = 1;
 
 	if (!DBWRAP_LOCK_ORDER_VALID(lock_order)) {
 		errno = EINVAL;
@@ -100,6 +163,7 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		const char *base;
 		bool try_mutex = true;
 		bool require_mutex = false;
+		bool try_seqlock = true;
 
 		base = strrchr_m(name, '/');
 		if (base != NULL) {
@@ -123,6 +187,66 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		if (require_mutex) {
 			tdb_flags |= TDB_MUTEX_LOCKING;
 		}
+
+		/*
+		 * Let readers like fetch_share_mode_unlocked() parse
+		 * records without taking the chain mutex.
+		 */
+		try_seqlock = lp_parm_bool(-1, "dbwrap_tdb_mutex_seqlock",
+					   "*", try_seqlock);
+		try_seqlock = lp_parm_bool(-1, "dbwrap_tdb_mutex_seqlock",
+					   base, try_seqlock);
+
+		if (try_seqlock && (tdb_flags & TDB_MUTEX_LOCKING)) {
+			tdb_flags |= TDB_MUTEX_SEQLOCK;
+		}
+	}
+
+	if (tdb_flags & TDB_CLEAR_IF_FIRST) {
+		const char *base;
+
+		base = strrchr_m(name, '/');
+		if (base != NULL) {
+			base += 1;
+		} else {
+			base = name;
+		}
+
+		/*
+		 * Only temporary databases can be split up, there
+		 * are no transactions spanning all shards.
+		 */
+		num_shards = lp_parm_int(-1, "dbwrap_shards", "*", num_shards);
+		num_shards = lp_parm_int(-1, "dbwrap_shards", base, num_shards);
+
+		if ((num_shards < 1) || (num_shards > 1024)) {
+			DBG_WARNING("Invalid dbwrap_shards %d for %s\n",
+				    num_shards, base);
+			num_shards = 1;
+		}
+	}
+
+	if (!(tdb_flags & TDB_CLEAR_IF_FIRST) && !lp_clustering()) {
+		const char *base;
+		bool try_wal = false;
+
+		base = strrchr_m(name, '/');
+		if (base != NULL) {
+			base += 1;
+		} else {
+			base = name;
+		}
+
+		/*
+		 * Persistent databases created with a write-ahead log
+		 * sync only the log on transaction commit.
+		 */
+		try_wal = lp_parm_bool(-1, "dbwrap_tdb_wal", "*", try_wal);
+		try_wal = lp_parm_bool(-1, "dbwrap_tdb_wal", base, try_wal);
+
+		if (try_wal) {
+			tdb_flags |= TDB_WAL;
+		}
 	}
 
 	sockname = lp_ctdbd_socket();
@@ -173,9 +297,17 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 
 	if (result == NULL) {
 		struct loadparm_context *lp_ctx = loadparm_init_s3(mem_ctx, loadparm_s3_helpers());
-		result = dbwrap_local_open(mem_ctx, lp_ctx, name, hash_size,
-					   tdb_flags, open_flags, mode,
-					   lock_order, dbwrap_flags);
+		if (num_shards > 1) {
+			result = db_open_local_sharded(
+				mem_ctx, lp_ctx, name, num_shards,
+				hash_size, tdb_flags, open_flags, mode,
+				lock_order, dbwrap_flags);
+		} else {
+			result = dbwrap_local_open(mem_ctx, lp_ctx, name,
+						   hash_size, tdb_flags,
+						   open_flags, mode,
+						   lock_order, dbwrap_flags);
+		}
 		talloc_unlink(mem_ctx, lp_ctx);
 	}
 	return result;
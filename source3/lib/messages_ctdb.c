@@ -118,6 +118,12 @@ int messaging_ctdb_init(const char *sockname, int timeout, uint64_t unique_id,
 		goto fail;
 	}
 
+	ret = ctdbd_setup_ring(ctx->conn);
+	if (ret != 0) {
+		DBG_DEBUG("ctdbd_setup_ring returned %s, using the socket\n",
+			  strerror(ret));
+	}
+
 	set_my_vnn(ctdbd_vnn(ctx->conn));
 
 	global_ctdb_context = ctx;
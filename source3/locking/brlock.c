@@ -51,6 +51,9 @@ struct byte_range_lock {
 	uint32_t num_read_oplocks;
 	struct lock_struct *lock_data;
 	struct db_record *record;
+	/* In-memory interval tree over lock_data, see brl_index_build() */
+	uint64_t *index;
+	unsigned int index_leaves;
 };
 
 /****************************************************************************
@@ -304,6 +307,227 @@ static bool brl_pending_overlap(const struct lock_struct *lock, const struct loc
 	return False;
 }
 
+/****************************************************************************
+ lock_data is kept sorted by start offset. Locks with the same start are
+ kept in the order they were added. For files with many locks we build an
+ implicit interval tree over the sorted array: a complete binary tree
+ whose leaves are the last bytes of the locks and whose inner nodes hold
+ the maximum of their children. Conflict checks use it to only visit the
+ locks that can overlap the range in question, in array order.
+****************************************************************************/
+
+#define BRL_INDEX_MIN_LOCKS 16
+
+static br_off brl_last_byte(const struct lock_struct *lock)
+{
+	if (lock->size == 0) {
+		return lock->start;
+	}
+	if (lock->start + lock->size - 1 < lock->start) {
+		/* Range wraps, see brl_overlap() */
+		return UINT64_MAX;
+	}
+	return lock->start + lock->size - 1;
+}
+
+static void brl_index_invalidate(struct byte_range_lock *br_lck)
+{
+	TALLOC_FREE(br_lck->index);
+	br_lck->index_leaves = 0;
+}
+
+static bool brl_index_build(struct byte_range_lock *br_lck)
+{
+	unsigned int i, leaves = 1;
+	uint64_t *index;
+
+	while (leaves < br_lck->num_locks) {
+		leaves *= 2;
+	}
+
+	index = talloc_zero_array(br_lck, uint64_t, leaves * 2);
+	if (index == NULL) {
+		return false;
+	}
+
+	for (i=0; i<br_lck->num_locks; i++) {
+		index[leaves + i] = brl_last_byte(&br_lck->lock_data[i]);
+	}
+	for (i=leaves-1; i>0; i--) {
+		index[i] = MAX(index[2*i], index[2*i+1]);
+	}
+
+	br_lck->index = index;
+	br_lck->index_leaves = leaves;
+	return true;
+}
+
+/****************************************************************************
+ Find the first lock at or after "from" that might overlap "range".
+ Returns br_lck->num_locks if there is none. The caller still has to do
+ the exact check, this only skips locks that can't overlap.
+****************************************************************************/
+
+static unsigned int brl_next_overlap(struct byte_range_lock *br_lck,
+				     const struct lock_struct *range,
+				     unsigned int from)
+{
+	br_off first = range->start;
+	br_off last = brl_last_byte(range);
+	const uint64_t *index;
+	unsigned int node;
+
+	if (from >= br_lck->num_locks) {
+		return br_lck->num_locks;
+	}
+	if (br_lck->num_locks < BRL_INDEX_MIN_LOCKS) {
+		return from;
+	}
+	if ((br_lck->index == NULL) && !brl_index_build(br_lck)) {
+		return from;
+	}
+	index = br_lck->index;
+
+	/*
+	 * Find the leftmost leaf at or after "from" with a last byte
+	 * at or after "first": Walk up until there is a right sibling
+	 * subtree with a big enough maximum, then down into it.
+	 */
+	node = br_lck->index_leaves + from;
+
+	if (index[node] < first) {
+		while (node > 1) {
+			if (((node & 1) == 0) && (index[node+1] >= first)) {
+				break;
+			}
+			node /= 2;
+		}
+		if (node == 1) {
+			return br_lck->num_locks;
+		}
+		node += 1;
+		while (node < br_lck->index_leaves) {
+			node *= 2;
+			if (index[node] < first) {
+				node += 1;
+			}
+		}
+	}
+	from = node - br_lck->index_leaves;
+
+	/*
+	 * Sorted by start, nothing after a lock beyond "last" can
+	 * overlap.
+	 */
+	if ((from >= br_lck->num_locks) ||
+	    (br_lck->lock_data[from].start > last)) {
+		return br_lck->num_locks;
+	}
+	return from;
+}
+
+/****************************************************************************
+ Index of the first lock starting at or after "start".
+****************************************************************************/
+
+static unsigned int brl_lower_bound(const struct byte_range_lock *br_lck,
+				    br_off start)
+{
+	unsigned int lo = 0, hi = br_lck->num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (br_lck->lock_data[mid].start < start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/****************************************************************************
+ Index of the first lock starting after "start", where a new lock with
+ this start goes.
+****************************************************************************/
+
+static unsigned int brl_upper_bound(const struct byte_range_lock *br_lck,
+				    br_off start)
+{
+	unsigned int lo = 0, hi = br_lck->num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (br_lck->lock_data[mid].start <= start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+struct brl_sort_key {
+	br_off start;
+	unsigned int idx;
+};
+
+static int brl_sort_key_cmp(const struct brl_sort_key *k1,
+			    const struct brl_sort_key *k2)
+{
+	if (k1->start != k2->start) {
+		return (k1->start < k2->start) ? -1 : 1;
+	}
+	if (k1->idx != k2->idx) {
+		return (k1->idx < k2->idx) ? -1 : 1;
+	}
+	return 0;
+}
+
+/****************************************************************************
+ Stable sort of a lock array by start. Used after POSIX splits and merges
+ and for records written before lock_data was kept sorted.
+****************************************************************************/
+
+static bool brl_sort_locks(struct lock_struct *locks, unsigned int num_locks)
+{
+	struct brl_sort_key *keys;
+	struct lock_struct *copy;
+	unsigned int i;
+
+	for (i=1; i<num_locks; i++) {
+		if (locks[i-1].start > locks[i].start) {
+			break;
+		}
+	}
+	if (i >= num_locks) {
+		return true;
+	}
+
+	keys = talloc_array(talloc_tos(), struct brl_sort_key, num_locks);
+	copy = talloc_memdup(keys, locks, sizeof(*locks) * num_locks);
+	if ((keys == NULL) || (copy == NULL)) {
+		TALLOC_FREE(keys);
+		return false;
+	}
+
+	for (i=0; i<num_locks; i++) {
+		keys[i] = (struct brl_sort_key) {
+			.start = locks[i].start, .idx = i
+		};
+	}
+	TYPESAFE_QSORT(keys, num_locks, brl_sort_key_cmp);
+
+	for (i=0; i<num_locks; i++) {
+		locks[i] = copy[keys[i].idx];
+	}
+
+	TALLOC_FREE(keys);
+	return true;
+}
+
 /****************************************************************************
  Amazingly enough, w2k3 "remembers" whether the last lock failure on a fnum
  is the same as this one and changes its error code. I wonder if any
@@ -351,7 +575,7 @@ void brl_init(bool read_only)
 		return;
 	}
 
-	tdb_flags = TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH;
+	tdb_flags = TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|TDB_WYHASH;
 
 	if (!lp_clustering()) {
 		/*
@@ -427,7 +651,9 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i = brl_next_overlap(br_lck, plock, 0);
+	     i < br_lck->num_locks;
+	     i = brl_next_overlap(br_lck, plock, i+1)) {
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -479,7 +705,9 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		}
 	}
 
-	/* no conflicts - add it to the list of locks */
+	/* no conflicts - add it to the list of locks, sorted by start */
+	i = brl_upper_bound(br_lck, plock->start);
+
 	locks = talloc_realloc(br_lck, locks, struct lock_struct,
 			       (br_lck->num_locks + 1));
 	if (!locks) {
@@ -487,10 +715,13 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		goto fail;
 	}
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
+	memmove(&locks[i+1], &locks[i],
+		(br_lck->num_locks - i) * sizeof(struct lock_struct));
+	memcpy(&locks[i], plock, sizeof(struct lock_struct));
 	br_lck->num_locks += 1;
 	br_lck->lock_data = locks;
 	br_lck->modified = True;
+	brl_index_invalidate(br_lck);
 
 	return NT_STATUS_OK;
  fail:
@@ -893,21 +1124,18 @@ static NTSTATUS brl_lock_posix(struct messaging_context *msg_ctx,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
-
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
+	/*
+	 * Add the lock, splits may have moved existing ranges. Keep
+	 * the lock array sorted by lock start.
+	 */
+	memcpy(&tp[count], plock, sizeof(struct lock_struct));
+	count++;
 
-	if (i < count) {
-		memmove(&tp[i+1], &tp[i],
-			(count - i)*sizeof(struct lock_struct));
+	if (!brl_sort_locks(tp, count)) {
+		TALLOC_FREE(tp);
+		status = NT_STATUS_NO_MEMORY;
+		goto fail;
 	}
-	memcpy(&tp[i], plock, sizeof(struct lock_struct));
-	count++;
 
 	/* We can get the POSIX lock, now see if it needs to
 	   be mapped into a lower level POSIX one, and if so can
@@ -957,6 +1185,7 @@ static NTSTATUS brl_lock_posix(struct messaging_context *msg_ctx,
 	br_lck->lock_data = tp;
 	locks = tp;
 	br_lck->modified = True;
+	brl_index_invalidate(br_lck);
 
 	/* A successful downgrade from write to read lock can trigger a lock
 	   re-evalutation where waiting readers can now proceed. */
@@ -1061,15 +1290,18 @@ NTSTATUS brl_lock(struct messaging_context *msg_ctx,
 	return ret;
 }
 
-static void brl_delete_lock_struct(struct lock_struct *locks,
-				   unsigned num_locks,
+static void brl_delete_lock_struct(struct byte_range_lock *br_lck,
 				   unsigned del_idx)
 {
-	if (del_idx >= num_locks) {
+	struct lock_struct *locks = br_lck->lock_data;
+
+	if (del_idx >= br_lck->num_locks) {
 		return;
 	}
 	memmove(&locks[del_idx], &locks[del_idx+1],
-		sizeof(*locks) * (num_locks - del_idx - 1));
+		sizeof(*locks) * (br_lck->num_locks - del_idx - 1));
+	br_lck->num_locks -= 1;
+	brl_index_invalidate(br_lck);
 }
 
 /****************************************************************************
@@ -1112,9 +1344,17 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
 	}
 #endif
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	for (i = brl_lower_bound(br_lck, plock->start);
+	     i < br_lck->num_locks;
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
+		if (lock->start != plock->start) {
+			/* Sorted by start, no match */
+			i = br_lck->num_locks;
+			break;
+		}
+
 		if (IS_PENDING_LOCK(lock->lock_type)) {
 			continue;
 		}
@@ -1139,8 +1379,7 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
   unlock_continue:
 #endif
 
-	brl_delete_lock_struct(locks, br_lck->num_locks, i);
-	br_lck->num_locks -= 1;
+	brl_delete_lock_struct(br_lck, i);
 	br_lck->modified = True;
 
 	/* Unlock the underlying POSIX regions. */
@@ -1155,7 +1394,9 @@ bool brl_unlock_windows_default(struct messaging_context *msg_ctx,
 	}
 
 	/* Send unlock messages to any pending waiters that overlap. */
-	for (j=0; j < br_lck->num_locks; j++) {
+	for (j = brl_next_overlap(br_lck, plock, 0);
+	     j < br_lck->num_locks;
+	     j = brl_next_overlap(br_lck, plock, j+1)) {
 		struct lock_struct *pend_lock = &locks[j];
 
 		/* Ignore non-pending locks. */
@@ -1282,6 +1523,12 @@ static bool brl_unlock_posix(struct messaging_context *msg_ctx,
 		return True;
 	}
 
+	/* A split may have moved the remainder of a range. */
+	if (!brl_sort_locks(tp, count)) {
+		TALLOC_FREE(tp);
+		return False;
+	}
+
 	/* Unlock any POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
 		release_posix_lock_posix_flavour(br_lck->fsp,
@@ -1313,6 +1560,7 @@ static bool brl_unlock_posix(struct messaging_context *msg_ctx,
 	locks = tp;
 	br_lck->lock_data = tp;
 	br_lck->modified = True;
+	brl_index_invalidate(br_lck);
 
 	/* Send unlock messages to any pending waiters that overlap. */
 
@@ -1396,7 +1644,9 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 	files_struct *fsp = br_lck->fsp;
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i = brl_next_overlap(br_lck, rw_probe, 0);
+	     i < br_lck->num_locks;
+	     i = brl_next_overlap(br_lck, rw_probe, i+1)) {
 		/*
 		 * Our own locks don't conflict.
 		 */
@@ -1474,7 +1724,9 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_flav = lock_flav;
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i = brl_next_overlap(br_lck, &lock, 0);
+	     i < br_lck->num_locks;
+	     i = brl_next_overlap(br_lck, &lock, i+1)) {
 		const struct lock_struct *exlock = &locks[i];
 		bool conflict = False;
 
@@ -1565,9 +1817,17 @@ bool brl_lock_cancel_default(struct byte_range_lock *br_lck,
 
 	SMB_ASSERT(plock);
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	for (i = brl_lower_bound(br_lck, plock->start);
+	     i < br_lck->num_locks;
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
+		if (lock->start != plock->start) {
+			/* Sorted by start, no match */
+			i = br_lck->num_locks;
+			break;
+		}
+
 		/* For pending locks we *always* care about the fnum. */
 		if (brl_same_context(&lock->context, &plock->context) &&
 				lock->fnum == plock->fnum &&
@@ -1584,8 +1844,7 @@ bool brl_lock_cancel_default(struct byte_range_lock *br_lck,
 		return False;
 	}
 
-	brl_delete_lock_struct(locks, br_lck->num_locks, i);
-	br_lck->num_locks -= 1;
+	brl_delete_lock_struct(br_lck, i);
 	br_lck->modified = True;
 	return True;
 }
@@ -1868,7 +2127,7 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 
 static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 {
-	unsigned i;
+	unsigned i, num_locks;
 	struct lock_struct *locks = br_lck->lock_data;
 
 	if (!br_lck->modified) {
@@ -1876,19 +2135,25 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		goto done;
 	}
 
-	i = 0;
+	num_locks = 0;
 
-	while (i < br_lck->num_locks) {
+	for (i = 0; i < br_lck->num_locks; i++) {
 		if (locks[i].context.pid.pid == 0) {
 			/*
 			 * Autocleanup, the process conflicted and does not
 			 * exist anymore.
 			 */
-			locks[i] = locks[br_lck->num_locks-1];
-			br_lck->num_locks -= 1;
-		} else {
-			i += 1;
+			continue;
+		}
+		/* Keep the order, lock_data is sorted by start */
+		if (num_locks != i) {
+			locks[num_locks] = locks[i];
 		}
+		num_locks += 1;
+	}
+	if (num_locks != br_lck->num_locks) {
+		br_lck->num_locks = num_locks;
+		brl_index_invalidate(br_lck);
 	}
 
 	if ((br_lck->num_locks == 0) && (br_lck->num_read_oplocks == 0)) {
@@ -1959,6 +2224,16 @@ static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 	}
 	memcpy(&br_lck->num_read_oplocks, data.dptr + data_len,
 	       sizeof(br_lck->num_read_oplocks));
+
+	/*
+	 * Records written by older versions are not sorted by
+	 * start. The order is only kept in memory, the record does
+	 * not change.
+	 */
+	if (!brl_sort_locks(br_lck->lock_data, br_lck->num_locks)) {
+		DEBUG(1, ("brl_sort_locks failed\n"));
+		return false;
+	}
 	return true;
 }
 
@@ -2080,9 +2355,7 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 			return NULL;
 		}
 
-		br_lock->num_read_oplocks = 0;
-		br_lock->num_locks = 0;
-		br_lock->lock_data = NULL;
+		*br_lock = (struct byte_range_lock) { 0 };
 
 	} else if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(3, ("Could not parse byte range lock record: "
@@ -77,7 +77,7 @@ static bool locking_init_internal(bool read_only)
 
 	backend = db_open(NULL, db_path,
 			  SMB_OPEN_DATABASE_TDB_HASH_SIZE,
-			  TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH,
+			  TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|TDB_WYHASH,
 			  read_only?O_RDONLY:O_RDWR|O_CREAT, 0644,
 			  DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 	TALLOC_FREE(db_path);
@@ -210,7 +210,8 @@ static int share_mode_data_nofree_destructor(struct share_mode_data *d)
 
 static struct share_mode_data *share_mode_memcache_fetch(TALLOC_CTX *mem_ctx,
 					const TDB_DATA id_key,
-					DATA_BLOB *blob)
+					DATA_BLOB *blob,
+					struct share_mode_stored_entries **pprev)
 {
 	enum ndr_err_code ndr_err;
 	struct share_mode_data *d;
@@ -255,7 +256,11 @@ static struct share_mode_data *share_mode_memcache_fetch(TALLOC_CTX *mem_ctx,
 			(unsigned long long)d->sequence_number,
 			(unsigned long long)sequence_number,
 			file_id_string(mem_ctx, &id)));
-		/* Cache out of date. Remove entry. */
+		/*
+		 * Cache out of date. Keep the entries we know, most of
+		 * them will still be the same. Remove entry.
+		 */
+		*pprev = talloc_move(mem_ctx, &d->stored);
 		memcache_delete(NULL,
 			SHARE_MODE_LOCK_CACHE,
 			key);
@@ -287,41 +292,161 @@ static struct share_mode_data *share_mode_memcache_fetch(TALLOC_CTX *mem_ctx,
 	return d;
 }
 
-/*******************************************************************
- Get all share mode entries for a dev/inode pair.
-********************************************************************/
+/*
+ * The share mode entries are not part of the NDR-encoded
+ * share_mode_data in the database. A locking.tdb record is the
+ * share_mode_data with num_share_modes == 0, followed by one
+ * fixed-size slot per share_mode_entry. Each slot is NDR-encoded on
+ * its own, so adding, removing or changing one entry does not
+ * require decoding and encoding all the others.
+ *
+ * share_mode_stored_entries remembers the slots as they are in the
+ * database. unparse_share_modes() only encodes entries that changed
+ * since, parse_share_modes() only decodes slots that changed since
+ * this process last looked at the record.
+ */
 
-static struct share_mode_data *parse_share_modes(TALLOC_CTX *mem_ctx,
-						const TDB_DATA key,
-						const TDB_DATA dbuf)
+struct share_mode_stored_entries {
+	uint32_t num_entries;
+	struct share_mode_entry *entries;
+	uint8_t *slots;
+};
+
+static size_t share_mode_entry_slot_size(void)
 {
-	struct share_mode_data *d;
-	enum ndr_err_code ndr_err;
-	uint32_t i;
-	DATA_BLOB blob;
+	static size_t slot_size;
 
-	blob.data = dbuf.dptr;
-	blob.length = dbuf.dsize;
+	if (slot_size == 0) {
+		struct share_mode_entry e;
+		enum ndr_err_code ndr_err;
+		DATA_BLOB blob;
 
-	/* See if we already have a cached copy of this key. */
-	d = share_mode_memcache_fetch(mem_ctx, key, &blob);
-	if (d != NULL) {
-		return d;
+		ZERO_STRUCT(e);
+
+		ndr_err = ndr_push_struct_blob(
+			&blob, talloc_tos(), &e,
+			(ndr_push_flags_fn_t)ndr_push_share_mode_entry);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			smb_panic("ndr_push_share_mode_entry failed");
+		}
+		slot_size = blob.length;
+		TALLOC_FREE(blob.data);
 	}
 
+	return slot_size;
+}
+
+static bool share_mode_entry_pull_slot(const uint8_t *slot,
+				       size_t slot_size,
+				       struct share_mode_entry *e)
+{
+	struct ndr_pull ndr = {
+		.data = discard_const_p(uint8_t, slot),
+		.data_size = slot_size,
+	};
+	enum ndr_err_code ndr_err;
+
+	ndr_err = ndr_pull_share_mode_entry(&ndr, NDR_SCALARS|NDR_BUFFERS, e);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_WARNING("ndr_pull_share_mode_entry failed: %s\n",
+			    ndr_errstr(ndr_err));
+		return false;
+	}
+	return (ndr.offset == slot_size);
+}
+
+/*
+ * Decode a locking.tdb record. Slots identical to the ones in "prev"
+ * are not decoded again but copied from prev.
+ */
+
+static struct share_mode_data *share_mode_data_pull(
+	TALLOC_CTX *mem_ctx, const DATA_BLOB *blob,
+	const struct share_mode_stored_entries *prev)
+{
+	size_t slot_size = share_mode_entry_slot_size();
+	struct share_mode_stored_entries *stored;
+	struct share_mode_data *d;
+	struct ndr_pull *ndr;
+	enum ndr_err_code ndr_err;
+	const uint8_t *slots;
+	size_t slots_len;
+	uint32_t i, num_slots;
+
 	d = talloc(mem_ctx, struct share_mode_data);
 	if (d == NULL) {
 		DEBUG(0, ("talloc failed\n"));
 		goto fail;
 	}
 
-	ndr_err = ndr_pull_struct_blob_all(
-		&blob, d, d, (ndr_pull_flags_fn_t)ndr_pull_share_mode_data);
+	ndr = ndr_pull_init_blob(blob, d);
+	if (ndr == NULL) {
+		DEBUG(0, ("talloc failed\n"));
+		goto fail;
+	}
+	ndr_err = ndr_pull_share_mode_data(ndr, NDR_SCALARS|NDR_BUFFERS, d);
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
 		DEBUG(1, ("ndr_pull_share_mode_lock failed: %s\n",
 			  ndr_errstr(ndr_err)));
 		goto fail;
 	}
+	slots = blob->data + ndr->offset;
+	slots_len = blob->length - ndr->offset;
+	TALLOC_FREE(ndr);
+
+	if ((slots_len % slot_size) != 0) {
+		DBG_WARNING("Invalid slot area length %zu\n", slots_len);
+		goto fail;
+	}
+	num_slots = slots_len / slot_size;
+
+	d->stored = talloc_zero(d, struct share_mode_stored_entries);
+	if (d->stored == NULL) {
+		DEBUG(0, ("talloc failed\n"));
+		goto fail;
+	}
+	stored = d->stored;
+
+	if (num_slots != 0) {
+		if (d->num_share_modes != 0) {
+			DBG_WARNING("Entries both in share_mode_data and "
+				    "in %"PRIu32" slots\n", num_slots);
+			goto fail;
+		}
+
+		stored->slots = talloc_memdup(stored, slots, slots_len);
+		if (stored->slots == NULL) {
+			DEBUG(0, ("talloc failed\n"));
+			goto fail;
+		}
+
+		TALLOC_FREE(d->share_modes);
+		d->share_modes = talloc_array(d, struct share_mode_entry,
+					      num_slots);
+		if (d->share_modes == NULL) {
+			DEBUG(0, ("talloc failed\n"));
+			goto fail;
+		}
+		d->num_share_modes = num_slots;
+
+		for (i=0; i<num_slots; i++) {
+			const uint8_t *slot = stored->slots + i * slot_size;
+			bool ok;
+
+			if ((prev != NULL) && (i < prev->num_entries) &&
+			    (memcmp(slot, prev->slots + i * slot_size,
+				    slot_size) == 0)) {
+				d->share_modes[i] = prev->entries[i];
+				continue;
+			}
+
+			ok = share_mode_entry_pull_slot(
+				slot, slot_size, &d->share_modes[i]);
+			if (!ok) {
+				goto fail;
+			}
+		}
+	}
 
 	/*
 	 * Initialize the values that are [skip] or [ignore]
@@ -344,9 +469,20 @@ static struct share_mode_data *parse_share_modes(TALLOC_CTX *mem_ctx,
 	d->modified = false;
 	d->fresh = false;
 
-	if (DEBUGLEVEL >= 10) {
-		DEBUG(10, ("parse_share_modes:\n"));
-		NDR_PRINT_DEBUG(share_mode_data, d);
+	/*
+	 * A record written with the entries inside share_mode_data
+	 * has no slots yet, the first store will encode all
+	 * entries.
+	 */
+	if (num_slots != 0) {
+		stored->entries = talloc_memdup(
+			stored, d->share_modes,
+			sizeof(struct share_mode_entry) * num_slots);
+		if (stored->entries == NULL) {
+			DEBUG(0, ("talloc failed\n"));
+			goto fail;
+		}
+		stored->num_entries = num_slots;
 	}
 
 	return d;
@@ -355,12 +491,54 @@ fail:
 	return NULL;
 }
 
+/*******************************************************************
+ Get all share mode entries for a dev/inode pair.
+********************************************************************/
+
+static struct share_mode_data *parse_share_modes(TALLOC_CTX *mem_ctx,
+						const TDB_DATA key,
+						const TDB_DATA dbuf)
+{
+	struct share_mode_stored_entries *prev = NULL;
+	struct share_mode_data *d;
+	DATA_BLOB blob;
+
+	blob.data = dbuf.dptr;
+	blob.length = dbuf.dsize;
+
+	/* See if we already have a cached copy of this key. */
+	d = share_mode_memcache_fetch(mem_ctx, key, &blob, &prev);
+	if (d != NULL) {
+		return d;
+	}
+
+	d = share_mode_data_pull(mem_ctx, &blob, prev);
+	TALLOC_FREE(prev);
+	if (d == NULL) {
+		return NULL;
+	}
+
+	if (DEBUGLEVEL >= 10) {
+		DEBUG(10, ("parse_share_modes:\n"));
+		NDR_PRINT_DEBUG(share_mode_data, d);
+	}
+
+	return d;
+}
+
 /*******************************************************************
  Create a storable data blob from a modified share_mode_data struct.
+ The returned blob only holds the share_mode_data, the entries are
+ in d->stored->slots.
 ********************************************************************/
 
 static TDB_DATA unparse_share_modes(struct share_mode_data *d)
 {
+	size_t slot_size = share_mode_entry_slot_size();
+	const struct share_mode_stored_entries *prev = d->stored;
+	struct share_mode_stored_entries *stored;
+	struct share_mode_entry *share_modes;
+	uint32_t i, num_share_modes;
 	DATA_BLOB blob;
 	enum ndr_err_code ndr_err;
 
@@ -381,8 +559,60 @@ static TDB_DATA unparse_share_modes(struct share_mode_data *d)
 		return make_tdb_data(NULL, 0);
 	}
 
+	stored = talloc_zero(d, struct share_mode_stored_entries);
+	if (stored == NULL) {
+		smb_panic("talloc failed");
+	}
+	stored->num_entries = d->num_share_modes;
+	stored->slots = talloc_array(stored, uint8_t,
+				     slot_size * stored->num_entries);
+	stored->entries = talloc_memdup(
+		stored, d->share_modes,
+		sizeof(struct share_mode_entry) * stored->num_entries);
+	if ((stored->slots == NULL) || (stored->entries == NULL)) {
+		smb_panic("talloc failed");
+	}
+
+	for (i=0; i<stored->num_entries; i++) {
+		const struct share_mode_entry *e = &d->share_modes[i];
+		DATA_BLOB slot = {
+			.data = stored->slots + i * slot_size,
+			.length = slot_size,
+		};
+
+		if ((prev != NULL) && (i < prev->num_entries) &&
+		    (memcmp(e, &prev->entries[i], sizeof(*e)) == 0)) {
+			memcpy(slot.data, prev->slots + i * slot_size,
+			       slot_size);
+			continue;
+		}
+
+		ndr_err = ndr_push_struct_into_fixed_blob(
+			&slot, e,
+			(ndr_push_flags_fn_t)ndr_push_share_mode_entry);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			smb_panic("ndr_push_share_mode_entry failed");
+		}
+	}
+
+	TALLOC_FREE(d->stored);
+	d->stored = stored;
+
+	/*
+	 * Push share_mode_data without the entries, they follow in
+	 * the slots.
+	 */
+	num_share_modes = d->num_share_modes;
+	share_modes = d->share_modes;
+	d->num_share_modes = 0;
+	d->share_modes = NULL;
+
 	ndr_err = ndr_push_struct_blob(
 		&blob, d, d, (ndr_push_flags_fn_t)ndr_push_share_mode_data);
+
+	d->num_share_modes = num_share_modes;
+	d->share_modes = share_modes;
+
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
 		smb_panic("ndr_push_share_mode_lock failed");
 	}
@@ -397,6 +627,7 @@ static TDB_DATA unparse_share_modes(struct share_mode_data *d)
 static int share_mode_data_destructor(struct share_mode_data *d)
 {
 	NTSTATUS status;
+	TDB_DATA dbufs[2];
 	TDB_DATA data;
 
 	if (!d->modified) {
@@ -432,7 +663,13 @@ static int share_mode_data_destructor(struct share_mode_data *d)
 		return 0;
 	}
 
-	status = dbwrap_record_store(d->record, data, TDB_REPLACE);
+	dbufs[0] = data;
+	dbufs[1] = make_tdb_data(
+		d->stored->slots,
+		share_mode_entry_slot_size() * d->stored->num_entries);
+
+	status = dbwrap_record_storev(d->record, dbufs, ARRAY_SIZE(dbufs),
+				      TDB_REPLACE);
 	if (!NT_STATUS_IS_OK(status)) {
 		char *errmsg;
 
@@ -802,11 +1039,9 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 {
 	struct share_mode_forall_state *state =
 		(struct share_mode_forall_state *)_state;
-	uint32_t i;
 	TDB_DATA key;
 	TDB_DATA value;
 	DATA_BLOB blob;
-	enum ndr_err_code ndr_err;
 	struct share_mode_data *d;
 	struct file_id fid;
 	int ret;
@@ -820,27 +1055,14 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 	}
 	memcpy(&fid, key.dptr, sizeof(fid));
 
-	d = talloc(talloc_tos(), struct share_mode_data);
-	if (d == NULL) {
-		return 0;
-	}
-
 	blob.data = value.dptr;
 	blob.length = value.dsize;
 
-	ndr_err = ndr_pull_struct_blob_all(
-		&blob, d, d, (ndr_pull_flags_fn_t)ndr_pull_share_mode_data);
-	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-		DEBUG(1, ("ndr_pull_share_mode_lock failed\n"));
+	d = share_mode_data_pull(talloc_tos(), &blob, NULL);
+	if (d == NULL) {
 		return 0;
 	}
 
-	for (i=0; i<d->num_share_modes; i++) {
-		struct share_mode_entry *entry = &d->share_modes[i];
-		entry->stale = false; /* [skip] in idl */
-		entry->lease = &d->leases[entry->lease_idx];
-	}
-
 	if (DEBUGLEVEL > 10) {
 		DEBUG(11, ("parse_share_modes:\n"));
 		NDR_PRINT_DEBUG(share_mode_data, d);
@@ -852,6 +1074,15 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 	return ret;
 }
 
+NTSTATUS share_mode_compact_step(unsigned max_records, int *moved)
+{
+	if (lock_db == NULL) {
+		*moved = 0;
+		return NT_STATUS_OK;
+	}
+	return dbwrap_compact_step(lock_db, max_records, moved);
+}
+
 int share_mode_forall(int (*fn)(struct file_id fid,
 				const struct share_mode_data *data,
 				void *private_data),
@@ -0,0 +1,879 @@
+/*
+ * Use the Linux io_uring interface for async pread, pwrite and fsync.
+ *
+ * Copyright (C) Samba Team 2018
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * All async I/O of an smbd process is funneled through a single
+ * io_uring instance. Submission queue entries prepared while
+ * processing one round of the tevent loop are handed to the kernel
+ * with a single io_uring_enter() from a tevent immediate, and all
+ * completions are reaped in one go when the ring fd becomes readable.
+ *
+ * If the kernel does not support io_uring or the ring is full, the
+ * requests are passed down to the next module, which normally is
+ * vfs_default with its pthreadpool based implementation.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "smbprofile.h"
+#include "lib/util/tevent_unix.h"
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_VFS
+
+#define VFS_IO_URING_DEFAULT_ENTRIES 128
+
+struct vfs_io_uring_ring;
+
+struct vfs_io_uring_request {
+	struct vfs_io_uring_request *prev, *next;
+	struct vfs_io_uring_ring *ring;
+	struct tevent_req *req;
+	struct io_uring_sqe sqe;
+	struct iovec iov;
+	struct timespec start_time;
+	void (*completion_fn)(struct vfs_io_uring_request *cur,
+			      int32_t res);
+	bool queued;
+	bool in_flight;
+};
+
+struct vfs_io_uring_ring {
+	pid_t pid;
+	int fd;
+	struct tevent_context *ev;
+	struct tevent_fd *fde;
+	struct tevent_immediate *submit_im;
+	bool submit_scheduled;
+
+	unsigned entries;
+	unsigned in_flight;
+
+	void *sq_ring;
+	size_t sq_ring_len;
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	unsigned *sq_kring_mask;
+	unsigned *sq_karray;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+
+	void *cq_ring;
+	size_t cq_ring_len;
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	unsigned *cq_kring_mask;
+	struct io_uring_cqe *cqes;
+
+	/*
+	 * Requests waiting for a free submission queue slot.
+	 */
+	struct vfs_io_uring_request *queue;
+};
+
+/*
+ * There's one ring per smbd process, shared by all tree connects.
+ */
+static struct vfs_io_uring_ring *vfs_io_uring_ring;
+static bool vfs_io_uring_unsupported;
+
+static int vfs_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int vfs_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int vfs_io_uring_ring_destructor(struct vfs_io_uring_ring *ring)
+{
+	if (vfs_io_uring_ring == ring) {
+		vfs_io_uring_ring = NULL;
+	}
+
+	TALLOC_FREE(ring->fde);
+
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_len);
+		ring->sqes = NULL;
+	}
+	if (ring->cq_ring != NULL) {
+		munmap(ring->cq_ring, ring->cq_ring_len);
+		ring->cq_ring = NULL;
+	}
+	if (ring->sq_ring != NULL) {
+		munmap(ring->sq_ring, ring->sq_ring_len);
+		ring->sq_ring = NULL;
+	}
+	if (ring->fd != -1) {
+		close(ring->fd);
+		ring->fd = -1;
+	}
+
+	return 0;
+}
+
+static void vfs_io_uring_fd_handler(struct tevent_context *ev,
+				    struct tevent_fd *fde,
+				    uint16_t flags,
+				    void *private_data);
+
+static struct vfs_io_uring_ring *vfs_io_uring_ring_create(
+	TALLOC_CTX *mem_ctx, struct tevent_context *ev, unsigned entries)
+{
+	struct vfs_io_uring_ring *ring = NULL;
+	struct io_uring_params p;
+	uint8_t *ptr = NULL;
+	int err;
+
+	ring = talloc_zero(mem_ctx, struct vfs_io_uring_ring);
+	if (ring == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	ring->fd = -1;
+	talloc_set_destructor(ring, vfs_io_uring_ring_destructor);
+
+	ZERO_STRUCT(p);
+
+	ring->fd = vfs_io_uring_setup(entries, &p);
+	if (ring->fd == -1) {
+		err = errno;
+		DBG_NOTICE("io_uring_setup(%u) failed: %s\n",
+			   entries, strerror(err));
+		goto fail;
+	}
+
+	ring->pid = getpid();
+	ring->ev = ev;
+	ring->entries = p.sq_entries;
+
+	ring->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ptr = mmap(NULL, ring->sq_ring_len, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED) {
+		err = errno;
+		DBG_ERR("mmap of sq ring failed: %s\n", strerror(err));
+		goto fail;
+	}
+	ring->sq_ring = ptr;
+	ring->sq_khead = (unsigned *)(ptr + p.sq_off.head);
+	ring->sq_ktail = (unsigned *)(ptr + p.sq_off.tail);
+	ring->sq_kring_mask = (unsigned *)(ptr + p.sq_off.ring_mask);
+	ring->sq_karray = (unsigned *)(ptr + p.sq_off.array);
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ring->sqes_len, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED) {
+		err = errno;
+		DBG_ERR("mmap of sqes failed: %s\n", strerror(err));
+		goto fail;
+	}
+	ring->sqes = (struct io_uring_sqe *)ptr;
+
+	ring->cq_ring_len = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, ring->cq_ring_len, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED) {
+		err = errno;
+		DBG_ERR("mmap of cq ring failed: %s\n", strerror(err));
+		goto fail;
+	}
+	ring->cq_ring = ptr;
+	ring->cq_khead = (unsigned *)(ptr + p.cq_off.head);
+	ring->cq_ktail = (unsigned *)(ptr + p.cq_off.tail);
+	ring->cq_kring_mask = (unsigned *)(ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(ptr + p.cq_off.cqes);
+
+	ring->submit_im = tevent_create_immediate(ring);
+	if (ring->submit_im == NULL) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	/*
+	 * The ring fd becomes readable as soon as there are
+	 * completion queue entries to reap.
+	 */
+	ring->fde = tevent_add_fd(ev, ring, ring->fd, TEVENT_FD_READ,
+				  vfs_io_uring_fd_handler, ring);
+	if (ring->fde == NULL) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	DBG_INFO("initialized io_uring with %u entries\n", ring->entries);
+
+	return ring;
+
+fail:
+	TALLOC_FREE(ring);
+	errno = err;
+	return NULL;
+}
+
+static struct vfs_io_uring_ring *vfs_io_uring_get_ring(
+	struct vfs_handle_struct *handle, struct tevent_context *ev)
+{
+	struct vfs_io_uring_ring *ring = vfs_io_uring_ring;
+	int entries;
+
+	if (ring != NULL && ring->pid != getpid()) {
+		/*
+		 * Inherited from our parent via fork(), the child
+		 * needs its own ring.
+		 */
+		TALLOC_FREE(ring);
+		vfs_io_uring_ring = NULL;
+	}
+
+	if (ring != NULL) {
+		if (ring->ev != ev) {
+			/*
+			 * Completions are delivered via the ring's
+			 * tevent context only.
+			 */
+			return NULL;
+		}
+		return ring;
+	}
+
+	if (vfs_io_uring_unsupported) {
+		return NULL;
+	}
+
+	entries = lp_parm_int(SNUM(handle->conn), "io_uring", "num_entries",
+			      VFS_IO_URING_DEFAULT_ENTRIES);
+	if (entries <= 0) {
+		entries = VFS_IO_URING_DEFAULT_ENTRIES;
+	}
+
+	ring = vfs_io_uring_ring_create(handle->conn->sconn, ev, entries);
+	if (ring == NULL) {
+		/*
+		 * Don't retry for every request, from now on this
+		 * process uses the next module's implementation.
+		 */
+		DBG_NOTICE("io_uring not available (%s), "
+			   "falling back to the next module\n",
+			   strerror(errno));
+		vfs_io_uring_unsupported = true;
+		return NULL;
+	}
+
+	vfs_io_uring_ring = ring;
+	return ring;
+}
+
+/*
+ * Move as many queued requests as fit into the submission queue.
+ */
+static unsigned vfs_io_uring_fill_sq(struct vfs_io_uring_ring *ring)
+{
+	unsigned mask = *ring->sq_kring_mask;
+	unsigned head = __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+	unsigned tail = *ring->sq_ktail;
+	unsigned filled = 0;
+
+	while (ring->queue != NULL) {
+		struct vfs_io_uring_request *cur = ring->queue;
+		unsigned idx;
+
+		if (tail - head >= ring->entries) {
+			break;
+		}
+
+		idx = tail & mask;
+		ring->sqes[idx] = cur->sqe;
+		ring->sq_karray[idx] = idx;
+		tail += 1;
+		filled += 1;
+
+		DLIST_REMOVE(ring->queue, cur);
+		cur->queued = false;
+		cur->in_flight = true;
+	}
+
+	if (filled != 0) {
+		__atomic_store_n(ring->sq_ktail, tail, __ATOMIC_RELEASE);
+	}
+
+	return tail - head;
+}
+
+static void vfs_io_uring_submit(struct vfs_io_uring_ring *ring)
+{
+	unsigned to_submit;
+	int ret;
+
+	to_submit = vfs_io_uring_fill_sq(ring);
+	if (to_submit == 0) {
+		return;
+	}
+
+	ret = vfs_io_uring_enter(ring->fd, to_submit, 0, 0);
+	if (ret == -1) {
+		/*
+		 * EAGAIN/EBUSY: The kernel is short of resources or the
+		 * completion queue needs to be drained first. The
+		 * entries stay in the submission queue and will be
+		 * picked up with the next io_uring_enter().
+		 */
+		DBG_DEBUG("io_uring_enter failed: %s\n", strerror(errno));
+	}
+}
+
+static void vfs_io_uring_submit_im_handler(struct tevent_context *ev,
+					   struct tevent_immediate *im,
+					   void *private_data)
+{
+	struct vfs_io_uring_ring *ring = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_ring);
+
+	ring->submit_scheduled = false;
+	vfs_io_uring_submit(ring);
+}
+
+static void vfs_io_uring_schedule_submit(struct vfs_io_uring_ring *ring)
+{
+	if (ring->submit_scheduled) {
+		return;
+	}
+	tevent_schedule_immediate(ring->submit_im, ring->ev,
+				  vfs_io_uring_submit_im_handler, ring);
+	ring->submit_scheduled = true;
+}
+
+static void vfs_io_uring_fd_handler(struct tevent_context *ev,
+				    struct tevent_fd *fde,
+				    uint16_t flags,
+				    void *private_data)
+{
+	struct vfs_io_uring_ring *ring = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_ring);
+	unsigned mask = *ring->cq_kring_mask;
+	unsigned head = *ring->cq_khead;
+	unsigned tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & mask];
+		struct vfs_io_uring_request *cur =
+			(struct vfs_io_uring_request *)(uintptr_t)
+			cqe->user_data;
+		int32_t res = cqe->res;
+
+		head += 1;
+		__atomic_store_n(ring->cq_khead, head, __ATOMIC_RELEASE);
+
+		ring->in_flight -= 1;
+		cur->in_flight = false;
+
+		if (res == -EINTR || res == -EAGAIN) {
+			/*
+			 * Just retry, the completion queue slot is
+			 * already released.
+			 */
+			ring->in_flight += 1;
+			DLIST_ADD_END(ring->queue, cur);
+			cur->queued = true;
+			continue;
+		}
+
+		cur->completion_fn(cur, res);
+
+		tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+	}
+
+	if (ring->queue != NULL) {
+		vfs_io_uring_submit(ring);
+	}
+}
+
+/*
+ * Check whether the ring can take another request. We never have
+ * more requests in flight than there are submission queue entries,
+ * so the completion queue (twice that size) can't overflow.
+ */
+static bool vfs_io_uring_ring_full(struct vfs_io_uring_ring *ring)
+{
+	return (ring->in_flight >= ring->entries);
+}
+
+/*
+ * Queue a request for submission with the next io_uring_enter().
+ */
+static void vfs_io_uring_request_queue(struct vfs_io_uring_ring *ring,
+				       struct vfs_io_uring_request *cur)
+{
+	cur->ring = ring;
+	cur->sqe.user_data = (uint64_t)(uintptr_t)cur;
+	PROFILE_TIMESTAMP(&cur->start_time);
+
+	ring->in_flight += 1;
+	DLIST_ADD_END(ring->queue, cur);
+	cur->queued = true;
+
+	vfs_io_uring_schedule_submit(ring);
+}
+
+static int vfs_io_uring_request_destructor(
+	struct vfs_io_uring_request *cur)
+{
+	if (cur->in_flight) {
+		/*
+		 * The kernel still owns our buffer, we have to wait
+		 * for the completion just like vfs_default has to wait
+		 * for its worker thread.
+		 */
+		return -1;
+	}
+	if (cur->queued) {
+		DLIST_REMOVE(cur->ring->queue, cur);
+		cur->ring->in_flight -= 1;
+		cur->queued = false;
+	}
+	return 0;
+}
+
+static void vfs_io_uring_prep_rw(struct vfs_io_uring_request *cur,
+				 uint8_t opcode,
+				 int fd,
+				 void *buf,
+				 size_t n,
+				 off_t offset)
+{
+	cur->iov = (struct iovec) { .iov_base = buf, .iov_len = n };
+
+	ZERO_STRUCT(cur->sqe);
+	cur->sqe.opcode = opcode;
+	cur->sqe.fd = fd;
+	cur->sqe.off = offset;
+	cur->sqe.addr = (uint64_t)(uintptr_t)&cur->iov;
+	cur->sqe.len = 1;
+}
+
+/*
+ * Submit the rest of a short read or write again, like
+ * sys_pread_full() and sys_pwrite_full() do.
+ */
+static void vfs_io_uring_request_resubmit(struct vfs_io_uring_request *cur,
+					  size_t done)
+{
+	struct vfs_io_uring_ring *ring = cur->ring;
+
+	cur->iov.iov_base = (uint8_t *)cur->iov.iov_base + done;
+	cur->iov.iov_len -= done;
+	cur->sqe.off += done;
+
+	ring->in_flight += 1;
+	DLIST_ADD_END(ring->queue, cur);
+	cur->queued = true;
+
+	vfs_io_uring_schedule_submit(ring);
+}
+
+/*
+ * done is what earlier submissions of a short read or write
+ * transferred. An error after a partial transfer reports the
+ * partial transfer, like pread() and pwrite() do.
+ */
+static void vfs_io_uring_finish(struct vfs_io_uring_request *cur,
+				int32_t res,
+				size_t done,
+				ssize_t *ret,
+				struct vfs_aio_state *vfs_aio_state)
+{
+	struct timespec end_time;
+
+	PROFILE_TIMESTAMP(&end_time);
+	vfs_aio_state->duration = nsec_time_diff(&end_time,
+						 &cur->start_time);
+
+	if (res < 0 && done == 0) {
+		*ret = -1;
+		vfs_aio_state->error = -res;
+		return;
+	}
+
+	*ret = done + MAX(res, 0);
+}
+
+struct vfs_io_uring_pread_state {
+	struct vfs_io_uring_request ur;
+	size_t done;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+	SMBPROFILE_BYTES_ASYNC_STATE(profile_bytes);
+};
+
+static int vfs_io_uring_pread_state_destructor(
+	struct vfs_io_uring_pread_state *state)
+{
+	return vfs_io_uring_request_destructor(&state->ur);
+}
+
+static void vfs_io_uring_pread_completion(struct vfs_io_uring_request *cur,
+					  int32_t res);
+static void vfs_io_uring_pread_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_pread_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp,
+	void *data,
+	size_t n, off_t offset)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_pread_state *state = NULL;
+	struct vfs_io_uring_ring *ring = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_pread_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	ring = vfs_io_uring_get_ring(handle, ev);
+	if (ring == NULL || vfs_io_uring_ring_full(ring)) {
+		struct tevent_req *subreq = NULL;
+
+		subreq = SMB_VFS_NEXT_PREAD_SEND(state, ev, handle, fsp,
+						 data, n, offset);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, vfs_io_uring_pread_next_done,
+					req);
+		return req;
+	}
+
+	state->ret = -1;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_pread_completion;
+
+	vfs_io_uring_prep_rw(&state->ur, IORING_OP_READV, fsp->fh->fd,
+			     data, n, offset);
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_pread, profile_p,
+				     state->profile_bytes, n);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->profile_bytes);
+
+	vfs_io_uring_request_queue(ring, &state->ur);
+
+	talloc_set_destructor(state, vfs_io_uring_pread_state_destructor);
+
+	return req;
+}
+
+/*
+ * The next module did the work, only pass on its result.
+ */
+static void vfs_io_uring_pread_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_pread_state *state = tevent_req_data(
+		req, struct vfs_io_uring_pread_state);
+
+	state->ret = SMB_VFS_PREAD_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static void vfs_io_uring_pread_completion(struct vfs_io_uring_request *cur,
+					  int32_t res)
+{
+	struct tevent_req *req = cur->req;
+	struct vfs_io_uring_pread_state *state = tevent_req_data(
+		req, struct vfs_io_uring_pread_state);
+
+	if (res > 0 && (size_t)res < cur->iov.iov_len) {
+		state->done += res;
+		vfs_io_uring_request_resubmit(cur, res);
+		return;
+	}
+
+	vfs_io_uring_finish(cur, res, state->done, &state->ret,
+			    &state->vfs_aio_state);
+	SMBPROFILE_BYTES_ASYNC_END(state->profile_bytes);
+	tevent_req_done(req);
+}
+
+static ssize_t vfs_io_uring_pread_recv(struct tevent_req *req,
+				       struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfs_io_uring_pread_state *state = tevent_req_data(
+		req, struct vfs_io_uring_pread_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+struct vfs_io_uring_pwrite_state {
+	struct vfs_io_uring_request ur;
+	size_t done;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+	SMBPROFILE_BYTES_ASYNC_STATE(profile_bytes);
+};
+
+static int vfs_io_uring_pwrite_state_destructor(
+	struct vfs_io_uring_pwrite_state *state)
+{
+	return vfs_io_uring_request_destructor(&state->ur);
+}
+
+static void vfs_io_uring_pwrite_completion(struct vfs_io_uring_request *cur,
+					   int32_t res);
+static void vfs_io_uring_pwrite_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_pwrite_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp,
+	const void *data,
+	size_t n, off_t offset)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_pwrite_state *state = NULL;
+	struct vfs_io_uring_ring *ring = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_pwrite_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	ring = vfs_io_uring_get_ring(handle, ev);
+	if (ring == NULL || vfs_io_uring_ring_full(ring)) {
+		struct tevent_req *subreq = NULL;
+
+		subreq = SMB_VFS_NEXT_PWRITE_SEND(state, ev, handle, fsp,
+						  data, n, offset);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, vfs_io_uring_pwrite_next_done,
+					req);
+		return req;
+	}
+
+	state->ret = -1;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_pwrite_completion;
+
+	vfs_io_uring_prep_rw(&state->ur, IORING_OP_WRITEV, fsp->fh->fd,
+			     discard_const(data), n, offset);
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_pwrite, profile_p,
+				     state->profile_bytes, n);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->profile_bytes);
+
+	vfs_io_uring_request_queue(ring, &state->ur);
+
+	talloc_set_destructor(state, vfs_io_uring_pwrite_state_destructor);
+
+	return req;
+}
+
+/*
+ * The next module did the work, only pass on its result.
+ */
+static void vfs_io_uring_pwrite_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_pwrite_state *state = tevent_req_data(
+		req, struct vfs_io_uring_pwrite_state);
+
+	state->ret = SMB_VFS_PWRITE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static void vfs_io_uring_pwrite_completion(struct vfs_io_uring_request *cur,
+					   int32_t res)
+{
+	struct tevent_req *req = cur->req;
+	struct vfs_io_uring_pwrite_state *state = tevent_req_data(
+		req, struct vfs_io_uring_pwrite_state);
+
+	if (res > 0 && (size_t)res < cur->iov.iov_len) {
+		state->done += res;
+		vfs_io_uring_request_resubmit(cur, res);
+		return;
+	}
+
+	vfs_io_uring_finish(cur, res, state->done, &state->ret,
+			    &state->vfs_aio_state);
+	SMBPROFILE_BYTES_ASYNC_END(state->profile_bytes);
+	tevent_req_done(req);
+}
+
+static ssize_t vfs_io_uring_pwrite_recv(struct tevent_req *req,
+					struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfs_io_uring_pwrite_state *state = tevent_req_data(
+		req, struct vfs_io_uring_pwrite_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+struct vfs_io_uring_fsync_state {
+	struct vfs_io_uring_request ur;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+	SMBPROFILE_BASIC_ASYNC_STATE(profile_basic);
+};
+
+static int vfs_io_uring_fsync_state_destructor(
+	struct vfs_io_uring_fsync_state *state)
+{
+	return vfs_io_uring_request_destructor(&state->ur);
+}
+
+static void vfs_io_uring_fsync_completion(struct vfs_io_uring_request *cur,
+					  int32_t res);
+static void vfs_io_uring_fsync_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_fsync_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_fsync_state *state = NULL;
+	struct vfs_io_uring_ring *ring = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_fsync_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	ring = vfs_io_uring_get_ring(handle, ev);
+	if (ring == NULL || vfs_io_uring_ring_full(ring)) {
+		struct tevent_req *subreq = NULL;
+
+		subreq = SMB_VFS_NEXT_FSYNC_SEND(state, ev, handle, fsp);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, vfs_io_uring_fsync_next_done,
+					req);
+		return req;
+	}
+
+	state->ret = -1;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_fsync_completion;
+
+	ZERO_STRUCT(state->ur.sqe);
+	state->ur.sqe.opcode = IORING_OP_FSYNC;
+	state->ur.sqe.fd = fsp->fh->fd;
+
+	SMBPROFILE_BASIC_ASYNC_START(syscall_asys_fsync, profile_p,
+				     state->profile_basic);
+
+	vfs_io_uring_request_queue(ring, &state->ur);
+
+	talloc_set_destructor(state, vfs_io_uring_fsync_state_destructor);
+
+	return req;
+}
+
+/*
+ * The next module did the work, only pass on its result.
+ */
+static void vfs_io_uring_fsync_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_fsync_state *state = tevent_req_data(
+		req, struct vfs_io_uring_fsync_state);
+
+	state->ret = SMB_VFS_FSYNC_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static void vfs_io_uring_fsync_completion(struct vfs_io_uring_request *cur,
+					  int32_t res)
+{
+	struct tevent_req *req = cur->req;
+	struct vfs_io_uring_fsync_state *state = tevent_req_data(
+		req, struct vfs_io_uring_fsync_state);
+
+	vfs_io_uring_finish(cur, res, 0, &state->ret, &state->vfs_aio_state);
+	SMBPROFILE_BASIC_ASYNC_END(state->profile_basic);
+	tevent_req_done(req);
+}
+
+static int vfs_io_uring_fsync_recv(struct tevent_req *req,
+				   struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfs_io_uring_fsync_state *state = tevent_req_data(
+		req, struct vfs_io_uring_fsync_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static struct vfs_fn_pointers vfs_io_uring_fns = {
+	.pread_send_fn = vfs_io_uring_pread_send,
+	.pread_recv_fn = vfs_io_uring_pread_recv,
+	.pwrite_send_fn = vfs_io_uring_pwrite_send,
+	.pwrite_recv_fn = vfs_io_uring_pwrite_recv,
+	.fsync_send_fn = vfs_io_uring_fsync_send,
+	.fsync_recv_fn = vfs_io_uring_fsync_recv,
+};
+
+NTSTATUS vfs_io_uring_init(TALLOC_CTX *);
+NTSTATUS vfs_io_uring_init(TALLOC_CTX *ctx)
+{
+	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION,
+				"io_uring", &vfs_io_uring_fns);
+}
@@ -0,0 +1,412 @@
+/*
+ * Merge small adjacent async writes to a file into larger ones.
+ *
+ * Copyright (C) Samba Team 2018
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Only one small write per file is passed down to the next module at
+ * a time. Small writes arriving while that one is in progress are
+ * queued. When it is done, the longest run of adjacent queued writes
+ * is copied into one buffer and written with a single call, then the
+ * individual requests are completed with their part of the result.
+ *
+ * Nothing is delayed when a file gets no concurrent writes, and the
+ * requests are only completed after the data was written. Write
+ * through and oplock or lease breaks are handled by smbd before and
+ * after the write, so they are not affected.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "lib/util/tevent_unix.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_VFS
+
+struct write_coalesce_config {
+	size_t max_write_size;
+	size_t max_batch_size;
+};
+
+struct write_coalesce_pwrite_state;
+struct write_coalesce_batch;
+
+struct write_coalesce_fsp {
+	/*
+	 * Small writes waiting for the current batch, in the order
+	 * they arrived.
+	 */
+	struct write_coalesce_pwrite_state *queue;
+	struct write_coalesce_batch *batch;
+};
+
+struct write_coalesce_pwrite_state {
+	struct write_coalesce_pwrite_state *prev, *next;
+	struct tevent_req *req;
+	struct write_coalesce_fsp *wfsp;
+	struct write_coalesce_batch *batch;
+	const void *data;
+	size_t n;
+	off_t offset;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+struct write_coalesce_batch {
+	struct vfs_handle_struct *handle;
+	struct tevent_context *ev;
+	struct files_struct *fsp;
+	struct write_coalesce_fsp *wfsp;
+	struct write_coalesce_pwrite_state **writes;
+	size_t num_writes;
+	off_t offset;
+	size_t length;
+};
+
+static void write_coalesce_batch_start(struct vfs_handle_struct *handle,
+				       struct tevent_context *ev,
+				       struct files_struct *fsp,
+				       struct write_coalesce_fsp *wfsp);
+static void write_coalesce_pwrite_next_done(struct tevent_req *subreq);
+static void write_coalesce_batch_done(struct tevent_req *subreq);
+
+static int write_coalesce_pwrite_state_destructor(
+	struct write_coalesce_pwrite_state *state)
+{
+	struct write_coalesce_batch *batch = state->batch;
+	size_t i;
+
+	if (batch == NULL) {
+		DLIST_REMOVE(state->wfsp->queue, state);
+		return 0;
+	}
+
+	/*
+	 * The batch has its own copy of the data,
+	 * just don't report back to us.
+	 */
+	for (i = 0; i < batch->num_writes; i++) {
+		if (batch->writes[i] == state) {
+			batch->writes[i] = NULL;
+		}
+	}
+	return 0;
+}
+
+static struct tevent_req *write_coalesce_pwrite_send(
+	struct vfs_handle_struct *handle,
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct files_struct *fsp,
+	const void *data,
+	size_t n, off_t offset)
+{
+	struct write_coalesce_config *config = NULL;
+	struct write_coalesce_fsp *wfsp = NULL;
+	struct tevent_req *req = NULL;
+	struct write_coalesce_pwrite_state *state = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct write_coalesce_config,
+				return NULL);
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct write_coalesce_pwrite_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->req = req;
+	state->data = data;
+	state->n = n;
+	state->offset = offset;
+	state->ret = -1;
+
+	if ((n == 0) || (n > config->max_write_size)) {
+		struct tevent_req *subreq = NULL;
+
+		subreq = SMB_VFS_NEXT_PWRITE_SEND(state, ev, handle, fsp,
+						  data, n, offset);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, write_coalesce_pwrite_next_done,
+					req);
+		return req;
+	}
+
+	wfsp = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (wfsp == NULL) {
+		wfsp = VFS_ADD_FSP_EXTENSION(handle, fsp,
+					     struct write_coalesce_fsp, NULL);
+		if (tevent_req_nomem(wfsp, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+	state->wfsp = wfsp;
+
+	DLIST_ADD_END(wfsp->queue, state);
+	talloc_set_destructor(state, write_coalesce_pwrite_state_destructor);
+
+	if (wfsp->batch == NULL) {
+		write_coalesce_batch_start(handle, ev, fsp, wfsp);
+	}
+
+	return req;
+}
+
+/*
+ * Large writes are passed down unchanged.
+ */
+static void write_coalesce_pwrite_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct write_coalesce_pwrite_state *state = tevent_req_data(
+		req, struct write_coalesce_pwrite_state);
+
+	state->ret = SMB_VFS_PWRITE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+/*
+ * Collect the longest run of adjacent writes from the head of the
+ * queue and pass it down.
+ */
+static void write_coalesce_batch_start(struct vfs_handle_struct *handle,
+				       struct tevent_context *ev,
+				       struct files_struct *fsp,
+				       struct write_coalesce_fsp *wfsp)
+{
+	struct write_coalesce_config *config = NULL;
+	struct write_coalesce_batch *batch = NULL;
+	struct write_coalesce_pwrite_state *w = NULL;
+	struct write_coalesce_pwrite_state *next = NULL;
+	struct tevent_req *subreq = NULL;
+	uint8_t *buf = NULL;
+	size_t i;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct write_coalesce_config,
+				goto fail);
+
+	if (wfsp->queue == NULL) {
+		return;
+	}
+
+	/*
+	 * The batch must not go away with any of the requests, hang
+	 * it off the fsp. smbd doesn't close the file before all
+	 * writes are done.
+	 */
+	batch = talloc_zero(fsp, struct write_coalesce_batch);
+	if (batch == NULL) {
+		goto fail;
+	}
+	batch->handle = handle;
+	batch->ev = ev;
+	batch->fsp = fsp;
+	batch->wfsp = wfsp;
+	batch->offset = wfsp->queue->offset;
+
+	for (w = wfsp->queue; w != NULL; w = w->next) {
+		if (w->offset != batch->offset + (off_t)batch->length) {
+			break;
+		}
+		if ((batch->num_writes > 0) &&
+		    (batch->length + w->n > config->max_batch_size)) {
+			break;
+		}
+		batch->length += w->n;
+		batch->num_writes += 1;
+	}
+
+	batch->writes = talloc_zero_array(batch,
+				     struct write_coalesce_pwrite_state *,
+				     batch->num_writes);
+	if (batch->writes == NULL) {
+		goto fail;
+	}
+
+	/*
+	 * Always copy, even a single write: the caller may free its
+	 * request, and with it the data, before the write is done.
+	 */
+	buf = talloc_array(batch, uint8_t, batch->length);
+	if (buf == NULL) {
+		goto fail;
+	}
+
+	for (i = 0, w = wfsp->queue; i < batch->num_writes; i++, w = next) {
+		next = w->next;
+
+		memcpy(buf + (w->offset - batch->offset), w->data, w->n);
+		DLIST_REMOVE(wfsp->queue, w);
+		w->batch = batch;
+		batch->writes[i] = w;
+	}
+
+	DBG_DEBUG("%s: writing %zu requests with %zu bytes at offset %jd\n",
+		  fsp_str_dbg(fsp), batch->num_writes, batch->length,
+		  (intmax_t)batch->offset);
+
+	subreq = SMB_VFS_NEXT_PWRITE_SEND(batch, ev, handle, fsp,
+					  buf, batch->length,
+					  batch->offset);
+	if (subreq == NULL) {
+		goto fail;
+	}
+	tevent_req_set_callback(subreq, write_coalesce_batch_done, batch);
+
+	wfsp->batch = batch;
+	return;
+
+fail:
+	/*
+	 * Out of memory, fail everything that was queued
+	 */
+	if (batch != NULL) {
+		for (i = 0; i < batch->num_writes; i++) {
+			w = batch->writes != NULL ? batch->writes[i] : NULL;
+			if (w != NULL) {
+				talloc_set_destructor(w, NULL);
+				tevent_req_defer_callback(w->req, ev);
+				tevent_req_error(w->req, ENOMEM);
+			}
+		}
+		TALLOC_FREE(batch);
+	}
+	while (wfsp->queue != NULL) {
+		w = wfsp->queue;
+		DLIST_REMOVE(wfsp->queue, w);
+		talloc_set_destructor(w, NULL);
+		tevent_req_defer_callback(w->req, ev);
+		tevent_req_error(w->req, ENOMEM);
+	}
+}
+
+static void write_coalesce_batch_done(struct tevent_req *subreq)
+{
+	struct write_coalesce_batch *batch = tevent_req_callback_data(
+		subreq, struct write_coalesce_batch);
+	struct write_coalesce_fsp *wfsp = batch->wfsp;
+	struct vfs_aio_state vfs_aio_state = { 0 };
+	ssize_t ret;
+	size_t i;
+
+	ret = SMB_VFS_PWRITE_RECV(subreq, &vfs_aio_state);
+	TALLOC_FREE(subreq);
+
+	/*
+	 * Start the next batch before completing this one: completing
+	 * the last outstanding write might trigger a deferred close.
+	 */
+	wfsp->batch = NULL;
+	write_coalesce_batch_start(batch->handle, batch->ev, batch->fsp,
+				   wfsp);
+
+	for (i = 0; i < batch->num_writes; i++) {
+		struct write_coalesce_pwrite_state *w = batch->writes[i];
+		off_t ofs;
+
+		if (w == NULL) {
+			continue;
+		}
+		talloc_set_destructor(w, NULL);
+
+		ofs = w->offset - batch->offset;
+
+		w->vfs_aio_state = vfs_aio_state;
+		if (ret == -1) {
+			w->ret = -1;
+		} else if (ret >= ofs + (off_t)w->n) {
+			w->ret = w->n;
+		} else if (ret > ofs) {
+			w->ret = ret - ofs;
+		} else {
+			w->ret = 0;
+		}
+
+		tevent_req_defer_callback(w->req, batch->ev);
+		tevent_req_done(w->req);
+	}
+
+	TALLOC_FREE(batch);
+}
+
+static ssize_t write_coalesce_pwrite_recv(struct tevent_req *req,
+					  struct vfs_aio_state *vfs_aio_state)
+{
+	struct write_coalesce_pwrite_state *state = tevent_req_data(
+		req, struct write_coalesce_pwrite_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static int write_coalesce_connect(struct vfs_handle_struct *handle,
+				  const char *service,
+				  const char *user)
+{
+	struct write_coalesce_config *config = NULL;
+	int ret;
+
+	ret = SMB_VFS_NEXT_CONNECT(handle, service, user);
+	if (ret < 0) {
+		return ret;
+	}
+
+	config = talloc_zero(handle->conn, struct write_coalesce_config);
+	if (config == NULL) {
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		DBG_ERR("talloc_zero() failed\n");
+		return -1;
+	}
+
+	config->max_write_size = lp_parm_ulong(SNUM(handle->conn),
+					       "write_coalesce",
+					       "max write size",
+					       64*1024);
+	config->max_batch_size = lp_parm_ulong(SNUM(handle->conn),
+					       "write_coalesce",
+					       "max batch size",
+					       1024*1024);
+
+	SMB_VFS_HANDLE_SET_DATA(handle, config, NULL,
+				struct write_coalesce_config,
+				return -1);
+
+	return 0;
+}
+
+static struct vfs_fn_pointers vfs_write_coalesce_fns = {
+	.connect_fn = write_coalesce_connect,
+	.pwrite_send_fn = write_coalesce_pwrite_send,
+	.pwrite_recv_fn = write_coalesce_pwrite_recv,
+};
+
+NTSTATUS vfs_write_coalesce_init(TALLOC_CTX *);
+NTSTATUS vfs_write_coalesce_init(TALLOC_CTX *ctx)
+{
+	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION,
+				"write_coalesce", &vfs_write_coalesce_fns);
+}
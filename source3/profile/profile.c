@@ -171,12 +171,14 @@ bool profile_setup(struct messaging_context *msg_ctx, bool rdonly)
 #define SMBPROFILE_STATS_BASIC(name) do { \
 	__UPDATE(#name "+count"); \
 	__UPDATE(#name "+time"); \
+	__UPDATE(#name "+latency"); \
 } while(0);
 #define SMBPROFILE_STATS_BYTES(name) do { \
 	__UPDATE(#name "+count"); \
 	__UPDATE(#name "+time"); \
 	__UPDATE(#name "+idle"); \
 	__UPDATE(#name "+bytes"); \
+	__UPDATE(#name "+latency"); \
 } while(0);
 #define SMBPROFILE_STATS_IOBYTES(name) do { \
 	__UPDATE(#name "+count"); \
@@ -184,6 +186,7 @@ bool profile_setup(struct messaging_context *msg_ctx, bool rdonly)
 	__UPDATE(#name "+idle"); \
 	__UPDATE(#name "+inbytes"); \
 	__UPDATE(#name "+outbytes"); \
+	__UPDATE(#name "+latency"); \
 } while(0);
 #define SMBPROFILE_STATS_SECTION_END
 #define SMBPROFILE_STATS_END
@@ -363,6 +366,15 @@ void smbprofile_cleanup(pid_t pid, pid_t dst)
 	tdb_chainunlock(smbprofile_state.internal.db->tdb, key);
 }
 
+static void smbprofile_latency_accumulate(uint64_t *acc, const uint64_t *add)
+{
+	size_t i;
+
+	for (i = 0; i < SMBPROFILE_HISTOGRAM_BUCKETS; i++) {
+		acc[i] += add[i];
+	}
+}
+
 void smbprofile_stats_accumulate(struct profile_stats *acc,
 				 const struct profile_stats *add)
 {
@@ -377,12 +389,16 @@ void smbprofile_stats_accumulate(struct profile_stats *acc,
 #define SMBPROFILE_STATS_BASIC(name) do { \
 	acc->values.name##_stats.count += add->values.name##_stats.count; \
 	acc->values.name##_stats.time += add->values.name##_stats.time; \
+	smbprofile_latency_accumulate(acc->values.name##_stats.latency, \
+				      add->values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_BYTES(name) do { \
 	acc->values.name##_stats.count += add->values.name##_stats.count; \
 	acc->values.name##_stats.time += add->values.name##_stats.time; \
 	acc->values.name##_stats.idle += add->values.name##_stats.idle; \
 	acc->values.name##_stats.bytes += add->values.name##_stats.bytes; \
+	smbprofile_latency_accumulate(acc->values.name##_stats.latency, \
+				      add->values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_IOBYTES(name) do { \
 	acc->values.name##_stats.count += add->values.name##_stats.count; \
@@ -390,6 +406,8 @@ void smbprofile_stats_accumulate(struct profile_stats *acc,
 	acc->values.name##_stats.idle += add->values.name##_stats.idle; \
 	acc->values.name##_stats.inbytes += add->values.name##_stats.inbytes; \
 	acc->values.name##_stats.outbytes += add->values.name##_stats.outbytes; \
+	smbprofile_latency_accumulate(acc->values.name##_stats.latency, \
+				      add->values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_SECTION_END
 #define SMBPROFILE_STATS_END
@@ -24,6 +24,9 @@
 #include "../lib/util/tevent_ntstatus.h"
 #include "../lib/util/tevent_unix.h"
 #include "lib/tevent_wait.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#include "system/filesys.h"
+#include "system/select.h"
 
 /****************************************************************************
  Statics plus accessor functions.
@@ -58,6 +61,7 @@ struct aio_extra {
 	size_t nbyte;
 	off_t offset;
 	bool write_through;
+	bool recvfile;
 };
 
 /****************************************************************************
@@ -358,14 +362,14 @@ static struct tevent_req *pwrite_fsync_send(TALLOC_CTX *mem_ctx,
 	return req;
 }
 
+static void pwrite_fsync_written(struct tevent_req *req);
+
 static void pwrite_fsync_write_done(struct tevent_req *subreq)
 {
 	struct tevent_req *req = tevent_req_callback_data(
 		subreq, struct tevent_req);
 	struct pwrite_fsync_state *state = tevent_req_data(
 		req, struct pwrite_fsync_state);
-	connection_struct *conn = state->fsp->conn;
-	bool do_sync;
 	struct vfs_aio_state vfs_aio_state;
 
 	state->nwritten = SMB_VFS_PWRITE_RECV(subreq, &vfs_aio_state);
@@ -375,6 +379,17 @@ static void pwrite_fsync_write_done(struct tevent_req *subreq)
 		return;
 	}
 
+	pwrite_fsync_written(req);
+}
+
+static void pwrite_fsync_written(struct tevent_req *req)
+{
+	struct pwrite_fsync_state *state = tevent_req_data(
+		req, struct pwrite_fsync_state);
+	connection_struct *conn = state->fsp->conn;
+	struct tevent_req *subreq = NULL;
+	bool do_sync;
+
 	do_sync = (lp_strict_sync(SNUM(conn)) &&
 		   (lp_sync_always(SNUM(conn)) || state->write_through));
 	if (!do_sync) {
@@ -416,6 +431,403 @@ static ssize_t pwrite_fsync_recv(struct tevent_req *req, int *perr)
 	return state->nwritten;
 }
 
+/*
+ * Receive the payload of a SMB2 recvfile write from the socket into
+ * the file from a worker thread, so the main event loop keeps
+ * processing requests and sending replies while a large write lands.
+ *
+ * While this runs nobody else may read from the socket, see
+ * smbd_smb2_recvfile_start() and smbd_smb2_recvfile_finish().
+ */
+
+#define AIO_RECVFILE_CHUNK (1024*1024)
+
+/*
+ * The worker writes to the file descriptor directly, see
+ * vfs_io_is_default().
+ */
+static bool aio_recvfile_possible(connection_struct *conn)
+{
+	if (!lp_parm_bool(SNUM(conn), "smbd", "async recvfile", false)) {
+		return false;
+	}
+	return vfs_io_is_default(conn);
+}
+
+struct aio_recvfile_state {
+	struct smbXsrv_connection *xconn;
+	int sock;
+	int fd;
+	off_t offset;
+	size_t count;
+	size_t nreceived;
+	size_t nwritten;
+	/* Error writing to the file, the socket is drained anyway */
+	int file_err;
+	/* Error reading the socket, the connection is broken */
+	int sock_err;
+};
+
+static int aio_recvfile_state_destructor(struct aio_recvfile_state *state);
+static void aio_recvfile_do(void *private_data);
+static void aio_recvfile_done(struct tevent_req *subreq);
+
+static struct tevent_req *aio_recvfile_send(TALLOC_CTX *mem_ctx,
+					    struct tevent_context *ev,
+					    struct smbXsrv_connection *xconn,
+					    struct files_struct *fsp,
+					    size_t count, off_t offset)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct aio_recvfile_state *state = NULL;
+	int ret;
+
+	req = tevent_req_create(mem_ctx, &state, struct aio_recvfile_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->xconn = xconn;
+	state->sock = xconn->transport.sock;
+	state->fd = fsp->fh->fd;
+	state->offset = offset;
+	state->count = count;
+
+	if (sconn->pool == NULL) {
+		ret = pthreadpool_tevent_init(sconn, lp_aio_max_threads(),
+					      &sconn->pool);
+		if (tevent_req_error(req, ret)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	subreq = pthreadpool_tevent_job_send(state, ev, sconn->pool,
+					     aio_recvfile_do, state);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, aio_recvfile_done, req);
+
+	smbd_smb2_recvfile_start(xconn);
+
+	talloc_set_destructor(state, aio_recvfile_state_destructor);
+
+	return req;
+}
+
+static int aio_recvfile_state_destructor(struct aio_recvfile_state *state)
+{
+	return -1;
+}
+
+/*
+ * Called from the worker thread: wait for more data on the
+ * non-blocking socket.
+ */
+static int aio_recvfile_wait(int sock)
+{
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, -1);
+	} while ((ret == -1) && (errno == EINTR));
+
+	if (ret == -1) {
+		return errno;
+	}
+	if ((pfd.revents & POLLIN) == 0) {
+		return EPIPE;
+	}
+	return 0;
+}
+
+static void aio_recvfile_write(struct aio_recvfile_state *state,
+			       const uint8_t *buf, size_t len)
+{
+	while ((len > 0) && (state->file_err == 0)) {
+		ssize_t ret;
+
+		ret = pwrite(state->fd, buf, len,
+			     state->offset + state->nwritten);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			state->file_err = errno;
+			break;
+		}
+		if (ret == 0) {
+			state->file_err = ENOSPC;
+			break;
+		}
+		buf += ret;
+		len -= ret;
+		state->nwritten += ret;
+	}
+}
+
+#if defined(HAVE_LINUX_SPLICE)
+/*
+ * Move the data from the socket into the file via a pipe without
+ * copying it to user space. If the first splice fails, the caller
+ * falls back to recv/pwrite.
+ */
+static void aio_recvfile_splice(struct aio_recvfile_state *state)
+{
+	int pipefd[2];
+	loff_t file_offset = state->offset;
+
+	if (pipe(pipefd) == -1) {
+		return;
+	}
+
+#ifdef F_SETPIPE_SZ
+	(void)fcntl(pipefd[1], F_SETPIPE_SZ, AIO_RECVFILE_CHUNK);
+#endif
+
+	while ((state->nreceived < state->count) &&
+	       (state->file_err == 0)) {
+		size_t remaining = state->count - state->nreceived;
+		ssize_t nread;
+		size_t to_write;
+
+		nread = splice(state->sock, NULL, pipefd[1], NULL,
+			       MIN(remaining, AIO_RECVFILE_CHUNK),
+			       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (nread == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN) {
+				state->sock_err = aio_recvfile_wait(
+					state->sock);
+				if (state->sock_err != 0) {
+					break;
+				}
+				continue;
+			}
+			if (state->nreceived == 0 &&
+			    (errno == EINVAL || errno == ENOSYS)) {
+				/* Let the caller try recv */
+				break;
+			}
+			state->sock_err = errno;
+			break;
+		}
+		if (nread == 0) {
+			state->sock_err = EPIPE;
+			break;
+		}
+		state->nreceived += nread;
+
+		to_write = nread;
+		while (to_write > 0) {
+			ssize_t nwritten;
+
+			nwritten = splice(pipefd[0], NULL, state->fd,
+					  &file_offset, to_write,
+					  SPLICE_F_MOVE);
+			if (nwritten == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				state->file_err = errno;
+				break;
+			}
+			to_write -= nwritten;
+			state->nwritten += nwritten;
+		}
+
+		while (to_write > 0) {
+			/*
+			 * Writing to the file failed, we still need to
+			 * get the data out of the pipe.
+			 */
+			uint8_t buf[4096];
+			ssize_t ret;
+
+			ret = read(pipefd[0], buf, MIN(to_write, sizeof(buf)));
+			if (ret == -1 && errno == EINTR) {
+				continue;
+			}
+			if (ret <= 0) {
+				state->sock_err = EIO;
+				break;
+			}
+			to_write -= ret;
+		}
+	}
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+#endif
+
+static void aio_recvfile_do(void *private_data)
+{
+	struct aio_recvfile_state *state = talloc_get_type_abort(
+		private_data, struct aio_recvfile_state);
+	size_t bufsize = MIN(state->count, 128*1024);
+	uint8_t *buf = NULL;
+
+#if defined(HAVE_LINUX_SPLICE)
+	aio_recvfile_splice(state);
+	if (state->sock_err != 0) {
+		return;
+	}
+#endif
+
+	if (state->nreceived == state->count) {
+		return;
+	}
+
+	buf = malloc(MAX(bufsize, 1));
+	if (buf == NULL) {
+		state->sock_err = ENOMEM;
+		return;
+	}
+
+	/*
+	 * Continue where splice stopped, if the file failed, just
+	 * drain the socket.
+	 */
+	while (state->nreceived < state->count) {
+		size_t to_read = MIN(state->count - state->nreceived,
+				     bufsize);
+		ssize_t nread;
+
+		nread = recv(state->sock, buf, to_read, 0);
+		if (nread == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				state->sock_err = aio_recvfile_wait(
+					state->sock);
+				if (state->sock_err != 0) {
+					break;
+				}
+				continue;
+			}
+			state->sock_err = errno;
+			break;
+		}
+		if (nread == 0) {
+			state->sock_err = EPIPE;
+			break;
+		}
+		state->nreceived += nread;
+
+		aio_recvfile_write(state, buf, nread);
+	}
+
+	free(buf);
+}
+
+static void aio_recvfile_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct aio_recvfile_state *state = tevent_req_data(
+		req, struct aio_recvfile_state);
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+
+	/*
+	 * With multichannel, terminating the connection frees it
+	 * together with the smb2 request "req" hangs off, so "req"
+	 * must not be touched afterwards.
+	 */
+
+	if (ret != 0 || state->sock_err != 0) {
+		/*
+		 * We don't know where we are in the stream,
+		 * give up on the connection.
+		 */
+		int err = (ret != 0) ? ret : state->sock_err;
+
+		DBG_ERR("recvfile from client %s failed: %s\n",
+			smbXsrv_connection_dbg(state->xconn), strerror(err));
+		smbd_server_connection_terminate(state->xconn, strerror(err));
+		return;
+	}
+
+	status = smbd_smb2_recvfile_finish(state->xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(state->xconn,
+						 nt_errstr(status));
+		return;
+	}
+
+	if (tevent_req_error(req, state->file_err)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
+static ssize_t aio_recvfile_recv(struct tevent_req *req, int *perr)
+{
+	struct aio_recvfile_state *state = tevent_req_data(
+		req, struct aio_recvfile_state);
+
+	if (tevent_req_is_unix_error(req, perr)) {
+		return -1;
+	}
+	return state->nwritten;
+}
+
+static void recvfile_fsync_write_done(struct tevent_req *subreq);
+
+static struct tevent_req *recvfile_fsync_send(TALLOC_CTX *mem_ctx,
+					      struct tevent_context *ev,
+					      struct smbXsrv_connection *xconn,
+					      struct files_struct *fsp,
+					      size_t n, off_t offset,
+					      bool write_through)
+{
+	struct tevent_req *req, *subreq;
+	struct pwrite_fsync_state *state;
+
+	req = tevent_req_create(mem_ctx, &state, struct pwrite_fsync_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ev = ev;
+	state->fsp = fsp;
+	state->write_through = write_through;
+
+	subreq = aio_recvfile_send(state, ev, xconn, fsp, n, offset);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, recvfile_fsync_write_done, req);
+	return req;
+}
+
+static void recvfile_fsync_write_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct pwrite_fsync_state *state = tevent_req_data(
+		req, struct pwrite_fsync_state);
+	int err;
+
+	state->nwritten = aio_recvfile_recv(subreq, &err);
+	TALLOC_FREE(subreq);
+	if (state->nwritten == -1) {
+		tevent_req_error(req, err);
+		return;
+	}
+
+	pwrite_fsync_written(req);
+}
+
 static void aio_pwrite_smb1_done(struct tevent_req *req);
 
 /****************************************************************************
@@ -840,6 +1252,13 @@ NTSTATUS schedule_aio_smb2_write(connection_struct *conn,
 		return NT_STATUS_RETRY;
 	}
 
+	if (smbreq->unread_bytes) {
+		if (!aio_recvfile_possible(conn)) {
+			return NT_STATUS_RETRY;
+		}
+		SMB_ASSERT(smbreq->unread_bytes == in_data.length);
+	}
+
 	/* Only do this on writes not using the write cache. */
 	if (lp_write_cache_size(SNUM(conn)) != 0) {
 		return NT_STATUS_RETRY;
@@ -849,11 +1268,6 @@ NTSTATUS schedule_aio_smb2_write(connection_struct *conn,
 		return NT_STATUS_RETRY;
 	}
 
-	if (smbreq->unread_bytes) {
-		/* Can't do async with recvfile. */
-		return NT_STATUS_RETRY;
-	}
-
 	if (!(aio_ex = create_aio_extra(smbreq->smb2req, fsp, 0))) {
 		return NT_STATUS_NO_MEMORY;
 	}
@@ -873,9 +1287,22 @@ NTSTATUS schedule_aio_smb2_write(connection_struct *conn,
 	aio_ex->nbyte = in_data.length;
 	aio_ex->offset = in_offset;
 
-	req = pwrite_fsync_send(aio_ex, fsp->conn->sconn->ev_ctx, fsp,
-				in_data.data, in_data.length, in_offset,
-				write_through);
+	if (smbreq->unread_bytes) {
+		req = recvfile_fsync_send(aio_ex, fsp->conn->sconn->ev_ctx,
+					  smbreq->xconn, fsp,
+					  in_data.length, in_offset,
+					  write_through);
+		if (req != NULL) {
+			/* The worker drains the socket now */
+			smbreq->unread_bytes = 0;
+			aio_ex->recvfile = true;
+			smbreq->smb2req->worker_jobs += 1;
+		}
+	} else {
+		req = pwrite_fsync_send(aio_ex, fsp->conn->sconn->ev_ctx, fsp,
+					in_data.data, in_data.length,
+					in_offset, write_through);
+	}
 	if (req == NULL) {
 		DEBUG(3, ("smb2: SMB_VFS_PWRITE_SEND failed. "
 			  "Error %s\n", strerror(errno)));
@@ -931,6 +1358,10 @@ static void aio_pwrite_smb2_done(struct tevent_req *req)
 	nwritten = pwrite_fsync_recv(req, &err);
 	TALLOC_FREE(req);
 
+	if (aio_ex->recvfile) {
+		aio_ex->smbreq->smb2req->worker_jobs -= 1;
+	}
+
 	DEBUG(10, ("pwrite_recv returned %d, err = %s\n", (int)nwritten,
 		   (nwritten == -1) ? strerror(err) : "no error"));
 
@@ -293,7 +293,16 @@ NTSTATUS smbd_smb2_request_process_close(struct smbd_smb2_request *req);
 NTSTATUS smbd_smb2_request_process_flush(struct smbd_smb2_request *req);
 NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req);
 NTSTATUS smb2_read_complete(struct tevent_req *req, ssize_t nread, int err);
+struct smbd_smb2_read_state;
+struct tevent_req *smb2_sendfile_async_send(TALLOC_CTX *mem_ctx,
+					    struct tevent_context *ev,
+					    struct smbXsrv_connection *xconn,
+					    struct smbd_smb2_read_state *read_state,
+					    const DATA_BLOB *hdr);
+NTSTATUS smb2_sendfile_async_recv(struct tevent_req *req);
 NTSTATUS smbd_smb2_request_process_write(struct smbd_smb2_request *req);
+void smbd_smb2_recvfile_start(struct smbXsrv_connection *xconn);
+NTSTATUS smbd_smb2_recvfile_finish(struct smbXsrv_connection *xconn);
 NTSTATUS smb2_write_complete(struct tevent_req *req, ssize_t nwritten, int err);
 NTSTATUS smb2_write_complete_nosync(struct tevent_req *req, ssize_t nwritten,
 				    int err);
@@ -356,6 +365,8 @@ struct smbXsrv_preauth {
 	uint8_t sha512_value[64];
 };
 
+struct smbd_smb2_request_cache;
+
 struct smbXsrv_connection {
 	struct smbXsrv_connection *prev, *next;
 
@@ -462,6 +473,18 @@ struct smbXsrv_connection {
 		} request_read_state;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
+		/*
+		 * A worker thread is reading the payload of a
+		 * recvfile write from the socket, see
+		 * smbd_smb2_recvfile_start().
+		 */
+		bool recvfile_pending;
+
+		/*
+		 * Freed requests kept for reuse,
+		 * see smbd_smb2_request_allocate().
+		 */
+		struct smbd_smb2_request_cache *request_cache;
 
 		struct {
 			/*
@@ -560,6 +583,7 @@ NTSTATUS smbXsrv_connection_init_tables(struct smbXsrv_connection *conn,
 					enum protocol_types protocol);
 
 NTSTATUS smbXsrv_session_global_init(struct messaging_context *msg_ctx);
+NTSTATUS smbXsrv_session_global_compact_step(unsigned max_records, int *moved);
 NTSTATUS smbXsrv_session_create(struct smbXsrv_connection *conn,
 				NTTIME now,
 				struct smbXsrv_session **_session);
@@ -612,6 +636,7 @@ struct tevent_req *smb2srv_session_close_previous_send(TALLOC_CTX *mem_ctx,
 NTSTATUS smb2srv_session_close_previous_recv(struct tevent_req *req);
 
 NTSTATUS smbXsrv_tcon_global_init(void);
+NTSTATUS smbXsrv_tcon_global_compact_step(unsigned max_records, int *moved);
 NTSTATUS smbXsrv_tcon_update(struct smbXsrv_tcon *tcon);
 NTSTATUS smbXsrv_tcon_disconnect(struct smbXsrv_tcon *tcon, uint64_t vuid);
 NTSTATUS smb1srv_tcon_table_init(struct smbXsrv_connection *conn);
@@ -636,6 +661,7 @@ NTSTATUS smbXsrv_tcon_global_traverse(
 			void *private_data);
 
 NTSTATUS smbXsrv_open_global_init(void);
+NTSTATUS smbXsrv_open_global_compact_step(unsigned max_records, int *moved);
 NTSTATUS smbXsrv_open_create(struct smbXsrv_connection *conn,
 			     struct auth_session_info *session_info,
 			     NTTIME now,
@@ -680,6 +706,17 @@ struct smbd_smb2_send_queue {
 
 	DATA_BLOB *sendfile_header;
 	NTSTATUS *sendfile_status;
+	/*
+	 * If set, the sendfile payload is pushed to the socket by a
+	 * worker thread, see smb2_sendfile_async_send().
+	 */
+	struct smbd_smb2_read_state *sendfile_read_state;
+	struct tevent_req *sendfile_subreq;
+	/*
+	 * If set, the PDU is encrypted by a worker thread and can't
+	 * be sent yet, see smbd_smb2_encrypt_async_send().
+	 */
+	struct tevent_req *crypto_subreq;
 	struct iovec *vector;
 	int count;
 
@@ -718,6 +755,13 @@ struct smbd_smb2_request {
 	 */
 	bool async_internal;
 
+	/*
+	 * Number of pthreadpool jobs (async sendfile/recvfile) that
+	 * still use memory hanging off this request. Such a request
+	 * must never go into the request cache.
+	 */
+	unsigned worker_jobs;
+
 	/*
 	 * the encryption key for the whole
 	 * compound chain
@@ -25,8 +25,15 @@
 #include "../libcli/smb/smb_common.h"
 #include "libcli/security/security.h"
 #include "../lib/util/tevent_ntstatus.h"
+#include "../lib/util/tevent_unix.h"
 #include "rpc_server/srv_pipe_hnd.h"
 #include "lib/util/sys_rw_data.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#include "system/select.h"
+
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
 
 static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 					      struct tevent_context *ev,
@@ -181,6 +188,7 @@ struct smbd_smb2_read_state {
 	uint8_t _out_hdr_buf[NBT_HDR_SIZE + SMB2_HDR_BODY + 0x10];
 	DATA_BLOB out_data;
 	uint32_t out_remaining;
+	bool async_sendfile;
 };
 
 static int smb2_smb2_read_state_deny_destructor(struct smbd_smb2_read_state *state)
@@ -328,6 +336,364 @@ normal_read:
 	return 0;
 }
 
+/*
+ * Asynchronous variant of smb2_sendfile_send_data(): The header and
+ * the file data are pushed into the socket by a worker thread, so
+ * large reads don't block the main event loop. The send queue is
+ * stalled until the job is done, so nobody else writes to the socket
+ * in the meantime.
+ */
+
+/* Max bytes moved through the pipe with one splice() call */
+#define SMB2_SENDFILE_ASYNC_CHUNK (1024*1024)
+
+/*
+ * The worker reads from the file descriptor directly, see
+ * vfs_io_is_default().
+ */
+static bool smb2_sendfile_async_possible(connection_struct *conn)
+{
+	if (!lp_parm_bool(SNUM(conn), "smbd", "async sendfile", false)) {
+		return false;
+	}
+	return vfs_io_is_default(conn);
+}
+
+struct smb2_sendfile_async_state {
+	int sock;
+	int fd;
+	uint8_t *hdr;
+	size_t hdr_len;
+	off_t offset;
+	size_t length;
+	size_t nread;
+	size_t nsent;
+	bool eof;
+	int err;
+};
+
+static int smb2_sendfile_async_state_destructor(
+	struct smb2_sendfile_async_state *state);
+static void smb2_sendfile_async_do(void *private_data);
+static void smb2_sendfile_async_done(struct tevent_req *subreq);
+
+struct tevent_req *smb2_sendfile_async_send(TALLOC_CTX *mem_ctx,
+					    struct tevent_context *ev,
+					    struct smbXsrv_connection *xconn,
+					    struct smbd_smb2_read_state *read_state,
+					    const DATA_BLOB *hdr)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smb2_sendfile_async_state *state = NULL;
+	int ret;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smb2_sendfile_async_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->sock = xconn->transport.sock;
+	state->fd = -1;
+	state->hdr_len = hdr->length;
+	state->offset = read_state->in_offset;
+	state->length = read_state->in_length;
+
+	/* Our own copy, the request might be gone before the worker */
+	state->hdr = talloc_memdup(state, hdr->data, hdr->length);
+	if (tevent_req_nomem(state->hdr, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	if (sconn->pool == NULL) {
+		ret = pthreadpool_tevent_init(sconn, lp_aio_max_threads(),
+					      &sconn->pool);
+		if (tevent_req_error(req, ret)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	/*
+	 * The worker must not depend on the fsp, it might be
+	 * closed while we're sending.
+	 */
+	state->fd = dup(read_state->fsp->fh->fd);
+	if (state->fd == -1) {
+		tevent_req_error(req, errno);
+		return tevent_req_post(req, ev);
+	}
+
+	DBG_DEBUG("async sendfile %zu bytes at offset %jd of %s\n",
+		  state->length, (intmax_t)state->offset,
+		  fsp_str_dbg(read_state->fsp));
+
+	subreq = pthreadpool_tevent_job_send(state, ev, sconn->pool,
+					     smb2_sendfile_async_do, state);
+	if (tevent_req_nomem(subreq, req)) {
+		close(state->fd);
+		state->fd = -1;
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smb2_sendfile_async_done, req);
+
+	talloc_set_destructor(state, smb2_sendfile_async_state_destructor);
+
+	return req;
+}
+
+static int smb2_sendfile_async_state_destructor(
+	struct smb2_sendfile_async_state *state)
+{
+	/*
+	 * The worker still uses our buffers
+	 */
+	return -1;
+}
+
+/*
+ * Called from the worker thread: wait until the non-blocking
+ * socket can take more data.
+ */
+static int smb2_sendfile_async_wait(int sock)
+{
+	struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, -1);
+	} while ((ret == -1) && (errno == EINTR));
+
+	if (ret == -1) {
+		return errno;
+	}
+	if (pfd.revents & (POLLERR|POLLHUP|POLLNVAL)) {
+		return EPIPE;
+	}
+	return 0;
+}
+
+static int smb2_sendfile_async_write(int sock, const uint8_t *buf,
+				     size_t len, bool more)
+{
+	int flags = more ? MSG_MORE : 0;
+
+	while (len > 0) {
+		ssize_t ret;
+		int err;
+
+		ret = send(sock, buf, len, flags);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return errno;
+			}
+			err = smb2_sendfile_async_wait(sock);
+			if (err != 0) {
+				return err;
+			}
+			continue;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+#if defined(HAVE_LINUX_SPLICE)
+/*
+ * Move file pages to the socket via a pipe without copying
+ * them to user space. If the file side of the splice fails, the
+ * caller sends the rest via pread.
+ */
+static void smb2_sendfile_async_splice(struct smb2_sendfile_async_state *state)
+{
+	int pipefd[2];
+	loff_t file_offset = state->offset + state->nsent;
+
+	if (pipe(pipefd) == -1) {
+		return;
+	}
+
+#ifdef F_SETPIPE_SZ
+	/*
+	 * Larger pipes mean fewer splice calls for multi-MB reads,
+	 * ignore errors, the pipe keeps its default size.
+	 */
+	(void)fcntl(pipefd[1], F_SETPIPE_SZ, SMB2_SENDFILE_ASYNC_CHUNK);
+#endif
+
+	while (state->nsent < state->length) {
+		size_t remaining = state->length - state->nsent;
+		ssize_t nread;
+		size_t to_write;
+
+		nread = splice(state->fd, &file_offset, pipefd[1], NULL,
+			       MIN(remaining, SMB2_SENDFILE_ASYNC_CHUNK),
+			       SPLICE_F_MOVE);
+		if (nread == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* Let the caller try pread */
+			break;
+		}
+		if (nread == 0) {
+			/* The caller pads with zeros */
+			state->eof = true;
+			break;
+		}
+
+		to_write = nread;
+		while (to_write > 0) {
+			ssize_t nwritten;
+			unsigned flags = SPLICE_F_MOVE;
+
+			if (state->nsent + to_write < state->length) {
+				flags |= SPLICE_F_MORE;
+			}
+
+			nwritten = splice(pipefd[0], NULL, state->sock, NULL,
+					  to_write, flags|SPLICE_F_NONBLOCK);
+			if (nwritten == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN) {
+					state->err = smb2_sendfile_async_wait(
+						state->sock);
+					if (state->err != 0) {
+						goto done;
+					}
+					continue;
+				}
+				state->err = errno;
+				goto done;
+			}
+			to_write -= nwritten;
+			state->nsent += nwritten;
+		}
+		state->nread += nread;
+	}
+
+done:
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+#endif
+
+static void smb2_sendfile_async_do(void *private_data)
+{
+	struct smb2_sendfile_async_state *state = talloc_get_type_abort(
+		private_data, struct smb2_sendfile_async_state);
+	uint8_t *buf = NULL;
+	size_t bufsize = MIN(state->length, 65536);
+
+	state->err = smb2_sendfile_async_write(state->sock, state->hdr,
+					       state->hdr_len,
+					       state->length > 0);
+	if (state->err != 0) {
+		return;
+	}
+
+#if defined(HAVE_LINUX_SPLICE)
+	smb2_sendfile_async_splice(state);
+	if (state->err != 0) {
+		return;
+	}
+#endif
+
+	if (state->nsent == state->length) {
+		return;
+	}
+
+	buf = malloc(MAX(bufsize, 1));
+	if (buf == NULL) {
+		state->err = ENOMEM;
+		return;
+	}
+
+	while (state->nsent < state->length) {
+		size_t to_send = MIN(state->length - state->nsent, bufsize);
+		ssize_t nread = 0;
+
+		if (!state->eof) {
+			nread = pread(state->fd, buf, to_send,
+				      state->offset + state->nsent);
+			if (nread == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				state->err = errno;
+				break;
+			}
+			if (nread == 0) {
+				state->eof = true;
+			}
+			state->nread += nread;
+		}
+
+		/*
+		 * The client already has the length in the header,
+		 * a short read is padded with zeros, as
+		 * sendfile_short_send() does.
+		 */
+		if (nread < to_send) {
+			memset(buf + nread, '\0', to_send - nread);
+		}
+
+		state->err = smb2_sendfile_async_write(
+			state->sock, buf, to_send,
+			state->nsent + to_send < state->length);
+		if (state->err != 0) {
+			break;
+		}
+		state->nsent += to_send;
+	}
+
+	free(buf);
+}
+
+static void smb2_sendfile_async_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct smb2_sendfile_async_state *state = tevent_req_data(
+		req, struct smb2_sendfile_async_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(state, NULL);
+	close(state->fd);
+	state->fd = -1;
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+	if (tevent_req_error(req, state->err)) {
+		return;
+	}
+
+	if (state->nread < state->length) {
+		DBG_NOTICE("short read: %zu of %zu bytes, padded with "
+			   "zeros\n", state->nread, state->length);
+	}
+
+	tevent_req_done(req);
+}
+
+NTSTATUS smb2_sendfile_async_recv(struct tevent_req *req)
+{
+	int err;
+
+	if (tevent_req_is_unix_error(req, &err)) {
+		return map_nt_error_from_unix_common(err);
+	}
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 					struct smbd_smb2_read_state *state)
 {
@@ -342,7 +708,8 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	 * We're using a write cache OR
 	 * It's not a regular file OR
 	 * Requested offset is greater than file size OR
-	 * there's not enough data in the file.
+	 * there's not enough data in the file OR
+	 * the client wants more than it asked for.
 	 * Phew :-). Luckily this means most
 	 * reads on most normal files. JRA.
 	*/
@@ -353,7 +720,12 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	    smbd_smb2_is_compound(smb2req) ||
 	    (fsp->base_fsp != NULL) ||
 	    (fsp->wcp != NULL) ||
-	    (!S_ISREG(fsp->fsp_name->st.st_ex_mode)) ||
+	    (state->in_length < state->in_minimum))
+	{
+		return NT_STATUS_RETRY;
+	}
+
+	if ((!S_ISREG(fsp->fsp_name->st.st_ex_mode)) ||
 	    (state->in_offset >= fsp->fsp_name->st.st_ex_size) ||
 	    (fsp->fsp_name->st.st_ex_size < state->in_offset + state->in_length))
 	{
@@ -365,8 +737,13 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	state->out_data.length = state->in_length;
 	state->out_remaining = 0;
 
+	fsp->fh->pos = state->in_offset + state->in_length;
+	fsp->fh->position_information = fsp->fh->pos;
+
 	state->out_headers = data_blob_const(state->_out_hdr_buf,
 					     sizeof(state->_out_hdr_buf));
+
+	state->async_sendfile = smb2_sendfile_async_possible(fsp->conn);
 	return NT_STATUS_OK;
 }
 
@@ -432,6 +809,228 @@ static bool smbd_smb2_read_cancel(struct tevent_req *req)
 	return cancel_smb2_aio(state->smbreq);
 }
 
+/*
+ * Adaptive read-ahead for SMB2 READ.
+ *
+ * Every read on a file handle is checked against the end of the
+ * previous one. Once a client reads sequentially the kernel is asked
+ * to fill the page cache ahead of it. The window doubles each time
+ * the client catches up with it, up to 'smbd:readahead max window',
+ * and is halved on random access. The posix_fadvise() runs in a worker
+ * thread, as it can block on starting the disk I/O.
+ */
+
+#define SMBD_READAHEAD_MIN_WINDOW (128*1024)
+#define SMBD_READAHEAD_SEQ_HITS 2
+
+struct fsp_readahead {
+	bool disabled;
+	size_t max_window;
+	off_t next_offset;
+	off_t ra_end;
+	size_t window;
+	unsigned hits;
+};
+
+#if defined(HAVE_POSIX_FADVISE)
+
+struct smbd_readahead_job_state {
+	int fd;
+	off_t offset;
+	size_t length;
+};
+
+static int smbd_readahead_job_state_destructor(
+	struct smbd_readahead_job_state *state)
+{
+	/*
+	 * The worker still uses the fd
+	 */
+	return -1;
+}
+
+static void smbd_readahead_job_do(void *private_data)
+{
+	struct smbd_readahead_job_state *state = talloc_get_type_abort(
+		private_data, struct smbd_readahead_job_state);
+
+	(void)posix_fadvise(state->fd, state->offset, state->length,
+			    POSIX_FADV_WILLNEED);
+	close(state->fd);
+	state->fd = -1;
+}
+
+static void smbd_readahead_job_done(struct tevent_req *subreq)
+{
+	struct smbd_readahead_job_state *state = tevent_req_callback_data(
+		subreq, struct smbd_readahead_job_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret != 0) {
+		DBG_DEBUG("readahead job failed: %s\n", strerror(ret));
+		if (state->fd != -1) {
+			close(state->fd);
+		}
+	}
+
+	talloc_set_destructor(state, NULL);
+	TALLOC_FREE(state);
+}
+
+static void smbd_readahead_schedule(struct files_struct *fsp,
+				    off_t offset,
+				    size_t length)
+{
+	struct smbd_server_connection *sconn = fsp->conn->sconn;
+	struct smbd_readahead_job_state *state = NULL;
+	struct tevent_req *subreq = NULL;
+	int ret;
+
+	if (sconn->pool == NULL) {
+		ret = pthreadpool_tevent_init(sconn, lp_aio_max_threads(),
+					      &sconn->pool);
+		if (ret != 0) {
+			return;
+		}
+	}
+
+	/*
+	 * The job does not need a reply, hang it off the
+	 * connection, so that it can outlive the file handle.
+	 */
+	state = talloc(sconn, struct smbd_readahead_job_state);
+	if (state == NULL) {
+		return;
+	}
+	state->offset = offset;
+	state->length = length;
+
+	state->fd = dup(fsp->fh->fd);
+	if (state->fd == -1) {
+		TALLOC_FREE(state);
+		return;
+	}
+
+	subreq = pthreadpool_tevent_job_send(state, sconn->ev_ctx, sconn->pool,
+					     smbd_readahead_job_do, state);
+	if (subreq == NULL) {
+		close(state->fd);
+		TALLOC_FREE(state);
+		return;
+	}
+	tevent_req_set_callback(subreq, smbd_readahead_job_done, state);
+
+	talloc_set_destructor(state, smbd_readahead_job_state_destructor);
+}
+
+static void smbd_readahead_observe(struct files_struct *fsp,
+				   off_t offset,
+				   size_t length)
+{
+	struct fsp_readahead *ra = fsp->readahead;
+	off_t end = offset + length;
+	bool sequential;
+
+	if (ra == NULL) {
+		ra = talloc_zero(fsp, struct fsp_readahead);
+		if (ra == NULL) {
+			return;
+		}
+		ra->disabled = !lp_parm_bool(SNUM(fsp->conn), "smbd",
+					     "readahead", false);
+		ra->max_window = lp_parm_ulong(SNUM(fsp->conn), "smbd",
+					       "readahead max window",
+					       8*1024*1024);
+		if (ra->max_window < SMBD_READAHEAD_MIN_WINDOW) {
+			ra->disabled = true;
+		}
+		if (!vfs_io_is_default(fsp->conn)) {
+			/*
+			 * fsp->fh->fd is only a kernel fd
+			 * if vfs_default does the I/O
+			 */
+			ra->disabled = true;
+		}
+		fsp->readahead = ra;
+	}
+
+	if (ra->disabled || (length == 0)) {
+		return;
+	}
+
+	if ((fsp->base_fsp != NULL) ||
+	    (fsp->fh->fd == -1) ||
+	    !S_ISREG(fsp->fsp_name->st.st_ex_mode)) {
+		ra->disabled = true;
+		return;
+	}
+
+	/*
+	 * Clients with many reads in flight don't always send them
+	 * in order, tolerate a gap of one read.
+	 */
+	sequential = (offset >= ra->next_offset - (off_t)length) &&
+		     (offset <= ra->next_offset + (off_t)length);
+
+	ra->next_offset = end;
+
+	if (!sequential) {
+		ra->hits = 0;
+		ra->window /= 2;
+		if (ra->window < SMBD_READAHEAD_MIN_WINDOW) {
+			ra->window = 0;
+		}
+		ra->ra_end = 0;
+		return;
+	}
+
+	ra->hits += 1;
+	if (ra->hits < SMBD_READAHEAD_SEQ_HITS) {
+		return;
+	}
+
+	if (ra->window == 0) {
+		ra->window = MAX(SMBD_READAHEAD_MIN_WINDOW, 4 * length);
+	} else if (ra->ra_end - end < (off_t)(ra->window / 2)) {
+		ra->window *= 2;
+	}
+	ra->window = MIN(ra->window, ra->max_window);
+
+	/*
+	 * Only ask for more once the client has consumed half
+	 * of what we prefetched.
+	 */
+	if (ra->ra_end - end >= (off_t)(ra->window / 2)) {
+		return;
+	}
+
+	offset = MAX(ra->ra_end, end);
+	ra->ra_end = end + ra->window;
+
+	if (offset >= fsp->fsp_name->st.st_ex_size) {
+		return;
+	}
+
+	DBG_DEBUG("%s: readahead %jd bytes at offset %jd\n",
+		  fsp_str_dbg(fsp), (intmax_t)(ra->ra_end - offset),
+		  (intmax_t)offset);
+
+	smbd_readahead_schedule(fsp, offset, ra->ra_end - offset);
+}
+
+#else
+
+static void smbd_readahead_observe(struct files_struct *fsp,
+				   off_t offset,
+				   size_t length)
+{
+	return;
+}
+
+#endif
+
 static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 					      struct tevent_context *ev,
 					      struct smbd_smb2_request *smb2req,
@@ -511,6 +1110,37 @@ static struct tevent_req *smbd_smb2_read_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	smbd_readahead_observe(fsp, in_offset, in_length);
+
+	if (smb2_sendfile_async_possible(conn)) {
+		/*
+		 * The sendfile data is pushed by a worker thread
+		 * without blocking us, so prefer it over reading
+		 * into a buffer via aio.
+		 */
+		init_strict_lock_struct(fsp,
+					fsp->op->global->open_persistent_id,
+					in_offset,
+					in_length,
+					READ_LOCK,
+					&lock);
+
+		if (!SMB_VFS_STRICT_LOCK_CHECK(conn, fsp, &lock)) {
+			tevent_req_nterror(req, NT_STATUS_FILE_LOCK_CONFLICT);
+			return tevent_req_post(req, ev);
+		}
+
+		status = schedule_smb2_sendfile_read(smb2req, state);
+		if (NT_STATUS_IS_OK(status)) {
+			tevent_req_done(req);
+			return tevent_req_post(req, ev);
+		}
+		if (!NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+			tevent_req_nterror(req, status);
+			return tevent_req_post(req, ev);
+		}
+	}
+
 	status = schedule_smb2_aio_read(fsp->conn,
 				smbreq,
 				fsp,
@@ -649,7 +1279,16 @@ static NTSTATUS smbd_smb2_read_recv(struct tevent_req *req,
 		talloc_set_destructor(state, smb2_smb2_read_state_deny_destructor);
 		tevent_req_received(req);
 		state->smb2req->queue_entry.sendfile_header = &state->out_headers;
-		talloc_set_destructor(state, smb2_sendfile_send_data);
+		if (state->async_sendfile) {
+			/*
+			 * smbd_smb2_flush_send_queue() will call
+			 * smb2_sendfile_async_send().
+			 */
+			talloc_set_destructor(state, NULL);
+			state->smb2req->queue_entry.sendfile_read_state = state;
+		} else {
+			talloc_set_destructor(state, smb2_sendfile_send_data);
+		}
 	} else {
 		tevent_req_received(req);
 	}
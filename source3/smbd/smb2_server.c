@@ -31,6 +31,8 @@
 #include "lib/util/iov_buf.h"
 #include "auth.h"
 #include "lib/crypto/sha512.h"
+#include "lib/crypto/aes.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 struct tevent_fd *fde,
@@ -266,15 +268,91 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 	return true;
 }
 
+/*
+ * Each request is a talloc pool big enough for the buffers of typical
+ * small requests and their responses. Freed requests are kept per
+ * connection and reused, so metadata heavy workloads don't need to
+ * malloc/free for every PDU.
+ */
+#define SMBD_SMB2_REQUEST_POOL_OBJECTS 16
+#define SMBD_SMB2_REQUEST_POOL_SIZE 4096
+
+struct smbd_smb2_request_cache {
+	struct smbXsrv_connection *xconn;
+	struct smbd_smb2_request *list;
+	size_t num;
+	size_t max;
+};
+
+static int smbd_smb2_request_cache_destructor(
+	struct smbd_smb2_request_cache *cache)
+{
+	/*
+	 * Let the requests in the list be
+	 * freed together with the cache.
+	 */
+	cache->xconn->smb2.request_cache = NULL;
+	return 0;
+}
+
+static struct smbd_smb2_request_cache *smbd_smb2_request_cache(
+	struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_request_cache *cache = xconn->smb2.request_cache;
+
+	if (cache != NULL) {
+		return cache;
+	}
+
+	cache = talloc_zero(xconn, struct smbd_smb2_request_cache);
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->xconn = xconn;
+	cache->max = lp_parm_ulong(-1, "smbd", "request cache size", 64);
+	talloc_set_destructor(cache, smbd_smb2_request_cache_destructor);
+
+	xconn->smb2.request_cache = cache;
+	return cache;
+}
+
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	struct smbd_smb2_request_cache *cache = NULL;
+
 	if (req->first_key.length > 0) {
 		data_blob_clear_free(&req->first_key);
 	}
 	if (req->last_key.length > 0) {
 		data_blob_clear_free(&req->last_key);
 	}
-	return 0;
+
+	if (req->xconn != NULL) {
+		cache = req->xconn->smb2.request_cache;
+	}
+	if (cache == NULL || cache->num >= cache->max) {
+		return 0;
+	}
+	if (req->worker_jobs != 0) {
+		/*
+		 * A worker still uses our memory, its state refuses
+		 * to be freed. Don't recycle the pool for the next
+		 * PDU, really free it instead.
+		 */
+		return 0;
+	}
+
+	/*
+	 * Free everything hanging off the request, this resets the
+	 * pool, and keep the request itself for the next PDU.
+	 */
+	talloc_free_children(req);
+	ZERO_STRUCTP(req);
+	talloc_steal(cache, req);
+	DLIST_ADD(cache->list, req);
+	cache->num += 1;
+
+	return -1;
 }
 
 void smb2_request_set_async_internal(struct smbd_smb2_request *req,
@@ -283,30 +361,31 @@ void smb2_request_set_async_internal(struct smbd_smb2_request *req,
 	req->async_internal = async_internal;
 }
 
-static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
+static struct smbd_smb2_request *smbd_smb2_request_allocate(
+	struct smbXsrv_connection *xconn)
 {
-	TALLOC_CTX *mem_pool;
+	struct smbd_smb2_request_cache *cache;
 	struct smbd_smb2_request *req;
 
-#if 0
-	/* Enable this to find subtle valgrind errors. */
-	mem_pool = talloc_init("smbd_smb2_request_allocate");
-#else
-	mem_pool = talloc_tos();
-#endif
-	if (mem_pool == NULL) {
+	cache = smbd_smb2_request_cache(xconn);
+	if (cache == NULL) {
 		return NULL;
 	}
 
-	req = talloc_zero(mem_pool, struct smbd_smb2_request);
-	if (req == NULL) {
-		talloc_free(mem_pool);
-		return NULL;
+	req = cache->list;
+	if (req != NULL) {
+		DLIST_REMOVE(cache->list, req);
+		cache->num -= 1;
+		talloc_steal(xconn, req);
+	} else {
+		req = talloc_pooled_object(xconn, struct smbd_smb2_request,
+					   SMBD_SMB2_REQUEST_POOL_OBJECTS,
+					   SMBD_SMB2_REQUEST_POOL_SIZE);
+		if (req == NULL) {
+			return NULL;
+		}
+		ZERO_STRUCTP(req);
 	}
-	talloc_reparent(mem_pool, mem_ctx, req);
-#if 0
-	TALLOC_FREE(mem_pool);
-#endif
 
 	req->last_session_id = UINT64_MAX;
 	req->last_tid = UINT32_MAX;
@@ -2734,6 +2813,261 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+/*
+ * Encrypting large responses in a worker thread lets a single
+ * connection use more than one CPU, as the next requests can be
+ * processed while the previous response is still being encrypted.
+ *
+ * The worker encrypts a copy of the PDU that belongs to the job, not
+ * to the request: The request can go away while the job runs, for
+ * example with its connection. The job then just frees itself once
+ * the worker is done.
+ */
+
+struct smbd_smb2_encrypt_job {
+	/* NULL once the caller has gone away */
+	struct tevent_req *req;
+	uint8_t key[AES_BLOCK_SIZE];
+	uint16_t cipher;
+	uint8_t *buf;
+	size_t buflen;
+	struct iovec *vector;
+	int count;
+	NTSTATUS status;
+};
+
+struct smbd_smb2_encrypt_async_state {
+	struct smbd_smb2_encrypt_job *job;
+	uint8_t *buf;
+	size_t buflen;
+};
+
+static int smbd_smb2_encrypt_async_state_destructor(
+	struct smbd_smb2_encrypt_async_state *state);
+static int smbd_smb2_encrypt_job_destructor(
+	struct smbd_smb2_encrypt_job *job);
+static void smbd_smb2_encrypt_async_do(void *private_data);
+static void smbd_smb2_encrypt_async_job_done(struct tevent_req *subreq);
+
+static struct tevent_req *smbd_smb2_encrypt_async_send(
+					TALLOC_CTX *mem_ctx,
+					struct tevent_context *ev,
+					struct smbXsrv_connection *xconn,
+					DATA_BLOB encryption_key,
+					const struct iovec *vector,
+					int count)
+{
+	struct smbd_server_connection *sconn = xconn->client->sconn;
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct smbd_smb2_encrypt_async_state *state = NULL;
+	struct smbd_smb2_encrypt_job *job = NULL;
+	ssize_t buflen;
+	size_t ofs = 0;
+	int i, ret;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct smbd_smb2_encrypt_async_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (sconn->pool == NULL) {
+		ret = pthreadpool_tevent_init(sconn, lp_aio_max_threads(),
+					      &sconn->pool);
+		if (ret != 0) {
+			tevent_req_nterror(req, map_nt_error_from_unix(ret));
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	buflen = iov_buflen(vector, count);
+	if (buflen == -1) {
+		tevent_req_nterror(req, NT_STATUS_INVALID_PARAMETER_MIX);
+		return tevent_req_post(req, ev);
+	}
+
+	/*
+	 * Hang the job off the connection, so that it can outlive
+	 * the request.
+	 */
+	job = talloc_zero(sconn, struct smbd_smb2_encrypt_job);
+	if (tevent_req_nomem(job, req)) {
+		return tevent_req_post(req, ev);
+	}
+	memcpy(job->key, encryption_key.data,
+	       MIN(encryption_key.length, sizeof(job->key)));
+	job->cipher = xconn->smb2.server.cipher;
+	job->buflen = buflen;
+	job->count = count;
+	job->buf = talloc_array(job, uint8_t, buflen);
+	job->vector = talloc_array(job, struct iovec, count);
+	if ((job->buf == NULL) || (job->vector == NULL)) {
+		TALLOC_FREE(job);
+		tevent_req_oom(req);
+		return tevent_req_post(req, ev);
+	}
+
+	for (i = 0; i < count; i++) {
+		memcpy(job->buf + ofs, vector[i].iov_base, vector[i].iov_len);
+		job->vector[i] = (struct iovec) {
+			.iov_base = job->buf + ofs,
+			.iov_len = vector[i].iov_len,
+		};
+		ofs += vector[i].iov_len;
+	}
+
+	subreq = pthreadpool_tevent_job_send(job, ev, sconn->pool,
+					     smbd_smb2_encrypt_async_do,
+					     job);
+	if (subreq == NULL) {
+		TALLOC_FREE(job);
+		tevent_req_oom(req);
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_encrypt_async_job_done,
+				job);
+
+	job->req = req;
+	state->job = job;
+	talloc_set_destructor(job, smbd_smb2_encrypt_job_destructor);
+	talloc_set_destructor(state, smbd_smb2_encrypt_async_state_destructor);
+
+	return req;
+}
+
+static int smbd_smb2_encrypt_async_state_destructor(
+	struct smbd_smb2_encrypt_async_state *state)
+{
+	if (state->job != NULL) {
+		/*
+		 * The job finishes on its own
+		 */
+		state->job->req = NULL;
+		state->job = NULL;
+	}
+	return 0;
+}
+
+static int smbd_smb2_encrypt_job_destructor(
+	struct smbd_smb2_encrypt_job *job)
+{
+	/*
+	 * The worker still uses our buffers
+	 */
+	return -1;
+}
+
+static void smbd_smb2_encrypt_async_do(void *private_data)
+{
+	struct smbd_smb2_encrypt_job *job = talloc_get_type_abort(
+		private_data, struct smbd_smb2_encrypt_job);
+	DATA_BLOB key = data_blob_const(job->key, sizeof(job->key));
+
+	/*
+	 * This must not use talloc or DEBUG.
+	 */
+	job->status = smb2_signing_encrypt_pdu_nolog(key,
+						     job->cipher,
+						     job->vector,
+						     job->count);
+}
+
+static void smbd_smb2_encrypt_async_job_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_encrypt_job *job = tevent_req_callback_data(
+		subreq, struct smbd_smb2_encrypt_job);
+	struct tevent_req *req = job->req;
+	struct smbd_smb2_encrypt_async_state *state = NULL;
+	NTSTATUS status = job->status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	talloc_set_destructor(job, NULL);
+	ZERO_STRUCT(job->key);
+
+	if (req == NULL) {
+		TALLOC_FREE(job);
+		return;
+	}
+	state = tevent_req_data(req, struct smbd_smb2_encrypt_async_state);
+	state->job = NULL;
+
+	if (ret != 0) {
+		status = map_nt_error_from_unix(ret);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(job);
+		tevent_req_nterror(req, status);
+		return;
+	}
+
+	state->buf = talloc_move(state, &job->buf);
+	state->buflen = job->buflen;
+	TALLOC_FREE(job);
+	tevent_req_done(req);
+}
+
+static NTSTATUS smbd_smb2_encrypt_async_recv(struct tevent_req *req,
+					     TALLOC_CTX *mem_ctx,
+					     uint8_t **pbuf,
+					     size_t *pbuflen)
+{
+	struct smbd_smb2_encrypt_async_state *state = tevent_req_data(
+		req, struct smbd_smb2_encrypt_async_state);
+	NTSTATUS status;
+
+	if (tevent_req_is_nterror(req, &status)) {
+		tevent_req_received(req);
+		return status;
+	}
+	*pbuf = talloc_move(mem_ctx, &state->buf);
+	*pbuflen = state->buflen;
+	tevent_req_received(req);
+	return NT_STATUS_OK;
+}
+
+static bool smbd_smb2_encrypt_async_wanted(struct smbd_smb2_request *req,
+					   const struct iovec *vector,
+					   int count)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	size_t min_size;
+	ssize_t len;
+
+	if (req->preauth != NULL) {
+		return false;
+	}
+
+	if (req->first_key.length == 0) {
+		return false;
+	}
+
+	switch (xconn->smb2.server.cipher) {
+	case SMB2_ENCRYPTION_AES128_CCM:
+	case SMB2_ENCRYPTION_AES128_GCM:
+		break;
+	default:
+		return false;
+	}
+
+	min_size = lp_parm_ulong(-1, "smbd", "async encryption size",
+				 64*1024);
+	if (min_size == 0) {
+		return false;
+	}
+
+	len = iov_buflen(vector, count);
+	if (len == -1 || (size_t)len < min_size) {
+		return false;
+	}
+
+	return true;
+}
+
+static void smbd_smb2_encrypt_async_done(struct tevent_req *subreq);
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -2741,6 +3075,7 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	struct iovec *firsttf = SMBD_SMB2_IDX_TF_IOV(req,out,first_idx);
 	struct iovec *outhdr = SMBD_SMB2_OUT_HDR_IOV(req);
 	struct iovec *outdyn = SMBD_SMB2_OUT_DYN_IOV(req);
+	bool async_encrypt = false;
 	NTSTATUS status;
 	bool ok;
 
@@ -2883,6 +3218,16 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	 * now check if we need to sign the current response
 	 */
 	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
+		async_encrypt = smbd_smb2_encrypt_async_wanted(
+			req, firsttf, req->out.vector_count - first_idx);
+	}
+
+	if (async_encrypt) {
+		/*
+		 * Done by smbd_smb2_encrypt_async_send() below,
+		 * once the request is queued.
+		 */
+	} else if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
 		status = smb2_signing_encrypt_pdu(req->first_key,
 					xconn->smb2.server.cipher,
 					firsttf,
@@ -2902,7 +3247,7 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 			return status;
 		}
 	}
-	if (req->first_key.length > 0) {
+	if (!async_encrypt && req->first_key.length > 0) {
 		data_blob_clear_free(&req->first_key);
 	}
 
@@ -2953,6 +3298,24 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	DLIST_ADD_END(xconn->smb2.send_queue, &req->queue_entry);
 	xconn->smb2.send_queue_len++;
 
+	if (async_encrypt) {
+		struct tevent_req *subreq = NULL;
+
+		subreq = smbd_smb2_encrypt_async_send(req,
+					req->sconn->ev_ctx,
+					xconn,
+					req->first_key,
+					firsttf,
+					req->out.vector_count - first_idx);
+		if (subreq == NULL) {
+			return NT_STATUS_NO_MEMORY;
+		}
+		tevent_req_set_callback(subreq,
+					smbd_smb2_encrypt_async_done,
+					req);
+		req->queue_entry.crypto_subreq = subreq;
+	}
+
 	status = smbd_smb2_flush_send_queue(xconn);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
@@ -2961,6 +3324,52 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	return NT_STATUS_OK;
 }
 
+static void smbd_smb2_encrypt_async_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct iovec *vector = NULL;
+	uint8_t *buf = NULL;
+	size_t buflen = 0;
+	NTSTATUS status;
+
+	SMB_ASSERT(req->queue_entry.crypto_subreq == subreq);
+
+	status = smbd_smb2_encrypt_async_recv(subreq, req, &buf, &buflen);
+	TALLOC_FREE(subreq);
+	req->queue_entry.crypto_subreq = NULL;
+	data_blob_clear_free(&req->first_key);
+
+	if (NT_STATUS_IS_OK(status)) {
+		/*
+		 * Send the NBT header and the encrypted copy instead
+		 * of the plain PDU.
+		 */
+		vector = talloc_array(req, struct iovec, 2);
+		if (vector == NULL) {
+			status = NT_STATUS_NO_MEMORY;
+		}
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("async encryption failed for client %s: %s\n",
+			smbXsrv_connection_dbg(xconn), nt_errstr(status));
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	vector[0] = req->queue_entry.vector[0];
+	vector[1] = (struct iovec) { .iov_base = buf, .iov_len = buflen };
+	req->queue_entry.vector = vector;
+	req->queue_entry.count = 2;
+
+	status = smbd_smb2_flush_send_queue(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn);
 
 void smbd_smb2_request_dispatch_immediate(struct tevent_context *ctx,
@@ -3447,6 +3856,14 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 		return NT_STATUS_OK;
 	}
 
+	if (xconn->smb2.recvfile_pending) {
+		/*
+		 * The socket belongs to the recvfile worker,
+		 * smbd_smb2_recvfile_finish() calls us again.
+		 */
+		return NT_STATUS_OK;
+	}
+
 	max_send_queue_len = MAX(1, xconn->smb2.credits.max/16);
 	cur_send_queue_len = xconn->smb2.send_queue_len;
 
@@ -3474,6 +3891,28 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 	return NT_STATUS_OK;
 }
 
+/*
+ * The payload of the current recvfile write is read from the socket
+ * by a worker thread. Until it's done we must not read the next
+ * request, but replies can still be sent.
+ */
+void smbd_smb2_recvfile_start(struct smbXsrv_connection *xconn)
+{
+	SMB_ASSERT(!xconn->smb2.recvfile_pending);
+	SMB_ASSERT(xconn->smb2.request_read_state.req == NULL);
+
+	xconn->smb2.recvfile_pending = true;
+	TEVENT_FD_NOT_READABLE(xconn->transport.fde);
+}
+
+NTSTATUS smbd_smb2_recvfile_finish(struct smbXsrv_connection *xconn)
+{
+	SMB_ASSERT(xconn->smb2.recvfile_pending);
+
+	xconn->smb2.recvfile_pending = false;
+	return smbd_smb2_request_next_incoming(xconn);
+}
+
 void smbd_smb2_process_negprot(struct smbXsrv_connection *xconn,
 			       uint64_t expected_seq_low,
 			       const uint8_t *inpdu, size_t size)
@@ -3584,8 +4023,64 @@ static int socket_error_from_errno(int ret,
 	return sys_errno;
 }
 
+/*
+ * Collect the vectors of the responses at the head of the send
+ * queue, so that they go out with a single syscall. Responses that
+ * need sendfile or are still being encrypted end the batch.
+ */
+static int smbd_smb2_send_queue_gather(struct smbXsrv_connection *xconn,
+				       struct iovec *iov,
+				       int max_iov,
+				       size_t *num_entries,
+				       bool *more)
+{
+	struct smbd_smb2_send_queue *e = NULL;
+	int count = 0;
+
+	*num_entries = 0;
+	*more = false;
+
+	for (e = xconn->smb2.send_queue; e != NULL; e = e->next) {
+		int n = e->count;
+
+		if ((e->sendfile_header != NULL) ||
+		    (e->sendfile_subreq != NULL) ||
+		    (e->crypto_subreq != NULL)) {
+			break;
+		}
+
+		if (count + n > max_iov) {
+			*more = true;
+			if (count > 0) {
+				break;
+			}
+			/*
+			 * A single huge compound response,
+			 * send what fits.
+			 */
+			n = max_iov;
+		}
+
+		memcpy(&iov[count], e->vector, n * sizeof(struct iovec));
+		count += n;
+		*num_entries += 1;
+	}
+
+	return count;
+}
+
+static void smbd_smb2_sendfile_async_done(struct tevent_req *subreq);
+
 static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 {
+	struct iovec iov[IOV_MAX];
+	struct msghdr msg;
+	int iov_count;
+	size_t num_entries;
+	size_t sent;
+	size_t i;
+	bool more;
+	int flags;
 	int ret;
 	int err;
 	bool retry;
@@ -3600,6 +4095,26 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
 		bool ok;
 
+		if (e->sendfile_subreq != NULL) {
+			/*
+			 * A worker is busy writing to the socket,
+			 * smbd_smb2_sendfile_async_done() will
+			 * restart us.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			return NT_STATUS_OK;
+		}
+
+		if (e->crypto_subreq != NULL) {
+			/*
+			 * A worker is still encrypting the PDU,
+			 * smbd_smb2_encrypt_async_done() will
+			 * restart us.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			return NT_STATUS_OK;
+		}
+
 		if (e->sendfile_header != NULL) {
 			size_t size = 0;
 			size_t i = 0;
@@ -3630,9 +4145,35 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 
 			e->sendfile_header->data = buf;
 			e->sendfile_header->length = size;
-			e->sendfile_status = &status;
 			e->count = 0;
 
+			if (e->sendfile_read_state != NULL) {
+				struct smbd_smb2_request *req =
+					talloc_get_type_abort(
+						e->mem_ctx,
+						struct smbd_smb2_request);
+				struct tevent_req *subreq = NULL;
+
+				subreq = smb2_sendfile_async_send(
+					e->mem_ctx,
+					xconn->ev_ctx,
+					xconn,
+					e->sendfile_read_state,
+					e->sendfile_header);
+				if (subreq == NULL) {
+					return NT_STATUS_NO_MEMORY;
+				}
+				tevent_req_set_callback(
+					subreq,
+					smbd_smb2_sendfile_async_done,
+					xconn);
+				e->sendfile_subreq = subreq;
+				req->worker_jobs += 1;
+				TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+				return NT_STATUS_OK;
+			}
+
+			e->sendfile_status = &status;
 			xconn->smb2.send_queue_len--;
 			DLIST_REMOVE(xconn->smb2.send_queue, e);
 			/*
@@ -3647,7 +4188,28 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			continue;
 		}
 
-		ret = writev(xconn->transport.sock, e->vector, e->count);
+		iov_count = smbd_smb2_send_queue_gather(xconn,
+							iov,
+							ARRAY_SIZE(iov),
+							&num_entries,
+							&more);
+
+		msg = (struct msghdr) {
+			.msg_iov = iov,
+			.msg_iovlen = iov_count,
+		};
+		flags = 0;
+#ifdef MSG_MORE
+		if (more) {
+			/*
+			 * We only ran out of vectors and will
+			 * send the rest right away.
+			 */
+			flags |= MSG_MORE;
+		}
+#endif
+
+		ret = sendmsg(xconn->transport.sock, &msg, flags);
 		if (ret == 0) {
 			/* propagate end of file */
 			return NT_STATUS_INTERNAL_ERROR;
@@ -3662,20 +4224,40 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			return map_nt_error_from_unix_common(err);
 		}
 
-		ok = iov_advance(&e->vector, &e->count, ret);
-		if (!ok) {
-			return NT_STATUS_INTERNAL_ERROR;
+		DO_PROFILE_INC(smb2_send_queue_writes);
+		if (num_entries > 1) {
+			SMBPROFILE_COUNT_INCREMENT(smb2_send_queue_coalesced,
+						   profile_p,
+						   num_entries - 1);
 		}
 
-		if (e->count > 0) {
+		sent = ret;
+		for (i = 0; i < num_entries; i++) {
+			size_t len;
+
+			e = xconn->smb2.send_queue;
+			len = iov_buflen(e->vector, e->count);
+
+			if (sent < len) {
+				ok = iov_advance(&e->vector, &e->count, sent);
+				if (!ok) {
+					return NT_STATUS_INTERNAL_ERROR;
+				}
+				break;
+			}
+			sent -= len;
+
+			xconn->smb2.send_queue_len--;
+			DLIST_REMOVE(xconn->smb2.send_queue, e);
+			talloc_free(e->mem_ctx);
+		}
+
+		if (i < num_entries) {
 			/* we have more to write */
+			DO_PROFILE_INC(smb2_send_queue_partial_writes);
 			TEVENT_FD_WRITEABLE(xconn->transport.fde);
 			return NT_STATUS_OK;
 		}
-
-		xconn->smb2.send_queue_len--;
-		DLIST_REMOVE(xconn->smb2.send_queue, e);
-		talloc_free(e->mem_ctx);
 	}
 
 	/*
@@ -3691,6 +4273,42 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 	return NT_STATUS_OK;
 }
 
+static void smbd_smb2_sendfile_async_done(struct tevent_req *subreq)
+{
+	struct smbXsrv_connection *xconn = tevent_req_callback_data(
+		subreq, struct smbXsrv_connection);
+	struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
+	struct smbd_smb2_request *req = NULL;
+	NTSTATUS status;
+
+	SMB_ASSERT(e != NULL);
+	SMB_ASSERT(e->sendfile_subreq == subreq);
+	req = talloc_get_type_abort(e->mem_ctx, struct smbd_smb2_request);
+
+	status = smb2_sendfile_async_recv(subreq);
+	TALLOC_FREE(subreq);
+	e->sendfile_subreq = NULL;
+	req->worker_jobs -= 1;
+
+	xconn->smb2.send_queue_len--;
+	DLIST_REMOVE(xconn->smb2.send_queue, e);
+	talloc_free(e->mem_ctx);
+
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("async sendfile failed for client %s: %s. "
+			"Terminating\n",
+			smbXsrv_connection_dbg(xconn), nt_errstr(status));
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_flush_send_queue(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 				     uint16_t fde_flags)
 {
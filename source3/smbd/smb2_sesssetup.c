@@ -30,6 +30,7 @@
 #include "../lib/util/tevent_ntstatus.h"
 #include "lib/crypto/sha512.h"
 #include "lib/crypto/aes.h"
+#include "lib/crypto/aes_accel.h"
 #include "lib/crypto/aes_ccm_128.h"
 #include "lib/crypto/aes_gcm_128.h"
 
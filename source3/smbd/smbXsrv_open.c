@@ -1547,6 +1547,23 @@ NTSTATUS smbXsrv_open_global_traverse(
 	return status;
 }
 
+NTSTATUS smbXsrv_open_global_compact_step(unsigned max_records, int *moved)
+{
+	NTSTATUS status;
+
+	*moved = 0;
+
+	status = smbXsrv_open_global_init();
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("Failed to initialize open_global: %s\n",
+			nt_errstr(status));
+		return status;
+	}
+
+	return dbwrap_compact_step(smbXsrv_open_global_db_ctx, max_records,
+				   moved);
+}
+
 NTSTATUS smbXsrv_open_cleanup(uint64_t persistent_id)
 {
 	NTSTATUS status = NT_STATUS_OK;
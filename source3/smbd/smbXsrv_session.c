@@ -1952,3 +1952,20 @@ NTSTATUS smbXsrv_session_global_traverse(
 
 	return status;
 }
+
+NTSTATUS smbXsrv_session_global_compact_step(unsigned max_records, int *moved)
+{
+	NTSTATUS status;
+
+	*moved = 0;
+
+	status = smbXsrv_session_global_init(NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("Failed to initialize session_global: %s\n",
+			nt_errstr(status));
+		return status;
+	}
+
+	return dbwrap_compact_step(smbXsrv_session_global_db_ctx, max_records,
+				   moved);
+}
@@ -1252,3 +1252,20 @@ NTSTATUS smbXsrv_tcon_global_traverse(
 
 	return status;
 }
+
+NTSTATUS smbXsrv_tcon_global_compact_step(unsigned max_records, int *moved)
+{
+	NTSTATUS status;
+
+	*moved = 0;
+
+	status = smbXsrv_tcon_global_init();
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("Failed to initialize tcon_global: %s\n",
+			nt_errstr(status));
+		return status;
+	}
+
+	return dbwrap_compact_step(smbXsrv_tcon_global_db_ctx, max_records,
+				   moved);
+}
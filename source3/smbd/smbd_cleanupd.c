@@ -19,6 +19,8 @@
 
 #include "includes.h"
 #include "smbd_cleanupd.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
 #include "lib/util_procid.h"
 #include "lib/util/tevent_ntstatus.h"
 #include "lib/util/debug.h"
@@ -28,7 +30,10 @@
 #include "cleanupdb.h"
 
 struct smbd_cleanupd_state {
+	struct tevent_context *ev;
 	pid_t parent_pid;
+	int compact_interval;
+	unsigned compact_records;
 };
 
 static void smbd_cleanupd_shutdown(struct messaging_context *msg,
@@ -43,6 +48,7 @@ static void smbd_cleanupd_unlock(struct messaging_context *msg,
 				 void *private_data, uint32_t msg_type,
 				 struct server_id server_id,
 				 DATA_BLOB *data);
+static bool smbd_cleanupd_schedule_compact(struct tevent_req *req);
 
 struct tevent_req *smbd_cleanupd_send(TALLOC_CTX *mem_ctx,
 				      struct tevent_context *ev,
@@ -57,7 +63,12 @@ struct tevent_req *smbd_cleanupd_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->ev = ev;
 	state->parent_pid = parent_pid;
+	state->compact_interval = lp_parm_int(
+		-1, "smbd", "tdb compact interval", 0);
+	state->compact_records = lp_parm_int(
+		-1, "smbd", "tdb compact records", 100);
 
 	status = messaging_register(msg, req, MSG_SHUTDOWN,
 				    smbd_cleanupd_shutdown);
@@ -77,9 +88,74 @@ struct tevent_req *smbd_cleanupd_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	if (!smbd_cleanupd_schedule_compact(req)) {
+		tevent_req_oom(req);
+		return tevent_req_post(req, ev);
+	}
+
 	return req;
 }
 
+/*
+ * Give the free space in the volatile databases back a few records at
+ * a time. tdb_compact_step() never blocks on a lock held by a client
+ * smbd, it just tries again on the next round.
+ *
+ * Off by default, "smbd:tdb compact interval" sets the seconds between
+ * rounds. Databases with mutexes only get their records moved down,
+ * their files are never cut.
+ */
+
+static void smbd_cleanupd_compact(struct tevent_context *ev,
+				  struct tevent_timer *te,
+				  struct timeval current_time,
+				  void *private_data)
+{
+	struct tevent_req *req = talloc_get_type_abort(
+		private_data, struct tevent_req);
+	struct smbd_cleanupd_state *state = tevent_req_data(
+		req, struct smbd_cleanupd_state);
+	unsigned max_records = state->compact_records;
+	int moved;
+	NTSTATUS status;
+
+	status = share_mode_compact_step(max_records, &moved);
+	DBG_DEBUG("locking.tdb: %s, moved %d records\n",
+		  nt_errstr(status), moved);
+
+	status = smbXsrv_session_global_compact_step(max_records, &moved);
+	DBG_DEBUG("smbXsrv_session_global.tdb: %s, moved %d records\n",
+		  nt_errstr(status), moved);
+
+	status = smbXsrv_tcon_global_compact_step(max_records, &moved);
+	DBG_DEBUG("smbXsrv_tcon_global.tdb: %s, moved %d records\n",
+		  nt_errstr(status), moved);
+
+	status = smbXsrv_open_global_compact_step(max_records, &moved);
+	DBG_DEBUG("smbXsrv_open_global.tdb: %s, moved %d records\n",
+		  nt_errstr(status), moved);
+
+	if (!smbd_cleanupd_schedule_compact(req)) {
+		DBG_WARNING("Could not schedule the next tdb compaction\n");
+	}
+}
+
+static bool smbd_cleanupd_schedule_compact(struct tevent_req *req)
+{
+	struct smbd_cleanupd_state *state = tevent_req_data(
+		req, struct smbd_cleanupd_state);
+	struct tevent_timer *te;
+
+	if ((state->compact_interval <= 0) || (state->compact_records == 0)) {
+		return true;
+	}
+
+	te = tevent_add_timer(state->ev, state,
+			      timeval_current_ofs(state->compact_interval, 0),
+			      smbd_cleanupd_compact, req);
+	return (te != NULL);
+}
+
 static void smbd_cleanupd_shutdown(struct messaging_context *msg,
 				   void *private_data, uint32_t msg_type,
 				   struct server_id server_id,
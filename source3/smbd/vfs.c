@@ -383,6 +383,47 @@ bool smbd_vfs_init(connection_struct *conn)
 	return True;
 }
 
+/*****************************************************************
+ Code that uses fsp->fh->fd directly, for example from a worker
+ thread, must be sure that it is a kernel file descriptor opened by
+ the default backend and that nothing stacked above it does I/O
+ itself. vfs_ceph and vfs_glusterfs never pass calls down and keep
+ their own handles in the fd.
+******************************************************************/
+
+bool vfs_io_is_default(connection_struct *conn)
+{
+	const struct vfs_init_function_entry *entry = NULL;
+	struct vfs_handle_struct *handle = conn->vfs_handles;
+
+	for (entry = backends; entry != NULL; entry = entry->next) {
+		if (strcmp(entry->name, DEFAULT_VFS_MODULE_NAME) == 0) {
+			break;
+		}
+	}
+	if ((entry == NULL) || (handle == NULL)) {
+		return false;
+	}
+
+	for (; handle->next != NULL; handle = handle->next) {
+		const struct vfs_fn_pointers *fns = handle->fns;
+
+		if ((fns->pread_fn != NULL) ||
+		    (fns->pread_send_fn != NULL) ||
+		    (fns->pread_recv_fn != NULL) ||
+		    (fns->pwrite_fn != NULL) ||
+		    (fns->pwrite_send_fn != NULL) ||
+		    (fns->pwrite_recv_fn != NULL) ||
+		    (fns->sendfile_fn != NULL) ||
+		    (fns->recvfile_fn != NULL)) {
+			return false;
+		}
+	}
+
+	/* The terminal backend */
+	return (handle->fns == entry->fns);
+}
+
 /*******************************************************************
  Check if a file exists in the vfs.
 ********************************************************************/
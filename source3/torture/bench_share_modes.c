@@ -0,0 +1,117 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Measure open/close of a file that many others have open
+ *
+ * Copyright (C) Samba Team 2018
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "libsmb/libsmb.h"
+#include "libcli/security/security.h"
+
+extern int torture_numops;
+
+/*
+ * Every open handle is a share mode entry in the file's locking.tdb
+ * record, no matter which client holds it. Keep an increasing number
+ * of handles open and time torture_numops open/close pairs on top of
+ * them.
+ */
+
+static NTSTATUS bench_share_modes_open(struct cli_state *cli,
+				       const char *fname,
+				       uint16_t *pfnum)
+{
+	return cli_ntcreate(cli, fname, 0, FILE_GENERIC_READ,
+			    FILE_ATTRIBUTE_NORMAL,
+			    FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+			    FILE_OPEN_IF, 0, 0, pfnum, NULL);
+}
+
+bool run_bench_share_modes(int dummy)
+{
+	const char *fname = "bench_share_modes.dat";
+	static const int num_openers[] = { 0, 16, 64, 256, 1024 };
+	struct cli_state *cli = NULL;
+	uint16_t *fnums = NULL;
+	int num_open = 0;
+	NTSTATUS status;
+	bool ret = false;
+	size_t i;
+	int j;
+
+	if (!torture_open_connection(&cli, 0)) {
+		return false;
+	}
+
+	fnums = talloc_array(talloc_tos(), uint16_t,
+			     num_openers[ARRAY_SIZE(num_openers)-1]);
+	if (fnums == NULL) {
+		d_fprintf(stderr, "talloc failed\n");
+		goto done;
+	}
+
+	for (i=0; i<ARRAY_SIZE(num_openers); i++) {
+		struct timeval start;
+		double usecs;
+
+		while (num_open < num_openers[i]) {
+			status = bench_share_modes_open(
+				cli, fname, &fnums[num_open]);
+			if (!NT_STATUS_IS_OK(status)) {
+				d_fprintf(stderr, "open %s failed: %s\n",
+					  fname, nt_errstr(status));
+				goto done;
+			}
+			num_open += 1;
+		}
+
+		start = timeval_current();
+
+		for (j=0; j<torture_numops; j++) {
+			uint16_t fnum;
+
+			status = bench_share_modes_open(cli, fname, &fnum);
+			if (!NT_STATUS_IS_OK(status)) {
+				d_fprintf(stderr, "open %s failed: %s\n",
+					  fname, nt_errstr(status));
+				goto done;
+			}
+			status = cli_close(cli, fnum);
+			if (!NT_STATUS_IS_OK(status)) {
+				d_fprintf(stderr, "close failed: %s\n",
+					  nt_errstr(status));
+				goto done;
+			}
+		}
+
+		usecs = timeval_elapsed(&start) * 1000000 / torture_numops;
+
+		printf("%5d openers: %8.1f us per open/close\n",
+		       num_open, usecs);
+	}
+
+	ret = true;
+done:
+	for (j=0; j<num_open; j++) {
+		cli_close(cli, fnums[j]);
+	}
+	TALLOC_FREE(fnums);
+	cli_unlink(cli, fname, FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	torture_close_connection(cli);
+	return ret;
+}
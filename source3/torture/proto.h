@@ -112,10 +112,14 @@ bool run_notify_bench3(int dummy);
 bool run_dbwrap_watch1(int dummy);
 bool run_dbwrap_watch2(int dummy);
 bool run_dbwrap_do_locked1(int dummy);
+bool run_dbwrap_sharded1(int dummy);
+bool run_dbwrap_sharded2(int dummy);
+bool run_bench_dbwrap_sharded(int dummy);
 bool run_idmap_tdb_common_test(int dummy);
 bool run_local_dbwrap_ctdb(int dummy);
 bool run_qpathinfo_bufsize(int dummy);
 bool run_bench_pthreadpool(int dummy);
+bool run_bench_share_modes(int dummy);
 bool run_messaging_read1(int dummy);
 bool run_messaging_read2(int dummy);
 bool run_messaging_read3(int dummy);
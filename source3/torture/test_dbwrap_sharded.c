@@ -0,0 +1,529 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Test and measure the sharded dbwrap backend
+ * Copyright (C) Samba Team 2018
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "system/filesys.h"
+#include "lib/dbwrap/dbwrap.h"
+#include "lib/dbwrap/dbwrap_open.h"
+#include "lib/dbwrap/dbwrap_sharded.h"
+#include "lib/util/util_tdb.h"
+#include "lib/util/sys_rw.h"
+
+extern int torture_nprocs;
+extern int torture_numops;
+
+static struct db_context *open_sharded(TALLOC_CTX *mem_ctx,
+				       const char *name, int num_shards,
+				       int tdb_flags)
+{
+	struct db_context **shards;
+	struct db_context *db = NULL;
+	int i;
+
+	shards = talloc_zero_array(mem_ctx, struct db_context *, num_shards);
+	if (shards == NULL) {
+		return NULL;
+	}
+
+	for (i=0; i<num_shards; i++) {
+		char *shard_name = talloc_asprintf(shards, "%s.%d", name, i);
+		if (shard_name == NULL) {
+			goto done;
+		}
+		shards[i] = db_open(shards, shard_name, 0, tdb_flags,
+				    O_CREAT|O_RDWR, 0644,
+				    DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+		if (shards[i] == NULL) {
+			fprintf(stderr, "db_open(%s) failed: %s\n",
+				shard_name, strerror(errno));
+			goto done;
+		}
+	}
+
+	db = db_open_sharded(mem_ctx, name, shards, num_shards);
+	if (db == NULL) {
+		fprintf(stderr, "db_open_sharded failed: %s\n",
+			strerror(errno));
+	}
+done:
+	TALLOC_FREE(shards);
+	return db;
+}
+
+static void unlink_shards(const char *name, int num_shards)
+{
+	int i;
+
+	for (i=0; i<num_shards; i++) {
+		char *shard_name = talloc_asprintf(talloc_tos(), "%s.%d",
+						   name, i);
+		if (shard_name != NULL) {
+			unlink(shard_name);
+		}
+		TALLOC_FREE(shard_name);
+	}
+}
+
+static int sharded1_count_fn(struct db_record *rec, void *private_data)
+{
+	int *count = private_data;
+	*count += 1;
+	return 0;
+}
+
+static int sharded1_delete_fn(struct db_record *rec, void *private_data)
+{
+	NTSTATUS status = dbwrap_record_delete(rec);
+	return NT_STATUS_IS_OK(status) ? 0 : -1;
+}
+
+static int sharded1_stop_fn(struct db_record *rec, void *private_data)
+{
+	int *count = private_data;
+	*count += 1;
+	return 1;
+}
+
+static int sharded1_partition_fn(struct db_record *rec, unsigned partition,
+				 void *private_data)
+{
+	int *counts = private_data;
+	counts[partition] += 1;
+	return 0;
+}
+
+static void sharded1_parse_fn(size_t idx, TDB_DATA key, TDB_DATA data,
+			      void *private_data)
+{
+	int *vals = private_data;
+
+	if (data.dsize == sizeof(uint32_t)) {
+		vals[idx] = IVAL(data.dptr, 0);
+	}
+}
+
+bool run_dbwrap_sharded1(int dummy)
+{
+	const char *dbname = "test_sharded.tdb";
+	const int num_shards = 4;
+	const int num_keys = 200;
+	struct db_context *db;
+	NTSTATUS status;
+	bool ret = false;
+	int i, count;
+
+	db = open_sharded(talloc_tos(), dbname, num_shards,
+			  TDB_CLEAR_IF_FIRST);
+	if (db == NULL) {
+		return false;
+	}
+
+	for (i=0; i<num_keys; i++) {
+		status = dbwrap_store_uint32_bystring(
+			db, talloc_asprintf(talloc_tos(), "key%d", i), i);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "store failed: %s\n",
+				nt_errstr(status));
+			goto fail;
+		}
+	}
+
+	for (i=0; i<num_keys; i++) {
+		const char *key = talloc_asprintf(talloc_tos(), "key%d", i);
+		uint32_t val;
+
+		status = dbwrap_fetch_uint32_bystring(db, key, &val);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "fetch %s failed: %s\n", key,
+				nt_errstr(status));
+			goto fail;
+		}
+		if (val != (uint32_t)i) {
+			fprintf(stderr, "%s: got %u, expected %d\n",
+				key, (unsigned)val, i);
+			goto fail;
+		}
+		if (!dbwrap_exists(db, string_term_tdb_data(key))) {
+			fprintf(stderr, "%s does not exist\n", key);
+			goto fail;
+		}
+	}
+
+	{
+		/* Every other key exists, ask across all shards at once */
+		TDB_DATA keys[num_keys];
+		int vals[num_keys];
+
+		for (i=0; i<num_keys; i++) {
+			keys[i] = string_term_tdb_data(talloc_asprintf(
+				talloc_tos(), "key%d", i * 2));
+			vals[i] = -1;
+		}
+		status = dbwrap_parse_records(db, keys, num_keys,
+					      sharded1_parse_fn, vals);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "parse_records failed: %s\n",
+				nt_errstr(status));
+			goto fail;
+		}
+		for (i=0; i<num_keys; i++) {
+			int expected = (i * 2 < num_keys) ? i * 2 : -1;
+			if (vals[i] != expected) {
+				fprintf(stderr, "parse_records key%d: got %d, "
+					"expected %d\n", i * 2, vals[i],
+					expected);
+				goto fail;
+			}
+		}
+	}
+
+	count = 0;
+	status = dbwrap_traverse_read(db, sharded1_count_fn, &count, NULL);
+	if (!NT_STATUS_IS_OK(status) || (count != num_keys)) {
+		fprintf(stderr, "traverse_read: %s, %d records, expected %d\n",
+			nt_errstr(status), count, num_keys);
+		goto fail;
+	}
+
+	{
+		int counts[3] = { 0, };
+
+		status = dbwrap_traverse_read_parallel(
+			db, ARRAY_SIZE(counts), sharded1_partition_fn,
+			counts, &count);
+		/* tdb shards can be partitioned, no fallback */
+		if (!NT_STATUS_IS_OK(status) || (count != num_keys) ||
+		    (counts[0] == 0) || (counts[1] == 0) || (counts[2] == 0) ||
+		    (counts[0] + counts[1] + counts[2] != num_keys)) {
+			fprintf(stderr, "traverse_read_parallel: %s, %d "
+				"records (%d/%d/%d), expected %d\n",
+				nt_errstr(status), count, counts[0],
+				counts[1], counts[2], num_keys);
+			goto fail;
+		}
+	}
+
+	{
+		int counts[3] = { 0, };
+		struct db_record *rec;
+
+		/*
+		 * A locked record makes its shard unable to partition,
+		 * this must be found before any shard is looked at.
+		 * "key5" is in the last shard.
+		 */
+		rec = dbwrap_fetch_locked(db, talloc_tos(),
+					  string_term_tdb_data("key5"));
+		if (rec == NULL) {
+			fprintf(stderr, "fetch_locked failed\n");
+			goto fail;
+		}
+		status = dbwrap_traverse_read_parallel(
+			db, ARRAY_SIZE(counts), sharded1_partition_fn,
+			counts, &count);
+		TALLOC_FREE(rec);
+		if (!NT_STATUS_IS_OK(status) || (count != num_keys) ||
+		    (counts[0] != num_keys)) {
+			fprintf(stderr, "locked traverse_read_parallel: %s, "
+				"%d records (%d/%d/%d), expected %d\n",
+				nt_errstr(status), count, counts[0],
+				counts[1], counts[2], num_keys);
+			goto fail;
+		}
+	}
+
+	count = 0;
+	status = dbwrap_traverse_read(db, sharded1_stop_fn, &count, NULL);
+	if (!NT_STATUS_IS_OK(status) || (count != 1)) {
+		fprintf(stderr, "stopped traverse: %s, %d records\n",
+			nt_errstr(status), count);
+		goto fail;
+	}
+
+	status = dbwrap_traverse(db, sharded1_delete_fn, NULL, &count);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "traverse failed: %s\n", nt_errstr(status));
+		goto fail;
+	}
+
+	count = 0;
+	status = dbwrap_traverse_read(db, sharded1_count_fn, &count, NULL);
+	if (!NT_STATUS_IS_OK(status) || (count != 0)) {
+		fprintf(stderr, "%d records left after delete\n", count);
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(db);
+	unlink_shards(dbname, num_shards);
+	return ret;
+}
+
+/*
+ * db_open() with dbwrap_shards must divide the hash size configured
+ * for the database among the shards
+ */
+bool run_dbwrap_sharded2(int dummy)
+{
+	const char *dbname = "test_sharded2.tdb";
+	const int num_shards = 4;
+	struct db_context *db;
+	struct tdb_context *tdb = NULL;
+	char *shard_name = NULL;
+	NTSTATUS status;
+	bool ret = false;
+	int hash_size;
+
+	lp_set_cmdline("dbwrap_shards:test_sharded2.tdb", "4");
+	lp_set_cmdline("tdb_hashsize:test_sharded2.tdb", "1000");
+	/* tdb_open() below can't open mutex tdbs */
+	lp_set_cmdline("dbwrap_tdb_mutexes:test_sharded2.tdb", "no");
+
+	db = db_open(talloc_tos(), dbname, 0, TDB_CLEAR_IF_FIRST,
+		     O_CREAT|O_RDWR, 0644,
+		     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		fprintf(stderr, "db_open failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	status = dbwrap_store_uint32_bystring(db, "key", 1);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "store failed: %s\n", nt_errstr(status));
+		goto fail;
+	}
+
+	/* tdb won't open a file twice in one process */
+	TALLOC_FREE(db);
+
+	shard_name = talloc_asprintf(talloc_tos(), "%s.0", dbname);
+	if (shard_name == NULL) {
+		goto fail;
+	}
+	tdb = tdb_open(shard_name, 0, 0, O_RDWR, 0);
+	if (tdb == NULL) {
+		fprintf(stderr, "tdb_open(%s) failed: %s\n", shard_name,
+			strerror(errno));
+		goto fail;
+	}
+
+	hash_size = tdb_hash_size(tdb);
+	if (hash_size != 1000 / num_shards) {
+		fprintf(stderr, "shard hash size %d, expected %d\n",
+			hash_size, 1000 / num_shards);
+		goto fail;
+	}
+
+	ret = true;
+fail:
+	if (tdb != NULL) {
+		tdb_close(tdb);
+	}
+	TALLOC_FREE(shard_name);
+	TALLOC_FREE(db);
+	unlink_shards(dbname, num_shards);
+	return ret;
+}
+
+/*
+ * Like smbds opening and closing different files: Every process
+ * creates and deletes records of its own in a shared database.
+ */
+
+static bool bench_sharded_child(const char *dbname, int num_shards,
+				int ready_fd, int go_fd)
+{
+	struct db_context *db;
+	uint64_t keybuf[2] = { getpid(), 0 };
+	TDB_DATA key = { .dptr = (uint8_t *)keybuf, .dsize = sizeof(keybuf) };
+	uint8_t valbuf[200] = { 0, };
+	TDB_DATA value = { .dptr = valbuf, .dsize = sizeof(valbuf) };
+	char c = 0;
+	ssize_t nread;
+	int i;
+
+	db = open_sharded(talloc_tos(), dbname, num_shards, TDB_CLEAR_IF_FIRST);
+	if (db == NULL) {
+		return false;
+	}
+
+	if (sys_write(ready_fd, &c, 1) != 1) {
+		return false;
+	}
+	nread = sys_read(go_fd, &c, 1);
+	if (nread != 0) {
+		return false;
+	}
+
+	for (i=0; i<torture_numops; i++) {
+		struct db_record *rec;
+		NTSTATUS status;
+
+		keybuf[1] = i % 64;
+
+		rec = dbwrap_fetch_locked(db, talloc_tos(), key);
+		if (rec == NULL) {
+			return false;
+		}
+		status = dbwrap_record_store(rec, value, 0);
+		TALLOC_FREE(rec);
+		if (!NT_STATUS_IS_OK(status)) {
+			return false;
+		}
+
+		rec = dbwrap_fetch_locked(db, talloc_tos(), key);
+		if (rec == NULL) {
+			return false;
+		}
+		status = dbwrap_record_delete(rec);
+		TALLOC_FREE(rec);
+		if (!NT_STATUS_IS_OK(status)) {
+			return false;
+		}
+	}
+
+	TALLOC_FREE(db);
+	return true;
+}
+
+static bool bench_sharded_run(int num_shards, double *popsec)
+{
+	const char *dbname = "bench_sharded.tdb";
+	struct db_context *db;
+	int ready_fds[2] = { -1, -1 };
+	int go_fds[2] = { -1, -1 };
+	struct timeval start;
+	bool ret = false;
+	int i, num_children = 0;
+
+	/*
+	 * Keep the db open while the children run to avoid
+	 * TDB_CLEAR_IF_FIRST wiping it underneath them.
+	 */
+	db = open_sharded(talloc_tos(), dbname, num_shards, TDB_CLEAR_IF_FIRST);
+	if (db == NULL) {
+		return false;
+	}
+
+	if ((pipe(ready_fds) != 0) || (pipe(go_fds) != 0)) {
+		perror("pipe");
+		goto done;
+	}
+
+	for (i=0; i<torture_nprocs; i++) {
+		pid_t pid = fork();
+
+		if (pid == -1) {
+			perror("fork");
+			goto done;
+		}
+		if (pid == 0) {
+			bool ok;
+			close(ready_fds[0]);
+			close(go_fds[1]);
+			ok = bench_sharded_child(dbname, num_shards,
+						 ready_fds[1], go_fds[0]);
+			_exit(ok ? 0 : 1);
+		}
+		num_children += 1;
+	}
+
+	close(ready_fds[1]);
+	ready_fds[1] = -1;
+	close(go_fds[0]);
+	go_fds[0] = -1;
+
+	for (i=0; i<num_children; i++) {
+		char c;
+		if (sys_read(ready_fds[0], &c, 1) != 1) {
+			fprintf(stderr, "child did not start\n");
+			goto done;
+		}
+	}
+
+	start = timeval_current();
+	close(go_fds[1]);
+	go_fds[1] = -1;
+
+	ret = true;
+
+	while (num_children > 0) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("waitpid");
+			ret = false;
+			break;
+		}
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			fprintf(stderr, "child %d failed\n", (int)pid);
+			ret = false;
+		}
+		num_children -= 1;
+	}
+
+	*popsec = (double)torture_nprocs * torture_numops * 2 /
+		timeval_elapsed(&start);
+
+done:
+	if (go_fds[1] != -1) {
+		close(go_fds[1]);
+	}
+	while ((num_children > 0) && (waitpid(-1, NULL, 0) > 0)) {
+		num_children -= 1;
+	}
+	if (ready_fds[0] != -1) {
+		close(ready_fds[0]);
+	}
+	if (ready_fds[1] != -1) {
+		close(ready_fds[1]);
+	}
+	if (go_fds[0] != -1) {
+		close(go_fds[0]);
+	}
+	TALLOC_FREE(db);
+	unlink_shards(dbname, num_shards);
+	return ret;
+}
+
+bool run_bench_dbwrap_sharded(int dummy)
+{
+	static const int shards[] = { 1, 2, 4, 8, 16 };
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(shards); i++) {
+		double opsec = 0;
+		bool ok;
+
+		ok = bench_sharded_run(shards[i], &opsec);
+		if (!ok) {
+			return false;
+		}
+		printf("%2d shards, %d processes: %10.0f ops/sec\n",
+		       shards[i], torture_nprocs, opsec);
+	}
+
+	return true;
+}
@@ -640,6 +640,47 @@ out:
 	return retval;
 }
 
+static bool test_sids2unixids4(TALLOC_CTX *memctx, struct idmap_domain *dom)
+{
+	NTSTATUS status;
+	struct id_map **test_maps;
+
+	test_maps = talloc_zero_array(memctx, struct id_map*, 3);
+
+	test_maps[0] = talloc(test_maps, struct id_map);
+	test_maps[1] = talloc(test_maps, struct id_map);
+	test_maps[2] = NULL;
+
+	/* ask for the same new mapping twice in one request */
+	test_maps[0]->sid = dom_sid_parse_talloc(test_maps, DOM_SID4 "-1006");
+	test_maps[0]->xid.type = ID_TYPE_UID;
+	test_maps[1]->sid = dom_sid_parse_talloc(test_maps, DOM_SID4 "-1006");
+	test_maps[1]->xid.type = ID_TYPE_UID;
+
+	status = idmap_tdb_common_sids_to_unixids(dom, test_maps);
+	if(!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_sids2sunixids4: sids2unixids "
+			  "failed (%s)!\n", nt_errstr(status)));
+		talloc_free(test_maps);
+		return false;
+	}
+
+	if(test_maps[0]->xid.id == 0 ||
+	   test_maps[0]->xid.type != test_maps[1]->xid.type ||
+	   test_maps[0]->xid.id != test_maps[1]->xid.id) {
+		DEBUG(0, ("test_sids2sunixids4: sids2unixids "
+			  "returned different ids for the same sid!\n"));
+		talloc_free(test_maps);
+		return false;
+	}
+
+	DEBUG(0, ("test_sids2unixids4: PASSED!\n"));
+
+	talloc_free(test_maps);
+
+	return true;
+}
+
 static bool test_unixid2sid1(TALLOC_CTX *memctx, struct idmap_domain *dom)
 {
 	NTSTATUS status1, status2, status3;
@@ -1001,6 +1042,8 @@ bool run_idmap_tdb_common_test(int dummy)
 	CHECKRESULT(result);
 	result = test_sids2unixids3(memctx, dom);
 	CHECKRESULT(result);
+	result = test_sids2unixids4(memctx, dom);
+	CHECKRESULT(result);
 
 	/* test idmap_tdb_common_unixid_to_sid */
 	result = test_unixid2sid1(memctx, dom);
@@ -2721,6 +2721,133 @@ fail_nofd:
 	return correct;
 }
 
+/*
+  test conflict checks on a file with many byte range locks
+*/
+static bool run_locktest10(int dummy)
+{
+	struct cli_state *cli1, *cli2;
+	const char *fname = "\\lockt10.lck";
+	const int num_locks = 2000;
+	uint16_t fnum1, fnum2;
+	uint8_t buf[10];
+	bool correct = false;
+	size_t nread;
+	NTSTATUS status;
+	int i;
+
+	if (!torture_open_connection(&cli1, 0) ||
+	    !torture_open_connection(&cli2, 1)) {
+		return false;
+	}
+
+	printf("starting locktest10\n");
+
+	cli_unlink(cli1, fname, FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+
+	status = cli_openx(cli1, fname, O_RDWR|O_CREAT|O_EXCL, DENY_NONE,
+			   &fnum1);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("open of %s failed (%s)\n", fname, nt_errstr(status));
+		goto fail;
+	}
+	status = cli_openx(cli2, fname, O_RDWR, DENY_NONE, &fnum2);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("open of %s failed (%s)\n", fname, nt_errstr(status));
+		goto fail;
+	}
+
+	memset(buf, 0, sizeof(buf));
+
+	/*
+	 * Lock 10 bytes every 100 bytes, write locks on even, read
+	 * locks on odd slots. Add them backwards to test the sorting.
+	 */
+	for (i = num_locks - 1; i >= 0; i--) {
+		status = cli_lock64(cli1, fnum1, i * 100, 10, 0,
+				    (i % 2) ? READ_LOCK : WRITE_LOCK);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("lock %d failed (%s)\n", i, nt_errstr(status));
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < num_locks; i += 37) {
+		status = cli_lock64(cli2, fnum2, i * 100 + 5, 1, 0,
+				    WRITE_LOCK);
+		if (NT_STATUS_IS_OK(status)) {
+			printf("lock inside range %d succeeded\n", i);
+			goto fail;
+		}
+
+		status = cli_lock64(cli2, fnum2, i * 100 + 50, 10, 0,
+				    WRITE_LOCK);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("lock between ranges %d failed (%s)\n", i,
+			       nt_errstr(status));
+			goto fail;
+		}
+		status = cli_unlock64(cli2, fnum2, i * 100 + 50, 10);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("unlock between ranges %d failed (%s)\n", i,
+			       nt_errstr(status));
+			goto fail;
+		}
+
+		status = cli_read(cli2, fnum2, (char *)buf, i * 100 + 5, 1,
+				  &nread);
+		if ((i % 2) && !NT_STATUS_IS_OK(status)) {
+			printf("read in read locked range %d failed (%s)\n",
+			       i, nt_errstr(status));
+			goto fail;
+		}
+		if (!(i % 2) && NT_STATUS_IS_OK(status)) {
+			printf("read in write locked range %d succeeded\n", i);
+			goto fail;
+		}
+
+		status = cli_writeall(cli2, fnum2, 0, buf, i * 100 + 5, 1,
+				      NULL);
+		if (NT_STATUS_IS_OK(status)) {
+			printf("write in locked range %d succeeded\n", i);
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < num_locks; i += 2) {
+		status = cli_unlock64(cli1, fnum1, i * 100, 10);
+		if (!NT_STATUS_IS_OK(status)) {
+			printf("unlock %d failed (%s)\n", i, nt_errstr(status));
+			goto fail;
+		}
+	}
+
+	for (i = 0; i < num_locks; i += 37) {
+		status = cli_lock64(cli2, fnum2, i * 100, 10, 0, WRITE_LOCK);
+		if ((i % 2) && NT_STATUS_IS_OK(status)) {
+			printf("lock on read locked range %d succeeded\n", i);
+			goto fail;
+		}
+		if (!(i % 2) && !NT_STATUS_IS_OK(status)) {
+			printf("lock on unlocked range %d failed (%s)\n", i,
+			       nt_errstr(status));
+			goto fail;
+		}
+	}
+
+	correct = true;
+
+fail:
+	cli_close(cli1, fnum1);
+	cli_close(cli2, fnum2);
+	cli_unlink(cli1, fname, FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	torture_close_connection(cli1);
+	torture_close_connection(cli2);
+
+	printf("finished locktest10\n");
+	return correct;
+}
+
 /*
 test whether fnums and tids open on one VC are available on another (a major
 security hole)
@@ -11452,6 +11579,7 @@ static struct {
 	{"LOCK7",  run_locktest7,  0},
 	{"LOCK8",  run_locktest8,  0},
 	{"LOCK9",  run_locktest9,  0},
+	{"LOCK10", run_locktest10, 0},
 	{"UNLINK", run_unlinktest, 0},
 	{"BROWSE", run_browsetest, 0},
 	{"ATTR",   run_attrtest,   0},
@@ -11529,6 +11657,7 @@ static struct {
 	{ "NOTIFY-BENCH", run_notify_bench },
 	{ "NOTIFY-BENCH2", run_notify_bench2 },
 	{ "NOTIFY-BENCH3", run_notify_bench3 },
+	{ "SHARE-MODES-BENCH", run_bench_share_modes },
 	{ "BAD-NBT-SESSION", run_bad_nbt_session },
 	{ "IGN-BAD-NEGPROT", run_ign_bad_negprot },
 	{ "SMB-ANY-CONNECT", run_smb_any_connect },
@@ -11551,6 +11680,8 @@ static struct {
 	{ "LOCAL-DBWRAP-WATCH1", run_dbwrap_watch1, 0 },
 	{ "LOCAL-DBWRAP-WATCH2", run_dbwrap_watch2, 0 },
 	{ "LOCAL-DBWRAP-DO-LOCKED1", run_dbwrap_do_locked1, 0 },
+	{ "LOCAL-DBWRAP-SHARDED1", run_dbwrap_sharded1, 0 },
+	{ "LOCAL-DBWRAP-SHARDED2", run_dbwrap_sharded2, 0 },
 	{ "LOCAL-MESSAGING-READ1", run_messaging_read1, 0 },
 	{ "LOCAL-MESSAGING-READ2", run_messaging_read2, 0 },
 	{ "LOCAL-MESSAGING-READ3", run_messaging_read3, 0 },
@@ -11578,6 +11709,7 @@ static struct {
 	{ "local-tdb-writer", run_local_tdb_writer, 0 },
 	{ "LOCAL-DBWRAP-CTDB", run_local_dbwrap_ctdb, 0 },
 	{ "LOCAL-BENCH-PTHREADPOOL", run_bench_pthreadpool, 0 },
+	{ "LOCAL-BENCH-DBWRAP-SHARDED", run_bench_dbwrap_sharded, 0 },
 	{ "LOCAL-PTHREADPOOL-TEVENT", run_pthreadpool_tevent, 0 },
 	{ "LOCAL-G-LOCK1", run_g_lock1, 0 },
 	{ "LOCAL-G-LOCK2", run_g_lock2, 0 },
@@ -37,6 +37,32 @@ static void profile_separator(const char * title)
     d_printf("%s\n", line);
 }
 
+/*
+ * Print the non-empty buckets of a latency histogram, labelled with
+ * their upper bound (the last one with its lower bound).
+ */
+static void profile_latency_dump(const char *name, const uint64_t *latency)
+{
+	size_t i;
+
+	for (i = 0; i < SMBPROFILE_HISTOGRAM_BUCKETS; i++) {
+		char field[60];
+
+		if (latency[i] == 0) {
+			continue;
+		}
+
+		if (i < SMBPROFILE_HISTOGRAM_BUCKETS - 1) {
+			snprintf(field, sizeof(field), "%s_latency_lt_%juus:",
+				 name, (uintmax_t)1 << i);
+		} else {
+			snprintf(field, sizeof(field), "%s_latency_ge_%juus:",
+				 name, (uintmax_t)1 << (i - 1));
+		}
+		d_printf("%-59s%20ju\n", field, (uintmax_t)latency[i]);
+	}
+}
+
 /*******************************************************************
  dump the elements of the profile structure
   ******************************************************************/
@@ -67,12 +93,14 @@ bool status_profile_dump(bool verbose)
 #define SMBPROFILE_STATS_BASIC(name) do { \
 	__PRINT_FIELD_LINE(#name, name##_stats,  count); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  time); \
+	profile_latency_dump(#name, stats.values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_BYTES(name) do { \
 	__PRINT_FIELD_LINE(#name, name##_stats,  count); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  time); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  idle); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  bytes); \
+	profile_latency_dump(#name, stats.values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_IOBYTES(name) do { \
 	__PRINT_FIELD_LINE(#name, name##_stats,  count); \
@@ -80,6 +108,7 @@ bool status_profile_dump(bool verbose)
 	__PRINT_FIELD_LINE(#name, name##_stats,  idle); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  inbytes); \
 	__PRINT_FIELD_LINE(#name, name##_stats,  outbytes); \
+	profile_latency_dump(#name, stats.values.name##_stats.latency); \
 } while(0);
 #define SMBPROFILE_STATS_SECTION_END
 #define SMBPROFILE_STATS_END
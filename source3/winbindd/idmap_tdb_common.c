@@ -539,10 +539,131 @@ struct idmap_tdb_common_sids_to_unixids_context {
 				      struct id_map * map);
 };
 
+struct idmap_tdb_common_sids_parse_state {
+	struct idmap_domain *dom;
+	struct id_map **ids;
+	size_t *idxs;
+	NTSTATUS *results;
+};
+
+static void idmap_tdb_common_sids_parser(size_t key_idx, TDB_DATA key,
+					 TDB_DATA data, void *private_data)
+{
+	struct idmap_tdb_common_sids_parse_state *state = private_data;
+	size_t idx = state->idxs[key_idx];
+	struct id_map *map = state->ids[idx];
+	unsigned long rec_id = 0;
+
+	if ((data.dsize == 0) || (data.dptr[data.dsize-1] != '\0')) {
+		DBG_DEBUG("Invalid record length %zu\n", data.dsize);
+		state->results[idx] = NT_STATUS_INTERNAL_DB_ERROR;
+		return;
+	}
+
+	if (sscanf((const char *)data.dptr, "UID %lu", &rec_id) == 1) {
+		map->xid.type = ID_TYPE_UID;
+	} else if (sscanf((const char *)data.dptr, "GID %lu", &rec_id) == 1) {
+		map->xid.type = ID_TYPE_GID;
+	} else {
+		DEBUG(2, ("Found INVALID record %s -> %s\n",
+			  (const char *)key.dptr, (const char *)data.dptr));
+		state->results[idx] = NT_STATUS_INTERNAL_DB_ERROR;
+		return;
+	}
+	map->xid.id = rec_id;
+
+	DEBUG(10, ("Found record %s -> %s\n", (const char *)key.dptr,
+		   (const char *)data.dptr));
+
+	/* apply filters before returning result */
+	if (!idmap_unix_id_is_in_range(map->xid.id, state->dom)) {
+		DEBUG(5,
+		      ("Requested id (%u) out of range (%u - %u). Filtered!\n",
+		       map->xid.id, state->dom->low_id, state->dom->high_id));
+		return;
+	}
+
+	state->results[idx] = NT_STATUS_OK;
+}
+
+/*
+ * Batched idmap_tdb_common_sid_to_unixid() for all ids still to be
+ * mapped: One dbwrap_parse_records() call looks at the sids grouped by
+ * hash chain instead of locking a chain per sid.
+ *
+ * Returns an array with the idmap_tdb_common_sid_to_unixid() result
+ * for every entry in ids.
+ */
+static NTSTATUS idmap_tdb_common_sids_to_unixids_batch(
+	TALLOC_CTX *mem_ctx, struct db_context *db,
+	struct idmap_domain *dom, struct id_map **ids, NTSTATUS **presults)
+{
+	struct idmap_tdb_common_sids_parse_state state = {
+		.dom = dom, .ids = ids,
+	};
+	TALLOC_CTX *frame;
+	TDB_DATA *keys;
+	size_t i, num_ids, num_keys = 0;
+	NTSTATUS status;
+
+	for (num_ids = 0; ids[num_ids]; num_ids++) {
+		;
+	}
+
+	state.results = talloc_array(mem_ctx, NTSTATUS, num_ids);
+	if (state.results == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	frame = talloc_stackframe();
+	keys = talloc_array(frame, TDB_DATA, num_ids);
+	state.idxs = talloc_array(frame, size_t, num_ids);
+	if ((keys == NULL) || (state.idxs == NULL)) {
+		status = NT_STATUS_NO_MEMORY;
+		goto fail;
+	}
+
+	for (i = 0; i < num_ids; i++) {
+		char *keystr;
+
+		state.results[i] = NT_STATUS_NONE_MAPPED;
+
+		if ((ids[i]->status != ID_UNKNOWN) &&
+		    (ids[i]->status != ID_UNMAPPED)) {
+			continue;
+		}
+
+		keystr = sid_string_talloc(keys, ids[i]->sid);
+		if (keystr == NULL) {
+			status = NT_STATUS_NO_MEMORY;
+			goto fail;
+		}
+		keys[num_keys] = string_term_tdb_data(keystr);
+		state.idxs[num_keys] = i;
+		num_keys += 1;
+	}
+
+	status = dbwrap_parse_records(db, keys, num_keys,
+				      idmap_tdb_common_sids_parser, &state);
+	if (!NT_STATUS_IS_OK(status)) {
+		goto fail;
+	}
+
+	TALLOC_FREE(frame);
+	*presults = state.results;
+	return NT_STATUS_OK;
+
+fail:
+	TALLOC_FREE(frame);
+	TALLOC_FREE(state.results);
+	return status;
+}
+
 static NTSTATUS idmap_tdb_common_sids_to_unixids_action(struct db_context *db,
 							void *private_data)
 {
 	struct idmap_tdb_common_sids_to_unixids_context *state = private_data;
+	NTSTATUS *results = NULL;
 	int i, num_mapped = 0;
 	NTSTATUS ret = NT_STATUS_OK;
 
@@ -550,14 +671,26 @@ static NTSTATUS idmap_tdb_common_sids_to_unixids_action(struct db_context *db,
 		   " domain: [%s], allocate: %s\n",
 		   state->dom->name, state->allocate_unmapped ? "yes" : "no"));
 
+	if (state->sid_to_unixid_fn == idmap_tdb_common_sid_to_unixid) {
+		ret = idmap_tdb_common_sids_to_unixids_batch(
+			talloc_tos(), db, state->dom, state->ids, &results);
+		if (!NT_STATUS_IS_OK(ret)) {
+			return ret;
+		}
+	}
+
 	for (i = 0; state->ids[i]; i++) {
 		if ((state->ids[i]->status == ID_UNKNOWN) ||
 		    /* retry if we could not map in previous run: */
 		    (state->ids[i]->status == ID_UNMAPPED)) {
 			NTSTATUS ret2;
 
-			ret2 = state->sid_to_unixid_fn(state->dom,
-					state->ids[i]);
+			if (results != NULL) {
+				ret2 = results[i];
+			} else {
+				ret2 = state->sid_to_unixid_fn(state->dom,
+						state->ids[i]);
+			}
 
 			if (!NT_STATUS_IS_OK(ret2)) {
 
@@ -586,6 +719,28 @@ static NTSTATUS idmap_tdb_common_sids_to_unixids_action(struct db_context *db,
 			num_mapped += 1;
 		}
 
+		if ((state->ids[i]->status == ID_UNMAPPED) &&
+		    state->allocate_unmapped && (results != NULL)) {
+			NTSTATUS ret2;
+
+			/*
+			 * The batched lookup ran before any allocation,
+			 * the same sid may have been mapped for an earlier
+			 * entry of ids in the meantime.
+			 */
+			ret2 = state->sid_to_unixid_fn(state->dom,
+						       state->ids[i]);
+			if (NT_STATUS_IS_OK(ret2)) {
+				state->ids[i]->status = ID_MAPPED;
+				num_mapped += 1;
+				continue;
+			}
+			if (!NT_STATUS_EQUAL(ret2, NT_STATUS_NONE_MAPPED)) {
+				ret = ret2;
+				goto done;
+			}
+		}
+
 		if ((state->ids[i]->status == ID_UNMAPPED) &&
 		    state->allocate_unmapped) {
 			ret =
@@ -599,6 +754,7 @@ static NTSTATUS idmap_tdb_common_sids_to_unixids_action(struct db_context *db,
 	}
 
 done:
+	TALLOC_FREE(results);
 
 	if (NT_STATUS_IS_OK(ret) ||
 	    NT_STATUS_EQUAL(ret, STATUS_SOME_UNMAPPED)) {
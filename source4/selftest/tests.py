@@ -353,6 +353,10 @@ for t in ["local.convert_string_handle", "local.convert_string", "local.ndr"]:
 tdbtorture4 = binpath("tdbtorture")
 if os.path.exists(tdbtorture4):
     plantestsuite("tdb.stress", "none", valgrindify(tdbtorture4))
+    plantestsuite("tdb.stress-chain-freelists", "none",
+                  [valgrindify(tdbtorture4), "-c"])
+    plantestsuite("tdb.stress-wal", "none",
+                  [valgrindify(tdbtorture4), "-w"])
 else:
     skiptestsuite("tdb.stress", "Using system TDB, tdbtorture not available")
 
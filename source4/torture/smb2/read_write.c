@@ -0,0 +1,141 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   SMB2 read/write test suite
+
+   Copyright (C) Samba Team 2018
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "libcli/smb2/smb2.h"
+#include "libcli/smb2/smb2_calls.h"
+
+#include "torture/torture.h"
+#include "torture/smb2/proto.h"
+
+#define CHECK_STATUS(_status, _expected) \
+	torture_assert_ntstatus_equal_goto(torture, _status, _expected, \
+		 ret, done, "Incorrect status")
+
+#define CHECK_VALUE(v, correct) \
+	torture_assert_int_equal_goto(torture, v, correct, \
+		 ret, done, "Incorrect value")
+
+#define FNAME "smb2_rwtest.dat"
+
+#define NUM_WRITES 16
+#define WRITE_SIZE 4096
+
+/*
+ * Send small adjacent writes on one handle before waiting for any of
+ * them, in a random order. NUM_WRITES stays below the 31 credits the
+ * client asks for by default. Servers may process or merge them
+ * in any order, the result must be the same as writing them one by
+ * one.
+ */
+static bool test_rw_parallel(struct torture_context *torture,
+			     struct smb2_tree *tree)
+{
+	bool ret = true;
+	NTSTATUS status;
+	struct smb2_handle h = {{0}};
+	size_t chunk = WRITE_SIZE;
+	size_t len = NUM_WRITES * WRITE_SIZE;
+	struct smb2_request *req[NUM_WRITES];
+	struct smb2_write w[NUM_WRITES];
+	unsigned order[NUM_WRITES];
+	struct smb2_read rd;
+	uint8_t *buf = NULL;
+	TALLOC_CTX *tmp_ctx = talloc_new(tree);
+	unsigned i;
+
+	torture_assert_goto(torture, tmp_ctx != NULL, ret, done,
+			    "talloc_new failed");
+
+	buf = talloc_array(tmp_ctx, uint8_t, len);
+	torture_assert_goto(torture, buf != NULL, ret, done,
+			    "talloc_array failed");
+	for (i = 0; i < len; i++) {
+		buf[i] = random();
+	}
+
+	for (i = 0; i < NUM_WRITES; i++) {
+		order[i] = i;
+	}
+	for (i = NUM_WRITES - 1; i > 0; i--) {
+		unsigned j = random() % (i + 1);
+		unsigned tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	smb2_util_unlink(tree, FNAME);
+
+	status = torture_smb2_testfile(tree, FNAME, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	for (i = 0; i < NUM_WRITES; i++) {
+		unsigned n = order[i];
+
+		ZERO_STRUCT(w[i]);
+		w[i].in.file.handle = h;
+		w[i].in.offset = n * chunk;
+		w[i].in.data = data_blob_const(buf + n * chunk, chunk);
+
+		req[i] = smb2_write_send(tree, &w[i]);
+		torture_assert_goto(torture, req[i] != NULL, ret, done,
+				    "smb2_write_send failed");
+	}
+
+	for (i = 0; i < NUM_WRITES; i++) {
+		status = smb2_write_recv(req[i], &w[i]);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		CHECK_VALUE(w[i].out.nwritten, chunk);
+	}
+
+	ZERO_STRUCT(rd);
+	rd.in.file.handle = h;
+	rd.in.length = len;
+	rd.in.offset = 0;
+	status = smb2_read(tree, tmp_ctx, &rd);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	CHECK_VALUE(rd.out.data.length, len);
+
+	torture_assert_mem_equal_goto(torture, rd.out.data.data, buf, len,
+				      ret, done, "Wrong data read back");
+
+done:
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree, h);
+	}
+	smb2_util_unlink(tree, FNAME);
+	talloc_free(tmp_ctx);
+	return ret;
+}
+
+/*
+   basic testing of SMB2 read and write
+*/
+struct torture_suite *torture_smb2_readwrite_init(TALLOC_CTX *ctx)
+{
+	struct torture_suite *suite = torture_suite_create(ctx, "rw");
+
+	torture_suite_add_1smb2_test(suite, "parallel", test_rw_parallel);
+
+	suite->description = talloc_strdup(suite, "SMB2-RW tests");
+
+	return suite;
+}